@@ -0,0 +1,55 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+#include "../bson_chunked.hpp"
+
+static const char* const blob_names[] = {
+  "b00", "b01", "b02", "b03", "b04", "b05", "b06", "b07",
+  "b08", "b09", "b10", "b11", "b12", "b13", "b14", "b15",
+};
+
+// Build a 16 MiB document of 1 MiB binaries by writer (growing one buffer)
+static void writer_large_document(benchmark::State& state)
+{
+  static const std::vector<std::uint8_t> blob(1 << 20, 0x33);
+  for (auto _ : state) {
+    bson::writer w;
+    for (auto name : blob_names) {
+      benchmark::DoNotOptimize(w.add_binary(name, blob.data(), blob.size()));
+    }
+    const std::uint8_t* bytes;
+    std::size_t length;
+    benchmark::DoNotOptimize(w.get_bytes(bytes, length));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * 16 * blob.size());
+}
+BENCHMARK(writer_large_document)->Unit(benchmark::kMillisecond);
+
+// Same document by chunked_writer: fragments (0) vs flattened copy (1)
+static void chunked_writer_large_document(benchmark::State& state)
+{
+  const bool flatten = state.range(0);
+  static const std::vector<std::uint8_t> blob(1 << 20, 0x33);
+  for (auto _ : state) {
+    bson::chunked_writer w(1 << 20);
+    for (auto name : blob_names) {
+      benchmark::DoNotOptimize(w.add_binary(name, blob.data(), blob.size()));
+    }
+    if (flatten) {
+      std::size_t length;
+      const auto bytes = w.flatten(length);
+      benchmark::DoNotOptimize(bytes);
+      bson::allocator::get_default().deallocate(bytes);
+    } else {
+      const bson::chunked_writer::fragment* fragments;
+      std::size_t count;
+      benchmark::DoNotOptimize(w.get_fragments(fragments, count));
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * 16 * blob.size());
+}
+BENCHMARK(chunked_writer_large_document)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "../bson_columnar.hpp"
+#include "../test/document_collection.hpp"
+
+// Order-like documents with the projected fields among other fields
+static document_collection make_collection(std::size_t count)
+{
+  document_collection collection;
+  for (std::size_t i = 0; i < count; ++i) {
+    bson::writer w;
+    w.add_int64("_id", static_cast<std::int64_t>(i));
+    w.add_string("customer", "customer-name");
+    w.add_double("price", static_cast<double>(i % 100) * 0.25);
+    w.add_string("status", "shipped");
+    w.add_int32("qty", static_cast<std::int32_t>(i % 9));
+    w.add_int64("ts", static_cast<std::int64_t>(1600000000000 + i));
+    w.add_string("note", "");
+    collection.add(w);
+  }
+  return collection;
+}
+
+static const document_collection collection = make_collection(200000);
+
+// Baseline: find() per field and document into vectors
+static void columnar_find(benchmark::State& state)
+{
+  std::vector<double> price(collection.count());
+  std::vector<std::int64_t> qty(collection.count());
+  std::vector<std::int64_t> ts(collection.count());
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < collection.count(); ++i) {
+      const auto doc = collection.doc(i);
+      price[i] = doc.find("price").as_double(0);
+      qty[i] = doc.find("qty").as_integer();
+      ts[i] = doc.find("ts").as_integer();
+    }
+    benchmark::DoNotOptimize(price.data());
+    benchmark::DoNotOptimize(qty.data());
+    benchmark::DoNotOptimize(ts.data());
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(columnar_find)->Unit(benchmark::kMillisecond);
+
+// Projection with 1 to N workers
+static void columnar_project(benchmark::State& state)
+{
+  const unsigned workers = state.range(0);
+  bson::projection columns({ { "price" }, { "qty", bson::type::int64 }, { "ts", bson::type::int64 } });
+  for (auto _ : state) {
+    const auto projected = bson::project(collection, columns, workers, 16);
+    benchmark::DoNotOptimize(projected);
+    benchmark::DoNotOptimize(columns[0].fp64());
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(columnar_project)
+  ->DenseRange(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../bson_filter.hpp"
+#include "../bson_parallel.hpp"
+#include "../test/document_collection.hpp"
+
+// Request log documents; 1 in 4 is "ok" and latency is uniform in [0, 200)
+static document_collection make_collection(std::size_t count)
+{
+  static const char* const statuses[] = { "ok", "error", "timeout", "retry" };
+  document_collection collection;
+  std::uint32_t seed = 1;
+  for (std::size_t i = 0; i < count; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    bson::writer w;
+    w.add_int64("_id", static_cast<std::int64_t>(i));
+    w.add_string("path", "/api/v1/items");
+    w.add_string("status", statuses[(seed >> 16) % 4]);
+    w.add_int32("latency", static_cast<std::int32_t>((seed >> 8) % 200));
+    w.add_string("agent", "client/1.0");
+    collection.add(w);
+  }
+  return collection;
+}
+
+static const document_collection collection = make_collection(200000);
+
+// Baseline: hand-coded find/compare chain
+static void filter_hand_coded(benchmark::State& state)
+{
+  for (auto _ : state) {
+    std::size_t matched = 0;
+    for (std::size_t i = 0; i < collection.count(); ++i) {
+      const auto doc = collection.doc(i);
+      const char* status;
+      std::size_t length;
+      double latency;
+      matched += (doc.find("status").get_string(status, length) && (length == 2) &&
+                  (std::memcmp(status, "ok", 2) == 0) &&
+                  doc.find("latency").get_number(latency) && (latency > 100)) ? 1 : 0;
+    }
+    benchmark::DoNotOptimize(matched);
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(filter_hand_coded)->Unit(benchmark::kMillisecond);
+
+// Compiled filter
+static void filter_compiled(benchmark::State& state)
+{
+  const bson::filter f("status == \"ok\" && latency > 100");
+  for (auto _ : state) {
+    std::size_t matched = 0;
+    for (std::size_t i = 0; i < collection.count(); ++i) {
+      matched += f.match(collection.doc(i)) ? 1 : 0;
+    }
+    benchmark::DoNotOptimize(matched);
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(filter_compiled)->Unit(benchmark::kMillisecond);
+
+// Compiled filter with parallel_count() and 1 to N workers
+static void filter_parallel(benchmark::State& state)
+{
+  const unsigned workers = state.range(0);
+  const bson::filter f("status == \"ok\" && latency > 100");
+  for (auto _ : state) {
+    const auto matched = bson::parallel_count(collection, f, workers, 64);
+    benchmark::DoNotOptimize(matched);
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(filter_parallel)
+  ->DenseRange(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
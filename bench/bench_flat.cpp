@@ -0,0 +1,412 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../bson_flat.hpp"
+
+static const int fields_per_document = 256;
+static const int max_fields = 4096;
+
+struct field_name_table {
+  char names[max_fields][4];
+
+  field_name_table()
+  {
+    for (int i = 0; i < max_fields; ++i) {
+      names[i][0] = 'a' + (i / 26 / 26) % 26;
+      names[i][1] = 'a' + (i / 26) % 26;
+      names[i][2] = 'a' + i % 26;
+      names[i][3] = '\0';
+    }
+  }
+};
+
+static const field_name_table field_names;
+
+// Default allocator which counts allocate / reallocate calls
+class counting_allocator : public bson::allocator {
+public:
+  void* allocate(std::size_t length) noexcept override
+  {
+    ++count;
+    return bson::allocator::get_default().allocate(length);
+  }
+
+  void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept override
+  {
+    ++count;
+    return bson::allocator::get_default().reallocate(buffer, length, new_length);
+  }
+
+  void deallocate(void* buffer) noexcept override
+  {
+    bson::allocator::get_default().deallocate(buffer);
+  }
+
+  std::int64_t count = 0;
+};
+
+static void report_allocations(benchmark::State& state, const counting_allocator& alloc)
+{
+  state.counters["allocs/op"] =
+    benchmark::Counter(static_cast<double>(alloc.count), benchmark::Counter::kAvgIterations);
+}
+
+// Flat document of int32 / double / string fields
+static void add_flat(bson::writer& w, int fields)
+{
+  for (int i = 0; i < fields; ++i) {
+    switch (i % 3) {
+    case 0:
+      w.add_int32(field_names.names[i], i);
+      break;
+    case 1:
+      w.add_double(field_names.names[i], i * 0.5);
+      break;
+    default:
+      w.add_string(field_names.names[i], "value");
+      break;
+    }
+  }
+}
+
+static std::size_t make_flat(void* buffer, std::size_t length, int fields)
+{
+  bson::writer w(buffer, length);
+  add_flat(w, fields);
+  const std::uint8_t* bytes;
+  std::size_t size;
+  return w.get_bytes(bytes, size) ? size : 0;
+}
+
+static void flat_sizes(benchmark::internal::Benchmark* b)
+{
+  for (int fields : { 16, 256, max_fields }) {
+    b->Arg(fields);
+  }
+}
+
+static void flat_sizes_and_buffers(benchmark::internal::Benchmark* b)
+{
+  for (int fields : { 16, 256, max_fields }) {
+    b->Args({ fields, 0 })->Args({ fields, 1 });
+  }
+}
+
+static void add_nested(bson::writer& w, int depth)
+{
+  if (depth > 0) {
+    auto s = w.add_document("d");
+    add_nested(s, depth - 1);
+    return;
+  }
+  for (int i = 0; i < fields_per_document; ++i) {
+    benchmark::DoNotOptimize(w.add_int32(field_names.names[i], i));
+  }
+}
+
+// Cost of appends at the innermost level should not depend on depth
+static void writer_nested_append(benchmark::State& state)
+{
+  const int depth = state.range(0);
+  static std::uint8_t buffer[8192];
+  for (auto _ : state) {
+    bson::writer w(buffer, sizeof(buffer));
+    add_nested(w, depth);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * fields_per_document);
+}
+BENCHMARK(writer_nested_append)->DenseRange(0, 10, 2);
+
+// Immediate (0) vs deferred (1) size update on a wide document
+static void writer_wide_append(benchmark::State& state)
+{
+  const bool deferred = state.range(0);
+  static std::uint8_t buffer[8192];
+  for (auto _ : state) {
+    bson::writer w(buffer, sizeof(buffer));
+    w.set_deferred(deferred);
+    add_nested(w, 0);
+    const std::uint8_t* bytes;
+    std::size_t length;
+    benchmark::DoNotOptimize(w.get_bytes(bytes, length));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * fields_per_document);
+}
+BENCHMARK(writer_wide_append)->Arg(0)->Arg(1);
+
+// Array of int32: formatted keys (0), push_int32 (1), push_range (2)
+static void writer_array_int32(benchmark::State& state)
+{
+  const int method = state.range(0);
+  static const int count = 1000;
+  static std::int32_t values[count];
+  static std::uint8_t buffer[16384];
+  for (auto _ : state) {
+    bson::writer w(buffer, sizeof(buffer));
+    auto a = w.add_array("a");
+    switch (method) {
+    case 0:
+      for (int i = 0; i < count; ++i) {
+        char key[12];
+        std::snprintf(key, sizeof(key), "%d", i);
+        a.add_int32(key, values[i]);
+      }
+      break;
+    case 1:
+      for (int i = 0; i < count; ++i) {
+        a.push_int32(values[i]);
+      }
+      break;
+    default:
+      a.push_range(values, count);
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(writer_array_int32)->DenseRange(0, 2);
+
+// Look up 10 fields of 200: linear find (0), indexed_reader including build (1),
+// find_many (2)
+static void reader_find_many(benchmark::State& state)
+{
+  const int method = state.range(0);
+  static const int fields = 200;
+  static const int lookups = 10;
+  static std::uint8_t buffer[4096];
+  bson::writer w(buffer, sizeof(buffer));
+  for (int i = 0; i < fields; ++i) {
+    w.add_int32(field_names.names[i], i);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  bson::reader r(bytes, length);
+  bson::indexed_reader::slot table[bson::indexed_reader::slots_for(fields)];
+  std::vector<bson::key> names;
+  for (int i = 0; i < lookups; ++i) {
+    names.emplace_back(field_names.names[fields - 1 - i * 19], 3);
+  }
+  bson::reader::element elements[lookups];
+  for (auto _ : state) {
+    std::int64_t sum = 0;
+    switch (method) {
+    case 0:
+      for (int i = 0; i < lookups; ++i) {
+        sum += r.find(names[i].data).as_int32();
+      }
+      break;
+    case 1: {
+      bson::indexed_reader index(r, table, sizeof(table) / sizeof(*table));
+      for (int i = 0; i < lookups; ++i) {
+        sum += index.find(names[i]).as_int32();
+      }
+      break;
+    }
+    case 2:
+      r.find_many(names.data(), lookups, elements);
+      for (int i = 0; i < lookups; ++i) {
+        sum += elements[i].as_int32();
+      }
+      break;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * lookups);
+}
+BENCHMARK(reader_find_many)->DenseRange(0, 2);
+
+template <class Reader>
+static std::int64_t sum_fields(const Reader& r)
+{
+  std::int64_t sum = 0;
+  for (const auto& field : r) {
+    if (field.is_document()) {
+      sum += sum_fields(field.as_document());
+    } else {
+      sum += field.as_int32();
+    }
+  }
+  return sum;
+}
+
+// Traverse 16x17 nested fields: checked (0), validate + trusted (1),
+// trusted only (2), validate without UTF-8 check + trusted (3)
+static void reader_traverse(benchmark::State& state)
+{
+  const int method = state.range(0);
+  static std::uint8_t buffer[8192];
+  bson::writer w(buffer, sizeof(buffer));
+  for (int i = 0; i < 16; ++i) {
+    auto d = w.add_document(field_names.names[i]);
+    for (int j = 0; j < 16; ++j) {
+      d.add_int32(field_names.names[j], j);
+    }
+    d.add_string("s", "string value");
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  bson::reader r(bytes, length);
+  const auto trusted = r.validate();
+  for (auto _ : state) {
+    switch (method) {
+    case 0:
+      benchmark::DoNotOptimize(sum_fields(r));
+      break;
+    case 1:
+      benchmark::DoNotOptimize(sum_fields(r.validate()));
+      break;
+    case 2:
+      benchmark::DoNotOptimize(sum_fields(trusted));
+      break;
+    case 3:
+      benchmark::DoNotOptimize(sum_fields(r.validate(100, false)));
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 16 * 17);
+}
+BENCHMARK(reader_traverse)->DenseRange(0, 3);
+
+// Find the last of 32 fields by name length (range) with common prefix
+static void reader_find_long_name(benchmark::State& state)
+{
+  const int name_length = state.range(0);
+  static std::uint8_t buffer[16384];
+  std::vector<std::string> names;
+  for (int i = 0; i < 32; ++i) {
+    names.push_back(std::string(name_length - 3, 'k') + field_names.names[i]);
+  }
+  bson::writer w(buffer, sizeof(buffer));
+  for (int i = 0; i < 32; ++i) {
+    w.add_int32(names[i].c_str(), i);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  bson::reader r(bytes, length);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(r.find(names.back().c_str()).as_int32());
+  }
+  state.SetItemsProcessed(state.iterations() * 32);
+}
+BENCHMARK(reader_find_long_name)->Arg(8)->Arg(32)->Arg(128);
+
+// Replace one of 64 fields: rebuild by add_* (0) vs patch (1)
+static void writer_patch(benchmark::State& state)
+{
+  const int method = state.range(0);
+  static std::uint8_t buffer[4096];
+  static std::uint8_t output[4096];
+  bson::writer w(buffer, sizeof(buffer));
+  for (int i = 0; i < 64; ++i) {
+    if (i & 1) {
+      w.add_string(field_names.names[i], "string value");
+    } else {
+      w.add_int32(field_names.names[i], i);
+    }
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  bson::reader r(bytes, length);
+  bson::writer v;
+  v.add_int64("v", 1);
+  const std::uint8_t* value_bytes;
+  std::size_t value_length;
+  v.get_bytes(value_bytes, value_length);
+  bson::patch p;
+  p.set(field_names.names[32], bson::reader(value_bytes, value_length).find("v"));
+  for (auto _ : state) {
+    bson::writer out(output, sizeof(output));
+    if (method == 0) {
+      for (const auto& field : r) {
+        if (std::strcmp(field.name(), field_names.names[32]) == 0) {
+          out.add_int64(field.name(), 1);
+        } else if (field.is_string()) {
+          out.add_string(field.name(), field.as_string());
+        } else {
+          out.add_int32(field.name(), field.as_int32());
+        }
+      }
+    } else {
+      p.apply(r, out);
+    }
+    benchmark::DoNotOptimize(output);
+  }
+  state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(writer_patch)->Arg(0)->Arg(1);
+
+// Build small / medium / large flat documents (range(0) fields) into
+// fixed (range(1) = 0) or auto (range(1) = 1) buffer
+static void writer_flat(benchmark::State& state)
+{
+  const int fields = state.range(0);
+  const bool automatic = state.range(1);
+  static std::uint8_t buffer[1 << 17];
+  counting_allocator alloc;
+  std::size_t length = 0;
+  for (auto _ : state) {
+    const std::uint8_t* bytes;
+    if (automatic) {
+      bson::writer w(alloc);
+      add_flat(w, fields);
+      benchmark::DoNotOptimize(w.get_bytes(bytes, length));
+    } else {
+      bson::writer w(buffer, sizeof(buffer));
+      add_flat(w, fields);
+      benchmark::DoNotOptimize(w.get_bytes(bytes, length));
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * fields);
+  state.SetBytesProcessed(state.iterations() * length);
+  report_allocations(state, alloc);
+}
+BENCHMARK(writer_flat)->Apply(flat_sizes_and_buffers);
+
+// Find in 256 fields at first (0), middle (1), last (2) and missing (3) position
+static void reader_find_position(benchmark::State& state)
+{
+  static const char* const names[] = {
+    field_names.names[0], field_names.names[fields_per_document / 2],
+    field_names.names[fields_per_document - 1], "zzz",
+  };
+  const char* name = names[state.range(0)];
+  static std::uint8_t buffer[8192];
+  const auto length = make_flat(buffer, sizeof(buffer), fields_per_document);
+  bson::reader r(buffer, length);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(r.find(name).valid());
+  }
+}
+BENCHMARK(reader_find_position)->DenseRange(0, 3);
+
+// Iterate all fields of small / medium / large flat documents
+static void reader_iterate_flat(benchmark::State& state)
+{
+  const int fields = state.range(0);
+  static std::uint8_t buffer[1 << 17];
+  const auto length = make_flat(buffer, sizeof(buffer), fields);
+  bson::reader r(buffer, length);
+  for (auto _ : state) {
+    std::size_t count = 0;
+    for (const auto& field : r) {
+      count += field.type() == bson::type::string;
+    }
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetItemsProcessed(state.iterations() * fields);
+  state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(reader_iterate_flat)->Apply(flat_sizes);
+
+BENCHMARK_MAIN();
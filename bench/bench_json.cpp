@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include "../bson_json.hpp"
+
+// Mixed document of 256 fields serialized in relaxed (0) / canonical (1) mode
+static void json_serialize(benchmark::State& state)
+{
+  const auto mode = state.range(0) ? bson::json_mode::canonical : bson::json_mode::relaxed;
+  bson::writer w;
+  for (int i = 0; i < 256; ++i) {
+    char name[8];
+    std::snprintf(name, sizeof(name), "f%d", i);
+    switch (i % 4) {
+    case 0:
+      w.add_int32(name, i * 1000);
+      break;
+    case 1:
+      w.add_double(name, i * 0.37);
+      break;
+    case 2:
+      w.add_string(name, "a reasonably long text value with \"quotes\" inside");
+      break;
+    default:
+      w.add_int64(name, 1LL << (i % 60));
+      break;
+    }
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  bson::reader r(bytes, length);
+  std::size_t total = 0;
+  auto sink = [&total](const char*, std::size_t size) {
+    total += size;
+    return true;
+  };
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bson::to_json(r, sink, mode));
+  }
+  state.SetBytesProcessed(static_cast<std::int64_t>(total));
+}
+BENCHMARK(json_serialize)->Arg(0)->Arg(1);
+
+// Parse JSON text of the same document into fixed buffer writer
+static void json_parse(benchmark::State& state)
+{
+  bson::writer w;
+  for (int i = 0; i < 256; ++i) {
+    char name[8];
+    std::snprintf(name, sizeof(name), "f%d", i);
+    switch (i % 4) {
+    case 0:
+      w.add_int32(name, i * 1000);
+      break;
+    case 1:
+      w.add_double(name, i * 0.37);
+      break;
+    case 2:
+      w.add_string(name, "a reasonably long text value with \"quotes\" inside");
+      break;
+    default:
+      w.add_int64(name, 1LL << (i % 60));
+      break;
+    }
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  w.get_bytes(bytes, length);
+  std::size_t text_length;
+  const auto text = bson::to_json(bson::reader(bytes, length), text_length);
+  static std::uint8_t buffer[65536];
+  for (auto _ : state) {
+    bson::writer out(buffer, sizeof(buffer));
+    benchmark::DoNotOptimize(bson::from_json(text, text_length, out));
+  }
+  state.SetBytesProcessed(state.iterations() * text_length);
+  std::free(text);
+}
+BENCHMARK(json_parse);
+
+BENCHMARK_MAIN();
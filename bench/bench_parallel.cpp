@@ -0,0 +1,55 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../bson_parallel.hpp"
+#include "../test/document_collection.hpp"
+
+// Documents with sizes varying from 1 to 64 fields
+static document_collection make_collection(std::size_t count)
+{
+  static const char names[][3] = { "aa", "ab", "ac", "ad", "ae", "af", "ag", "ah" };
+  document_collection collection;
+  std::uint32_t seed = 1;
+  for (std::size_t i = 0; i < count; ++i) {
+    bson::writer w;
+    w.add_int64("i", static_cast<std::int64_t>(i));
+    seed = seed * 1103515245u + 12345u;
+    const auto fields = 1 + (seed >> 16) % 64;
+    for (std::size_t j = 0; j < fields; ++j) {
+      w.add_int32(names[j % 8], static_cast<std::int32_t>(j));
+    }
+    collection.add(w);
+  }
+  return collection;
+}
+
+static const document_collection collection = make_collection(200000);
+
+// Sum of all int32 fields with 1 to N workers
+static void parallel_scan_scaling(benchmark::State& state)
+{
+  const unsigned workers = state.range(0);
+  for (auto _ : state) {
+    const auto sum = bson::parallel_reduce(
+      collection, std::int64_t(0),
+      [](std::int64_t& local, const bson::reader& doc, std::size_t) {
+        for (const auto& field : doc) {
+          local += field.as_int32();
+        }
+      },
+      [](std::int64_t& total, std::int64_t local) { total += local; },
+      workers, 64
+    );
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * collection.count());
+}
+BENCHMARK(parallel_scan_scaling)
+  ->DenseRange(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
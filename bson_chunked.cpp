@@ -0,0 +1,309 @@
+/**
+ * @file bson_chunked.cpp
+ * @brief Writer building very large BSON documents in a chain of chunks
+ */
+#include "bson_chunked.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace bson {
+
+/**
+ * @brief Chunk header (data follows)
+ */
+struct chunked_document::chunk {
+  chunk* next;
+  std::size_t used;
+  std::size_t capacity;
+
+  std::uint8_t* data() noexcept { return reinterpret_cast<std::uint8_t*>(this + 1); }
+};
+
+chunked_document::chunked_document(chunked_document&& other) noexcept
+: owner(other.owner), depth(other.depth), header(other.header), position(other.position)
+{
+  other.owner = nullptr;
+}
+
+chunked_document::~chunked_document() noexcept
+{
+  if ((!owner) || (depth == 0)) {
+    // Moved, failed to start or root
+    return;
+  }
+  if (owner->open_depth != depth) {
+    // Destroyed while its subdocument is open: the document cannot be completed
+    owner->broken = true;
+    return;
+  }
+  owner->close(header, position);
+  --owner->open_depth;
+}
+
+bool chunked_document::valid() const noexcept
+{
+  return owner && (!owner->broken) && (owner->open_depth == depth);
+}
+
+bool chunked_document::add_element(const key& e_name, type type, std::size_t space) noexcept
+{
+  if ((!valid()) || (!owner->reserve(1 + e_name.length + 1 + space))) {
+    return false;
+  }
+  const std::uint8_t terminator = 0x00;
+  owner->append(&type, 1);
+  owner->append(e_name.data, e_name.length);
+  owner->append(&terminator, 1);
+  return true;
+}
+
+bool chunked_document::add_double(const key& e_name, double value) noexcept
+{
+  if (!add_element(e_name, bson::type::fp64, sizeof(value))) {
+    return false;
+  }
+  owner->append(&value, sizeof(value));
+  return true;
+}
+
+bool chunked_document::add_string(const key& e_name, const char* string, std::size_t length) noexcept
+{
+  if ((length >= INT32_MAX) || (!add_element(e_name, bson::type::string, 4 + length + 1))) {
+    return false;
+  }
+  const std::int32_t length_buffer = static_cast<std::int32_t>(length + 1);
+  const char terminator = '\0';
+  owner->append(&length_buffer, 4);
+  owner->append(string, length);
+  owner->append(&terminator, 1);
+  return true;
+}
+
+bool chunked_document::add_binary(const key& e_name, const void* buffer,
+                                  std::size_t length, subtype subtype) noexcept
+{
+  if ((length > INT32_MAX) || (!add_element(e_name, bson::type::binary, 4 + 1 + length))) {
+    return false;
+  }
+  const std::int32_t length_buffer = static_cast<std::int32_t>(length);
+  owner->append(&length_buffer, 4);
+  owner->append(&subtype, 1);
+  owner->append(buffer, length);
+  return true;
+}
+
+bool chunked_document::add_boolean(const key& e_name, bool value) noexcept
+{
+  if (!add_element(e_name, bson::type::boolean, 1)) {
+    return false;
+  }
+  const std::uint8_t byte = value ? 1 : 0;
+  owner->append(&byte, 1);
+  return true;
+}
+
+bool chunked_document::add_null(const key& e_name) noexcept
+{
+  return add_element(e_name, bson::type::null, 0);
+}
+
+bool chunked_document::add_int32(const key& e_name, std::int32_t value) noexcept
+{
+  if (!add_element(e_name, bson::type::int32, sizeof(value))) {
+    return false;
+  }
+  owner->append(&value, sizeof(value));
+  return true;
+}
+
+bool chunked_document::add_int64(const key& e_name, std::int64_t value) noexcept
+{
+  if (!add_element(e_name, bson::type::int64, sizeof(value))) {
+    return false;
+  }
+  owner->append(&value, sizeof(value));
+  return true;
+}
+
+chunked_document chunked_document::add_subdocument(const key& e_name, type type) noexcept
+{
+  // Header (4) + terminator (1) reserved until the subdocument is closed
+  if (!add_element(e_name, type, 5)) {
+    return chunked_document(nullptr, 0, cursor { nullptr, 0 }, 0);
+  }
+  const auto at = owner->tail();
+  const auto header_position = owner->length;
+  const std::int32_t placeholder = 5;
+  owner->append(&placeholder, 4);
+  ++owner->open_depth;
+  return chunked_document(owner, depth + 1, at, header_position);
+}
+
+chunked_writer::chunked_writer(std::size_t chunk_length, allocator& alloc) noexcept
+: chunked_document(this, 0, cursor { nullptr, 0 }, 0),
+  alloc(&alloc), chunk_length(std::max<std::size_t>(chunk_length, 16))
+{
+  if (!reserve(4)) {
+    broken = true;
+    return;
+  }
+  header = tail();
+  const std::int32_t placeholder = 5;
+  append(&placeholder, 4);
+}
+
+chunked_writer::~chunked_writer() noexcept
+{
+  while (first) {
+    const auto next = first->next;
+    alloc->deallocate(first);
+    first = next;
+  }
+  if (fragments) {
+    alloc->deallocate(fragments);
+  }
+}
+
+bool chunked_writer::get_fragments(const fragment*& fragments, std::size_t& count) noexcept
+{
+  if (broken || (open_depth != 0)) {
+    return false;
+  }
+  if (fragment_capacity < chunk_count) {
+    const auto new_fragments = static_cast<fragment*>(
+      this->fragments ? alloc->reallocate(this->fragments, sizeof(fragment) * fragment_capacity,
+                                          sizeof(fragment) * chunk_count)
+                      : alloc->allocate(sizeof(fragment) * chunk_count)
+    );
+    if (!new_fragments) {
+      return false;
+    }
+    this->fragments = new_fragments;
+    fragment_capacity = chunk_count;
+  }
+
+  // Terminator is always reserved, and overwritten by the next element
+  const auto saved_current = current;
+  const auto saved_used = current->used;
+  const auto saved_available = available;
+  const auto saved_length = length;
+  close(header, 0);
+
+  count = 0;
+  for (auto c = first; c; c = c->next) {
+    this->fragments[count++] = fragment { c->data(), c->used };
+    if (c == current) {
+      break;
+    }
+  }
+  fragments = this->fragments;
+
+  if (current != saved_current) {
+    current->used = 0;
+    current = saved_current;
+  }
+  current->used = saved_used;
+  available = saved_available;
+  length = saved_length;
+  return true;
+}
+
+std::uint8_t* chunked_writer::flatten(std::size_t& length) noexcept
+{
+  const fragment* list;
+  std::size_t count;
+  if (!get_fragments(list, count)) {
+    return nullptr;
+  }
+  const auto total = size();
+  const auto bytes = static_cast<std::uint8_t*>(alloc->allocate(total));
+  if (!bytes) {
+    return nullptr;
+  }
+  auto dest = bytes;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::memcpy(dest, list[i].data, list[i].length);
+    dest += list[i].length;
+  }
+  length = total;
+  return bytes;
+}
+
+bool chunked_writer::reserve(std::size_t space) noexcept
+{
+  // Terminators of open subdocuments and root are kept available
+  const std::size_t terminators = open_depth + 1;
+  if ((space > INT32_MAX) || (length + space + terminators > INT32_MAX)) {
+    return false;
+  }
+  const auto required = space + terminators;
+  if (available >= required) {
+    return true;
+  }
+  const auto capacity = std::max(chunk_length, required - available);
+  const auto new_chunk = static_cast<chunk*>(alloc->allocate(sizeof(chunk) + capacity));
+  if (!new_chunk) {
+    return false;
+  }
+  new_chunk->next = nullptr;
+  new_chunk->used = 0;
+  new_chunk->capacity = capacity;
+  if (last) {
+    last->next = new_chunk;
+  } else {
+    first = current = new_chunk;
+  }
+  last = new_chunk;
+  ++chunk_count;
+  available += capacity;
+  return true;
+}
+
+chunked_writer::cursor chunked_writer::tail() noexcept
+{
+  while ((current->used == current->capacity) && current->next) {
+    current = current->next;
+  }
+  return cursor { current, current->used };
+}
+
+void chunked_writer::append(const void* data, std::size_t space) noexcept
+{
+  auto source = static_cast<const std::uint8_t*>(data);
+  length += space;
+  available -= space;
+  while (space > 0) {
+    const auto at = tail();
+    const auto size = std::min(space, at.target->capacity - at.offset);
+    std::memcpy(at.target->data() + at.offset, source, size);
+    at.target->used += size;
+    source += size;
+    space -= size;
+  }
+}
+
+void chunked_writer::overwrite(cursor at, const void* data, std::size_t space) noexcept
+{
+  auto source = static_cast<const std::uint8_t*>(data);
+  while (space > 0) {
+    if (at.offset == at.target->capacity) {
+      // Continue in next chunk
+      at = cursor { at.target->next, 0 };
+    }
+    const auto size = std::min(space, at.target->capacity - at.offset);
+    std::memcpy(at.target->data() + at.offset, source, size);
+    at.offset += size;
+    source += size;
+    space -= size;
+  }
+}
+
+void chunked_writer::close(cursor at, std::size_t header_position) noexcept
+{
+  const std::uint8_t terminator = 0x00;
+  append(&terminator, 1);
+  const std::int32_t total = static_cast<std::int32_t>(length - header_position);
+  overwrite(at, &total, 4);
+}
+
+} /* namespace bson */
@@ -0,0 +1,395 @@
+/**
+ * @file bson_chunked.hpp
+ * @brief Writer building very large BSON documents in a chain of chunks
+ */
+#ifndef _BSON_CPP11_BSON_CHUNKED_HPP_
+#define _BSON_CPP11_BSON_CHUNKED_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+// Forward declaration
+class chunked_writer;
+
+/**
+ * @brief Writer of (sub)document in chunked_writer
+ *
+ * @note Only the innermost open (sub)document accepts elements, as with
+ *       writer. Elements of arrays are named by the caller ("0", "1", ...).
+ */
+class chunked_document {
+public:
+  /**
+   * @brief Construct a new document writer (move)
+   *
+   * @param other Another document writer
+   */
+  chunked_document(chunked_document&& other) noexcept;
+
+  // Prohibit copying
+  chunked_document(const chunked_document&) = delete;
+  chunked_document& operator =(const chunked_document&) = delete;
+
+  /**
+   * @brief Destroy the document writer (closes subdocument)
+   */
+  ~chunked_document() noexcept;
+
+  /**
+   * @brief Check if elements can be added
+   */
+  bool valid() const noexcept;
+
+  /**
+   * @brief Add double
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param value Double value to store
+   */
+  bool add_double(const char* e_name, double value) noexcept
+  {
+    return add_double(key(e_name, std::strlen(e_name)), value);
+  }
+
+  /**
+   * @brief Add double
+   *
+   * @param e_name Element name with length
+   * @param value Double value to store
+   */
+  bool add_double(const key& e_name, double value) noexcept;
+
+  /**
+   * @brief Add NUL-terminated string
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param string String to store (NUL terminated)
+   */
+  bool add_string(const char* e_name, const char* string) noexcept
+  {
+    return add_string(key(e_name, std::strlen(e_name)), string, std::strlen(string));
+  }
+
+  /**
+   * @brief Add string
+   *
+   * @param e_name Element name with length
+   * @param string String to store (can include NUL)
+   * @param length Length of string in bytes
+   */
+  bool add_string(const key& e_name, const char* string, std::size_t length) noexcept;
+
+  /**
+   * @brief Add binary
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param buffer Pointer to buffer
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  bool add_binary(const char* e_name, const void* buffer, std::size_t length,
+                  subtype subtype = subtype::generic) noexcept
+  {
+    return add_binary(key(e_name, std::strlen(e_name)), buffer, length, subtype);
+  }
+
+  /**
+   * @brief Add binary
+   *
+   * @param e_name Element name with length
+   * @param buffer Pointer to buffer
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  bool add_binary(const key& e_name, const void* buffer, std::size_t length,
+                  subtype subtype = subtype::generic) noexcept;
+
+  /**
+   * @brief Add boolean
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param value Boolean value to store
+   */
+  bool add_boolean(const char* e_name, bool value) noexcept
+  {
+    return add_boolean(key(e_name, std::strlen(e_name)), value);
+  }
+
+  /**
+   * @brief Add boolean
+   *
+   * @param e_name Element name with length
+   * @param value Boolean value to store
+   */
+  bool add_boolean(const key& e_name, bool value) noexcept;
+
+  /**
+   * @brief Add boolean true
+   *
+   * @param e_name Element name (NUL terminated)
+   */
+  bool add_true(const char* e_name) noexcept { return add_boolean(e_name, true); }
+
+  /**
+   * @brief Add boolean false
+   *
+   * @param e_name Element name (NUL terminated)
+   */
+  bool add_false(const char* e_name) noexcept { return add_boolean(e_name, false); }
+
+  /**
+   * @brief Add null
+   *
+   * @param e_name Element name (NUL terminated)
+   */
+  bool add_null(const char* e_name) noexcept
+  {
+    return add_null(key(e_name, std::strlen(e_name)));
+  }
+
+  /**
+   * @brief Add null
+   *
+   * @param e_name Element name with length
+   */
+  bool add_null(const key& e_name) noexcept;
+
+  /**
+   * @brief Add 32-bit signed integer
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param value Integer value to store
+   */
+  bool add_int32(const char* e_name, std::int32_t value) noexcept
+  {
+    return add_int32(key(e_name, std::strlen(e_name)), value);
+  }
+
+  /**
+   * @brief Add 32-bit signed integer
+   *
+   * @param e_name Element name with length
+   * @param value Integer value to store
+   */
+  bool add_int32(const key& e_name, std::int32_t value) noexcept;
+
+  /**
+   * @brief Add 64-bit signed integer
+   *
+   * @param e_name Element name (NUL terminated)
+   * @param value Integer value to store
+   */
+  bool add_int64(const char* e_name, std::int64_t value) noexcept
+  {
+    return add_int64(key(e_name, std::strlen(e_name)), value);
+  }
+
+  /**
+   * @brief Add 64-bit signed integer
+   *
+   * @param e_name Element name with length
+   * @param value Integer value to store
+   */
+  bool add_int64(const key& e_name, std::int64_t value) noexcept;
+
+  /**
+   * @brief Add embedded document
+   *
+   * @note The subdocument is closed when the returned writer is destroyed.
+   * @param e_name Element name (NUL terminated)
+   * @return Writer of subdocument (invalid if failed)
+   */
+  chunked_document add_document(const char* e_name) noexcept
+  {
+    return add_subdocument(key(e_name, std::strlen(e_name)), bson::type::document);
+  }
+
+  /**
+   * @brief Add embedded document
+   *
+   * @param e_name Element name with length
+   * @return Writer of subdocument (invalid if failed)
+   */
+  chunked_document add_document(const key& e_name) noexcept
+  {
+    return add_subdocument(e_name, bson::type::document);
+  }
+
+  /**
+   * @brief Add array
+   *
+   * @param e_name Element name (NUL terminated)
+   * @return Writer of array (invalid if failed)
+   */
+  chunked_document add_array(const char* e_name) noexcept
+  {
+    return add_subdocument(key(e_name, std::strlen(e_name)), bson::type::array);
+  }
+
+  /**
+   * @brief Add array
+   *
+   * @param e_name Element name with length
+   * @return Writer of array (invalid if failed)
+   */
+  chunked_document add_array(const key& e_name) noexcept
+  {
+    return add_subdocument(e_name, bson::type::array);
+  }
+
+protected:
+  struct chunk;
+
+  /**
+   * @brief Position of byte in chunk chain
+   */
+  struct cursor {
+    chunk* target;
+    std::size_t offset;
+  };
+
+  chunked_document(chunked_writer* owner, std::uint32_t depth, cursor header, std::size_t position) noexcept
+  : owner(owner), depth(depth), header(header), position(position) {}
+
+  chunked_document add_subdocument(const key& e_name, type type) noexcept;
+
+  /**
+   * @brief Write type and name of element after reserving its space
+   *
+   * @param space Length of value in bytes
+   */
+  bool add_element(const key& e_name, type type, std::size_t space) noexcept;
+
+  friend class chunked_writer;
+
+protected:
+  chunked_writer* owner;  ///< Root writer (nullptr if invalid or moved)
+  std::uint32_t depth;    ///< Nesting depth (zero for root)
+  cursor header;          ///< Location of length header
+  std::size_t position;   ///< Offset of length header in document
+};
+
+/**
+ * @brief Writer keeping the document in a chain of fixed-size chunks
+ *
+ * @note Unlike writer, whose single buffer is reallocated and copied as it
+ *       grows, written bytes never move: the chain gains a chunk when the
+ *       last one is full, so peak memory stays near the final size. Length
+ *       headers of subdocuments are patched when they are closed, even if a
+ *       header straddles a chunk boundary. The document is exposed as a
+ *       list of fragments (one per chunk, e.g. for writev(2)) or flattened
+ *       once into one buffer. Values larger than a chunk get a chunk of their
+ *       own size. Documents are limited to INT32_MAX bytes by the format.
+ *
+ * @code
+ * bson::chunked_writer w(1 << 20);
+ * w.add_binary("blob", data, length);
+ * const bson::chunked_writer::fragment* fragments;
+ * std::size_t count;
+ * if (w.get_fragments(fragments, count)) {
+ *   ::writev(fd, reinterpret_cast<const iovec*>(fragments), count);
+ * }
+ * @endcode
+ */
+class chunked_writer : public chunked_document {
+public:
+  /**
+   * @brief Fragment of document (layout compatible with POSIX struct iovec)
+   */
+  using fragment = gather_writer::fragment;
+
+  /**
+   * @brief Construct a new chunked writer
+   *
+   * @param chunk_length Capacity of each chunk in bytes (at least 16)
+   * @param alloc Allocator for chunks and fragment list
+   */
+  explicit chunked_writer(std::size_t chunk_length = 65536,
+                          allocator& alloc = allocator::get_default()) noexcept;
+
+  // Prohibit copying and moving (subdocument writers refer to this)
+  chunked_writer(const chunked_writer&) = delete;
+  chunked_writer& operator =(const chunked_writer&) = delete;
+
+  /**
+   * @brief Destroy the chunked writer (all chunks are deallocated)
+   */
+  ~chunked_writer() noexcept;
+
+  /**
+   * @brief Get fragments of document
+   *
+   * @note Fragments are valid until the writer is modified or destroyed.
+   * @param fragments Reference to store pointer to fragments
+   * @param count Reference to store number of fragments
+   * @return false if a subdocument is being written or allocation failed
+   */
+  bool get_fragments(const fragment*& fragments, std::size_t& count) noexcept;
+
+  /**
+   * @brief Copy document into one allocated buffer
+   *
+   * @note The buffer must be deallocated by the writer's allocator
+   *       (std::free for the default allocator).
+   * @param length Reference to store length in bytes
+   * @return nullptr if a subdocument is being written or allocation failed
+   */
+  std::uint8_t* flatten(std::size_t& length) noexcept;
+
+  /**
+   * @brief Get length of document in bytes (when no subdocument is open)
+   */
+  std::size_t size() const noexcept { return length + 1; }
+
+  /**
+   * @brief Get number of chunks
+   */
+  std::size_t chunks() const noexcept { return chunk_count; }
+
+private:
+  /**
+   * @brief Ensure space for bytes plus terminators of open documents
+   */
+  bool reserve(std::size_t space) noexcept;
+
+  /**
+   * @brief Get location of next byte to write
+   */
+  cursor tail() noexcept;
+
+  /**
+   * @brief Append reserved bytes
+   */
+  void append(const void* data, std::size_t space) noexcept;
+
+  /**
+   * @brief Overwrite bytes written at location
+   */
+  static void overwrite(cursor at, const void* data, std::size_t space) noexcept;
+
+  /**
+   * @brief Terminate document whose header is at location
+   */
+  void close(cursor at, std::size_t header_position) noexcept;
+
+  friend class chunked_document;
+
+private:
+  allocator* alloc;
+  std::size_t chunk_length;
+  chunk* first = nullptr;
+  chunk* current = nullptr;        ///< Chunk receiving next bytes
+  chunk* last = nullptr;
+  std::size_t chunk_count = 0;
+  std::size_t length = 0;          ///< Bytes written (without root terminator)
+  std::size_t available = 0;       ///< Free bytes from current to last chunk
+  std::uint32_t open_depth = 0;    ///< Depth of innermost open document
+  bool broken = false;             ///< Set if a subdocument was closed out of order
+  fragment* fragments = nullptr;
+  std::size_t fragment_capacity = 0;
+};
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_CHUNKED_HPP_ */
@@ -0,0 +1,26 @@
+/**
+ * @file bson_codec.cpp
+ * @brief Struct codec for BSON flat writer / reader
+ */
+#include "bson_codec.hpp"
+#include <cstring>
+
+namespace bson {
+
+std::size_t find_field(const key* names, std::size_t count, std::size_t hint, const key& e_name) noexcept
+{
+  // Compare length before contents
+  if ((hint < count) && (names[hint].length == e_name.length) &&
+      (std::memcmp(names[hint].data, e_name.data, e_name.length) == 0)) {
+    return hint;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    if ((names[i].length == e_name.length) &&
+        (std::memcmp(names[i].data, e_name.data, e_name.length) == 0)) {
+      return i;
+    }
+  }
+  return count;
+}
+
+} /* namespace bson */
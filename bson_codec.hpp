@@ -0,0 +1,315 @@
+/**
+ * @file bson_codec.hpp
+ * @brief Struct codec for BSON flat writer / reader
+ */
+#ifndef _BSON_CPP11_BSON_CODEC_HPP_
+#define _BSON_CPP11_BSON_CODEC_HPP_
+
+#include "bson_flat.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * @brief Describe members of struct for bson::encode() / bson::decode()
+ *
+ * @note Use in the namespace of the struct (found by argument-dependent
+ *       lookup). Members are stored with their names in the given order.
+ *       Up to 32 members are supported.
+ *
+ * @code
+ * struct point { std::int32_t x; std::int32_t y; };
+ * BSON_FIELDS(point, x, y)
+ * @endcode
+ */
+#define BSON_FIELDS(T, ...) \
+  constexpr std::size_t bson_field_count(const T*) noexcept \
+  { \
+    return BSON_FIELDS_COUNT(__VA_ARGS__); \
+  } \
+  inline const ::bson::key* bson_field_names(const T*) noexcept \
+  { \
+    static constexpr ::bson::key names[] = { BSON_FIELDS_FOR_EACH(BSON_FIELDS_NAME, __VA_ARGS__) }; \
+    return names; \
+  } \
+  template <class Function> \
+  inline bool bson_field_each(const T& object, Function&& function) noexcept \
+  { \
+    return BSON_FIELDS_FOR_EACH(BSON_FIELDS_EACH, __VA_ARGS__) true; \
+  } \
+  template <class Function> \
+  inline bool bson_field_apply(T& object, std::size_t index, Function&& function) \
+  { \
+    switch (index) { BSON_FIELDS_FOR_EACH(BSON_FIELDS_CASE, __VA_ARGS__) } \
+    return true; \
+  }
+
+#define BSON_FIELDS_NAME(i, m) ::bson::key(#m),
+#define BSON_FIELDS_EACH(i, m) function(::bson::key(#m), object.m) &&
+#define BSON_FIELDS_CASE(i, m) case i: return function(object.m);
+
+#define BSON_FIELDS_EXPAND(x) x
+#define BSON_FIELDS_CAT(a, b) BSON_FIELDS_CAT_(a, b)
+#define BSON_FIELDS_CAT_(a, b) a##b
+#define BSON_FIELDS_FOR_EACH(M, ...) \
+  BSON_FIELDS_EXPAND(BSON_FIELDS_CAT(BSON_FIELDS_FOR_, BSON_FIELDS_COUNT(__VA_ARGS__))(M, 0, __VA_ARGS__))
+#define BSON_FIELDS_COUNT(...) \
+  BSON_FIELDS_EXPAND(BSON_FIELDS_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define BSON_FIELDS_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define BSON_FIELDS_FOR_1(M, i, a) M(i, a)
+#define BSON_FIELDS_FOR_2(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_1(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_3(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_2(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_4(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_3(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_5(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_4(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_6(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_5(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_7(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_6(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_8(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_7(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_9(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_8(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_10(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_9(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_11(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_10(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_12(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_11(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_13(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_12(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_14(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_13(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_15(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_14(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_16(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_15(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_17(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_16(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_18(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_17(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_19(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_18(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_20(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_19(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_21(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_20(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_22(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_21(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_23(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_22(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_24(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_23(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_25(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_24(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_26(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_25(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_27(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_26(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_28(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_27(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_29(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_28(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_30(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_29(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_31(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_30(M, i + 1, __VA_ARGS__))
+#define BSON_FIELDS_FOR_32(M, i, a, ...) M(i, a) BSON_FIELDS_EXPAND(BSON_FIELDS_FOR_31(M, i + 1, __VA_ARGS__))
+
+namespace bson {
+
+/**
+ * @brief Encode described struct (BSON_FIELDS) as fields of document
+ * 
+ * @param w Writer to add fields
+ * @param object Struct to encode
+ */
+template <class T>
+bool encode(writer& w, const T& object) noexcept;
+
+/**
+ * @brief Decode described struct (BSON_FIELDS) from document in one pass
+ * 
+ * @note Unknown fields are ignored and missing members are left unchanged.
+ *       Decoding strings and vectors may throw std::bad_alloc.
+ * @param document Reader of source document
+ * @param object Struct to store values
+ * @return false if the document is malformed or a field has incompatible type
+ */
+template <class T>
+bool decode(const reader& document, T& object);
+
+/**
+ * @brief Find index of described field by name
+ * 
+ * @param names Field names
+ * @param count Number of fields
+ * @param hint Index to try first (fields are usually in declaration order)
+ * @param e_name Element name
+ * @return count if not found
+ */
+std::size_t find_field(const key* names, std::size_t count, std::size_t hint, const key& e_name) noexcept;
+
+/**
+ * @brief Value codec (primary template for described structs as embedded documents)
+ */
+template <class T, class Enable = void>
+struct codec {
+  static bool encode(writer& w, const key& e_name, const T& value) noexcept
+  {
+    auto subdocument = w.add_document(e_name);
+    return subdocument.valid() && bson::encode(subdocument, value);
+  }
+
+  static bool push(array_writer& a, const T& value) noexcept
+  {
+    auto subdocument = a.push_document();
+    return subdocument.valid() && bson::encode(subdocument, value);
+  }
+
+  static bool decode(const reader::element& e, T& value)
+  {
+    return e.is_document() && bson::decode(e.as_document(), value);
+  }
+};
+
+template <>
+struct codec<bool> {
+  static bool encode(writer& w, const key& e_name, bool value) noexcept { return w.add_boolean(e_name, value); }
+  static bool push(array_writer& a, bool value) noexcept { return a.push_boolean(value); }
+  static bool decode(const reader::element& e, bool& value) noexcept { return e.get_boolean(value); }
+};
+
+template <>
+struct codec<std::int32_t> {
+  static bool encode(writer& w, const key& e_name, std::int32_t value) noexcept { return w.add_int32(e_name, value); }
+  static bool push(array_writer& a, std::int32_t value) noexcept { return a.push_int32(value); }
+  static bool decode(const reader::element& e, std::int32_t& value) noexcept { return e.get_int32(value); }
+};
+
+template <>
+struct codec<std::int64_t> {
+  static bool encode(writer& w, const key& e_name, std::int64_t value) noexcept { return w.add_int64(e_name, value); }
+  static bool push(array_writer& a, std::int64_t value) noexcept { return a.push_int64(value); }
+  static bool decode(const reader::element& e, std::int64_t& value) noexcept { return e.get_integer(value); }
+};
+
+template <>
+struct codec<double> {
+  static bool encode(writer& w, const key& e_name, double value) noexcept { return w.add_double(e_name, value); }
+  static bool push(array_writer& a, double value) noexcept { return a.push_double(value); }
+  static bool decode(const reader::element& e, double& value) noexcept
+  {
+    std::int64_t integer;
+    return e.get_double(value) || (e.get_integer(integer) && (value = static_cast<double>(integer), true));
+  }
+};
+
+template <>
+struct codec<std::string> {
+  static bool encode(writer& w, const key& e_name, const std::string& value) noexcept
+  {
+    return w.add_string(e_name, value.data(), value.size());
+  }
+  static bool push(array_writer& a, const std::string& value) noexcept
+  {
+    return a.push_string(value.data(), value.size());
+  }
+  static bool decode(const reader::element& e, std::string& value)
+  {
+    const char* string;
+    std::size_t length;
+    return e.get_string(string, length) && (value.assign(string, length), true);
+  }
+};
+
+/**
+ * @brief Writer of array items (push_range() for fixed-width values)
+ */
+template <class T>
+struct codec_range {
+  template <class Vector>
+  static bool push(array_writer& a, const Vector& values) noexcept
+  {
+    for (const auto& value : values) {
+      if (!codec<T>::push(a, value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+template <class T>
+struct codec_fixed_range {
+  template <class Vector>
+  static bool push(array_writer& a, const Vector& values) noexcept
+  {
+    return values.empty() || a.push_range(values.data(), values.size());
+  }
+};
+
+template <> struct codec_range<std::int32_t> : codec_fixed_range<std::int32_t> {};
+template <> struct codec_range<std::int64_t> : codec_fixed_range<std::int64_t> {};
+template <> struct codec_range<double> : codec_fixed_range<double> {};
+
+template <class T, class Allocator>
+struct codec<std::vector<T, Allocator>> {
+  static bool encode(writer& w, const key& e_name, const std::vector<T, Allocator>& values) noexcept
+  {
+    auto a = w.add_array(e_name);
+    return a.valid() && codec_range<T>::push(a, values);
+  }
+
+  static bool push(array_writer& a, const std::vector<T, Allocator>& values) noexcept
+  {
+    auto subarray = a.push_array();
+    return subarray.valid() && codec_range<T>::push(subarray, values);
+  }
+
+  static bool decode(const reader::element& e, std::vector<T, Allocator>& values)
+  {
+    if (!e.is_array()) {
+      return false;
+    }
+    values.clear();
+    const auto items = e.as_array();
+    auto it = items.begin();
+    for (; it != items.end(); ++it) {
+      T value {};
+      if (!codec<T>::decode(*it, value)) {
+        return false;
+      }
+      values.push_back(std::move(value));
+    }
+    return !it.fail();
+  }
+};
+
+/**
+ * @brief Member visitor of bson::encode()
+ */
+struct field_encoder {
+  writer& w;
+
+  template <class V>
+  bool operator()(const key& e_name, const V& value) const noexcept
+  {
+    return codec<V>::encode(w, e_name, value);
+  }
+};
+
+/**
+ * @brief Member visitor of bson::decode()
+ */
+struct field_decoder {
+  const reader::element& e;
+
+  template <class V>
+  bool operator()(V& value) const
+  {
+    return codec<V>::decode(e, value);
+  }
+};
+
+template <class T>
+bool encode(writer& w, const T& object) noexcept
+{
+  return bson_field_each(object, field_encoder{ w });
+}
+
+template <class T>
+bool decode(const reader& document, T& object)
+{
+  const auto names = bson_field_names(static_cast<const T*>(nullptr));
+  const auto count = bson_field_count(static_cast<const T*>(nullptr));
+  std::size_t hint = 0;
+  auto it = document.begin();
+  for (; it != document.end(); ++it) {
+    const auto index = find_field(names, count, hint, key(it->name(), it->name_length()));
+    if (index == count) {
+      continue;
+    }
+    hint = index + 1;
+    if (!bson_field_apply(object, index, field_decoder{ *it })) {
+      return false;
+    }
+  }
+  return !it.fail();
+}
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_CODEC_HPP_ */
@@ -0,0 +1,168 @@
+/**
+ * @file bson_columnar.cpp
+ * @brief Columnar projection of fields from collections of BSON documents
+ */
+#include "bson_columnar.hpp"
+#include <cstring>
+
+namespace bson {
+
+namespace {
+
+const std::uint8_t no_column = 0xff;
+
+} /* namespace */
+
+constexpr std::size_t projection::max_columns;
+constexpr std::size_t projection::max_order;
+constexpr std::size_t projection::block_rows;
+
+std::size_t projection::column::null_count(std::size_t rows) const noexcept
+{
+  std::size_t nulls = 0;
+  for (std::size_t i = 0; i < rows; i += block_rows) {
+    auto missing = ~bits[i / block_rows];
+    if (rows - i < block_rows) {
+      missing &= (std::uint64_t(1) << (rows - i)) - 1;
+    }
+    for (; missing; missing &= missing - 1) {
+      ++nulls;
+    }
+  }
+  return nulls;
+}
+
+projection::hint::hint() noexcept
+{
+  std::memset(order, no_column, sizeof(order));
+}
+
+projection::projection(std::initializer_list<column_spec> columns, allocator& alloc) noexcept
+: projection(columns.begin(), columns.size(), alloc)
+{
+}
+
+projection::projection(const column_spec* columns, std::size_t count, allocator& alloc) noexcept
+: alloc(alloc)
+{
+  if (count > max_columns) {
+    return;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto kind = columns[i].kind;
+    if ((kind != bson::type::fp64) && (kind != bson::type::int64)) {
+      return;
+    }
+    table[i].e_name = columns[i].name;
+    table[i].value_type = kind;
+  }
+  this->count = count;
+}
+
+projection::~projection() noexcept
+{
+  release();
+}
+
+void projection::release() noexcept
+{
+  for (std::size_t i = 0; i < count; ++i) {
+    if (table[i].values) {
+      alloc.deallocate(table[i].values);
+    }
+    table[i].values = nullptr;
+    table[i].bits = nullptr;
+  }
+  row_count = 0;
+}
+
+bool projection::resize(std::size_t rows) noexcept
+{
+  if (!valid()) {
+    return false;
+  }
+  if (rows == row_count) {
+    return true;
+  }
+  release();
+  if (rows == 0) {
+    return true;
+  }
+  const auto words = (rows + block_rows - 1) / block_rows;
+  if (words > SIZE_MAX / sizeof(std::uint64_t) / (block_rows + 1)) {
+    return false;
+  }
+
+  // Values (8 bytes each) followed by validity words in one allocation
+  const auto length = (rows + words) * sizeof(std::uint64_t);
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto buffer = alloc.allocate(length);
+    if (!buffer) {
+      release();
+      return false;
+    }
+    table[i].values = buffer;
+    table[i].bits = static_cast<std::uint64_t*>(buffer) + rows;
+    std::memset(table[i].bits, 0, words * sizeof(std::uint64_t));
+  }
+  row_count = rows;
+  return true;
+}
+
+void projection::store(std::size_t index, std::size_t row, const reader::element& field) noexcept
+{
+  auto& target = table[index];
+  bool present;
+  if (target.value_type == bson::type::fp64) {
+    double value = 0;
+    present = field.get_number(value);
+    static_cast<double*>(target.values)[row] = present ? value : 0;
+  } else {
+    std::int64_t value = 0;
+    present = field.get_integer(value);
+    static_cast<std::int64_t*>(target.values)[row] = present ? value : 0;
+  }
+  const auto mask = std::uint64_t(1) << (row % block_rows);
+  auto& word = target.bits[row / block_rows];
+  word = present ? (word | mask) : (word & ~mask);
+}
+
+void projection::extract(std::size_t row, const reader& doc, hint& state) noexcept
+{
+  auto pending = (count == max_columns) ? ~std::uint32_t(0) : ((std::uint32_t(1) << count) - 1);
+  std::size_t position = 0;
+  for (auto it = doc.begin(), end = doc.end(); pending && (it != end); ++it, ++position) {
+    const auto& field = *it;
+    const auto e_name = field.name();
+    const auto length = field.name_length();
+
+    // Try the column found at this position in the previous document
+    auto match = (position < max_order) ? state.order[position] : no_column;
+    if ((match == no_column) || !((pending >> match) & 1) ||
+        !table[match].e_name.matches(e_name, length)) {
+      match = no_column;
+      for (std::uint8_t i = 0; i < count; ++i) {
+        if (((pending >> i) & 1) && table[i].e_name.matches(e_name, length)) {
+          match = i;
+          break;
+        }
+      }
+      if (position < max_order) {
+        state.order[position] = match;
+      }
+    }
+    if (match != no_column) {
+      pending &= ~(std::uint32_t(1) << match);
+      store(match, row, field);
+    }
+  }
+
+  // Missing fields are null
+  for (std::size_t i = 0; pending; ++i, pending >>= 1) {
+    if (pending & 1) {
+      store(i, row, reader::element());
+    }
+  }
+}
+
+} /* namespace bson */
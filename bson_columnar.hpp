@@ -0,0 +1,275 @@
+/**
+ * @file bson_columnar.hpp
+ * @brief Columnar projection of fields from collections of BSON documents
+ */
+#ifndef _BSON_CPP11_BSON_COLUMNAR_HPP_
+#define _BSON_CPP11_BSON_COLUMNAR_HPP_
+
+#include "bson_parallel.hpp"
+#include <algorithm>
+#include <initializer_list>
+
+namespace bson {
+
+/**
+ * @brief Typed columns extracted from top-level fields of documents
+ *
+ * @note A row is stored for each document. Values of type::fp64 columns are
+ *       taken from double, int32 and int64 elements, and values of
+ *       type::int64 columns from int32 and int64 elements. Missing fields and
+ *       other types are null: the validity bit of the row is cleared and the
+ *       value is 0, so columns can be summed without checking validity.
+ *
+ * @code
+ * bson::projection columns({ { "price" }, { "qty", bson::type::int64 } });
+ * bson::project(collection, columns);
+ * const double* price = columns[0].fp64();
+ * @endcode
+ */
+class projection {
+public:
+  /**
+   * @brief Maximum number of columns
+   */
+  static constexpr std::size_t max_columns = 32;
+
+  /**
+   * @brief Number of leading element positions learned by hint
+   */
+  static constexpr std::size_t max_order = 64;
+
+  /**
+   * @brief Number of rows sharing one validity word
+   */
+  static constexpr std::size_t block_rows = 64;
+
+  /**
+   * @brief Name and type of column
+   */
+  struct column_spec {
+    /**
+     * @brief Construct from string literal
+     *
+     * @param e_name Element name
+     * @param kind type::fp64 or type::int64
+     */
+    template <std::size_t N>
+    column_spec(const char (&e_name)[N], bson::type kind = bson::type::fp64) noexcept
+    : name(e_name), kind(kind) {}
+
+    /**
+     * @brief Construct from key
+     *
+     * @param e_name Element name
+     * @param kind type::fp64 or type::int64
+     */
+    column_spec(const key& e_name, bson::type kind = bson::type::fp64) noexcept
+    : name(e_name), kind(kind) {}
+
+    key name;
+    bson::type kind;
+  };
+
+  /**
+   * @brief Column of values with validity bitmap
+   */
+  class column {
+  public:
+    /**
+     * @brief Get element name
+     */
+    const key& name() const noexcept { return e_name; }
+
+    /**
+     * @brief Get value type (type::fp64 or type::int64)
+     */
+    bson::type kind() const noexcept { return value_type; }
+
+    /**
+     * @brief Get double values (nullptr if not a type::fp64 column)
+     */
+    const double* fp64() const noexcept
+    {
+      return (value_type == bson::type::fp64) ? static_cast<const double*>(values) : nullptr;
+    }
+
+    /**
+     * @brief Get int64 values (nullptr if not a type::int64 column)
+     */
+    const std::int64_t* int64() const noexcept
+    {
+      return (value_type == bson::type::int64) ? static_cast<const std::int64_t*>(values) : nullptr;
+    }
+
+    /**
+     * @brief Get validity bitmap
+     *
+     * @note Bit (row % 64) of word (row / 64) is set if the row is not null.
+     */
+    const std::uint64_t* validity() const noexcept { return bits; }
+
+    /**
+     * @brief Check if row is null
+     *
+     * @param row Row index
+     */
+    bool is_null(std::size_t row) const noexcept
+    {
+      return ((bits[row / block_rows] >> (row % block_rows)) & 1) == 0;
+    }
+
+    /**
+     * @brief Count null rows
+     *
+     * @param rows Number of rows
+     */
+    std::size_t null_count(std::size_t rows) const noexcept;
+
+  private:
+    friend class projection;
+
+    key e_name = key(nullptr, 0);
+    bson::type value_type = bson::type::fp64;
+    void* values = nullptr;
+    std::uint64_t* bits = nullptr;
+  };
+
+  /**
+   * @brief Learned positions of columns in documents
+   *
+   * @note Keep one hint per thread and reuse it across documents. The
+   *       column found at each element position is tried first at the same
+   *       position of the next document.
+   */
+  struct hint {
+    hint() noexcept;
+
+    std::uint8_t order[max_order];
+  };
+
+  /**
+   * @brief Construct a new projection
+   *
+   * @note Column names must outlive the projection. The projection is
+   *       invalid if there are no columns, too many columns or a column of
+   *       unsupported type.
+   * @param columns Names and types of columns
+   * @param alloc Allocator for column storage
+   */
+  explicit projection(std::initializer_list<column_spec> columns,
+                      allocator& alloc = allocator::get_default()) noexcept;
+
+  /**
+   * @brief Construct a new projection
+   *
+   * @param columns Array of names and types of columns
+   * @param count Number of columns
+   * @param alloc Allocator for column storage
+   */
+  projection(const column_spec* columns, std::size_t count,
+             allocator& alloc = allocator::get_default()) noexcept;
+
+  // Prohibit copying
+  projection(const projection&) = delete;
+  projection& operator =(const projection&) = delete;
+
+  /**
+   * @brief Destroy the projection
+   */
+  ~projection() noexcept;
+
+  /**
+   * @brief Check if the projection is valid
+   */
+  bool valid() const noexcept { return count > 0; }
+
+  /**
+   * @brief Get number of columns
+   */
+  std::size_t columns() const noexcept { return count; }
+
+  /**
+   * @brief Get number of rows
+   */
+  std::size_t rows() const noexcept { return row_count; }
+
+  /**
+   * @brief Get column
+   *
+   * @param index Column index (in order of construction)
+   */
+  const column& operator [](std::size_t index) const noexcept { return table[index]; }
+
+  /**
+   * @brief Allocate storage for rows
+   *
+   * @note Previous values are discarded if storage is reallocated.
+   * @param rows Number of rows
+   * @return false if invalid or allocation failed (no rows)
+   */
+  bool resize(std::size_t rows) noexcept;
+
+  /**
+   * @brief Extract fields of document into row
+   *
+   * @note Rows in one block of block_rows share validity words, so a block
+   *       must not be extracted concurrently by different threads.
+   * @param row Row index (less than rows())
+   * @param doc Document
+   * @param state Hint of the calling thread
+   */
+  void extract(std::size_t row, const reader& doc, hint& state) noexcept;
+
+private:
+  void store(std::size_t index, std::size_t row, const reader::element& field) noexcept;
+
+  void release() noexcept;
+
+private:
+  column table[max_columns];
+  allocator& alloc;
+  std::size_t count = 0;
+  std::size_t row_count = 0;
+};
+
+/**
+ * @brief Project documents into columns
+ *
+ * @note Each document is walked once and the walk stops as soon as all
+ *       columns are found. With several workers, blocks of
+ *       projection::block_rows rows are distributed by parallel_scheduler.
+ * @tparam Collection Type with count() and doc(std::size_t) returning reader
+ *         (e.g. bson::mapped_file after build_index())
+ * @param collection Collection of documents (shared read-only)
+ * @param output Projection resized to collection.count() rows
+ * @param workers Number of workers (0 for default, 1 for the calling thread only)
+ * @param grain Number of blocks taken at once
+ * @return false if output is invalid or allocation failed
+ */
+template <class Collection>
+bool project(const Collection& collection, projection& output,
+             unsigned workers = 0, std::size_t grain = 4) noexcept
+{
+  const auto rows = collection.count();
+  if (!output.resize(rows)) {
+    return false;
+  }
+  const auto blocks = (rows + projection::block_rows - 1) / projection::block_rows;
+  parallel_scheduler scheduler(blocks, workers, grain);
+  auto task = [&](unsigned worker) {
+    projection::hint state;
+    std::size_t begin, end;
+    while (scheduler.next(worker, begin, end)) {
+      const auto last = std::min(end * projection::block_rows, rows);
+      for (auto i = begin * projection::block_rows; i < last; ++i) {
+        output.extract(i, collection.doc(i), state);
+      }
+    }
+  };
+  scheduler.run(task);
+  return true;
+}
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_COLUMNAR_HPP_ */
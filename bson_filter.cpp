@@ -0,0 +1,624 @@
+/**
+ * @file bson_filter.cpp
+ * @brief Predicate filter compiled to bytecode evaluated over BSON bytes
+ */
+#include "bson_filter.hpp"
+#include <algorithm>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#if (__cplusplus >= 201703L) && defined(__has_include)
+# if __has_include(<charconv>)
+#  include <charconv>
+# endif
+#endif
+
+namespace bson {
+
+namespace {
+
+enum opcode : std::uint8_t {
+  op_compare,       ///< acc = (path relation literal)
+  op_exists,        ///< acc = path exists
+  op_negate,        ///< acc = !acc
+  op_jump_false,    ///< if (!acc) goto operand
+  op_jump_true,     ///< if (acc) goto operand
+};
+
+enum relation : std::uint8_t {
+  rel_eq,
+  rel_lt,
+  rel_le,
+  rel_gt,
+  rel_ge,
+};
+
+/**
+ * @brief Parse number literal with '.' whatever the LC_NUMERIC locale
+ *
+ * @param text NUL-terminated copy of literal (modified)
+ * @param length Length of literal in bytes
+ */
+double to_double(char* text, std::size_t length) noexcept
+{
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+  // std::from_chars() rejects a leading '+' and out of range values
+  const auto first = text + ((text[0] == '+') ? 1 : 0);
+  double value;
+  const auto result = std::from_chars(first, text + length, value);
+  if ((result.ec == std::errc()) && (result.ptr == text + length)) {
+    return value;
+  }
+#endif
+  const auto point = std::localeconv()->decimal_point;
+  if ((point[0] != '.') && (point[0] != '\0') && (point[1] == '\0')) {
+    std::replace(text, text + length, '.', point[0]);
+  }
+  return std::strtod(text, nullptr);
+}
+
+template <class T>
+inline bool relate(std::uint8_t rel, const T& value, const T& operand) noexcept
+{
+  switch (rel) {
+  case rel_eq:
+    return value == operand;
+  case rel_lt:
+    return value < operand;
+  case rel_le:
+    return value <= operand;
+  case rel_gt:
+    return value > operand;
+  default:
+    return value >= operand;
+  }
+}
+
+inline bool is_name_char(char c) noexcept
+{
+  return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+         ((c >= '0') && (c <= '9')) || (c == '_') || (c == '$');
+}
+
+inline bool is_digit(char c) noexcept
+{
+  return (c >= '0') && (c <= '9');
+}
+
+} /* namespace */
+
+/**
+ * @brief Recursive descent compiler of filter expressions
+ */
+class filter_compiler {
+public:
+  filter_compiler(filter& output, const char* expression, std::size_t length) noexcept
+  : output(output), cursor(expression), begin(expression), end(expression + length) {}
+
+  bool run() noexcept
+  {
+    if (!parse_or(0)) {
+      return false;
+    }
+    skip_space();
+    return (cursor == end);
+  }
+
+  std::size_t position() const noexcept
+  {
+    return static_cast<std::size_t>(cursor - begin);
+  }
+
+private:
+  void skip_space() noexcept
+  {
+    while ((cursor < end) && ((*cursor == ' ') || (*cursor == '\t') || (*cursor == '\n') || (*cursor == '\r'))) {
+      ++cursor;
+    }
+  }
+
+  bool accept(const char* token) noexcept
+  {
+    skip_space();
+    const auto length = std::strlen(token);
+    if ((static_cast<std::size_t>(end - cursor) < length) || (std::memcmp(cursor, token, length) != 0)) {
+      return false;
+    }
+    cursor += length;
+    return true;
+  }
+
+  bool accept_word(const char* word) noexcept
+  {
+    const auto start = cursor;
+    if (!accept(word) || ((cursor < end) && is_name_char(*cursor))) {
+      cursor = start;
+      return false;
+    }
+    return true;
+  }
+
+  bool emit(std::uint8_t code, std::uint8_t rel = 0, std::uint8_t path = 0, std::uint16_t operand = 0) noexcept
+  {
+    if (output.code_length == filter::max_instructions) {
+      return false;
+    }
+    output.code[output.code_length++] = filter::instruction { code, rel, path, operand };
+    return true;
+  }
+
+  bool parse_or(std::size_t depth) noexcept
+  {
+    if (!parse_and(depth)) {
+      return false;
+    }
+    while (accept("||")) {
+      // Jump over right operand if true
+      const auto jump = output.code_length;
+      if (!emit(op_jump_true) || !parse_and(depth)) {
+        return false;
+      }
+      output.code[jump].operand = static_cast<std::uint16_t>(output.code_length);
+    }
+    return true;
+  }
+
+  bool parse_and(std::size_t depth) noexcept
+  {
+    if (!parse_unary(depth)) {
+      return false;
+    }
+    while (accept("&&")) {
+      // Early exit on failing conjunct
+      const auto jump = output.code_length;
+      if (!emit(op_jump_false) || !parse_unary(depth)) {
+        return false;
+      }
+      output.code[jump].operand = static_cast<std::uint16_t>(output.code_length);
+    }
+    return true;
+  }
+
+  bool parse_unary(std::size_t depth) noexcept
+  {
+    if (depth == filter::max_depth) {
+      return false;
+    }
+    if (accept("!=")) {
+      // Not a negation
+      return false;
+    }
+    if (accept("!")) {
+      return parse_unary(depth + 1) && emit(op_negate);
+    }
+    if (accept("(")) {
+      return parse_or(depth + 1) && accept(")");
+    }
+    skip_space();
+    const auto start = cursor;
+    if (accept_word("exists") && accept("(")) {
+      std::uint8_t path;
+      return parse_path(path) && accept(")") && emit(op_exists, 0, path);
+    }
+    cursor = start;
+    return parse_comparison();
+  }
+
+  bool parse_comparison() noexcept
+  {
+    std::uint8_t path;
+    if (!parse_path(path)) {
+      return false;
+    }
+    bool negate = false;
+    std::uint8_t rel;
+    if (accept("==")) {
+      rel = rel_eq;
+    } else if (accept("!=")) {
+      rel = rel_eq;
+      negate = true;
+    } else if (accept("<=")) {
+      rel = rel_le;
+    } else if (accept(">=")) {
+      rel = rel_ge;
+    } else if (accept("<")) {
+      rel = rel_lt;
+    } else if (accept(">")) {
+      rel = rel_gt;
+    } else {
+      return false;
+    }
+    std::uint16_t index;
+    if (!parse_literal(index)) {
+      return false;
+    }
+    const auto kind = output.literals[index].kind;
+    if ((rel != rel_eq) && (kind != bson::type::fp64) && (kind != bson::type::string)) {
+      // Booleans and null are not ordered
+      return false;
+    }
+    return emit(op_compare, rel, path, index) && (!negate || emit(op_negate));
+  }
+
+  bool store_text(const char* data, std::size_t length, filter::text_range& range) noexcept
+  {
+    if (filter::max_text - output.text_length < length) {
+      return false;
+    }
+    std::memcpy(output.text + output.text_length, data, length);
+    range.offset = static_cast<std::uint16_t>(output.text_length);
+    range.length = static_cast<std::uint16_t>(length);
+    output.text_length += length;
+    return true;
+  }
+
+  bool same_text(const filter::text_range& range, const char* data, std::size_t length) const noexcept
+  {
+    return (range.length == length) && (std::memcmp(output.text + range.offset, data, length) == 0);
+  }
+
+  bool parse_path(std::uint8_t& index) noexcept
+  {
+    skip_space();
+    const auto start = cursor;
+    const char* field_end = nullptr;
+    for (;;) {
+      const auto segment = cursor;
+      while ((cursor < end) && is_name_char(*cursor)) {
+        ++cursor;
+      }
+      if (cursor == segment) {
+        // Empty segment
+        return false;
+      }
+      if (!field_end) {
+        field_end = cursor;
+      }
+      if ((cursor == end) || (*cursor != '.')) {
+        break;
+      }
+      ++cursor;
+    }
+    const auto length = static_cast<std::size_t>(cursor - start);
+
+    // Reuse same path
+    for (std::size_t i = 0; i < output.path_count; ++i) {
+      if (same_text(output.paths[i].name, start, length)) {
+        index = static_cast<std::uint8_t>(i);
+        return true;
+      }
+    }
+    if (output.path_count == filter::max_paths) {
+      return false;
+    }
+    auto& entry = output.paths[output.path_count];
+    if (!store_text(start, length, entry.name)) {
+      return false;
+    }
+    const auto field_length = static_cast<std::size_t>(field_end - start);
+    entry.field = static_cast<std::uint8_t>(output.field_count);
+    for (std::size_t i = 0; i < output.field_count; ++i) {
+      if (same_text(output.fields[i], start, field_length)) {
+        entry.field = static_cast<std::uint8_t>(i);
+        break;
+      }
+    }
+    if (entry.field == output.field_count) {
+      // Fields share text of first path using them
+      output.fields[output.field_count++] = filter::text_range { entry.name.offset, static_cast<std::uint16_t>(field_length) };
+    }
+    entry.first_segment = static_cast<std::uint16_t>(output.segment_count);
+    entry.segments = 0;
+    auto segment = field_end;
+    while (segment < cursor) {
+      const auto first = segment + 1;
+      segment = first;
+      while ((segment < cursor) && (*segment != '.')) {
+        ++segment;
+      }
+      if (output.segment_count == filter::max_segments) {
+        return false;
+      }
+      output.segments[output.segment_count++] = filter::text_range {
+        static_cast<std::uint16_t>(entry.name.offset + (first - start)),
+        static_cast<std::uint16_t>(segment - first)
+      };
+      ++entry.segments;
+    }
+    index = static_cast<std::uint8_t>(output.path_count++);
+    return true;
+  }
+
+  bool parse_literal(std::uint16_t& index) noexcept
+  {
+    if (output.literal_count == filter::max_literals) {
+      return false;
+    }
+    auto& value = output.literals[output.literal_count];
+    value = filter::literal { 0, 0, filter::text_range { 0, 0 }, bson::type::null, false };
+    skip_space();
+    if (accept_word("true")) {
+      value.kind = bson::type::boolean;
+      value.integer = 1;
+    } else if (accept_word("false")) {
+      value.kind = bson::type::boolean;
+    } else if (accept_word("null")) {
+      value.kind = bson::type::null;
+    } else if ((cursor < end) && (*cursor == '"')) {
+      if (!parse_string(value.string)) {
+        return false;
+      }
+      value.kind = bson::type::string;
+    } else if (!parse_number(value)) {
+      return false;
+    }
+    index = static_cast<std::uint16_t>(output.literal_count++);
+    return true;
+  }
+
+  bool parse_string(filter::text_range& range) noexcept
+  {
+    ++cursor;
+    range.offset = static_cast<std::uint16_t>(output.text_length);
+    for (;;) {
+      if (cursor == end) {
+        return false;
+      }
+      auto c = *cursor++;
+      if (c == '"') {
+        break;
+      }
+      if (c == '\\') {
+        if ((cursor == end) || ((*cursor != '"') && (*cursor != '\\'))) {
+          return false;
+        }
+        c = *cursor++;
+      }
+      if (output.text_length == filter::max_text) {
+        return false;
+      }
+      output.text[output.text_length++] = c;
+    }
+    range.length = static_cast<std::uint16_t>(output.text_length - range.offset);
+    return true;
+  }
+
+  bool parse_number(filter::literal& value) noexcept
+  {
+    const auto start = cursor;
+    if ((cursor < end) && ((*cursor == '-') || (*cursor == '+'))) {
+      ++cursor;
+    }
+    const auto digits = cursor;
+
+    // Accumulate magnitude as negative to accept INT64_MIN
+    std::int64_t integer = 0;
+    bool exact = true;
+    while ((cursor < end) && is_digit(*cursor)) {
+      const auto digit = *cursor++ - '0';
+      if (integer < (INT64_MIN + digit) / 10) {
+        exact = false;
+      }
+      integer = exact ? (integer * 10 - digit) : integer;
+    }
+    if (cursor == digits) {
+      return false;
+    }
+    if ((cursor < end) && (*cursor == '.')) {
+      exact = false;
+      ++cursor;
+      while ((cursor < end) && is_digit(*cursor)) {
+        ++cursor;
+      }
+    }
+    if ((cursor < end) && ((*cursor == 'e') || (*cursor == 'E'))) {
+      exact = false;
+      ++cursor;
+      if ((cursor < end) && ((*cursor == '-') || (*cursor == '+'))) {
+        ++cursor;
+      }
+      const auto exponent = cursor;
+      while ((cursor < end) && is_digit(*cursor)) {
+        ++cursor;
+      }
+      if (cursor == exponent) {
+        return false;
+      }
+    }
+    if ((cursor < end) && is_name_char(*cursor)) {
+      return false;
+    }
+    char buffer[64];
+    const auto length = static_cast<std::size_t>(cursor - start);
+    if (length >= sizeof(buffer)) {
+      return false;
+    }
+    std::memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    value.number = to_double(buffer, length);
+    if (exact && (*start != '-')) {
+      exact = (integer != INT64_MIN);
+      integer = -integer;
+    }
+    value.integer = integer;
+    value.exact = exact;
+    value.kind = bson::type::fp64;
+    return true;
+  }
+
+private:
+  filter& output;
+  const char* cursor;
+  const char* begin;
+  const char* end;
+};
+
+/**
+ * @brief State of one document during match()
+ */
+class filter::evaluation {
+public:
+  evaluation(const filter& owner, const reader& doc) noexcept
+  : owner(owner), cursor(doc.begin()), end(doc.end()),
+    pending((owner.field_count == max_paths) ? ~std::uint32_t(0) : ((std::uint32_t(1) << owner.field_count) - 1)) {}
+
+  reader::element resolve(std::uint8_t index) noexcept
+  {
+    const auto& entry = owner.paths[index];
+    auto value = field(entry.field);
+    for (std::size_t i = 0; value.valid() && (i < entry.segments); ++i) {
+      const auto& segment = owner.segments[entry.first_segment + i];
+      const auto type = value.type();
+      if ((type != bson::type::document) && (type != bson::type::array)) {
+        return reader::element();
+      }
+      const auto sub = (type == bson::type::document) ? value.as_document() : value.as_array();
+      value = find(sub, key(owner.text + segment.offset, segment.length));
+    }
+    return value;
+  }
+
+  /**
+   * @brief Check if a field was not found because of a malformed element
+   */
+  bool failed() const noexcept { return failure; }
+
+private:
+  reader::element field(std::uint8_t index) noexcept
+  {
+    // Continue traversal until the field is found, recording others on the way
+    while (((pending >> index) & 1) && (cursor != end)) {
+      const auto& element = *cursor;
+      const auto e_name = element.name();
+      const auto length = element.name_length();
+      for (std::size_t i = 0; i < owner.field_count; ++i) {
+        const auto& name = owner.fields[i];
+        if (((pending >> i) & 1) && key(owner.text + name.offset, name.length).matches(e_name, length)) {
+          found[i].value = element;
+          pending &= ~(std::uint32_t(1) << i);
+          break;
+        }
+      }
+      ++cursor;
+    }
+    if ((pending >> index) & 1) {
+      // Missing, unless traversal stopped at a malformed element
+      failure = failure || cursor.fail();
+      return reader::element();
+    }
+    return found[index].value;
+  }
+
+  reader::element find(const reader& sub, const key& e_name) noexcept
+  {
+    auto it = sub.begin();
+    for (const auto sub_end = sub.end(); it != sub_end; ++it) {
+      if (e_name.matches(it->name(), it->name_length())) {
+        return *it;
+      }
+    }
+    failure = failure || it.fail();
+    return reader::element();
+  }
+
+private:
+  const filter& owner;
+  reader::const_iterator cursor;
+  reader::const_iterator end;
+  std::uint32_t pending;
+  bool failure = false;
+
+  // Left uninitialized (only read after being found)
+  union slot {
+    slot() noexcept {}
+    reader::element value;
+  } found[max_paths];
+};
+
+constexpr std::size_t filter::max_instructions;
+constexpr std::size_t filter::max_paths;
+constexpr std::size_t filter::max_segments;
+constexpr std::size_t filter::max_literals;
+constexpr std::size_t filter::max_text;
+constexpr std::size_t filter::max_depth;
+
+bool filter::compile(const char* expression) noexcept
+{
+  return compile(expression, std::strlen(expression));
+}
+
+bool filter::compile(const char* expression, std::size_t length) noexcept
+{
+  code_length = literal_count = path_count = field_count = segment_count = text_length = 0;
+  filter_compiler compiler(*this, expression, length);
+  if (!compiler.run()) {
+    code_length = 0;
+    error = compiler.position();
+    return false;
+  }
+  error = 0;
+  return true;
+}
+
+bool filter::compare(const instruction& op, const reader::element& value) const noexcept
+{
+  const auto& operand = literals[op.operand];
+  switch (operand.kind) {
+  case bson::type::fp64:
+    if (operand.exact && value.is_integer()) {
+      std::int64_t integer;
+      return value.get_integer(integer) && relate(op.relation, integer, operand.integer);
+    } else {
+      double number;
+      return value.get_number(number) && relate(op.relation, number, operand.number);
+    }
+  case bson::type::string: {
+    const char* string;
+    std::size_t length;
+    if (!value.get_string(string, length)) {
+      return false;
+    }
+    const auto compared = std::memcmp(string, text + operand.string.offset, std::min<std::size_t>(length, operand.string.length));
+    const int order = (compared != 0) ? compared : ((length < operand.string.length) ? -1 : (length > operand.string.length) ? 1 : 0);
+    return relate(op.relation, order, 0);
+  }
+  case bson::type::boolean: {
+    bool flag;
+    return value.get_boolean(flag) && (flag == (operand.integer != 0));
+  }
+  default:
+    return value.type() == bson::type::null;
+  }
+}
+
+bool filter::match(const reader& doc) const noexcept
+{
+  if (!code_length || !doc.valid()) {
+    return false;
+  }
+  evaluation state(*this, doc);
+  bool result = false;
+  for (std::size_t pc = 0; pc < code_length;) {
+    const auto& op = code[pc++];
+    switch (op.code) {
+    case op_compare:
+      result = compare(op, state.resolve(op.path));
+      break;
+    case op_exists:
+      result = state.resolve(op.path).valid();
+      break;
+    case op_negate:
+      result = !result;
+      break;
+    case op_jump_false:
+      pc = result ? pc : op.operand;
+      break;
+    default:
+      pc = result ? op.operand : pc;
+      break;
+    }
+  }
+  return result && !state.failed();
+}
+
+} /* namespace bson */
@@ -0,0 +1,189 @@
+/**
+ * @file bson_filter.hpp
+ * @brief Predicate filter compiled to bytecode evaluated over BSON bytes
+ */
+#ifndef _BSON_CPP11_BSON_FILTER_HPP_
+#define _BSON_CPP11_BSON_FILTER_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+/**
+ * @brief Predicate over documents compiled from an expression
+ *
+ * @note Grammar of expressions:
+ *       - `a || b`, `a && b`, `!a`, `( a )`
+ *       - `path == literal` (also !=, <, <=, >, >=)
+ *       - `exists(path)`
+ *       where a path is a dotted name (e.g. `user.age`, `tags.0`) and a
+ *       literal is a number, a double-quoted string (with \\" and \\\\
+ *       escapes), `true`, `false` or `null`.
+ *
+ *       Number literals use '.' as decimal point regardless of locale.
+ *       Numbers compare with double, int32 and int64 elements: integers are
+ *       compared exactly and other combinations as doubles (get_number()).
+ *       Strings compare bytewise with string elements. Booleans and null
+ *       support only == and !=. A comparison with a missing field or an
+ *       element of another type is false, and `!=` is always the negation
+ *       of `==`.
+ *
+ *       Each document is traversed at most once: fields are located on
+ *       first use, recording other referenced fields passed on the way, and
+ *       evaluation stops at the first conjunct that fails. A compiled filter
+ *       is immutable, so one filter can be shared by concurrent threads
+ *       (e.g. with parallel_count() over a mapped_file).
+ *
+ * @code
+ * bson::filter f("status == \"ok\" && latency > 100");
+ * auto slow = bson::parallel_count(file, f);
+ * @endcode
+ */
+class filter {
+public:
+  /**
+   * @brief Maximum number of instructions
+   */
+  static constexpr std::size_t max_instructions = 128;
+
+  /**
+   * @brief Maximum number of distinct paths
+   */
+  static constexpr std::size_t max_paths = 32;
+
+  /**
+   * @brief Maximum total number of nested segments of paths
+   */
+  static constexpr std::size_t max_segments = 64;
+
+  /**
+   * @brief Maximum number of literals
+   */
+  static constexpr std::size_t max_literals = 64;
+
+  /**
+   * @brief Maximum total length of names and strings in bytes
+   */
+  static constexpr std::size_t max_text = 1024;
+
+  /**
+   * @brief Maximum nesting depth of parentheses and negations
+   */
+  static constexpr std::size_t max_depth = 32;
+
+  /**
+   * @brief Construct an invalid filter
+   */
+  filter() noexcept {}
+
+  /**
+   * @brief Construct a new filter by compiling expression
+   *
+   * @param expression NUL-terminated expression
+   */
+  explicit filter(const char* expression) noexcept { (void)compile(expression); }
+
+  /**
+   * @brief Compile expression
+   *
+   * @note The expression is not referenced after compilation.
+   * @param expression NUL-terminated expression
+   * @return false if syntax error or limits exceeded (the filter becomes invalid)
+   */
+  bool compile(const char* expression) noexcept;
+
+  /**
+   * @brief Compile expression
+   *
+   * @param expression Pointer to expression (NUL termination not required)
+   * @param length Length of expression in bytes
+   * @return false if syntax error or limits exceeded (the filter becomes invalid)
+   */
+  bool compile(const char* expression, std::size_t length) noexcept;
+
+  /**
+   * @brief Check if the filter is valid
+   */
+  bool valid() const noexcept { return code_length > 0; }
+
+  /**
+   * @brief Get position in expression where compilation failed
+   */
+  std::size_t error_position() const noexcept { return error; }
+
+  /**
+   * @brief Get number of instructions
+   */
+  std::size_t size() const noexcept { return code_length; }
+
+  /**
+   * @brief Check if document matches
+   *
+   * @note Malformed bytes are only detected where traversal reaches them
+   *       while looking for a field. Use reader::validate() to reject
+   *       malformed documents first.
+   * @param doc Document
+   * @return false if no match, the filter is invalid, or a field could not
+   *         be found because of a malformed element (even for negated
+   *         predicates such as `a != 1`)
+   */
+  bool match(const reader& doc) const noexcept;
+
+  /**
+   * @brief Check if document matches (predicate for parallel scans)
+   */
+  bool operator ()(const reader& doc) const noexcept { return match(doc); }
+
+private:
+  friend class filter_compiler;
+
+  struct text_range {
+    std::uint16_t offset;
+    std::uint16_t length;
+  };
+
+  struct path_entry {
+    text_range name;              ///< Whole dotted path
+    std::uint8_t field;           ///< Index of top-level field
+    std::uint8_t segments;        ///< Number of nested segments after the field
+    std::uint16_t first_segment;  ///< Index of first nested segment
+  };
+
+  struct literal {
+    double number;
+    std::int64_t integer;         ///< Exact number (or 1 / 0 for boolean)
+    text_range string;
+    bson::type kind;              ///< fp64 (number), string, boolean or null
+    bool exact;                   ///< Number is an integer representable as int64
+  };
+
+  struct instruction {
+    std::uint8_t code;
+    std::uint8_t relation;
+    std::uint8_t path;
+    std::uint16_t operand;        ///< Literal index or jump target
+  };
+
+  class evaluation;
+
+  bool compare(const instruction& op, const reader::element& value) const noexcept;
+
+private:
+  instruction code[max_instructions];
+  literal literals[max_literals];
+  path_entry paths[max_paths];
+  text_range fields[max_paths];
+  text_range segments[max_segments];
+  char text[max_text];
+  std::size_t code_length = 0;
+  std::size_t literal_count = 0;
+  std::size_t path_count = 0;
+  std::size_t field_count = 0;
+  std::size_t segment_count = 0;
+  std::size_t text_length = 0;
+  std::size_t error = 0;
+};
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_FILTER_HPP_ */
@@ -4,25 +4,313 @@
  */
 #include "bson_flat.hpp"
 #include <malloc.h>
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <new>
+
+#ifndef BSON_NO_SIMD
+# if defined(__SSE2__)
+#  include <immintrin.h>
+#  define BSON_SIMD_SSE2 1
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define BSON_SIMD_AVX2 1
+#  endif
+# elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define BSON_SIMD_NEON 1
+# endif
+#endif
+
+#ifdef BSON_STATS
+# define BSON_STATS_ADD(counter, value) (local_stats.counter += (value))
+#else
+# define BSON_STATS_ADD(counter, value) ((void)0)
+#endif
 
 namespace bson {
 
+namespace {
+
+#ifdef BSON_STATS
+thread_local stats local_stats;
+#endif
+
+/**
+ * @brief Allocator based on malloc / realloc / free
+ */
+class malloc_allocator : public allocator {
+public:
+  void* allocate(std::size_t length) noexcept override
+  {
+    return ::malloc(length);
+  }
+
+  void* reallocate(void* buffer, std::size_t, std::size_t new_length) noexcept override
+  {
+    return ::realloc(buffer, new_length);
+  }
+
+  void deallocate(void* buffer) noexcept override
+  {
+    ::free(buffer);
+  }
+};
+
+} /* namespace */
+
+allocator& allocator::get_default() noexcept
+{
+  static malloc_allocator instance;
+  return instance;
+}
+
+constexpr std::size_t stats::depth_buckets;
+constexpr bool stats::enabled;
+
+stats stats::snapshot() noexcept
+{
+#ifdef BSON_STATS
+  return local_stats;
+#else
+  return stats();
+#endif
+}
+
+void stats::reset() noexcept
+{
+#ifdef BSON_STATS
+  local_stats = stats();
+#endif
+}
+
+stats& stats::operator+=(const stats& other) noexcept
+{
+  allocations += other.allocations;
+  reallocations += other.reallocations;
+  bytes_copied += other.bytes_copied;
+  bytes_written += other.bytes_written;
+  failed_appends += other.failed_appends;
+  for (std::size_t i = 0; i < depth_buckets; ++i) {
+    subdocuments[i] += other.subdocuments[i];
+  }
+  elements_scanned += other.elements_scanned;
+  elements_validated += other.elements_validated;
+  return *this;
+}
+
+arena_allocator::arena_allocator(void* buffer, std::size_t length, allocator* upstream) noexcept
+: base(static_cast<std::uint8_t*>(buffer)), top(base), limit(base + length),
+  last(nullptr), upstream(upstream)
+{
+}
+
+void* arena_allocator::allocate(std::size_t length) noexcept
+{
+  // Keep every allocation aligned for any scalar type
+  const auto align = alignof(std::max_align_t);
+  const auto start = top + ((align - (reinterpret_cast<std::uintptr_t>(top) % align)) % align);
+  if ((start <= limit) && (length <= static_cast<std::size_t>(limit - start))) {
+    last = start;
+    top = start + length;
+    return start;
+  }
+  return upstream ? upstream->allocate(length) : nullptr;
+}
+
+void* arena_allocator::reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept
+{
+  if (!owns(buffer)) {
+    return upstream ? upstream->reallocate(buffer, length, new_length) : nullptr;
+  }
+  if (buffer == last) {
+    // Extend (or shrink) the last allocation in place
+    if (new_length <= static_cast<std::size_t>(limit - last)) {
+      top = last + new_length;
+      return buffer;
+    }
+  } else if (new_length <= length) {
+    return buffer;
+  }
+  const auto new_buffer = allocate(new_length);
+  if (!new_buffer) {
+    return nullptr;
+  }
+  std::memcpy(new_buffer, buffer, (length < new_length) ? length : new_length);
+  return new_buffer;
+}
+
+void arena_allocator::deallocate(void* buffer) noexcept
+{
+  if (!owns(buffer)) {
+    if (upstream && buffer) {
+      upstream->deallocate(buffer);
+    }
+    return;
+  }
+  if (buffer == last) {
+    // Roll back the last allocation
+    top = last;
+    last = nullptr;
+  }
+}
+
+namespace {
+
+/**
+ * @brief Header placed in front of every pool block
+ */
+union pool_header {
+  unsigned index;           ///< Size class index (or pool_large)
+  std::max_align_t align;   ///< Keep payload aligned
+};
+
+const unsigned pool_large = ~0u;
+
+} /* namespace */
+
+pool_allocator::pool_allocator(allocator& upstream) noexcept
+: upstream(upstream)
+{
+  for (auto& list : free_list) {
+    list = nullptr;
+  }
+}
+
+pool_allocator::~pool_allocator() noexcept
+{
+  trim();
+}
+
+void* pool_allocator::allocate(std::size_t length) noexcept
+{
+  unsigned index = 0;
+  while ((index < classes) && ((std::size_t(1) << (min_shift + index)) < length)) {
+    ++index;
+  }
+  pool_header* header;
+  if (index >= classes) {
+    // Too large to be pooled
+    header = static_cast<pool_header*>(upstream.allocate(sizeof(pool_header) + length));
+    if (!header) {
+      return nullptr;
+    }
+    header->index = pool_large;
+    return header + 1;
+  }
+  if (auto cached = free_list[index]) {
+    free_list[index] = cached->next;
+    return cached;
+  }
+  header = static_cast<pool_header*>(
+    upstream.allocate(sizeof(pool_header) + (std::size_t(1) << (min_shift + index)))
+  );
+  if (!header) {
+    return nullptr;
+  }
+  header->index = index;
+  return header + 1;
+}
+
+void* pool_allocator::reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept
+{
+  const auto header = static_cast<pool_header*>(buffer) - 1;
+  if ((header->index != pool_large) &&
+      (new_length <= (std::size_t(1) << (min_shift + header->index)))) {
+    // Fits in the current block
+    return buffer;
+  }
+  const auto new_buffer = allocate(new_length);
+  if (!new_buffer) {
+    return nullptr;
+  }
+  std::memcpy(new_buffer, buffer, (length < new_length) ? length : new_length);
+  deallocate(buffer);
+  return new_buffer;
+}
+
+void pool_allocator::deallocate(void* buffer) noexcept
+{
+  if (!buffer) {
+    return;
+  }
+  const auto header = static_cast<pool_header*>(buffer) - 1;
+  if (header->index == pool_large) {
+    upstream.deallocate(header);
+    return;
+  }
+  const auto cached = static_cast<block*>(buffer);
+  cached->next = free_list[header->index];
+  free_list[header->index] = cached;
+}
+
+void pool_allocator::trim() noexcept
+{
+  for (auto& list : free_list) {
+    while (list) {
+      const auto cached = list;
+      list = cached->next;
+      upstream.deallocate(reinterpret_cast<pool_header*>(cached) - 1);
+    }
+  }
+}
+
+void size_history::update(std::size_t length) noexcept
+{
+  std::size_t next = predicted.load(std::memory_order_relaxed);
+  next -= (next >> 3);
+  if (next < length) {
+    next = length;
+  }
+  if (next < 5) {
+    next = 5;
+  } else if (next > INT32_MAX) {
+    next = INT32_MAX;
+  }
+  predicted.store(static_cast<std::uint32_t>(next), std::memory_order_relaxed);
+}
+
 writer::writer() noexcept
-: buffer(nullptr), offset(0), locked(0), length(128), malloc(1)
+: writer(128, allocator::get_default())
+{
+}
+
+writer::writer(bson::allocator& allocator) noexcept
+: writer(128, allocator)
+{
+}
+
+writer::writer(size_history& history, bson::allocator& allocator) noexcept
+: writer(history.get(), allocator)
+{
+  this->history = &history;
+}
+
+writer::writer(std::size_t size_hint, bson::allocator& allocator) noexcept
+: buffer(nullptr), offset(0), locked(0), length(0), malloc(1),
+  depth(0), batched(0), gather(0), deferred(0), alloc(&allocator), history(nullptr)
 {
-  buffer = ::malloc(length);
+  if (size_hint < 5) {
+    size_hint = 5;
+  } else if (size_hint > INT32_MAX) {
+    size_hint = INT32_MAX;
+  }
+  length = size_hint;
+  buffer = alloc->allocate(length);
   if (!buffer) {
     locked = 1;
     is_root = 0;
   } else {
+    BSON_STATS_ADD(allocations, 1);
     update_offset(buffer, 4);
   }
 }
 
 writer::writer(void* buffer, std::size_t length) noexcept
 {
+  this->mode = 0;
+  this->alloc = nullptr;
+  this->history = nullptr;
   if ((length < 5) || (length > INT32_MAX)) {
     // Construct invalid writer
     this->buffer = nullptr;
@@ -38,6 +326,20 @@ writer::writer(void* buffer, std::size_t length) noexcept
   }
 }
 
+writer::writer(writer&& other) noexcept
+: buffer(other.buffer), state(other.state), is_root(other.is_root), mode(other.mode),
+  alloc(other.alloc), history(other.history)
+{
+  if (!is_root) {
+    root = other.root;
+  }
+  // Invalidate source
+  other.buffer = nullptr;
+  other.offset = 0;
+  other.locked = 1;
+  other.is_root = 0;
+}
+
 writer::~writer() noexcept
 {
   if (locked) {
@@ -46,7 +348,10 @@ writer::~writer() noexcept
   locked = 1;
   if (is_root) {
     if (malloc) {
-      ::free(buffer);
+      if (history) {
+        history->update(offset + 1);
+      }
+      alloc->deallocate(buffer);
     }
     is_root = 0;
   } else {
@@ -59,12 +364,61 @@ writer::~writer() noexcept
 
     parent->locked = 0;
     auto root = get_root();
+    if (deferred) {
+      patch(root->buffer);
+    }
+    if (gather && (depth < static_cast<gather_writer*>(root)->pending_capacity)) {
+      // External bytes are already counted in ancestors
+      static_cast<gather_writer*>(root)->pending[depth] = 0;
+    }
     parent->update_offset(root->buffer, offset + 1);
   }
   buffer = nullptr;
 }
 
 bool writer::add_double(const char* e_name, double value) noexcept
+{
+  return add_double(key(e_name, std::strlen(e_name)), value);
+}
+
+bool writer::add_string(const char* e_name, const char* string) noexcept
+{
+  return add_string(key(e_name, std::strlen(e_name)), string, std::strlen(string));
+}
+
+bool writer::add_string(const char* e_name, const char* string,
+                        std::size_t length) noexcept
+{
+  return add_string(key(e_name, std::strlen(e_name)), string, length);
+}
+
+bool writer::add_binary(const char* e_name, const void* buffer,
+                        std::size_t length, subtype subtype) noexcept
+{
+  return add_binary(key(e_name, std::strlen(e_name)), buffer, length, subtype);
+}
+
+void* writer::add_binary(const char* e_name, std::size_t length, subtype subtype) noexcept
+{
+  return add_binary(key(e_name, std::strlen(e_name)), length, subtype);
+}
+
+bool writer::add_boolean(const char* e_name, bool value) noexcept
+{
+  return add_boolean(key(e_name, std::strlen(e_name)), value);
+}
+
+bool writer::add_int32(const char* e_name, std::int32_t value) noexcept
+{
+  return add_int32(key(e_name, std::strlen(e_name)), value);
+}
+
+bool writer::add_int64(const char* e_name, std::int64_t value) noexcept
+{
+  return add_int64(key(e_name, std::strlen(e_name)), value);
+}
+
+bool writer::add_double(const key& e_name, double value) noexcept
 {
   auto dest = static_cast<double*>(
     add_element(e_name, bson::type::fp64, 8)
@@ -76,17 +430,26 @@ bool writer::add_double(const char* e_name, double value) noexcept
   return true;
 }
 
-bool writer::add_string(const char* e_name, const char* string) noexcept
+bool writer::add_string(const key& e_name, const char* string) noexcept
 {
   return add_string(e_name, string, std::strlen(string));
 }
 
-bool writer::add_string(const char* e_name, const char* string,
-                        std::size_t length) noexcept
+bool writer::add_string(const key& e_name, const char* string, std::size_t length) noexcept
 {
   if (length >= INT32_MAX) {
     return false;
   }
+  if (gather && (length >= static_cast<gather_writer*>(get_root())->threshold)) {
+    // Length (4) + payload (external) + NUL (1)
+    const int32_t length_buffer = length + 1;
+    if (!add_external(e_name, bson::type::string, 5, 4, string, length)) {
+      return false;
+    }
+    std::memcpy(static_cast<std::uint8_t*>(get_root()->buffer) + offset - 5, &length_buffer, 4);
+    static_cast<std::uint8_t*>(get_root()->buffer)[offset - 1] = 0x00;
+    return true;
+  }
   union {
     std::int32_t* int32;
     char* chars;
@@ -103,9 +466,20 @@ bool writer::add_string(const char* e_name, const char* string,
   return true;
 }
 
-bool writer::add_binary(const char* e_name, const void* buffer,
+bool writer::add_binary(const key& e_name, const void* buffer,
                         std::size_t length, subtype subtype) noexcept
 {
+  if (gather && (length >= static_cast<gather_writer*>(get_root())->threshold) && (length <= INT32_MAX)) {
+    // Length (4) + subtype (1) + payload (external)
+    const int32_t length_buffer = length;
+    if (!add_external(e_name, bson::type::binary, 5, 5, buffer, length)) {
+      return false;
+    }
+    const auto dest = static_cast<std::uint8_t*>(get_root()->buffer) + offset - 5;
+    std::memcpy(dest, &length_buffer, 4);
+    dest[4] = static_cast<std::uint8_t>(subtype);
+    return true;
+  }
   auto pointer = add_binary(e_name, length, subtype);
   if (!pointer) {
     return false;
@@ -114,7 +488,7 @@ bool writer::add_binary(const char* e_name, const void* buffer,
   return true;
 }
 
-void* writer::add_binary(const char* e_name, std::size_t length, subtype subtype) noexcept
+void* writer::add_binary(const key& e_name, std::size_t length, subtype subtype) noexcept
 {
   if (length > INT32_MAX) {
     return nullptr;
@@ -134,7 +508,7 @@ void* writer::add_binary(const char* e_name, std::size_t length, subtype subtype
   return dest.pointer;
 }
 
-bool writer::add_boolean(const char* e_name, bool value) noexcept
+bool writer::add_boolean(const key& e_name, bool value) noexcept
 {
   const auto dest = static_cast<std::uint8_t*>(
     add_element(e_name, bson::type::boolean, 1)
@@ -146,7 +520,7 @@ bool writer::add_boolean(const char* e_name, bool value) noexcept
   return true;
 }
 
-bool writer::add_int32(const char* e_name, std::int32_t value) noexcept
+bool writer::add_int32(const key& e_name, std::int32_t value) noexcept
 {
   const auto dest = static_cast<std::int32_t*>(
     add_element(e_name, bson::type::int32, 4)
@@ -158,7 +532,7 @@ bool writer::add_int32(const char* e_name, std::int32_t value) noexcept
   return true;
 }
 
-bool writer::add_int64(const char* e_name, std::int64_t value) noexcept
+bool writer::add_int64(const key& e_name, std::int64_t value) noexcept
 {
   const auto dest = static_cast<std::int64_t*>(
     add_element(e_name, bson::type::int64, 8)
@@ -172,10 +546,13 @@ bool writer::add_int64(const char* e_name, std::int64_t value) noexcept
 
 bool writer::get_bytes(const std::uint8_t*& bytes, std::size_t& length) const noexcept
 {
-  if (locked) {
+  if (locked || gather) {
     return false;
   }
   const auto root = static_cast<const writer*>(const_cast<writer*>(this)->get_root());
+  if (deferred) {
+    patch(root->buffer);
+  }
   const auto header_offset = (is_root ? 0 : (parent->offset - 5));
   bytes = static_cast<const std::uint8_t*>(root->buffer) + header_offset;
   length = (offset + 1) - header_offset;
@@ -184,11 +561,17 @@ bool writer::get_bytes(const std::uint8_t*& bytes, std::size_t& length) const no
 
 std::uint8_t* writer::release(std::size_t& length) noexcept
 {
-  if (locked || !is_root || !malloc) {
+  if (locked || !is_root || !malloc || batched || gather) {
     return nullptr;
   }
   auto bytes = static_cast<std::uint8_t*>(buffer);
   length = (offset + 1);
+  if (deferred) {
+    patch(buffer);
+  }
+  if (history) {
+    history->update(length);
+  }
 
   // Invalidate write
   parent = nullptr;
@@ -200,49 +583,123 @@ std::uint8_t* writer::release(std::size_t& length) noexcept
 }
 
 void* writer::add_element(const char* e_name, type type, std::size_t space) noexcept
+{
+  return add_element(key(e_name, std::strlen(e_name)), type, space);
+}
+
+void* writer::add_element(const key& e_name, type type, std::size_t space) noexcept
 {
   if (locked) {
+    BSON_STATS_ADD(failed_appends, 1);
+    return nullptr;
+  }
+  const auto name_length = e_name.length;
+  if (name_length == 0) {
     return nullptr;
   }
   std::size_t depth;
   const auto root = get_root(&depth);
-  const auto name_length = std::strlen(e_name) + 1;
-  if (name_length <= 1) {
+  auto required = offset + 1 + name_length + 1 + space + 1 + depth;
+  if ((root->length < required) && (!root->expand(required))) {
+    BSON_STATS_ADD(failed_appends, 1);
     return nullptr;
   }
-  auto required = offset + 1 + name_length + space + 1 + depth;
-  if (root->length < required) {
-    // Insufficient space
-    if (!root->malloc) {
-      // Fixed buffer full
-      return nullptr;
-    }
-    // Growth buffer
-    auto new_length = root->length;
-    do { new_length *= 2; } while (new_length < required);
-    auto new_buffer = ::realloc(root->buffer, new_length);
-    if (!new_buffer) {
-      return nullptr;
-    }
-    root->buffer = new_buffer;
-    root->length = new_length;
-  }
+  BSON_STATS_ADD(bytes_written, 1 + name_length + 1 + space);
 
   //    <--size--->
-  // .. xx 00 00 00 .. .. .. .. nn nn nn nn nn 00 tt ss ss ss ss 00
-  //                  |        |<--name_length-->   |<--space-->|
-  //       parent->offset    this->offset         dest        this->offset
-  //                             (old)                            (new)
+  // .. xx 00 00 00 .. .. .. .. nn nn nn nn 00 tt ss ss ss ss 00
+  //                  |        |<name_length>   |<--space-->|
+  //       parent->offset    this->offset     dest        this->offset
+  //                             (old)                        (new)
 
   auto dest = static_cast<std::uint8_t*>(root->buffer) + offset;
   *dest++ = static_cast<std::uint8_t>(type);
-  std::memcpy(dest, e_name, name_length);
+  std::memcpy(dest, e_name.data, name_length);
   dest += name_length;
-  update_offset(root->buffer, offset + name_length + 1 + space);
+  *dest++ = 0x00;
+  update_offset(root->buffer, offset + 1 + name_length + 1 + space);
+  return dest;
+}
+
+void* writer::add_elements(std::size_t space) noexcept
+{
+  if (locked) {
+    BSON_STATS_ADD(failed_appends, 1);
+    return nullptr;
+  }
+  std::size_t depth;
+  const auto root = get_root(&depth);
+  auto required = offset + space + 1 + depth;
+  if ((root->length < required) && (!root->expand(required))) {
+    BSON_STATS_ADD(failed_appends, 1);
+    return nullptr;
+  }
+  BSON_STATS_ADD(bytes_written, space);
+  auto dest = static_cast<std::uint8_t*>(root->buffer) + offset;
+  update_offset(root->buffer, offset + space);
   return dest;
 }
 
+bool writer::set_deferred(bool enable) noexcept
+{
+  if (locked || !is_root) {
+    return false;
+  }
+  if (deferred && !enable) {
+    patch(buffer);
+  }
+  deferred = enable;
+  return true;
+}
+
+bool writer::reserve(std::size_t length) noexcept
+{
+  if (locked) {
+    return false;
+  }
+  std::size_t depth;
+  const auto root = get_root(&depth);
+  auto required = offset + 1 + length + depth;
+  return (root->length >= required) || root->expand(required);
+}
+
+bool writer::expand(std::size_t required) noexcept
+{
+  if (!malloc) {
+    // Fixed buffer full
+    return false;
+  }
+  if (required > INT32_MAX) {
+    return false;
+  }
+  // Growth buffer
+  std::size_t new_length = length;
+  do { new_length *= 2; } while (new_length < required);
+  if (new_length > INT32_MAX) {
+    new_length = INT32_MAX;
+  }
+  auto new_buffer = alloc->reallocate(buffer, length, new_length);
+  if (!new_buffer && (new_length > required)) {
+    // Retry without growth slack (e.g. rest of fixed batch buffer)
+    new_length = required;
+    new_buffer = alloc->reallocate(buffer, length, new_length);
+  }
+  if (!new_buffer) {
+    return false;
+  }
+  BSON_STATS_ADD(reallocations, 1);
+  BSON_STATS_ADD(bytes_copied, offset + 1);
+  buffer = new_buffer;
+  length = new_length;
+  return true;
+}
+
 writer writer::add_subdocument(const char* e_name, type type) noexcept
+{
+  return add_subdocument(key(e_name, std::strlen(e_name)), type);
+}
+
+writer writer::add_subdocument(const key& e_name, type type) noexcept
 {
   auto dest = static_cast<std::int32_t*>(
     add_element(e_name, type, 5)
@@ -252,11 +709,17 @@ writer writer::add_subdocument(const char* e_name, type type) noexcept
   }
   *dest++ = 5;
   *reinterpret_cast<std::uint8_t*>(dest) = 0x00;
+  BSON_STATS_ADD(subdocuments[std::min<std::size_t>(depth, stats::depth_buckets - 1)], 1);
   locked = 1;
   return writer(this, offset - 1);
 }
 
 bool writer::add_subdocument(const char* e_name, type type, const writer& subdocument) noexcept
+{
+  return add_subdocument(key(e_name, std::strlen(e_name)), type, subdocument);
+}
+
+bool writer::add_subdocument(const key& e_name, type type, const writer& subdocument) noexcept
 {
   const std::uint8_t* bytes;
   std::size_t space;
@@ -272,357 +735,1699 @@ bool writer::add_subdocument(const char* e_name, type type, const writer& subdoc
   return true;
 }
 
-writer* writer::get_root(std::size_t* depth_store) noexcept
+bool writer::add_external(const key& e_name, type type, std::size_t space, std::size_t position,
+                          const void* data, std::size_t length) noexcept
 {
-  auto target = this;
-  std::size_t depth = 0;
-  while (target->is_root == 0) {
-    target = target->parent;
-    ++depth;
+  if (locked) {
+    return false;
+  }
+  std::size_t depth;
+  const auto root = static_cast<gather_writer*>(get_root(&depth));
+  if (!root->reserve_external(depth)) {
+    return false;
+  }
+  const auto external = root->pending ? root->pending[0] : 0;
+  if (external + length + offset + 2 + e_name.length + space + 1 + depth > INT32_MAX) {
+    return false;
+  }
+  auto dest = static_cast<std::uint8_t*>(add_element(e_name, type, space));
+  if (!dest) {
+    return false;
   }
-  if (depth_store) {
-    *depth_store = depth;
+  auto& reference = root->references[root->reference_count++];
+  reference.position = (dest - static_cast<std::uint8_t*>(root->buffer)) + position;
+  reference.data = data;
+  reference.length = length;
+  for (std::size_t i = 0; i <= depth; ++i) {
+    root->pending[i] += length;
   }
-  return target;
+  if (!deferred) {
+    patch(root->buffer);
+  }
+  return true;
 }
 
 void writer::update_offset(void* buffer, std::uint32_t new_offset) noexcept
+{
+  offset = new_offset;
+  if (!deferred) {
+    patch(buffer);
+  }
+}
+
+void writer::patch(void* buffer) const noexcept
 {
   const auto bytes = static_cast<std::uint8_t*>(buffer);
   const auto header_offset = is_root ? 0 : (parent->offset - 5);
-  int total_buffer = new_offset + 1 - header_offset;
+  int total_buffer = offset + 1 - header_offset;
+  if (gather) {
+    const auto root = static_cast<const gather_writer*>(is_root ? this : this->root);
+    if (depth < root->pending_capacity) {
+      total_buffer += root->pending[depth];
+    }
+  }
   std::memcpy(bytes + header_offset, &total_buffer, 4);
-  bytes[new_offset] = 0x00;
-  offset = new_offset;
+  bytes[offset] = 0x00;
 }
 
-bool reader::element::truthy() const noexcept
+namespace {
+
+const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/**
+ * @brief Count decimal digits of value
+ */
+inline std::size_t count_digits(std::uint32_t value) noexcept
 {
-  union {
-    double fp64;
-    int32_t int32;
-    int64_t int64;
-  } buffer;
-  switch (type()) {
-  case bson::type::fp64:
-    std::memcpy(&buffer.fp64, data.fp64, 8);
-    return (!std::isnan(buffer.fp64)) && (buffer.fp64 != 0.0);
-  case bson::type::string:
-    std::memcpy(&buffer.int32, data.int32, 4);
+  std::size_t digits = 1;
+  for (;;) {
+    if (value < 10) { return digits; }
+    if (value < 100) { return digits + 1; }
+    if (value < 1000) { return digits + 2; }
+    if (value < 10000) { return digits + 3; }
+    value /= 10000;
+    digits += 4;
+  }
+}
+
+/**
+ * @brief Sum decimal digits of consecutive values [first, first + count)
+ */
+std::size_t sum_digits(std::uint32_t first, std::size_t count) noexcept
+{
+  std::size_t total = 0;
+  std::uint64_t low = first;
+  const std::uint64_t end = low + count;
+  std::uint64_t power = 10;
+  std::size_t digits = 1;
+  while (low < end) {
+    if (low < power) {
+      const auto high = (end < power) ? end : power;
+      total += (high - low) * digits;
+      low = high;
+    }
+    power *= 10;
+    ++digits;
+  }
+  return total;
+}
+
+/**
+ * @brief Write decimal digits of value (without NUL termination)
+ *
+ * @return Number of digits written
+ */
+inline std::size_t format_index(char* dest, std::uint32_t value) noexcept
+{
+  const auto digits = count_digits(value);
+  auto pointer = dest + digits;
+  while (value >= 100) {
+    const auto pair = (value % 100) * 2;
+    value /= 100;
+    pointer -= 2;
+    pointer[0] = digit_pairs[pair];
+    pointer[1] = digit_pairs[pair + 1];
+  }
+  if (value >= 10) {
+    pointer[-2] = digit_pairs[value * 2];
+    pointer[-1] = digit_pairs[value * 2 + 1];
+  } else {
+    pointer[-1] = static_cast<char>('0' + value);
+  }
+  return digits;
+}
+
+} /* namespace */
+
+void* array_writer::push_element(type type, std::size_t space) noexcept
+{
+  char digits[10];
+  const auto dest = add_element(key(digits, format_index(digits, index)), type, space);
+  if (dest) {
+    ++index;
+  }
+  return dest;
+}
+
+bool array_writer::push_double(double value) noexcept
+{
+  char digits[10];
+  return add_double(key(digits, format_index(digits, index)), value) && (++index, true);
+}
+
+bool array_writer::push_string(const char* string) noexcept
+{
+  return push_string(string, std::strlen(string));
+}
+
+bool array_writer::push_string(const char* string, std::size_t length) noexcept
+{
+  char digits[10];
+  return add_string(key(digits, format_index(digits, index)), string, length) && (++index, true);
+}
+
+writer array_writer::push_document() noexcept
+{
+  char digits[10];
+  auto subdocument = add_subdocument(key(digits, format_index(digits, index)), bson::type::document);
+  if (subdocument) {
+    ++index;
+  }
+  return subdocument;
+}
+
+array_writer array_writer::push_array() noexcept
+{
+  char digits[10];
+  array_writer subdocument(add_subdocument(key(digits, format_index(digits, index)), bson::type::array));
+  if (subdocument) {
+    ++index;
+  }
+  return subdocument;
+}
+
+bool array_writer::push_document(const writer& subdocument) noexcept
+{
+  char digits[10];
+  return add_subdocument(key(digits, format_index(digits, index)), bson::type::document, subdocument) &&
+    (++index, true);
+}
+
+bool array_writer::push_array(const writer& subdocument) noexcept
+{
+  char digits[10];
+  return add_subdocument(key(digits, format_index(digits, index)), bson::type::array, subdocument) &&
+    (++index, true);
+}
+
+bool array_writer::push_binary(const void* buffer, std::size_t length, subtype subtype) noexcept
+{
+  char digits[10];
+  return add_binary(key(digits, format_index(digits, index)), buffer, length, subtype) && (++index, true);
+}
+
+void* array_writer::push_binary(std::size_t length, subtype subtype) noexcept
+{
+  char digits[10];
+  const auto dest = add_binary(key(digits, format_index(digits, index)), length, subtype);
+  if (dest) {
+    ++index;
+  }
+  return dest;
+}
+
+bool array_writer::push_boolean(bool value) noexcept
+{
+  char digits[10];
+  return add_boolean(key(digits, format_index(digits, index)), value) && (++index, true);
+}
+
+bool array_writer::push_int32(std::int32_t value) noexcept
+{
+  char digits[10];
+  return add_int32(key(digits, format_index(digits, index)), value) && (++index, true);
+}
+
+bool array_writer::push_int64(std::int64_t value) noexcept
+{
+  char digits[10];
+  return add_int64(key(digits, format_index(digits, index)), value) && (++index, true);
+}
+
+bool array_writer::push_fixed(type type, const void* values, std::size_t size, std::size_t count) noexcept
+{
+  if (locked) {
+    return false;
+  }
+  if (count == 0) {
+    return true;
+  }
+  if (count > static_cast<std::size_t>(INT32_MAX - index)) {
+    return false;
+  }
+
+  // Each element is: type (1) + key digits + NUL (1) + value
+  auto dest = static_cast<std::uint8_t*>(
+    add_elements(count * (2 + size) + sum_digits(index, count))
+  );
+  if (!dest) {
+    return false;
+  }
+  auto source = static_cast<const std::uint8_t*>(values);
+  for (std::size_t i = 0; i < count; ++i) {
+    *dest++ = static_cast<std::uint8_t>(type);
+    dest += format_index(reinterpret_cast<char*>(dest), index++);
+    *dest++ = 0x00;
+    std::memcpy(dest, source, size);
+    dest += size;
+    source += size;
+  }
+  return true;
+}
+
+batch_writer::document::~document() noexcept
+{
+  if (!is_root) {
+    // Moved or failed to start
+    return;
+  }
+  if (locked) {
+    // Subdocument still open: discard without commit
+    batch->writing = false;
+    malloc = 0;
+    return;
+  }
+  if (deferred) {
+    patch(buffer);
+  }
+  batch->used += offset + 1;
+  ++batch->documents;
+  batch->writing = false;
+
+  // Prevent deallocation by writer
+  malloc = 0;
+}
+
+batch_writer::batch_writer(std::size_t capacity, allocator& upstream) noexcept
+: upstream(&upstream), storage(nullptr), capacity(0)
+{
+  if (capacity > 0) {
+    (void)reserve(capacity);
+  }
+}
+
+batch_writer::batch_writer(void* buffer, std::size_t length) noexcept
+: upstream(nullptr), storage(static_cast<std::uint8_t*>(buffer)), capacity(length)
+{
+}
+
+batch_writer::~batch_writer() noexcept
+{
+  if (upstream && storage) {
+    upstream->deallocate(storage);
+  }
+}
+
+batch_writer::document batch_writer::add_document(std::size_t size_hint) noexcept
+{
+  if (!upstream) {
+    // Fit in the rest of fixed buffer
+    size_hint = std::min(size_hint, capacity - used);
+  }
+  return document(*this, size_hint);
+}
+
+bool batch_writer::get_bytes(const std::uint8_t*& bytes, std::size_t& length) const noexcept
+{
+  if (writing) {
+    return false;
+  }
+  bytes = storage;
+  length = used;
+  return true;
+}
+
+std::uint8_t* batch_writer::release(std::size_t& length) noexcept
+{
+  if (writing || !upstream) {
+    return nullptr;
+  }
+  auto bytes = storage;
+  length = used;
+  storage = nullptr;
+  capacity = 0;
+  used = 0;
+  documents = 0;
+  return bytes;
+}
+
+void batch_writer::clear() noexcept
+{
+  if (!writing) {
+    used = 0;
+    documents = 0;
+  }
+}
+
+void* batch_writer::allocate(std::size_t length) noexcept
+{
+  if (writing || (!reserve(used + length))) {
+    return nullptr;
+  }
+  writing = true;
+  return storage + used;
+}
+
+void* batch_writer::reallocate(void*, std::size_t, std::size_t new_length) noexcept
+{
+  if (!reserve(used + new_length)) {
+    return nullptr;
+  }
+  return storage + used;
+}
+
+void batch_writer::deallocate(void*) noexcept
+{
+  // Document discarded without commit
+  writing = false;
+}
+
+bool batch_writer::reserve(std::size_t required) noexcept
+{
+  if (required <= capacity) {
+    return true;
+  }
+  if (!upstream) {
+    return false;
+  }
+  auto new_capacity = std::max(required, capacity * 2);
+  auto new_storage = static_cast<std::uint8_t*>(
+    storage ? upstream->reallocate(storage, capacity, new_capacity) : upstream->allocate(new_capacity)
+  );
+  if (!new_storage) {
+    return false;
+  }
+  storage = new_storage;
+  capacity = new_capacity;
+  return true;
+}
+
+gather_writer::~gather_writer() noexcept
+{
+  if (alloc) {
+    if (references) {
+      alloc->deallocate(references);
+    }
+    if (pending) {
+      alloc->deallocate(pending);
+    }
+    if (fragments) {
+      alloc->deallocate(fragments);
+    }
+  }
+}
+
+bool gather_writer::get_fragments(const fragment*& fragments, std::size_t& count) noexcept
+{
+  if (locked || (!grow(this->fragments, fragment_capacity, reference_count * 2 + 1))) {
+    return false;
+  }
+  if (deferred) {
+    patch(buffer);
+  }
+  const auto bytes = static_cast<const std::uint8_t*>(buffer);
+  std::size_t cursor = 0;
+  count = 0;
+  for (std::size_t i = 0; i < reference_count; ++i) {
+    const auto& reference = references[i];
+    if (reference.position > cursor) {
+      this->fragments[count++] = fragment { bytes + cursor, reference.position - cursor };
+      cursor = reference.position;
+    }
+    if (reference.length > 0) {
+      this->fragments[count++] = fragment { reference.data, reference.length };
+    }
+  }
+  this->fragments[count++] = fragment { bytes + cursor, offset + 1 - cursor };
+  fragments = this->fragments;
+  return true;
+}
+
+bool gather_writer::reserve_external(std::size_t depth) noexcept
+{
+  const auto old_capacity = pending_capacity;
+  if (!grow(pending, pending_capacity, depth + 1)) {
+    return false;
+  }
+  for (auto i = old_capacity; i < pending_capacity; ++i) {
+    pending[i] = 0;
+  }
+  return grow(references, reference_capacity, reference_count + 1);
+}
+
+template <class T>
+bool gather_writer::grow(T*& array, std::size_t& capacity, std::size_t required) noexcept
+{
+  if ((required <= capacity) || (!alloc)) {
+    return (required <= capacity);
+  }
+  const auto new_capacity = std::max<std::size_t>(std::max<std::size_t>(capacity * 2, 8), required);
+  auto new_array = static_cast<T*>(
+    array ? alloc->reallocate(array, capacity * sizeof(T), new_capacity * sizeof(T))
+          : alloc->allocate(new_capacity * sizeof(T))
+  );
+  if (!new_array) {
+    return false;
+  }
+  array = new_array;
+  capacity = new_capacity;
+  return true;
+}
+
+namespace {
+
+/**
+ * @brief Byte scanning kernels
+ *
+ * @note Each kernel processes [begin, end) and never reads outside of it.
+ *       Vector width blocks are processed by SIMD and the tail by scalar code.
+ */
+struct scan_kernels {
+  /**
+   * @brief Find NUL character (nullptr if not found)
+   */
+  const std::uint8_t* (*find_nul)(const std::uint8_t* begin, const std::uint8_t* end) noexcept;
+
+  /**
+   * @brief Skip ASCII characters (returns first non-ASCII byte or end)
+   */
+  const std::uint8_t* (*skip_ascii)(const std::uint8_t* begin, const std::uint8_t* end) noexcept;
+};
+
+const std::uint8_t* find_nul_scalar(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; begin < end; ++begin) {
+    if (*begin == 0x00) {
+      return begin;
+    }
+  }
+  return nullptr;
+}
+
+const std::uint8_t* skip_ascii_scalar(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; begin < end; ++begin) {
+    if (*begin & 0x80) {
+      break;
+    }
+  }
+  return begin;
+}
+
+#ifdef BSON_SIMD_SSE2
+const std::uint8_t* find_nul_sse2(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  const auto zero = _mm_setzero_si128();
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_nul_scalar(begin, end);
+}
+
+const std::uint8_t* skip_ascii_sse2(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const auto mask = _mm_movemask_epi8(block);
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return skip_ascii_scalar(begin, end);
+}
+#endif  /* BSON_SIMD_SSE2 */
+
+#ifdef BSON_SIMD_AVX2
+__attribute__((target("avx2")))
+const std::uint8_t* find_nul_avx2(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  const auto zero = _mm256_setzero_si256();
+  for (; end - begin >= 32; begin += 32) {
+    const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero)));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_nul_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+const std::uint8_t* skip_ascii_avx2(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; end - begin >= 32; begin += 32) {
+    const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(block));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return skip_ascii_sse2(begin, end);
+}
+#endif  /* BSON_SIMD_AVX2 */
+
+#ifdef BSON_SIMD_NEON
+const std::uint8_t* find_nul_neon(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = vld1q_u8(begin);
+    if (vminvq_u8(block) == 0) {
+      return find_nul_scalar(begin, begin + 16);
+    }
+  }
+  return find_nul_scalar(begin, end);
+}
+
+const std::uint8_t* skip_ascii_neon(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = vld1q_u8(begin);
+    if (vmaxvq_u8(block) & 0x80) {
+      return skip_ascii_scalar(begin, begin + 16);
+    }
+  }
+  return skip_ascii_scalar(begin, end);
+}
+#endif  /* BSON_SIMD_NEON */
+
+scan_kernels select_kernels() noexcept
+{
+#if defined(BSON_SIMD_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return scan_kernels { find_nul_avx2, skip_ascii_avx2 };
+  }
+#endif
+#if defined(BSON_SIMD_SSE2)
+  return scan_kernels { find_nul_sse2, skip_ascii_sse2 };
+#elif defined(BSON_SIMD_NEON)
+  return scan_kernels { find_nul_neon, skip_ascii_neon };
+#else
+  return scan_kernels { find_nul_scalar, skip_ascii_scalar };
+#endif
+}
+
+/**
+ * @brief Get kernels selected on first use
+ *
+ * @note A function-local static, so callers from static initializers of
+ *       other translation units never see uninitialized kernels.
+ */
+const scan_kernels& get_kernels() noexcept
+{
+  static const scan_kernels kernels = select_kernels();
+  return kernels;
+}
+
+/**
+ * @brief Find NUL character in name
+ *
+ * @note Short names are scanned inline to avoid the cost of indirect call.
+ */
+inline const char* find_name_end(const char* begin, const char* end) noexcept
+{
+  const auto limit = ((end - begin) > 16) ? (begin + 16) : end;
+  for (; begin < limit; ++begin) {
+    if (*begin == '\0') {
+      return begin;
+    }
+  }
+  if (begin == end) {
+    return nullptr;
+  }
+  return reinterpret_cast<const char*>(get_kernels().find_nul(
+    reinterpret_cast<const std::uint8_t*>(begin), reinterpret_cast<const std::uint8_t*>(end)
+  ));
+}
+
+/**
+ * @brief Validate UTF-8 sequence
+ *
+ * @note Rejects overlong forms, surrogates and code points above U+10FFFF.
+ */
+bool validate_utf8_slow(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  const auto skip_ascii = get_kernels().skip_ascii;
+  for (;;) {
+    begin = skip_ascii(begin, end);
+    if (begin == end) {
+      return true;
+    }
+    const auto lead = *begin;
+    std::size_t trail;
+    std::uint8_t min = 0x80, max = 0xbf;
+    if ((lead >= 0xc2) && (lead <= 0xdf)) {
+      trail = 1;
+    } else if ((lead >= 0xe0) && (lead <= 0xef)) {
+      trail = 2;
+      if (lead == 0xe0) {
+        min = 0xa0;
+      } else if (lead == 0xed) {
+        max = 0x9f;
+      }
+    } else if ((lead >= 0xf0) && (lead <= 0xf4)) {
+      trail = 3;
+      if (lead == 0xf0) {
+        min = 0x90;
+      } else if (lead == 0xf4) {
+        max = 0x8f;
+      }
+    } else {
+      return false;
+    }
+    if (static_cast<std::size_t>(end - begin) <= trail) {
+      return false;
+    }
+    if ((begin[1] < min) || (begin[1] > max)) {
+      return false;
+    }
+    for (std::size_t i = 2; i <= trail; ++i) {
+      if ((begin[i] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+    begin += trail + 1;
+  }
+}
+
+/**
+ * @brief Validate UTF-8 sequence (short ASCII strings are checked inline)
+ */
+inline bool validate_utf8(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  if (end - begin <= 16) {
+    std::uint8_t bits = 0;
+    for (auto p = begin; p < end; ++p) {
+      bits |= *p;
+    }
+    if (!(bits & 0x80)) {
+      return true;
+    }
+  }
+  return validate_utf8_slow(begin, end);
+}
+
+} /* namespace */
+
+bool reader::element::truthy() const noexcept
+{
+  union {
+    double fp64;
+    int32_t int32;
+    int64_t int64;
+  } buffer;
+  switch (type()) {
+  case bson::type::fp64:
+    std::memcpy(&buffer.fp64, data.fp64, 8);
+    return (!std::isnan(buffer.fp64)) && (buffer.fp64 != 0.0);
+  case bson::type::string:
+    std::memcpy(&buffer.int32, data.int32, 4);
     return (buffer.int32 > 1);
   case bson::type::document:
   case bson::type::array:
   case bson::type::binary:
-    return true;
+    return true;
+  case bson::type::boolean:
+    return (*data.byte != 0x00);
+  case bson::type::int32:
+    std::memcpy(&buffer.int32, data.int32, 4);
+    return (buffer.int32 != 0);
+  case bson::type::int64:
+    std::memcpy(&buffer.int64, data.int64, 8);
+    return (buffer.int64 != 0);
+  case bson::type::undefined:
+  case bson::type::null:
+  default:
+    return false;
+  }
+}
+
+bool reader::element::get_double(double& value) const noexcept
+{
+  if (!is_double()) {
+    return false;
+  }
+  std::memcpy(&value, data.fp64, sizeof(double));
+  return true;
+}
+
+bool reader::element::get_string(const char*& string) const noexcept
+{
+  if (!is_string()) {
+    return false;
+  }
+  string = data.offset<char>(4);
+  return true;
+}
+
+bool reader::element::get_string(const char*& string, std::size_t& length) const noexcept
+{
+  if (!is_string()) {
+    return false;
+  }
+  string = data.offset<char>(4);
+  int32_t length_buffer;
+  std::memcpy(&length_buffer, data.int32, 4);
+  length = length_buffer - 1;
+  return true;
+}
+
+bool reader::element::get_binary(const void*& buffer, std::size_t& length) const noexcept
+{
+  if (!is_binary()) {
+    return false;
+  }
+  buffer = data.offset<void>(5);
+  int32_t length_buffer;
+  std::memcpy(&length_buffer, data.int32, 4);
+  length = length_buffer;
+  return true;
+}
+
+bool reader::element::get_binary(const void*& buffer, std::size_t& length, bson::subtype& subtype) const noexcept
+{
+  if (!is_binary()) {
+    return false;
+  }
+  buffer = data.offset<void>(5);
+  int32_t length_buffer;
+  std::memcpy(&length_buffer, data.int32, 4);
+  length = length_buffer;
+  subtype = *data.offset<bson::subtype>(4);
+  return true;
+}
+
+bool reader::element::get_boolean(bool& value) const noexcept
+{
+  if (!is_boolean()) {
+    return false;
+  }
+  value = (*data.byte) != 0;
+  return true;
+}
+
+bool reader::element::get_int32(int32_t& value) const noexcept
+{
+  if (!is_int32()) {
+    return false;
+  }
+  std::memcpy(&value, data.int32, 4);
+  return true;
+}
+
+bool reader::element::get_int64(int64_t& value) const noexcept
+{
+  if (!is_int64()) {
+    return false;
+  }
+  std::memcpy(&value, data.int64, 8);
+  return true;
+}
+
+bool reader::element::get_integer(int64_t& value) const noexcept
+{
+  switch (type()) {
+  case bson::type::int32:
+    {
+      int32_t value_buffer;
+      std::memcpy(&value_buffer, data.int32, 4);
+      value = value_buffer;
+    }
+    return true;
+  case bson::type::int64:
+    std::memcpy(&value, data.int64, 8);
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool reader::element::get_number(double& value) const noexcept
+{
+  switch (type()) {
+  case bson::type::fp64:
+    std::memcpy(&value, data.fp64, 8);
+    return true;
+  case bson::type::int32:
+    {
+      int32_t value_buffer;
+      std::memcpy(&value_buffer, data.int32, 4);
+      value = value_buffer;
+    }
+    return true;
+  case bson::type::int64:
+    {
+      int64_t value_buffer;
+      std::memcpy(&value_buffer, data.int64, 8);
+      value = value_buffer;
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+reader reader::element::as_subdocument(const reader& default_value, bson::type type) const noexcept
+{
+  if (this->type() != type) {
+    return default_value;
+  }
+  int32_t length_buffer;
+  std::memcpy(&length_buffer, data.int32, 4);
+  return reader(data.pointer, length_buffer);
+}
+
+reader::const_iterator::const_iterator(const reader& owner) noexcept
+{
+  /*
+    if (end_position) {
+      // Current element is valid
+    } else {
+      // Current element is invalid
+      if (next_position)
+        // Failed (next_position indicates failed position)
+      } else {
+        // Ended
+      }
+    }
+  */
+  if (!owner.buffer) {
+    // No valid buffer
+    return;
+  }
+  next_position.pointer = owner.buffer.pointer;
+  if (owner.length < 4) {
+    // No total length field
+    return;
+  }
+  int32_t total;
+  std::memcpy(&total, next_position.int32, 4);
+  if ((total < 4) || (static_cast<std::size_t>(total) > owner.length)) {
+    // Invalid total length
+    return;
+  }
+
+  // Get the first element
+  end_position.pointer = next_position.offset<void>(total);
+  ++next_position.int32;
+  this->operator++();
+}
+
+reader::const_iterator& reader::const_iterator::operator++() noexcept
+{
+  if (!end_position) {
+    // No more elements
+    return *this;
+  }
+
+  // Get type
+  if (next_position.pointer >= end_position.pointer) {
+    // Buffer ended without termination
+terminate:
+    current.e_name = nullptr;
+    current.data = nullptr;
+    end_position = nullptr;
+    return *this;
+  }
+  auto type = *next_position.type++;
+  if (static_cast<std::uint8_t>(type) == 0x00) {
+    // End of document
+    next_position = nullptr;
+    goto terminate;
+  }
+
+  // Parse e_name
+  BSON_STATS_ADD(elements_scanned, 1);
+  current.e_name = next_position.name;
+  {
+    const auto name_end = find_name_end(next_position.name, end_position.name);
+    if (!name_end) {
+      // Abnormal termination in e_name/type
+      goto terminate;
+    }
+    next_position.name = name_end + 1;
+  }
+
+  // Update current
+  current.data = next_position.pointer;
+
+  switch (type) {
+  case bson::type::fp64:
+  case bson::type::int64:
+    if (++next_position.int64 <= end_position.pointer) {
+      return *this;
+    }
+    break;
+  case bson::type::string:
+    if (++next_position.int32 <= end_position.pointer) {
+      std::int32_t length;
+      std::memcpy(&length, &next_position.int32[-1], 4);
+      if (length >= 1) {
+        next_position.string += length;
+        if (next_position.pointer <= end_position.pointer) {
+          if (next_position.string[-1] == '\0') {
+            return *this;
+          }
+        }
+      }
+    }
+    break;
+  case bson::type::document:
+  case bson::type::array:
+    if (++next_position.int32 <= end_position.pointer) {
+      std::int32_t length;
+      std::memcpy(&length, &next_position.int32[-1], 4);
+      if (length >= 5) {
+        next_position.byte += (length - 4);
+        if (next_position.pointer <= end_position.pointer) {
+          if (next_position.byte[-1] == 0x00) {
+            return *this;
+          }
+        }
+      }
+    }
+    break;
+  case bson::type::binary:
+    if (++next_position.int32 <= end_position.pointer) {
+      std::int32_t length;
+      std::memcpy(&length, &next_position.int32[-1], 4);
+      if (length >= 0) {
+        next_position.byte += (length + 1);
+        if (next_position.pointer <= end_position.pointer) {
+          return *this;
+        }
+      }
+    }
+    break;
+  case bson::type::undefined:
+  case bson::type::null:
+    return *this;
   case bson::type::boolean:
-    return (*data.byte != 0x00);
+    if (++next_position.byte <= end_position.pointer) {
+      return *this;
+    }
+    break;
   case bson::type::int32:
-    std::memcpy(&buffer.int32, data.int32, 4);
-    return (buffer.int32 != 0);
+    if (++next_position.int32 <= end_position.pointer) {
+      return *this;
+    }
+    break;
+  }
+
+  // Abnormal termination in element
+  goto terminate;
+}
+
+int reader::query_size(const void* buffer, std::size_t length) noexcept
+{
+  if (length < 4) {
+    return -1;
+  }
+  std::int32_t total;
+  std::memcpy(&total, buffer, 4);
+  return total;
+}
+
+reader::element reader::find(const char* e_name) const noexcept
+{
+  return find(key(e_name, std::strlen(e_name)));
+}
+
+reader::element reader::find(const key& e_name) const noexcept
+{
+  // Compare length (known from parsed element) before contents
+  const auto length = e_name.length;
+  for (const auto& field : *this) {
+    if ((static_cast<std::size_t>(field.data.name - field.e_name - 1) == length) &&
+        (std::memcmp(field.e_name, e_name.data, length) == 0)) {
+      return field;
+    }
+  }
+  return element { nullptr, nullptr };
+}
+
+reader::element reader::find(const path& e_path) const noexcept
+{
+  if (!e_path) {
+    return element { nullptr, nullptr };
+  }
+  reader current(*this);
+  bool in_array = false;
+  for (std::size_t i = 0; ; ++i) {
+    const auto& segment = e_path[i];
+    element found { nullptr, nullptr };
+    if (in_array && (segment.index != path::no_index)) {
+      // Skip array elements by count
+      auto skip = segment.index;
+      for (const auto& field : current) {
+        if (skip-- == 0) {
+          found = field;
+          break;
+        }
+      }
+    } else {
+      for (const auto& field : current) {
+        if ((static_cast<std::size_t>(field.data.name - field.e_name - 1) == segment.length) &&
+            (std::memcmp(field.e_name, segment.data, segment.length) == 0)) {
+          found = field;
+          break;
+        }
+      }
+    }
+    if ((!found) || (i + 1 == e_path.size())) {
+      return found;
+    }
+    switch (found.type()) {
+    case bson::type::document:
+      in_array = false;
+      break;
+    case bson::type::array:
+      in_array = true;
+      break;
+    default:
+      return element { nullptr, nullptr };
+    }
+    current = found.as_subdocument(reader(nullptr, 0), found.type());
+  }
+}
+
+namespace {
+
+bool validate_document(const std::uint8_t* source, std::size_t length, std::size_t depth, bool utf8) noexcept
+{
+  if (length < 5) {
+    return false;
+  }
+  std::int32_t total;
+  std::memcpy(&total, source, 4);
+  if ((total < 5) || (static_cast<std::size_t>(total) > length)) {
+    return false;
+  }
+  const auto end = source + total - 1;
+  if (*end != 0x00) {
+    return false;
+  }
+  source += 4;
+  while (source < end) {
+    BSON_STATS_ADD(elements_validated, 1);
+    const auto type = static_cast<bson::type>(*source++);
+
+    // Name (short ASCII names are scanned and checked in a single pass)
+    const auto name = source;
+    const auto limit = ((end - source) > 16) ? (source + 16) : end;
+    std::uint8_t bits = 0;
+    while ((source < limit) && (*source != 0x00)) {
+      bits |= *source++;
+    }
+    if ((source == limit) || (bits & 0x80)) {
+      source = reinterpret_cast<const std::uint8_t*>(find_name_end(
+        reinterpret_cast<const char*>(source), reinterpret_cast<const char*>(end)
+      ));
+      if ((!source) || (utf8 && (!validate_utf8(name, source)))) {
+        return false;
+      }
+    }
+    ++source;
+    const auto remain = static_cast<std::size_t>(end - source);
+
+    std::int32_t size;
+    switch (type) {
+    case bson::type::fp64:
+    case bson::type::int64:
+      if (remain < 8) {
+        return false;
+      }
+      source += 8;
+      break;
+    case bson::type::string:
+      if (remain < 5) {
+        return false;
+      }
+      std::memcpy(&size, source, 4);
+      if ((size < 1) || (static_cast<std::size_t>(size) > remain - 4) || (source[4 + size - 1] != 0x00)) {
+        return false;
+      }
+      if (utf8 && (!validate_utf8(source + 4, source + 4 + size - 1))) {
+        return false;
+      }
+      source += 4 + size;
+      break;
+    case bson::type::document:
+    case bson::type::array:
+      if ((depth == 0) || (remain < 5)) {
+        return false;
+      }
+      std::memcpy(&size, source, 4);
+      if ((size < 5) || (static_cast<std::size_t>(size) > remain) ||
+          (!validate_document(source, size, depth - 1, utf8))) {
+        return false;
+      }
+      source += size;
+      break;
+    case bson::type::binary:
+      if (remain < 5) {
+        return false;
+      }
+      std::memcpy(&size, source, 4);
+      if ((size < 0) || (static_cast<std::size_t>(size) > remain - 5)) {
+        return false;
+      }
+      source += 5 + size;
+      break;
+    case bson::type::undefined:
+    case bson::type::null:
+      break;
+    case bson::type::boolean:
+      if (remain < 1) {
+        return false;
+      }
+      ++source;
+      break;
+    case bson::type::int32:
+      if (remain < 4) {
+        return false;
+      }
+      source += 4;
+      break;
+    default:
+      // Unknown type or unexpected terminator
+      return false;
+    }
+  }
+  return true;
+}
+
+} /* namespace */
+
+trusted_reader reader::validate(std::size_t max_depth, bool utf8) const noexcept
+{
+  if ((!buffer) || (!validate_document(buffer.byte, length, max_depth, utf8))) {
+    return trusted_reader();
+  }
+  return trusted_reader(*this);
+}
+
+std::size_t reader::find_many(const key* names, std::size_t count, element* elements) const noexcept
+{
+  for (std::size_t i = 0; i < count; ++i) {
+    elements[i] = element { nullptr, nullptr };
+  }
+  std::size_t found = 0;
+  if (count == 0) {
+    return found;
+  }
+  for (const auto& field : *this) {
+    const auto e_name = field.e_name;
+    const auto length = static_cast<std::size_t>(field.data.name - e_name - 1);
+    for (std::size_t i = 0; i < count; ++i) {
+      if ((elements[i].data) || !names[i].matches(e_name, length)) {
+        continue;
+      }
+      elements[i] = field;
+      if (++found == count) {
+        return found;
+      }
+    }
+  }
+  return found;
+}
+
+constexpr std::size_t path::max_segments;
+constexpr std::uint32_t path::no_index;
+
+path::path(const char* dotted, std::size_t length) noexcept
+{
+  std::size_t start = 0;
+  for (std::size_t i = 0; i <= length; ++i) {
+    if ((i < length) && (dotted[i] != '.')) {
+      continue;
+    }
+    const auto segment_length = i - start;
+    if ((segment_length == 0) || (segment_length > INT32_MAX) || (count == max_segments)) {
+      // Empty segment or too many segments
+      count = 0;
+      return;
+    }
+    auto& segment = segments[count++];
+    segment.data = dotted + start;
+    segment.length = static_cast<std::uint32_t>(segment_length);
+
+    // Decimal without leading zero (same as array keys)
+    std::uint64_t index = 0;
+    segment.index = no_index;
+    if ((segment_length <= 10) && ((segment_length == 1) || (dotted[start] != '0'))) {
+      std::size_t j;
+      for (j = start; j < i; ++j) {
+        const auto c = dotted[j];
+        if ((c < '0') || (c > '9')) {
+          break;
+        }
+        index = index * 10 + (c - '0');
+      }
+      if ((j == i) && (index <= INT32_MAX)) {
+        segment.index = static_cast<std::uint32_t>(index);
+      }
+    }
+    start = i + 1;
+  }
+}
+
+trusted_reader::const_iterator& trusted_reader::const_iterator::operator++() noexcept
+{
+  auto source = next_position;
+  const auto type = static_cast<bson::type>(*source++);
+  if (static_cast<std::uint8_t>(type) == 0x00) {
+    // End of document
+    current.e_name = nullptr;
+    current.data = nullptr;
+    return *this;
+  }
+  BSON_STATS_ADD(elements_scanned, 1);
+  current.e_name = reinterpret_cast<const char*>(source);
+  while (*source++ != 0x00) {
+    // Names are short in general; a plain loop is faster than strlen() call
+  }
+  current.data = source;
+
+  std::int32_t size;
+  switch (type) {
+  case bson::type::fp64:
   case bson::type::int64:
-    std::memcpy(&buffer.int64, data.int64, 8);
-    return (buffer.int64 != 0);
-  case bson::type::undefined:
-  case bson::type::null:
+    source += 8;
+    break;
+  case bson::type::string:
+    std::memcpy(&size, source, 4);
+    source += 4 + size;
+    break;
+  case bson::type::document:
+  case bson::type::array:
+    std::memcpy(&size, source, 4);
+    source += size;
+    break;
+  case bson::type::binary:
+    std::memcpy(&size, source, 4);
+    source += 5 + size;
+    break;
+  case bson::type::boolean:
+    ++source;
+    break;
+  case bson::type::int32:
+    source += 4;
+    break;
   default:
-    return false;
+    break;
   }
+  next_position = source;
+  return *this;
 }
 
-bool reader::element::get_double(double& value) const noexcept
+trusted_reader::element trusted_reader::find(const char* e_name) const noexcept
 {
-  if (!is_double()) {
+  return find(key(e_name, std::strlen(e_name)));
+}
+
+trusted_reader::element trusted_reader::find(const key& e_name) const noexcept
+{
+  const auto length = e_name.length;
+  for (const auto& field : *this) {
+    if ((static_cast<std::size_t>(field.data.name - field.e_name - 1) == length) &&
+        (std::memcmp(field.e_name, e_name.data, length) == 0)) {
+      return field;
+    }
+  }
+  return element();
+}
+
+bool mutable_reader::element::set_string(const char* string, std::size_t length) const noexcept
+{
+  std::size_t current;
+  const char* dest;
+  if ((!get_string(dest, current)) || (current != length)) {
     return false;
   }
-  std::memcpy(&value, data.fp64, sizeof(double));
+  std::memcpy(const_cast<char*>(dest), string, length);
   return true;
 }
 
-bool reader::element::get_string(const char*& string) const noexcept
+indexed_reader::indexed_reader(const reader& source, slot* table, std::size_t capacity) noexcept
+: document(source), table(table), mask(0)
+{
+  if (capacity == 0) {
+    this->table = nullptr;
+  } else {
+    while ((mask + 1) <= (capacity >> 1)) {
+      mask = (mask << 1) | 1;
+    }
+    for (std::size_t i = 0; i <= mask; ++i) {
+      table[i].e_name = nullptr;
+    }
+  }
+  for (auto it = document.cbegin(); it != document.cend(); ++it) {
+    const auto e_name = it->e_name;
+    if ((!this->table) || ((count + 1) > ((mask + 1) >> 1))) {
+      // Keep load factor at most 50% to bound probe length
+      overflow = e_name;
+      return;
+    }
+    const auto length = static_cast<std::uint32_t>(it->data.name - e_name - 1);
+    const auto h = hash(e_name, length);
+    for (auto i = h & mask; ; i = (i + 1) & mask) {
+      auto& entry = this->table[i];
+      if (!entry.e_name) {
+        entry.e_name = e_name;
+        entry.hash = h;
+        entry.length = length;
+        ++count;
+        break;
+      }
+      if ((entry.hash == h) && (entry.length == length) &&
+          (std::memcmp(entry.e_name, e_name, length) == 0)) {
+        // Duplicated name
+        break;
+      }
+    }
+  }
+}
+
+reader::element indexed_reader::find(const char* e_name) const noexcept
+{
+  const auto length = std::strlen(e_name);
+  return find(e_name, length, hash(e_name, length));
+}
+
+reader::element indexed_reader::find(const key& e_name) const noexcept
 {
-  if (!is_string()) {
-    return false;
-  }
-  string = data.offset<char>(4);
-  return true;
+  return find(e_name.data, e_name.length, hash(e_name.data, e_name.length));
 }
 
-bool reader::element::get_string(const char*& string, std::size_t& length) const noexcept
+std::uint32_t indexed_reader::hash(const char* e_name, std::size_t length) noexcept
 {
-  if (!is_string()) {
-    return false;
+  // FNV-1a
+  std::uint32_t h = 2166136261u;
+  for (std::size_t i = 0; i < length; ++i) {
+    h = (h ^ static_cast<std::uint8_t>(e_name[i])) * 16777619u;
   }
-  string = data.offset<char>(4);
-  int32_t length_buffer;
-  std::memcpy(&length_buffer, data.int32, 4);
-  length = length_buffer - 1;
-  return true;
+  return h;
 }
 
-bool reader::element::get_binary(const void*& buffer, std::size_t& length) const noexcept
+reader::element indexed_reader::find(const char* e_name, std::size_t length, std::uint32_t hash) const noexcept
 {
-  if (!is_binary()) {
-    return false;
+  if (table) {
+    for (auto i = hash & mask; ; i = (i + 1) & mask) {
+      const auto& entry = table[i];
+      if (!entry.e_name) {
+        break;
+      }
+      if ((entry.hash == hash) && (entry.length == length) &&
+          (std::memcmp(entry.e_name, e_name, length) == 0)) {
+        return reader::element { entry.e_name, entry.e_name + length + 1 };
+      }
+    }
   }
-  buffer = data.offset<void>(5);
-  int32_t length_buffer;
-  std::memcpy(&length_buffer, data.int32, 4);
-  length = length_buffer;
-  return true;
+  if (!overflow) {
+    return reader::element { nullptr, nullptr };
+  }
+
+  // Linear scan of fields which did not fit in table
+  auto it = document.cbegin();
+  while ((it != document.cend()) && (it->e_name != overflow)) {
+    ++it;
+  }
+  for (; it != document.cend(); ++it) {
+    if ((static_cast<std::size_t>(it->data.name - it->e_name - 1) == length) &&
+        (std::memcmp(it->e_name, e_name, length) == 0)) {
+      return *it;
+    }
+  }
+  return reader::element { nullptr, nullptr };
 }
 
-bool reader::element::get_binary(const void*& buffer, std::size_t& length, bson::subtype& subtype) const noexcept
+shared_document::control* shared_document::adopt(writer& source) noexcept
 {
-  if (!is_binary()) {
-    return false;
+  if (source.locked || !source.is_root || !source.malloc || source.batched || source.gather) {
+    // Batch document buffer is not owned and gather writer buffer lacks external payloads
+    return nullptr;
   }
-  buffer = data.offset<void>(5);
-  int32_t length_buffer;
-  std::memcpy(&length_buffer, data.int32, 4);
-  length = length_buffer;
-  subtype = *data.offset<bson::subtype>(4);
-  return true;
+  const auto alloc = source.alloc;
+  const auto shared = static_cast<control*>(alloc->allocate(sizeof(control)));
+  if (!shared) {
+    return nullptr;
+  }
+  std::size_t length;
+  const auto buffer = source.release(length);
+  if (!buffer) {
+    alloc->deallocate(shared);
+    return nullptr;
+  }
+  new (shared) control { { 1 }, alloc, buffer, buffer, length };
+  return shared;
 }
 
-bool reader::element::get_boolean(bool& value) const noexcept
+shared_document::control* shared_document::copy(const void* buffer, std::size_t length,
+                                                 allocator& alloc) noexcept
 {
-  if (!is_boolean()) {
-    return false;
+  if (!buffer) {
+    return nullptr;
   }
-  value = (*data.byte) != 0;
-  return true;
+  // Place bytes after control block in single allocation
+  const auto align = alignof(std::max_align_t);
+  const auto header = (sizeof(control) + align - 1) / align * align;
+  const auto bytes = static_cast<std::uint8_t*>(alloc.allocate(header + length));
+  if (!bytes) {
+    return nullptr;
+  }
+  std::memcpy(bytes + header, buffer, length);
+  return new (bytes) control { { 1 }, &alloc, nullptr, bytes + header, length };
 }
 
-bool reader::element::get_int32(int32_t& value) const noexcept
+void shared_document::unref() noexcept
 {
-  if (!is_int32()) {
-    return false;
+  if (shared && (shared->references.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+    const auto alloc = shared->alloc;
+    const auto buffer = shared->buffer;
+    shared->~control();
+    if (buffer) {
+      alloc->deallocate(buffer);
+    }
+    alloc->deallocate(shared);
   }
-  std::memcpy(&value, data.int32, 4);
-  return true;
+  shared = nullptr;
 }
 
-bool reader::element::get_int64(int64_t& value) const noexcept
+constexpr std::size_t patch::max_edits;
+
+bool patch::set(const char* e_path, const reader::element& value) noexcept
 {
-  if (!is_int64()) {
-    return false;
-  }
-  std::memcpy(&value, data.int64, 8);
-  return true;
+  return value.valid() && add(e_path, value);
 }
 
-bool reader::element::get_integer(int64_t& value) const noexcept
+bool patch::remove(const char* e_path) noexcept
 {
-  switch (type()) {
-  case bson::type::int32:
-    {
-      int32_t value_buffer;
-      std::memcpy(&value_buffer, data.int32, 4);
-      value = value_buffer;
-    }
-    return true;
-  case bson::type::int64:
-    std::memcpy(&value, data.int64, 8);
-    return true;
-  default:
-    return false;
-  }
+  return add(e_path, reader::element());
 }
 
-bool reader::element::get_number(double& value) const noexcept
+bool patch::add(const char* e_path, const reader::element& value) noexcept
 {
-  switch (type()) {
-  case bson::type::fp64:
-    std::memcpy(&value, data.fp64, 8);
-    return true;
-  case bson::type::int32:
-    {
-      int32_t value_buffer;
-      std::memcpy(&value_buffer, data.int32, 4);
-      value = value_buffer;
-    }
-    return true;
-  case bson::type::int64:
-    {
-      int64_t value_buffer;
-      std::memcpy(&value_buffer, data.int64, 8);
-      value = value_buffer;
-    }
-    return true;
-  default:
+  if (count >= max_edits) {
+    return false;
+  }
+  path target(e_path);
+  if (!target.valid()) {
     return false;
   }
+  edits[count].target = target;
+  edits[count].value = value;
+  ++count;
+  return true;
 }
 
-reader reader::element::as_subdocument(const reader& default_value, bson::type type) const noexcept
+bool patch::apply(const reader& source, writer& output) const noexcept
 {
-  if (this->type() != type) {
-    return default_value;
+  const edit* active[max_edits];
+  for (std::size_t i = 0; i < count; ++i) {
+    active[i] = &edits[i];
   }
-  int32_t length_buffer;
-  std::memcpy(&length_buffer, data.int32, 4);
-  return reader(data.pointer, length_buffer);
+  return merge(source, output, false, 0, active, count);
 }
 
-reader::const_iterator::const_iterator(const reader& owner) noexcept
+bool patch::merge(const reader& source, writer& output, bool array, std::size_t depth,
+                  const edit* const* active, std::size_t n) const noexcept
 {
-  /*
-    if (end_position) {
-      // Current element is valid
-    } else {
-      // Current element is invalid
-      if (next_position)
-        // Failed (next_position indicates failed position)
-      } else {
-        // Ended
+  bool used[max_edits] = {};
+  const std::uint8_t* run_begin = nullptr;
+  const std::uint8_t* run_end = nullptr;
+  char digits[10];
+  std::uint32_t index = 0;   // Next index of array element in output
+  auto it = source.cbegin();
+  const auto end = source.cend();
+  for (; it != end; ++it) {
+    const key e_name(it->e_name, it->data.name - it->e_name - 1);
+    bool edited = false;
+    for (std::size_t i = 0; (i < n) && (!edited); ++i) {
+      const auto& segment = active[i]->target[depth];
+      edited = ((segment.length == e_name.length) &&
+                (std::memcmp(segment.data, e_name.data, e_name.length) == 0));
+    }
+
+    // Keys of array elements are renumbered after removals
+    const auto name = array ? key(digits, format_index(digits, index)) : e_name;
+    const bool renamed = array && ((name.length != e_name.length) ||
+                                   (std::memcmp(name.data, e_name.data, name.length) != 0));
+    if (!edited && !renamed) {
+      // Extend the run of untouched elements (type byte precedes e_name)
+      if (!run_begin) {
+        run_begin = reinterpret_cast<const std::uint8_t*>(it->e_name - 1);
       }
+      run_end = it.next_position.byte;
+      ++index;
+      continue;
     }
-  */
-  if (!owner.buffer) {
-    // No valid buffer
-    return;
+    if (run_begin) {
+      const auto space = static_cast<std::size_t>(run_end - run_begin);
+      const auto dest = output.add_elements(space);
+      if (!dest) {
+        return false;
+      }
+      std::memcpy(dest, run_begin, space);
+      run_begin = nullptr;
+    }
+    bool written = true;
+    if (edited ? !write_field(output, e_name, name, *it, depth, active, n, used, written)
+               : !copy_element(output, name, *it)) {
+      return false;
+    }
+    index += written ? 1 : 0;
   }
-  next_position.pointer = owner.buffer.pointer;
-  if (owner.length < 4) {
-    // No total length field
-    return;
+  if (it.fail()) {
+    return false;
   }
-  int32_t total;
-  std::memcpy(&total, next_position.int32, 4);
-  if ((total < 4) || (static_cast<std::size_t>(total) > owner.length)) {
-    // Invalid total length
-    return;
+  if (run_begin) {
+    const auto space = static_cast<std::size_t>(run_end - run_begin);
+    const auto dest = output.add_elements(space);
+    if (!dest) {
+      return false;
+    }
+    std::memcpy(dest, run_begin, space);
   }
 
-  // Get the first element
-  end_position.pointer = next_position.offset<void>(total);
-  ++next_position.int32;
-  this->operator++();
+  // Append fields which do not exist in source (to the end of arrays)
+  for (std::size_t i = 0; i < n; ++i) {
+    if (!used[i]) {
+      const auto& segment = active[i]->target[depth];
+      const key e_name(segment.data, segment.length);
+      bool written = false;
+      if (!write_field(output, e_name, array ? key(digits, format_index(digits, index)) : e_name,
+                       reader::element(), depth, active, n, used, written)) {
+        return false;
+      }
+      index += written ? 1 : 0;
+    }
+  }
+  return true;
 }
 
-reader::const_iterator& reader::const_iterator::operator++() noexcept
+bool patch::write_field(writer& output, const key& e_name, const key& output_name,
+                        const reader::element& original, std::size_t depth,
+                        const edit* const* active, std::size_t n, bool* used,
+                        bool& written) const noexcept
 {
-  if (!end_position) {
-    // No more elements
-    return *this;
+  // Collect edits of this field; an edit of the field itself discards earlier nested ones
+  const edit* terminal = nullptr;
+  const edit* nested[max_edits];
+  std::size_t nested_count = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto& target = active[i]->target;
+    const auto& segment = target[depth];
+    if ((segment.length != e_name.length) ||
+        (std::memcmp(segment.data, e_name.data, e_name.length) != 0)) {
+      continue;
+    }
+    used[i] = true;
+    if (target.size() == depth + 1) {
+      terminal = active[i];
+      nested_count = 0;
+    } else {
+      nested[nested_count++] = active[i];
+    }
   }
 
-  // Get type
-  if (next_position.pointer >= end_position.pointer) {
-    // Buffer ended without termination
-terminate:
-    current.e_name = nullptr;
-    current.data = nullptr;
-    end_position = nullptr;
-    return *this;
-  }
-  auto type = *next_position.type++;
-  if (static_cast<std::uint8_t>(type) == 0x00) {
-    // End of document
-    next_position = nullptr;
-    goto terminate;
+  const auto& base = terminal ? terminal->value : original;
+  written = false;
+  if (nested_count == 0) {
+    written = base.valid();
+    return (!written) || copy_element(output, output_name, base);
   }
 
-  // Parse e_name
-  current.e_name = next_position.name;
-  for (;;) {
-    if (next_position.name >= end_position.name) {
-      // Abnormal termination in e_name/type
-      goto terminate;
+  static const std::uint8_t empty[5] = { 0x05, 0x00, 0x00, 0x00, 0x00 };
+  auto type = bson::type::document;
+  reader source(empty, sizeof(empty));
+  if (!base.valid()) {
+    // Create missing parent only if something is set in it
+    std::size_t i = 0;
+    while ((i < nested_count) && (!nested[i]->value.valid())) {
+      ++i;
     }
-    if (*next_position.name++ == '\0') {
-      break;
+    if (i == nested_count) {
+      return true;
+    }
+  } else {
+    type = base.type();
+    if (type == bson::type::document) {
+      source = base.as_document();
+    } else if (type == bson::type::array) {
+      source = base.as_array();
+    } else {
+      return false;
     }
   }
+  written = true;
+  auto subdocument = output.add_subdocument(output_name, type);
+  return subdocument.valid() &&
+         merge(source, subdocument, type == bson::type::array, depth + 1, nested, nested_count);
+}
 
-  // Update current
-  current.data = next_position.pointer;
-
+bool patch::copy_element(writer& output, const key& e_name, const reader::element& value) noexcept
+{
+  const auto type = value.type();
+  std::size_t space = 0;
+  std::int32_t size;
   switch (type) {
   case bson::type::fp64:
   case bson::type::int64:
-    if (++next_position.int64 <= end_position.pointer) {
-      return *this;
-    }
+    space = 8;
     break;
   case bson::type::string:
-    if (++next_position.int32 <= end_position.pointer) {
-      std::int32_t length;
-      std::memcpy(&length, &next_position.int32[-1], 4);
-      if (length >= 1) {
-        next_position.string += length;
-        if (next_position.pointer <= end_position.pointer) {
-          if (next_position.string[-1] == '\0') {
-            return *this;
-          }
-        }
-      }
-    }
+    std::memcpy(&size, value.data.int32, 4);
+    space = 4 + size;
     break;
   case bson::type::document:
   case bson::type::array:
-    if (++next_position.int32 <= end_position.pointer) {
-      std::int32_t length;
-      std::memcpy(&length, &next_position.int32[-1], 4);
-      if (length >= 5) {
-        next_position.byte += (length - 4);
-        if (next_position.pointer <= end_position.pointer) {
-          if (next_position.byte[-1] == 0x00) {
-            return *this;
-          }
-        }
-      }
-    }
+    std::memcpy(&size, value.data.int32, 4);
+    space = size;
     break;
   case bson::type::binary:
-    if (++next_position.int32 <= end_position.pointer) {
-      std::int32_t length;
-      std::memcpy(&length, &next_position.int32[-1], 4);
-      if (length >= 0) {
-        next_position.byte += (length + 1);
-        if (next_position.pointer <= end_position.pointer) {
-          return *this;
-        }
-      }
-    }
+    std::memcpy(&size, value.data.int32, 4);
+    space = 5 + size;
     break;
-  case bson::type::undefined:
-  case bson::type::null:
-    return *this;
   case bson::type::boolean:
-    if (++next_position.byte <= end_position.pointer) {
-      return *this;
-    }
+    space = 1;
     break;
   case bson::type::int32:
-    if (++next_position.int32 <= end_position.pointer) {
-      return *this;
-    }
+    space = 4;
+    break;
+  default:
     break;
   }
-
-  // Abnormal termination in element
-  goto terminate;
-}
-
-int reader::query_size(const void* buffer, std::size_t length) noexcept
-{
-  if (length < 4) {
-    return -1;
-  }
-  std::int32_t total;
-  std::memcpy(&total, buffer, 4);
-  return total;
-}
-
-reader::element reader::find(const char* e_name) const noexcept
-{
-  for (const auto& field : *this) {
-    if (std::strcmp(field.name(), e_name) == 0) {
-      return field;
-    }
+  const auto dest = output.add_element(e_name, type, space);
+  if (!dest) {
+    return false;
   }
-  return element { nullptr, nullptr };
+  std::memcpy(dest, value.data.pointer, space);
+  return true;
 }
 
 } /* namespace bson */
@@ -13,10 +13,24 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <utility>
 #include <limits>
 #include <iterator>
+#include <initializer_list>
 #include <ostream>
+#include <atomic>
+
+#if (__cplusplus >= 201703L)
+# include <string_view>
+# define BSON_HAS_STRING_VIEW 1
+#endif
+#if (__cplusplus >= 202002L) && defined(__has_include)
+# if __has_include(<span>)
+#  include <span>
+#  define BSON_HAS_SPAN 1
+# endif
+#endif
 
 namespace bson {
 
@@ -44,6 +58,302 @@ enum class subtype : std::uint8_t {
   user_defined    = 0x80,
 };
 
+/**
+ * @brief Memory allocator interface for BSON writer
+ */
+class allocator {
+public:
+  /**
+   * @brief Destroy the allocator
+   */
+  virtual ~allocator() noexcept = default;
+
+  /**
+   * @brief Allocate memory
+   *
+   * @param length Length in bytes
+   * @return nullptr if failed
+   */
+  virtual void* allocate(std::size_t length) noexcept = 0;
+
+  /**
+   * @brief Reallocate memory
+   *
+   * @param buffer Pointer to memory allocated by this allocator
+   * @param length Current length in bytes
+   * @param new_length New length in bytes
+   * @return nullptr if failed (the original memory is kept)
+   */
+  virtual void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept = 0;
+
+  /**
+   * @brief Deallocate memory
+   *
+   * @param buffer Pointer to memory allocated by this allocator
+   */
+  virtual void deallocate(void* buffer) noexcept = 0;
+
+  /**
+   * @brief Get the default allocator (malloc / realloc / free)
+   */
+  static allocator& get_default() noexcept;
+};
+
+/**
+ * @brief Bump allocator on a caller-supplied region
+ *
+ * @note Memory is reclaimed in bulk by reset(). Only the last allocation
+ *       can be extended in place. Not thread-safe (use one per thread).
+ */
+class arena_allocator : public allocator {
+public:
+  /**
+   * @brief Construct a new arena allocator
+   *
+   * @param buffer Pointer to region
+   * @param length Length of region in bytes
+   * @param upstream Allocator used when the region is exhausted (nullptr to fail)
+   */
+  arena_allocator(void* buffer, std::size_t length, allocator* upstream = nullptr) noexcept;
+
+  // Prohibit copying
+  arena_allocator(const arena_allocator&) = delete;
+  arena_allocator& operator =(const arena_allocator&) = delete;
+
+  void* allocate(std::size_t length) noexcept override;
+  void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept override;
+  void deallocate(void* buffer) noexcept override;
+
+  /**
+   * @brief Reclaim all memory allocated from the region
+   *
+   * @note Memory allocated from upstream is not affected.
+   */
+  void reset() noexcept
+  {
+    top = base;
+    last = nullptr;
+  }
+
+  /**
+   * @brief Get used length of the region in bytes
+   */
+  std::size_t used() const noexcept { return top - base; }
+
+  /**
+   * @brief Get total length of the region in bytes
+   */
+  std::size_t capacity() const noexcept { return limit - base; }
+
+private:
+  bool owns(const void* buffer) const noexcept
+  {
+    auto bytes = static_cast<const std::uint8_t*>(buffer);
+    return (bytes >= base) && (bytes < limit);
+  }
+
+private:
+  std::uint8_t* base;   ///< Start of region
+  std::uint8_t* top;    ///< Next allocation
+  std::uint8_t* limit;  ///< End of region
+  std::uint8_t* last;   ///< Last allocation (nullptr if none)
+  allocator* upstream;  ///< Fallback allocator
+};
+
+/**
+ * @brief Size-class pool allocator which recycles deallocated buffers
+ *
+ * @note Blocks are cached in power-of-two classes (128 bytes to 4 MiB)
+ *       until trim() or destruction. Not thread-safe (use one per thread).
+ */
+class pool_allocator : public allocator {
+public:
+  /**
+   * @brief Construct a new pool allocator
+   *
+   * @param upstream Allocator to obtain blocks from
+   */
+  explicit pool_allocator(allocator& upstream = allocator::get_default()) noexcept;
+
+  /**
+   * @brief Destroy the pool allocator (cached blocks are returned to upstream)
+   */
+  ~pool_allocator() noexcept override;
+
+  // Prohibit copying
+  pool_allocator(const pool_allocator&) = delete;
+  pool_allocator& operator =(const pool_allocator&) = delete;
+
+  void* allocate(std::size_t length) noexcept override;
+  void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept override;
+  void deallocate(void* buffer) noexcept override;
+
+  /**
+   * @brief Return all cached blocks to upstream
+   */
+  void trim() noexcept;
+
+private:
+  static constexpr unsigned min_shift = 7;
+  static constexpr unsigned classes = 16;
+
+  struct block {
+    block* next;
+  };
+
+  allocator& upstream;
+  block* free_list[classes];
+};
+
+/**
+ * @brief Learned initial buffer length for writers building similar documents
+ *
+ * @note Typically declared as a function-local static at the call site.
+ *       Follows growth immediately and decays slowly. Thread-safe.
+ */
+class size_history {
+public:
+  /**
+   * @brief Construct a new size history
+   *
+   * @param initial Initial length in bytes
+   */
+  constexpr size_history(std::uint32_t initial = 128) noexcept : predicted(initial) {}
+
+  // Prohibit copying
+  size_history(const size_history&) = delete;
+  size_history& operator =(const size_history&) = delete;
+
+  /**
+   * @brief Get predicted length in bytes
+   */
+  std::size_t get() const noexcept
+  {
+    return predicted.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Record length of a finished document
+   *
+   * @param length Length in bytes
+   */
+  void update(std::size_t length) noexcept;
+
+private:
+  std::atomic<std::uint32_t> predicted;
+};
+
+/**
+ * @brief Per-thread instrumentation counters
+ *
+ * @note Counting is compiled in only when the library is built with
+ *       BSON_STATS defined; otherwise all counters stay zero at no cost.
+ *       Snapshots of each thread can be summed with operator+=.
+ */
+struct stats {
+  /**
+   * @brief Number of buckets in depth histogram (the last one counts deeper levels)
+   */
+  static constexpr std::size_t depth_buckets = 8;
+
+#ifdef BSON_STATS
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+  std::uint64_t allocations = 0;        ///< Buffers allocated by writers
+  std::uint64_t reallocations = 0;      ///< Buffer growth events of writers
+  std::uint64_t bytes_copied = 0;       ///< Bytes in use when buffers grew
+  std::uint64_t bytes_written = 0;      ///< Bytes appended by writers
+  std::uint64_t failed_appends = 0;     ///< Appends rejected (buffer full or writer locked)
+  std::uint64_t subdocuments[depth_buckets] = {};  ///< Subdocuments opened by depth (1 origin)
+  std::uint64_t elements_scanned = 0;   ///< Elements parsed by reader iteration and find
+  std::uint64_t elements_validated = 0; ///< Elements checked by reader::validate
+
+  /**
+   * @brief Get counters of the calling thread
+   */
+  static stats snapshot() noexcept;
+
+  /**
+   * @brief Reset counters of the calling thread
+   */
+  static void reset() noexcept;
+
+  /**
+   * @brief Add counters (e.g. to aggregate threads)
+   * 
+   * @param other Counters to add
+   */
+  stats& operator+=(const stats& other) noexcept;
+};
+
+/**
+ * @brief Element name with known length
+ *
+ * @note The name must not contain NUL.
+ */
+struct key {
+  /**
+   * @brief Construct from string literal (length is determined at compile time)
+   *
+   * @note Do not use with partially filled char arrays.
+   * @param e_name String literal
+   */
+  template <std::size_t N>
+  constexpr key(const char (&e_name)[N]) noexcept : data(e_name), length(N - 1) {}
+
+  /**
+   * @brief Construct from pointer and length
+   *
+   * @param e_name Pointer to name (NUL termination not required)
+   * @param length Length of name in bytes
+   */
+  constexpr key(const char* e_name, std::size_t length) noexcept : data(e_name), length(length) {}
+
+#ifdef BSON_HAS_STRING_VIEW
+  /**
+   * @brief Construct from string view (C++17)
+   *
+   * @param e_name View of name (NUL termination not required)
+   */
+  constexpr key(std::string_view e_name) noexcept : data(e_name.data()), length(e_name.size()) {}
+#endif
+
+  /**
+   * @brief Check if element name is equal to the key
+   *
+   * @note Length and first byte are compared before the whole name, so
+   *       mismatches are rejected cheaply when scanning many keys.
+   * @param e_name Pointer to element name
+   * @param e_length Length of element name in bytes
+   */
+  bool matches(const char* e_name, std::size_t e_length) const noexcept
+  {
+    return (length == e_length) &&
+           ((length == 0) || ((data[0] == e_name[0]) && (std::memcmp(data, e_name, length) == 0)));
+  }
+
+  const char* data;     ///< Pointer to name
+  std::size_t length;   ///< Length of name in bytes (without NUL)
+};
+
+namespace literals {
+
+/**
+ * @brief Make element name with compile-time length ("name"_key)
+ */
+constexpr key operator"" _key(const char* e_name, std::size_t length) noexcept
+{
+  return key(e_name, length);
+}
+
+} /* namespace literals */
+
+// Forward declaration
+class array_writer;
+
 /**
  * @brief BSON writer class
  */
@@ -54,6 +364,32 @@ public:
    */
   writer() noexcept;
 
+  /**
+   * @brief Construct a new BSON writer (auto allocation with custom allocator)
+   *
+   * @param allocator Allocator to obtain buffer from (must outlive the writer)
+   */
+  explicit writer(bson::allocator& allocator) noexcept;
+
+  /**
+   * @brief Construct a new BSON writer (auto allocation with initial length)
+   *
+   * @param size_hint Initial buffer length in bytes
+   * @param allocator Allocator to obtain buffer from (must outlive the writer)
+   */
+  explicit writer(std::size_t size_hint,
+                  bson::allocator& allocator = bson::allocator::get_default()) noexcept;
+
+  /**
+   * @brief Construct a new BSON writer (auto allocation with learned initial length)
+   *
+   * @note The final length is recorded to history on release() or destruction.
+   * @param history Size history of the call site (must outlive the writer)
+   * @param allocator Allocator to obtain buffer from (must outlive the writer)
+   */
+  explicit writer(size_history& history,
+                  bson::allocator& allocator = bson::allocator::get_default()) noexcept;
+
   /**
    * @brief Construct a new BSON writer (fixed buffer)
    * 
@@ -69,8 +405,10 @@ public:
 
   /**
    * @brief Construct a new BSON writer by move from others
+   *
+   * @note The source writer becomes invalid.
    */
-  writer(writer&&) noexcept = default;
+  writer(writer&& other) noexcept;
 
   // Prohibit copying and moving
   writer(const writer&) = delete;
@@ -105,6 +443,14 @@ public:
    */
   bool add_double(const char* e_name, double value) noexcept;
 
+  /**
+   * @brief Add double value
+   * 
+   * @param e_name Element name with length
+   * @param value Double value to store
+   */
+  bool add_double(const key& e_name, double value) noexcept;
+
   /**
    * @brief Add NUL-terminated string
    * 
@@ -113,6 +459,14 @@ public:
    */
   bool add_string(const char* e_name, const char* string) noexcept;
 
+  /**
+   * @brief Add NUL-terminated string
+   * 
+   * @param e_name Element name with length
+   * @param string String to store (NUL terminated)
+   */
+  bool add_string(const key& e_name, const char* string) noexcept;
+
   /**
    * @brief Add string
    * 
@@ -122,6 +476,39 @@ public:
    */
   bool add_string(const char* e_name, const char* string, std::size_t length) noexcept;
 
+  /**
+   * @brief Add string
+   * 
+   * @param e_name Element name with length
+   * @param string String to store (can include NUL)
+   * @param length Length of string in bytes
+   */
+  bool add_string(const key& e_name, const char* string, std::size_t length) noexcept;
+
+#ifdef BSON_HAS_STRING_VIEW
+  /**
+   * @brief Add string from view (C++17)
+   * 
+   * @param e_name Element name
+   * @param string String to store (can include NUL)
+   */
+  bool add_string(const char* e_name, std::string_view string) noexcept
+  {
+    return add_string(e_name, string.data(), string.size());
+  }
+
+  /**
+   * @brief Add string from view (C++17)
+   * 
+   * @param e_name Element name with length (std::string_view converts implicitly)
+   * @param string String to store (can include NUL)
+   */
+  bool add_string(const key& e_name, std::string_view string) noexcept
+  {
+    return add_string(e_name, string.data(), string.size());
+  }
+#endif
+
   /**
    * @brief Add embedded document
    * 
@@ -133,15 +520,29 @@ public:
   }
 
   /**
-   * @brief Add array
+   * @brief Add embedded document
    * 
-   * @param e_name Element name
+   * @param e_name Element name with length
    */
-  writer add_array(const char* e_name) noexcept
+  writer add_document(const key& e_name) noexcept
   {
-    return add_subdocument(e_name, bson::type::array);
+    return add_subdocument(e_name, bson::type::document);
   }
 
+  /**
+   * @brief Add array
+   * 
+   * @param e_name Element name
+   */
+  array_writer add_array(const char* e_name) noexcept;
+
+  /**
+   * @brief Add array
+   * 
+   * @param e_name Element name with length
+   */
+  array_writer add_array(const key& e_name) noexcept;
+
   /**
    * @brief Add pre-constructed embedded document
    * 
@@ -153,6 +554,17 @@ public:
     return add_subdocument(e_name, bson::type::document, subdocument);
   }
 
+  /**
+   * @brief Add pre-constructed embedded document
+   * 
+   * @param e_name Element name with length
+   * @param subdocument Reference to BSON writer which holds document to add
+   */
+  bool add_document(const key& e_name, const writer& subdocument) noexcept
+  {
+    return add_subdocument(e_name, bson::type::document, subdocument);
+  }
+
   /**
    * @brief Add pre-constructed array
    * 
@@ -164,6 +576,17 @@ public:
     return add_subdocument(e_name, bson::type::array, subdocument);
   }
 
+  /**
+   * @brief Add pre-constructed array
+   * 
+   * @param e_name Element name with length
+   * @param subdocument Reference to BSON writer which holds array to add
+   */
+  bool add_array(const key& e_name, const writer& subdocument) noexcept
+  {
+    return add_subdocument(e_name, bson::type::array, subdocument);
+  }
+
   /**
    * @brief Add binary
    * 
@@ -175,6 +598,17 @@ public:
   bool add_binary(const char* e_name, const void* buffer, std::size_t length,
                   subtype subtype = subtype::generic) noexcept;
 
+  /**
+   * @brief Add binary
+   * 
+   * @param e_name Element name with length
+   * @param buffer Pointer to buffer
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  bool add_binary(const key& e_name, const void* buffer, std::size_t length,
+                  subtype subtype = subtype::generic) noexcept;
+
   /**
    * @brief Add binary (without copy)
    * 
@@ -185,6 +619,16 @@ public:
   void* add_binary(const char* e_name, std::size_t length,
                    subtype subtype = subtype::generic) noexcept;
 
+  /**
+   * @brief Add binary (without copy)
+   * 
+   * @param e_name Element name with length
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  void* add_binary(const key& e_name, std::size_t length,
+                   subtype subtype = subtype::generic) noexcept;
+
   /**
    * @brief Add undefined
    * 
@@ -195,6 +639,16 @@ public:
     return add_element(e_name, bson::type::undefined, 0) != nullptr;
   }
 
+  /**
+   * @brief Add undefined
+   * 
+   * @param e_name Element name with length
+   */
+  bool add_undefined(const key& e_name) noexcept
+  {
+    return add_element(e_name, bson::type::undefined, 0) != nullptr;
+  }
+
   /**
    * @brief Add boolean
    * 
@@ -203,6 +657,14 @@ public:
    */
   bool add_boolean(const char* e_name, bool value) noexcept;
 
+  /**
+   * @brief Add boolean
+   * 
+   * @param e_name Element name with length
+   * @param value Boolean value to store
+   */
+  bool add_boolean(const key& e_name, bool value) noexcept;
+
   /**
    * @brief Add boolean true
    * 
@@ -213,6 +675,16 @@ public:
     return add_boolean(e_name, true);
   }
 
+  /**
+   * @brief Add boolean true
+   * 
+   * @param e_name Element name with length
+   */
+  bool add_true(const key& e_name) noexcept
+  {
+    return add_boolean(e_name, true);
+  }
+
   /**
    * @brief Add boolean false
    * 
@@ -224,23 +696,51 @@ public:
   }
 
   /**
-   * @brief Add null
+   * @brief Add boolean false
    * 
-   * @param e_name Element name
+   * @param e_name Element name with length
    */
-  bool add_null(const char* e_name) noexcept
+  bool add_false(const key& e_name) noexcept
   {
-    return add_element(e_name, bson::type::null, 0) != nullptr;
+    return add_boolean(e_name, false);
   }
 
   /**
-   * @brief Add 32-bit signed integer
+   * @brief Add null
+   * 
+   * @param e_name Element name
+   */
+  bool add_null(const char* e_name) noexcept
+  {
+    return add_element(e_name, bson::type::null, 0) != nullptr;
+  }
+
+  /**
+   * @brief Add null
+   * 
+   * @param e_name Element name with length
+   */
+  bool add_null(const key& e_name) noexcept
+  {
+    return add_element(e_name, bson::type::null, 0) != nullptr;
+  }
+
+  /**
+   * @brief Add 32-bit signed integer
    * 
    * @param e_name Element name
    * @param value Integer value to store
    */
   bool add_int32(const char* e_name, std::int32_t value) noexcept;
 
+  /**
+   * @brief Add 32-bit signed integer
+   * 
+   * @param e_name Element name with length
+   * @param value Integer value to store
+   */
+  bool add_int32(const key& e_name, std::int32_t value) noexcept;
+
   /**
    * @brief Add 64-bit signed integer
    * 
@@ -249,10 +749,38 @@ public:
    */
   bool add_int64(const char* e_name, std::int64_t value) noexcept;
 
+  /**
+   * @brief Add 64-bit signed integer
+   * 
+   * @param e_name Element name with length
+   * @param value Integer value to store
+   */
+  bool add_int64(const key& e_name, std::int64_t value) noexcept;
+
+  /**
+   * @brief Enable or disable deferred size update
+   *
+   * @note In deferred mode, appending elements only writes the element bytes.
+   *       Size headers and termination bytes are written when a subdocument
+   *       is closed, or get_bytes() / release() is called.
+   *       Only the root writer can change the mode (subdocuments inherit it).
+   * @param enable true to enable
+   */
+  bool set_deferred(bool enable = true) noexcept;
+
+  /**
+   * @brief Reserve buffer space
+   *
+   * @note For fixed buffer writers, this only checks the remaining space.
+   * @param length Length in bytes of elements to be added
+   */
+  bool reserve(std::size_t length) noexcept;
+
   /**
    * @brief Get the BSON bytes
    * 
-   * @note When the writer is locked, this function fails.
+   * @note When the writer is locked or belongs to a gather_writer (whose
+   *       buffer lacks external payloads), this function fails.
    * @param bytes Reference to retrieve pointer
    * @param length Reference to retrieve length in bytes
    */
@@ -261,6 +789,9 @@ public:
   /**
    * @brief Release BSON bytes
    * 
+   * @note Released bytes must be deallocated by the writer's allocator
+   *       (std::free for the default allocator). Fails for gather_writer and
+   *       batch_writer::document (whose buffer is owned by the batch).
    * @param length Reference to retrieve length in bytes
    */
   std::uint8_t* release(std::size_t& length) noexcept;
@@ -270,7 +801,8 @@ private:
    * @brief Construct an invalid BSON writer
    */
   writer(std::nullptr_t) noexcept
-  : parent(nullptr), offset(0), locked(1), length(0), malloc(0) {}
+  : parent(nullptr), offset(0), locked(1), length(0), malloc(0),
+    depth(0), gather(0), deferred(0), alloc(nullptr), history(nullptr) {}
 
   /**
    * @brief Construct a new BSON writer for subdocument
@@ -279,7 +811,9 @@ private:
    * @param offset Start offset of subdocument
    */
   writer(writer* parent, std::uint32_t offset) noexcept
-  : parent(parent), offset(offset), locked(0), length(0), malloc(0) {}
+  : parent(parent), offset(offset), locked(0), length(0), malloc(0),
+    depth(parent->depth + 1), gather(parent->gather), deferred(parent->deferred),
+    root(parent->get_root()) {}
 
   /**
    * @brief Allocate space and add element 
@@ -290,6 +824,35 @@ private:
    */
   void* add_element(const char* e_name, type type, std::size_t space) noexcept;
 
+  /**
+   * @brief Allocate space and add element 
+   * 
+   * @param e_name Element name with length
+   * @param type Element type
+   * @param space Length to allocate additionally
+   */
+  void* add_element(const key& e_name, type type, std::size_t space) noexcept;
+
+  /**
+   * @brief Allocate space for pre-encoded elements
+   * 
+   * @param space Total length of elements in bytes
+   */
+  void* add_elements(std::size_t space) noexcept;
+
+  /**
+   * @brief Add element whose payload is referenced externally (gather mode)
+   * 
+   * @param e_name Element name with length
+   * @param type Element type
+   * @param space Length of element except payload
+   * @param position Offset of payload in element
+   * @param data Pointer to payload
+   * @param length Length of payload in bytes
+   */
+  bool add_external(const key& e_name, type type, std::size_t space, std::size_t position,
+                    const void* data, std::size_t length) noexcept;
+
   /**
    * @brief Add subdocument (embedded document or array)
    * 
@@ -298,6 +861,14 @@ private:
    */
   writer add_subdocument(const char* e_name, type type) noexcept;
 
+  /**
+   * @brief Add subdocument (embedded document or array)
+   * 
+   * @param e_name Element name with length
+   * @param type Element type
+   */
+  writer add_subdocument(const key& e_name, type type) noexcept;
+
   /**
    * @brief Add pre-constructed subdocument (embedded document or array)
    * 
@@ -307,12 +878,34 @@ private:
    */
   bool add_subdocument(const char* e_name, type type, const writer& subdocument) noexcept;
 
+  /**
+   * @brief Add pre-constructed subdocument (embedded document or array)
+   * 
+   * @param e_name Element name with length
+   * @param type Element type
+   * @param subdocument Reference to BSON writer which holds subdocument to add
+   */
+  bool add_subdocument(const key& e_name, type type, const writer& subdocument) noexcept;
+
+  /**
+   * @brief Expand root's buffer
+   *
+   * @param required Required length in bytes
+   */
+  bool expand(std::size_t required) noexcept;
+
   /**
    * @brief Get the root writer
    * 
    * @param depth_store If not nullptr, depth (zero for root) will be stored
    */
-  writer* get_root(std::size_t* depth_store = nullptr) noexcept;
+  writer* get_root(std::size_t* depth_store = nullptr) noexcept
+  {
+    if (depth_store) {
+      *depth_store = depth;
+    }
+    return is_root ? this : root;
+  }
 
   /**
    * @brief Write offset and update total size and termination byte
@@ -322,6 +915,13 @@ private:
    */
   void update_offset(void* buffer, std::uint32_t new_offset) noexcept;
 
+  /**
+   * @brief Write total size and termination byte for current offset
+   *
+   * @param buffer Pointer to root's buffer
+   */
+  void patch(void* buffer) const noexcept;
+
 private:
   union {
     void* buffer;     ///< Data buffer (when is_root != 0)
@@ -341,669 +941,2120 @@ private:
     };
     std::uint32_t is_root;
   };
+  union {
+    struct {
+      std::uint32_t depth : 29;   ///< Nesting depth (zero for root)
+      std::uint32_t batched : 1;  ///< Set if buffer is owned by batch_writer
+      std::uint32_t gather : 1;   ///< Set if root is gather_writer
+      std::uint32_t deferred : 1; ///< Set if size update is deferred
+    };
+    std::uint32_t mode;
+  };
+  union {
+    struct {
+      bson::allocator* alloc; ///< Allocator (when malloc != 0)
+      size_history* history;  ///< Size history to update (nullable)
+    };
+    writer* root;             ///< Root document (when is_root == 0)
+  };
+
+  friend class array_writer;
+  friend class batch_writer;
+  friend class gather_writer;
+  friend class patch;
+  friend class shared_document;
+  template <class... Fields> friend class schema;
 };
 
 /**
- * @brief BSON reader class
+ * @brief BSON writer class for array with automatic index keys
  */
-class reader {
-private:
-  union accessor {
-    const char* name;
-    const bson::type* type;
-    const bson::subtype* subtype;
-    const char* string;
-    const std::uint8_t* byte;
-    const double* fp64;
-    const std::int32_t* int32;
-    const std::int64_t* int64;
-    const void* pointer;
-
-    accessor(const void* pointer) noexcept : pointer(pointer) {}
+class array_writer : public writer {
+public:
+  /**
+   * @brief Construct a new BSON array writer by move from others
+   */
+  array_writer(array_writer&&) noexcept = default;
 
-    operator bool() const noexcept { return (pointer != nullptr); }
+  /**
+   * @brief Get number of elements pushed
+   */
+  std::size_t size() const noexcept { return index; }
 
-    template <class T>
-    const T* offset(int byte_offset) const noexcept
-    {
-      return reinterpret_cast<const T*>(byte + byte_offset);
-    }
-  };
+  /**
+   * @brief Push double value
+   * 
+   * @param value Double value to store
+   */
+  bool push_double(double value) noexcept;
 
-public:
-  // Forward declaration
-  class const_iterator;
+  /**
+   * @brief Push NUL-terminated string
+   * 
+   * @param string String to store (NUL terminated)
+   */
+  bool push_string(const char* string) noexcept;
 
   /**
-   * @brief Element reader class
+   * @brief Push string
+   * 
+   * @param string String to store (can include NUL)
+   * @param length Length of string in bytes
    */
-  class element {
-  public:
-    /**
-     * @brief Construct a new element (copy)
-     * 
-     * @param other Another element
-     */
-    element(const element& other) noexcept
-    : e_name(other.e_name), data(other.data.pointer) {}
+  bool push_string(const char* string, std::size_t length) noexcept;
 
-    /**
-     * @brief Construct a new element (move)
-     * 
-     * @param other Another element
-     */
-    element(element&& other) noexcept : element(other) {}
+  /**
+   * @brief Push embedded document
+   */
+  writer push_document() noexcept;
 
-    /**
-     * @brief Destroy the element
-     * 
-     */
-    ~element() noexcept = default;
+  /**
+   * @brief Push array
+   */
+  array_writer push_array() noexcept;
 
-    /**
-     * @brief Copy from another element
-     * 
-     * @param other Another element
-     */
-    element& operator=(const element& other) noexcept
-    {
-      e_name = other.e_name;
-      data = other.data.pointer;
-      return *this;
-    }
+  /**
+   * @brief Push pre-constructed embedded document
+   * 
+   * @param subdocument Reference to BSON writer which holds document to add
+   */
+  bool push_document(const writer& subdocument) noexcept;
 
-    /**
-     * @brief Move from another element
-     * 
-     * @param other Another element
-     */
-    element& operator=(element&& other) noexcept
-    {
-      return *this = other;
-    }
+  /**
+   * @brief Push pre-constructed array
+   * 
+   * @param subdocument Reference to BSON writer which holds array to add
+   */
+  bool push_array(const writer& subdocument) noexcept;
 
-    /**
-     * @brief Check if the element is valid
-     */
-    operator bool() const noexcept { return valid(); }
+  /**
+   * @brief Push binary
+   * 
+   * @param buffer Pointer to buffer
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  bool push_binary(const void* buffer, std::size_t length,
+                   subtype subtype = subtype::generic) noexcept;
 
-    /**
-     * @brief Check if the element is valid
-     */
-    bool valid() const noexcept { return data; }
+  /**
+   * @brief Push binary (without copy)
+   * 
+   * @param length Length in bytes
+   * @param subtype Sub type
+   */
+  void* push_binary(std::size_t length, subtype subtype = subtype::generic) noexcept;
 
-    /**
-     * @brief Check if the element is valid and has truthy value
-     */
-    bool truthy() const noexcept;
+  /**
+   * @brief Push undefined
+   */
+  bool push_undefined() noexcept { return push_element(bson::type::undefined, 0) != nullptr; }
 
-    /**
-     * @brief Check if the element is invalid or has falsy value
-     */
-    bool falsy() const noexcept { return !truthy(); }
+  /**
+   * @brief Push boolean
+   * 
+   * @param value Boolean value to store
+   */
+  bool push_boolean(bool value) noexcept;
 
-    /**
-     * @brief Check if the element type is double
-     */
-    bool is_double() const noexcept { return type() == bson::type::fp64; }
+  /**
+   * @brief Push boolean true
+   */
+  bool push_true() noexcept { return push_boolean(true); }
 
-    /**
-     * @brief Check if the element type is string
-     */
-    bool is_string() const noexcept { return type() == bson::type::string; }
+  /**
+   * @brief Push boolean false
+   */
+  bool push_false() noexcept { return push_boolean(false); }
 
-    /**
-     * @brief Check if the element type is document
-     */
-    bool is_document() const noexcept { return type() == bson::type::document; }
+  /**
+   * @brief Push null
+   */
+  bool push_null() noexcept { return push_element(bson::type::null, 0) != nullptr; }
 
-    /**
-     * @brief Check if the element type is array
-     */
-    bool is_array() const noexcept { return type() == bson::type::array; }
+  /**
+   * @brief Push 32-bit signed integer
+   * 
+   * @param value Integer value to store
+   */
+  bool push_int32(std::int32_t value) noexcept;
 
-    /**
-     * @brief Check if the element type is binary
-     */
-    bool is_binary() const noexcept { return type() == bson::type::binary; }
+  /**
+   * @brief Push 64-bit signed integer
+   * 
+   * @param value Integer value to store
+   */
+  bool push_int64(std::int64_t value) noexcept;
 
-    /**
-     * @brief Check if the element type is undefined
-     */
-    bool is_undefined() const noexcept { return type() == bson::type::undefined; }
+  /**
+   * @brief Push multiple doubles at once
+   * 
+   * @param values Pointer to values
+   * @param count Number of values
+   */
+  bool push_range(const double* values, std::size_t count) noexcept
+  {
+    return push_fixed(bson::type::fp64, values, sizeof(*values), count);
+  }
+
+  /**
+   * @brief Push multiple 32-bit signed integers at once
+   * 
+   * @param values Pointer to values
+   * @param count Number of values
+   */
+  bool push_range(const std::int32_t* values, std::size_t count) noexcept
+  {
+    return push_fixed(bson::type::int32, values, sizeof(*values), count);
+  }
+
+  /**
+   * @brief Push multiple 64-bit signed integers at once
+   * 
+   * @param values Pointer to values
+   * @param count Number of values
+   */
+  bool push_range(const std::int64_t* values, std::size_t count) noexcept
+  {
+    return push_fixed(bson::type::int64, values, sizeof(*values), count);
+  }
+
+private:
+  /**
+   * @brief Construct a new BSON array writer from subdocument writer
+   * 
+   * @param other Writer returned by add_subdocument
+   */
+  explicit array_writer(writer&& other) noexcept
+  : writer(std::move(other)), index(0) {}
+
+  /**
+   * @brief Allocate space and add element with next index key
+   * 
+   * @param type Element type
+   * @param space Length to allocate additionally
+   */
+  void* push_element(type type, std::size_t space) noexcept;
+
+  /**
+   * @brief Add fixed-size elements with consecutive index keys in one pass
+   * 
+   * @param type Element type
+   * @param values Pointer to values
+   * @param size Size of each value in bytes
+   * @param count Number of values
+   */
+  bool push_fixed(type type, const void* values, std::size_t size, std::size_t count) noexcept;
+
+  friend class writer;
+
+private:
+  std::uint32_t index;  ///< Next index
+};
+
+inline array_writer writer::add_array(const char* e_name) noexcept
+{
+  return array_writer(add_subdocument(e_name, bson::type::array));
+}
+
+inline array_writer writer::add_array(const key& e_name) noexcept
+{
+  return array_writer(add_subdocument(e_name, bson::type::array));
+}
+
+/**
+ * @brief Value traits for fixed-size schema fields
+ *
+ * @tparam T Value type (double, std::int32_t, std::int64_t or bool)
+ */
+template <class T> struct field_traits;
+
+template <> struct field_traits<double> {
+  static constexpr bson::type type = bson::type::fp64;
+  static constexpr std::size_t size = 8;
+  static void store(std::uint8_t* dest, double value) noexcept { std::memcpy(dest, &value, 8); }
+};
+
+template <> struct field_traits<std::int32_t> {
+  static constexpr bson::type type = bson::type::int32;
+  static constexpr std::size_t size = 4;
+  static void store(std::uint8_t* dest, std::int32_t value) noexcept { std::memcpy(dest, &value, 4); }
+};
+
+template <> struct field_traits<std::int64_t> {
+  static constexpr bson::type type = bson::type::int64;
+  static constexpr std::size_t size = 8;
+  static void store(std::uint8_t* dest, std::int64_t value) noexcept { std::memcpy(dest, &value, 8); }
+};
+
+template <> struct field_traits<bool> {
+  static constexpr bson::type type = bson::type::boolean;
+  static constexpr std::size_t size = 1;
+  static void store(std::uint8_t* dest, bool value) noexcept { *dest = value ? 1 : 0; }
+};
+
+/**
+ * @brief Fixed-size field of schema
+ *
+ * @tparam Name Element name (pointer to constexpr char array with linkage)
+ * @tparam T Value type (double, std::int32_t, std::int64_t or bool)
+ */
+template <const char* Name, class T>
+struct field {
+  using value_type = T;
+
+  static constexpr std::size_t count(const char* name) noexcept
+  {
+    return (*name == '\0') ? 0 : (1 + count(name + 1));
+  }
+
+  static constexpr std::size_t name_length = count(Name);
+  static constexpr std::size_t value_offset = 1 + name_length + 1;
+  static constexpr std::size_t size = value_offset + field_traits<T>::size;
+
+  static_assert(name_length > 0, "Element name must not be empty");
+
+  /**
+   * @brief Write type, name and zero value
+   */
+  static void prepare(std::uint8_t* dest) noexcept
+  {
+    dest[0] = static_cast<std::uint8_t>(field_traits<T>::type);
+    std::memcpy(dest + 1, Name, name_length + 1);
+    std::memset(dest + value_offset, 0, field_traits<T>::size);
+  }
+
+  /**
+   * @brief Write value
+   */
+  static void store(std::uint8_t* dest, T value) noexcept
+  {
+    field_traits<T>::store(dest + value_offset, value);
+  }
+};
+
+/**
+ * @brief Byte layout of schema fields
+ */
+template <class... Fields> struct schema_layout;
+
+template <> struct schema_layout<> {
+  static constexpr std::size_t size = 0;
+  static void prepare(std::uint8_t*) noexcept {}
+  static void store(std::uint8_t*) noexcept {}
+};
+
+template <class Field, class... Rest> struct schema_layout<Field, Rest...> {
+  static constexpr std::size_t size = Field::size + schema_layout<Rest...>::size;
+
+  static void prepare(std::uint8_t* dest) noexcept
+  {
+    Field::prepare(dest);
+    schema_layout<Rest...>::prepare(dest + Field::size);
+  }
+
+  static void store(std::uint8_t* dest, typename Field::value_type value,
+                    typename Rest::value_type... rest) noexcept
+  {
+    Field::store(dest, value);
+    schema_layout<Rest...>::store(dest + Field::size, rest...);
+  }
+};
+
+/**
+ * @brief Encoder for documents with fixed-shape prefix
+ *
+ * @note Keys, type bytes and offsets are determined at compile time and
+ *       the element template is built once. Encoding copies the template
+ *       and stores values at constant offsets.
+ *       Variable-length elements can be appended with bson::writer after encode().
+ * @tparam Fields bson::field types
+ *
+ * @code
+ * constexpr char ts[] = "ts";
+ * constexpr char v[] = "v";
+ * using sample = bson::schema<bson::field<ts, std::int64_t>, bson::field<v, double>>;
+ * sample::encode(w, 1234, 0.5);
+ * @endcode
+ */
+template <class... Fields>
+class schema {
+  using layout = schema_layout<Fields...>;
+
+public:
+  /**
+   * @brief Total length of fields in bytes
+   */
+  static constexpr std::size_t size = layout::size;
+
+  /**
+   * @brief Length of standalone document in bytes
+   */
+  static constexpr std::size_t document_size = 4 + size + 1;
+
+  /**
+   * @brief Append fields to writer
+   * 
+   * @param w Writer to append to
+   * @param values Values of fields
+   */
+  static bool encode(writer& w, typename Fields::value_type... values) noexcept
+  {
+    auto dest = static_cast<std::uint8_t*>(w.add_elements(size));
+    if (!dest) {
+      return false;
+    }
+    std::memcpy(dest, image(), size);
+    layout::store(dest, values...);
+    return true;
+  }
+
+  /**
+   * @brief Encode standalone document which consists of fields only
+   * 
+   * @param buffer Pointer to buffer
+   * @param length Length of buffer (at least document_size)
+   * @param values Values of fields
+   * @return Length of document (zero if failed)
+   */
+  static std::size_t encode_document(void* buffer, std::size_t length,
+                                     typename Fields::value_type... values) noexcept
+  {
+    if (length < document_size) {
+      return 0;
+    }
+    auto dest = static_cast<std::uint8_t*>(buffer);
+    const std::int32_t total = document_size;
+    std::memcpy(dest, &total, 4);
+    std::memcpy(dest + 4, image(), size);
+    layout::store(dest + 4, values...);
+    dest[4 + size] = 0x00;
+    return document_size;
+  }
+
+private:
+  struct templates {
+    std::uint8_t bytes[size ? size : 1];
+    templates() noexcept { layout::prepare(bytes); }
+  };
+
+  static const std::uint8_t* image() noexcept
+  {
+    static const templates instance;
+    return instance.bytes;
+  }
+};
+
+/**
+ * @brief Compiled dotted path (e.g. "a.b.17.c")
+ *
+ * @note Segments refer to the source string, which must outlive the path.
+ *       Decimal segments are also recognized as array indexes so that
+ *       arrays are skipped by element count instead of key comparison.
+ */
+class path {
+public:
+  /**
+   * @brief Maximum number of segments
+   */
+  static constexpr std::size_t max_segments = 16;
+
+  /**
+   * @brief Index value of non-numeric segment
+   */
+  static constexpr std::uint32_t no_index = 0xffffffffu;
+
+  /**
+   * @brief Segment of path
+   */
+  struct segment {
+    const char* data;
+    std::uint32_t length;
+    std::uint32_t index;
+  };
+
+  /**
+   * @brief Construct an empty path (invalid)
+   */
+  path() noexcept {}
+
+  /**
+   * @brief Construct a new path
+   * 
+   * @param dotted Dotted path string (NUL terminated)
+   */
+  explicit path(const char* dotted) noexcept : path(dotted, std::strlen(dotted)) {}
+
+  /**
+   * @brief Construct a new path
+   * 
+   * @param dotted Dotted path string
+   * @param length Length of path string
+   */
+  path(const char* dotted, std::size_t length) noexcept;
+
+  /**
+   * @brief Check if the path is valid (non-empty segments within max_segments)
+   */
+  bool valid() const noexcept { return count > 0; }
+
+  /**
+   * @brief Check if the path is valid
+   */
+  operator bool() const noexcept { return valid(); }
+
+  /**
+   * @brief Get number of segments
+   */
+  std::size_t size() const noexcept { return count; }
+
+  /**
+   * @brief Get segment
+   * 
+   * @param position Index of segment
+   */
+  const segment& operator[](std::size_t position) const noexcept { return segments[position]; }
+
+private:
+  segment segments[max_segments];
+  std::size_t count = 0;
+};
+
+/**
+ * @brief Writer of consecutive root documents into one contiguous buffer
+ *
+ * @note Only one document can be written at a time. Each document is
+ *       finalized in place when its writer is destroyed, so the whole batch
+ *       is available as a single region without intermediate copies.
+ *       Growing the buffer may move previously written documents.
+ *
+ * @code
+ * bson::batch_writer batch;
+ * for (...) {
+ *   auto w = batch.add_document();
+ *   w.add_int32("i", i);
+ * }
+ * batch.get_bytes(bytes, length);  // send(fd, bytes, length, 0)
+ * @endcode
+ */
+class batch_writer : private allocator {
+public:
+  /**
+   * @brief Writer of one document in batch
+   */
+  class document : public writer {
+  public:
+    /**
+     * @brief Construct a new document writer (move)
+     * 
+     * @param other Another document writer
+     */
+    document(document&& other) noexcept = default;
+
+    /**
+     * @brief Destroy the document writer and commit the document to batch
+     */
+    ~document() noexcept;
+
+  private:
+    document(batch_writer& batch, std::size_t size_hint) noexcept
+    : writer(size_hint, batch), batch(&batch)
+    {
+      batched = 1;
+    }
+
+    // Buffer is owned by batch
+    using writer::release;
+
+    friend class batch_writer;
+
+  private:
+    batch_writer* batch;
+  };
+
+  /**
+   * @brief Construct a new batch writer (growable)
+   * 
+   * @param upstream Allocator for batch buffer
+   */
+  explicit batch_writer(allocator& upstream = allocator::get_default()) noexcept
+  : batch_writer(0, upstream) {}
+
+  /**
+   * @brief Construct a new batch writer (growable) with initial capacity
+   * 
+   * @param capacity Initial capacity in bytes
+   * @param upstream Allocator for batch buffer
+   */
+  explicit batch_writer(std::size_t capacity, allocator& upstream = allocator::get_default()) noexcept;
+
+  /**
+   * @brief Construct a new batch writer (fixed buffer)
+   * 
+   * @param buffer Pointer to buffer
+   * @param length Length of buffer
+   */
+  batch_writer(void* buffer, std::size_t length) noexcept;
+
+  // Prohibit copying
+  batch_writer(const batch_writer&) = delete;
+  batch_writer& operator =(const batch_writer&) = delete;
+
+  /**
+   * @brief Destroy the batch writer
+   */
+  ~batch_writer() noexcept;
+
+  /**
+   * @brief Start a new document
+   * 
+   * @param size_hint Expected length of document in bytes
+   * @return Invalid writer if another document is being written or no space
+   */
+  document add_document(std::size_t size_hint = 128) noexcept;
+
+  /**
+   * @brief Get concatenated documents
+   * 
+   * @param bytes Reference to store pointer to documents
+   * @param length Reference to store total length
+   * @return false if a document is being written
+   */
+  bool get_bytes(const std::uint8_t*& bytes, std::size_t& length) const noexcept;
+
+  /**
+   * @brief Release buffer of growable batch
+   * 
+   * @note The buffer must be deallocated by the upstream allocator.
+   * @param length Reference to store total length
+   * @return nullptr if a document is being written or the buffer is fixed
+   */
+  std::uint8_t* release(std::size_t& length) noexcept;
+
+  /**
+   * @brief Discard all documents (capacity is kept)
+   */
+  void clear() noexcept;
+
+  /**
+   * @brief Get number of documents
+   */
+  std::size_t count() const noexcept { return documents; }
+
+  /**
+   * @brief Get total length of documents in bytes
+   */
+  std::size_t size() const noexcept { return used; }
+
+private:
+  void* allocate(std::size_t length) noexcept override;
+  void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept override;
+  void deallocate(void* buffer) noexcept override;
+
+  bool reserve(std::size_t required) noexcept;
+
+private:
+  allocator* upstream;      ///< Allocator for growable buffer (nullptr if fixed)
+  std::uint8_t* storage;    ///< Start of batch buffer
+  std::size_t capacity;     ///< Length of batch buffer
+  std::size_t used = 0;     ///< Length of committed documents
+  std::size_t documents = 0;
+  bool writing = false;     ///< Document is being written
+};
+
+/**
+ * @brief Writer which produces gather list instead of copying large payloads
+ *
+ * @note Strings and binaries whose length is at least the threshold are not
+ *       copied; only their element headers are written to the buffer, and the
+ *       payload pointers are recorded. All length headers include the
+ *       external payloads. The payloads must be kept until the fragments
+ *       are consumed.
+ *
+ * @code
+ * bson::gather_writer w(4096);
+ * w.add_binary("blob", blob, blob_length);
+ * const bson::gather_writer::fragment* fragments;
+ * std::size_t count;
+ * w.get_fragments(fragments, count);
+ * writev(fd, reinterpret_cast<const iovec*>(fragments), count);
+ * @endcode
+ */
+class gather_writer : public writer {
+public:
+  /**
+   * @brief Fragment of document (layout compatible with POSIX struct iovec)
+   */
+  struct fragment {
+    const void* data;
+    std::size_t length;
+  };
+
+  /**
+   * @brief Construct a new gather writer
+   * 
+   * @param threshold Minimum payload length to be referenced externally
+   * @param alloc Allocator for buffer and gather list
+   */
+  explicit gather_writer(std::size_t threshold = 4096, allocator& alloc = allocator::get_default()) noexcept
+  : writer(alloc), threshold(threshold)
+  {
+    gather = 1;
+  }
+
+  // Prohibit copying and moving (subdocument writers refer to this)
+  gather_writer(const gather_writer&) = delete;
+  gather_writer& operator =(const gather_writer&) = delete;
+
+  /**
+   * @brief Destroy the gather writer
+   */
+  ~gather_writer() noexcept;
+
+  /**
+   * @brief Get fragments of document
+   * 
+   * @note Fragments are valid until the writer is modified or destroyed.
+   * @param fragments Reference to store pointer to fragments
+   * @param count Reference to store number of fragments
+   * @return false if a subdocument is being written or allocation failed
+   */
+  bool get_fragments(const fragment*& fragments, std::size_t& count) noexcept;
+
+  /**
+   * @brief Get total length of document including external payloads
+   */
+  std::size_t size() const noexcept { return offset + 1 + (pending ? pending[0] : 0); }
+
+  /**
+   * @brief Get number of external payloads
+   */
+  std::size_t external_count() const noexcept { return reference_count; }
+
+private:
+  // Buffer does not contain external payloads
+  using writer::get_bytes;
+  using writer::release;
+
+  bool reserve_external(std::size_t depth) noexcept;
+
+  template <class T>
+  bool grow(T*& array, std::size_t& capacity, std::size_t required) noexcept;
+
+  friend class writer;
+
+private:
+  struct reference {
+    std::size_t position;
+    const void* data;
+    std::size_t length;
+  };
+
+  std::size_t threshold;
+  reference* references = nullptr;
+  std::size_t reference_count = 0;
+  std::size_t reference_capacity = 0;
+  std::size_t* pending = nullptr;   ///< External bytes in open document of each depth
+  std::size_t pending_capacity = 0;
+  fragment* fragments = nullptr;
+  std::size_t fragment_capacity = 0;
+};
+
+// Forward declaration
+class trusted_reader;
+
+/**
+ * @brief BSON reader class
+ */
+class reader {
+private:
+  union accessor {
+    const char* name;
+    const bson::type* type;
+    const bson::subtype* subtype;
+    const char* string;
+    const std::uint8_t* byte;
+    const double* fp64;
+    const std::int32_t* int32;
+    const std::int64_t* int64;
+    const void* pointer;
+
+    accessor(const void* pointer) noexcept : pointer(pointer) {}
+
+    operator bool() const noexcept { return (pointer != nullptr); }
+
+    template <class T>
+    const T* offset(int byte_offset) const noexcept
+    {
+      return reinterpret_cast<const T*>(byte + byte_offset);
+    }
+  };
+
+public:
+  // Forward declaration
+  class const_iterator;
+
+  /**
+   * @brief Element reader class
+   */
+  class element {
+  public:
+    /**
+     * @brief Construct a new element (invalid)
+     */
+    element() noexcept {}
+
+    /**
+     * @brief Construct a new element (copy)
+     * 
+     * @param other Another element
+     */
+    element(const element& other) noexcept
+    : e_name(other.e_name), data(other.data.pointer) {}
+
+    /**
+     * @brief Construct a new element (move)
+     * 
+     * @param other Another element
+     */
+    element(element&& other) noexcept : element(other) {}
+
+    /**
+     * @brief Destroy the element
+     * 
+     */
+    ~element() noexcept = default;
+
+    /**
+     * @brief Copy from another element
+     * 
+     * @param other Another element
+     */
+    element& operator=(const element& other) noexcept
+    {
+      e_name = other.e_name;
+      data = other.data.pointer;
+      return *this;
+    }
+
+    /**
+     * @brief Move from another element
+     * 
+     * @param other Another element
+     */
+    element& operator=(element&& other) noexcept
+    {
+      return *this = other;
+    }
+
+    /**
+     * @brief Check if the element is valid
+     */
+    operator bool() const noexcept { return valid(); }
+
+    /**
+     * @brief Check if the element is valid
+     */
+    bool valid() const noexcept { return data; }
+
+    /**
+     * @brief Check if the element is valid and has truthy value
+     */
+    bool truthy() const noexcept;
+
+    /**
+     * @brief Check if the element is invalid or has falsy value
+     */
+    bool falsy() const noexcept { return !truthy(); }
+
+    /**
+     * @brief Check if the element type is double
+     */
+    bool is_double() const noexcept { return type() == bson::type::fp64; }
+
+    /**
+     * @brief Check if the element type is string
+     */
+    bool is_string() const noexcept { return type() == bson::type::string; }
+
+    /**
+     * @brief Check if the element type is document
+     */
+    bool is_document() const noexcept { return type() == bson::type::document; }
+
+    /**
+     * @brief Check if the element type is array
+     */
+    bool is_array() const noexcept { return type() == bson::type::array; }
+
+    /**
+     * @brief Check if the element type is binary
+     */
+    bool is_binary() const noexcept { return type() == bson::type::binary; }
+
+    /**
+     * @brief Check if the element type is undefined
+     */
+    bool is_undefined() const noexcept { return type() == bson::type::undefined; }
+
+    /**
+     * @brief Check if the element type is boolean
+     */
+    bool is_boolean() const noexcept { return type() == bson::type::boolean; }
+
+    /**
+     * @brief Check if the element type is null
+     */
+    bool is_null() const noexcept { return type() == bson::type::null; }
+
+    /**
+     * @brief Check if the element type is int32
+     */
+    bool is_int32() const noexcept { return type() == bson::type::int32; }
+
+    /**
+     * @brief Check if the element type is int64
+     */
+    bool is_int64() const noexcept { return type() == bson::type::int64; }
+
+    /**
+     * @brief Check if the element type is null or undefined
+     */
+    bool is_null_or_undefined() const noexcept
+    {
+      switch (type()) {
+      case bson::type::undefined:
+      case bson::type::null:
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    /**
+     * @brief Check if the element type is int32 or int64
+     */
+    bool is_integer() const noexcept
+    {
+      switch (type()) {
+      case bson::type::int32:
+      case bson::type::int64:
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    /**
+     * @brief Check if the element type is double, int32 or int64
+     */
+    bool is_number() const noexcept
+    {
+      switch (type()) {
+      case bson::type::fp64:
+      case bson::type::int32:
+      case bson::type::int64:
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    /**
+     * @brief Get double value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_double(double& value) const noexcept;
+
+    /**
+     * @brief Get string value
+     * 
+     * @param string Reference to store pointer
+     */
+    bool get_string(const char*& string) const noexcept;
+
+    /**
+     * @brief Get string value
+     * 
+     * @param string Reference to store pointer
+     * @param length Reference to store length (not includes NUL termination)
+     */
+    bool get_string(const char*& string, std::size_t& length) const noexcept;
+
+    /**
+     * @brief Get binary value
+     * 
+     * @param buffer Rerefence to store pointer
+     * @param length Reference to store length
+     */
+    bool get_binary(const void*& buffer, std::size_t& length) const noexcept;
+
+    /**
+     * @brief Get binary value
+     * 
+     * @param buffer Rerefence to store pointer
+     * @param length Reference to store length
+     * @param subtype Reference to store subtype
+     */
+    bool get_binary(const void*& buffer, std::size_t& length, bson::subtype& subtype) const noexcept;
+
+    /**
+     * @brief Get boolean value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_boolean(bool& value) const noexcept;
+
+    /**
+     * @brief Get int32 value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_int32(int32_t& value) const noexcept;
+
+    /**
+     * @brief Get int64 value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_int64(int64_t& value) const noexcept;
+
+    /**
+     * @brief Get integer value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_integer(int64_t& value) const noexcept;
+
+    /**
+     * @brief Get number value
+     * 
+     * @param value Reference to store value
+     */
+    bool get_number(double& value) const noexcept;
+
+    /**
+     * @brief Get double as return value
+     * 
+     * @param default_value Default value if the type is not double
+     */
+    double as_double(double default_value = std::numeric_limits<double>::quiet_NaN()) const noexcept
+    {
+      (void)get_double(default_value);
+      return default_value;
+    }
+
+    /**
+     * @brief Get string as return value
+     * 
+     * @param default_value Default string if the type is not string
+     */
+    const char* as_string(const char* default_value = "") const noexcept
+    {
+      (void)get_string(default_value);
+      return default_value;
+    }
+
+    /**
+     * @brief Get string as return value
+     * 
+     * @param length Reference to store length
+     */
+    const char* as_string(std::size_t& length) const noexcept
+    {
+      const char* result;
+      return get_string(result, length) ? result : (length = 0, "");
+    }
+
+    /**
+     * @brief Get string as return value
+     * 
+     * @param length Reference to store length
+     * @param default_value Default string if the type is not string
+     * @param default_length Default length if the type is not string
+     */
+    const char* as_string(std::size_t& length, const char* default_value, std::size_t default_length) const noexcept
+    {
+      const char* result;
+      return get_string(result, length) ? result : (length = default_length, default_value);
+    }
+
+#ifdef BSON_HAS_STRING_VIEW
+    /**
+     * @brief Get string as view into the buffer (C++17)
+     * 
+     * @param default_value Default view if the type is not string
+     */
+    std::string_view as_string_view(std::string_view default_value = {}) const noexcept
+    {
+      const char* result;
+      std::size_t length;
+      return get_string(result, length) ? std::string_view(result, length) : default_value;
+    }
+#endif
+
+    /**
+     * @brief Get document reader as return value
+     */
+    reader as_document() const noexcept
+    {
+      return as_document(reader(nullptr, 0));
+    }
+
+    /**
+     * @brief Get document reader as return value
+     * 
+     * @param default_value Reader for default value if the type is not document
+     */
+    reader as_document(const reader& default_value) const noexcept
+    {
+      return as_subdocument(default_value, bson::type::document);
+    }
+
+    /**
+     * @brief Get array reader as return value
+     */
+    reader as_array() const noexcept
+    {
+      return as_array(reader(nullptr, 0));
+    }
+
+    /**
+     * @brief Get array reader as return value
+     * 
+     * @param default_value Reader for default value if the type is not array
+     */
+    reader as_array(const reader& default_value) const noexcept
+    {
+      return as_subdocument(default_value, bson::type::array);
+    }
+
+    /**
+     * @brief Get binary as return value
+     * 
+     * @param length Reference to store length
+     */
+    const void* as_binary(std::size_t& length) const noexcept
+    {
+      const void* result;
+      return get_binary(result, length) ? result : (length = 0, nullptr);
+    }
+
+    /**
+     * @brief Get binary as return value
+     * 
+     * @param length Reference to store length
+     * @param subtype Reference to store subtype
+     */
+    const void* as_binary(std::size_t& length, subtype& subtype) const noexcept
+    {
+      const void* result;
+      return get_binary(result, length, subtype) ? result : (length = 0, nullptr);
+    }
+
+    /**
+     * @brief Get binary as return value
+     * 
+     * @param length Reference to store length
+     * @param default_value Default pointer if the type is not binary
+     * @param default_length Default length if the type is not binary
+     */
+    const void* as_binary(std::size_t& length, const void* default_value, std::size_t default_length) const noexcept
+    {
+      const void* result;
+      return get_binary(result, length) ? result : (length = default_length, default_value);
+    }
+
+    /**
+     * @brief Get binary as return value
+     * 
+     * @param length Reference to store length
+     * @param subtype Reference to store subtype
+     * @param default_value Default pointer if the type is not binary
+     * @param default_length Default length if the type is not binary
+     * @param default_subtype Default subtype if the type is not binary
+     */
+    const void* as_binary(std::size_t& length, subtype& subtype,
+      const void* default_value, std::size_t default_length, 
+      bson::subtype default_subtype = bson::subtype::generic) const noexcept
+    {
+      const void* result;
+      return get_binary(result, length, subtype) ? result :
+        (length = default_length, subtype = default_subtype, default_value);
+    }
+
+#ifdef BSON_HAS_SPAN
+    /**
+     * @brief Get binary as span into the buffer (C++20)
+     * 
+     * @param default_value Default span if the type is not binary
+     */
+    std::span<const std::uint8_t> as_binary_span(std::span<const std::uint8_t> default_value = {}) const noexcept
+    {
+      const void* result;
+      std::size_t length;
+      return get_binary(result, length) ?
+        std::span<const std::uint8_t>(static_cast<const std::uint8_t*>(result), length) : default_value;
+    }
+#endif
+
+    /**
+     * @brief Get boolean as return value
+     * 
+     * @param default_value Default value if the type is not boolean
+     */
+    bool as_boolean(bool default_value = false) const noexcept
+    {
+      (void)get_boolean(default_value);
+      return default_value;
+    }
+
+    /**
+     * @brief Get int32 as return value
+     * 
+     * @param default_value Default value if the type is not int32
+     */
+    int32_t as_int32(int32_t default_value = 0) const noexcept
+    {
+      (void)get_int32(default_value);
+      return default_value;
+    }
+
+    /**
+     * @brief Get int64 as return value
+     * 
+     * @param default_value Default value if the type is not int64
+     */
+    int64_t as_int64(int64_t default_value = 0) const noexcept
+    {
+      (void)get_int64(default_value);
+      return default_value;
+    }
 
     /**
-     * @brief Check if the element type is boolean
+     * @brief Get integer as return value
+     * 
+     * @param default_value Default value if the type is not int32 nor int64
      */
-    bool is_boolean() const noexcept { return type() == bson::type::boolean; }
+    int64_t as_integer(int64_t default_value = 0) const noexcept
+    {
+      (void)get_integer(default_value);
+      return default_value;
+    }
 
     /**
-     * @brief Check if the element type is null
+     * @brief Get number as return value
+     * 
+     * @param default_value Default value if the type is not double, int32 nor int64
      */
-    bool is_null() const noexcept { return type() == bson::type::null; }
+    double as_number(double default_value = std::numeric_limits<double>::quiet_NaN()) const noexcept
+    {
+      (void)get_number(default_value);
+      return default_value;
+    }
 
     /**
-     * @brief Check if the element type is int32
+     * @brief Get element name
      */
-    bool is_int32() const noexcept { return type() == bson::type::int32; }
+    const char* name() const noexcept
+    {
+      return e_name;
+    }
 
     /**
-     * @brief Check if the element type is int64
+     * @brief Get element name length in bytes
      */
-    bool is_int64() const noexcept { return type() == bson::type::int64; }
+    std::size_t name_length() const noexcept
+    {
+      return data ? static_cast<std::size_t>(data.name - e_name - 1) : 0;
+    }
 
     /**
-     * @brief Check if the element type is null or undefined
+     * @brief Get element type
      */
-    bool is_null_or_undefined() const noexcept
+    bson::type type() const noexcept
     {
-      switch (type()) {
-      case bson::type::undefined:
-      case bson::type::null:
-        return true;
-      default:
-        return false;
-      }
+      return data ? static_cast<bson::type>(e_name[-1]) : static_cast<bson::type>(0);
     }
 
+  private:
+    reader as_subdocument(const reader& default_value, bson::type type) const noexcept;
+
+    element(const char* e_name, const void* data)
+    : e_name(e_name), data(data) {}
+
+    friend class const_iterator;
+    friend class reader;
+    friend class indexed_reader;
+    friend class trusted_reader;
+    friend class mutable_reader;
+    friend class patch;
+    friend std::ostream& operator<<(std::ostream&, const element&);
+
+  private:
+    const char* e_name = nullptr;
+    accessor data { nullptr };
+  };
+
+  /**
+   * @brief Iterator class for BSON reader
+   */
+  class const_iterator : public std::iterator<std::forward_iterator_tag, const element> {
+  public:
     /**
-     * @brief Check if the element type is int32 or int64
+     * @brief Construct a new const_iterator
      */
-    bool is_integer() const noexcept
+    const_iterator() noexcept {}
+
+    /**
+     * @brief Construct a new const_iterator (copy)
+     * 
+     * @param other Another iterator
+     */
+    const_iterator(const const_iterator& other) noexcept
+    : current(other.current),
+      next_position(other.next_position), end_position(other.end_position) {}
+
+    /**
+     * @brief Destroy the const_iterator
+     */
+    ~const_iterator() noexcept = default;
+
+    /**
+     * @brief Access element as reference
+     */
+    reference operator*() const noexcept
     {
-      switch (type()) {
-      case bson::type::int32:
-      case bson::type::int64:
-        return true;
-      default:
-        return false;
-      }
+      return current;
     }
 
     /**
-     * @brief Check if the element type is double, int32 or int64
+     * @brief Access element as pointer
      */
-    bool is_number() const noexcept
+    pointer operator->() const noexcept
     {
-      switch (type()) {
-      case bson::type::fp64:
-      case bson::type::int32:
-      case bson::type::int64:
-        return true;
-      default:
-        return false;
-      }
+      return &this->operator*();
     }
 
     /**
-     * @brief Get double value
-     * 
-     * @param value Reference to store value
+     * @brief Advance to next element (Pre-increment)
      */
-    bool get_double(double& value) const noexcept;
+    const_iterator& operator++() noexcept;
 
     /**
-     * @brief Get string value
-     * 
-     * @param string Reference to store pointer
+     * @brief Advance to next element (Post-increment)
      */
-    bool get_string(const char*& string) const noexcept;
+    const_iterator operator++(int) noexcept
+    {
+      const_iterator old = *this;
+      this->operator++();
+      return old;
+    }
 
     /**
-     * @brief Get string value
+     * @brief Compare (!=) two iterators
      * 
-     * @param string Reference to store pointer
-     * @param length Reference to store length (not includes NUL termination)
+     * @param other Another iterator
      */
-    bool get_string(const char*& string, std::size_t& length) const noexcept;
+    bool operator!=(const const_iterator& other) const noexcept
+    {
+      if (end_position) {
+        if (other.end_position) {
+          return (current.e_name != other.current.e_name);
+        }
+        return true;
+      }
+      return other.end_position;
+    }
 
     /**
-     * @brief Get binary value
+     * @brief Compare (==) two iterators
      * 
-     * @param buffer Rerefence to store pointer
-     * @param length Reference to store length
+     * @param other Another iterator
      */
-    bool get_binary(const void*& buffer, std::size_t& length) const noexcept;
+    bool operator==(const const_iterator& other) const noexcept
+    {
+      return !this->operator!=(other);
+    }
 
     /**
-     * @brief Get binary value
-     * 
-     * @param buffer Rerefence to store pointer
-     * @param length Reference to store length
-     * @param subtype Reference to store subtype
+     * @brief Check if the iterator is failed state
      */
-    bool get_binary(const void*& buffer, std::size_t& length, bson::subtype& subtype) const noexcept;
+    bool fail() const noexcept
+    {
+      return ((!end_position) && (next_position));
+    }
+
+  private:
+    const_iterator(const reader& owner) noexcept;
+
+    void parse(accessor start) noexcept;
+
+    void set_next(const void* position) noexcept;
+
+    friend class reader;
+    friend class patch;
+    friend std::ostream& operator<<(std::ostream&, const const_iterator&);
+
+  private:
+    element current { nullptr, nullptr };
+    accessor next_position { nullptr };
+    accessor end_position { nullptr };
+  };
+
+  using iterator = const_iterator;
+
+public:
+  /**
+   * @brief Query document length
+   * 
+   * @param buffer Pointer to buffer
+   * @param length Length of buffer
+   * @return <0 Cannot detect (more data required)
+   * @return >=0 Length of document
+   */
+  static int query_size(const void* buffer, std::size_t length) noexcept;
+
+  /**
+   * @brief Construct a new BSON reader
+   * 
+   * @param buffer Pointer to buffer
+   * @param length Length of buffer
+   */
+  reader(const void* buffer, std::size_t length) noexcept
+  : buffer(static_cast<const std::uint8_t*>(buffer)), length(length) {}
+
+  /**
+   * @brief Destroy the BSON reader
+   */
+  ~reader() noexcept = default;
+
+  /**
+   * @brief Check if the reader has a valid buffer
+   */
+  bool valid() const noexcept { return (buffer.pointer != nullptr); }
+
+  /**
+   * @brief Check if the reader has a valid buffer
+   */
+  operator bool() const noexcept { return valid(); }
+
+  /**
+   * @brief Return an iterator to the beginning
+   */
+  iterator begin() const noexcept { return cbegin(); }
+
+  /**
+   * @brief Return an iterator to the end
+   */
+  iterator end() const noexcept { return cend(); }
+
+  /**
+   * @brief Return an iterator to the beginning (const)
+   */
+  const_iterator cbegin() const noexcept { return const_iterator(*this); }
+
+  /**
+   * @brief Return an iterator to the end (const)
+   */
+  const_iterator cend() const noexcept { return const_iterator(); }
+
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name to find
+   */
+  element find(const char* e_name) const noexcept;
+
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name with length (std::string_view converts implicitly)
+   */
+  element find(const key& e_name) const noexcept;
 
-    /**
-     * @brief Get boolean value
-     * 
-     * @param value Reference to store value
-     */
-    bool get_boolean(bool& value) const noexcept;
+  /**
+   * @brief Find a nested field
+   * 
+   * @note Array elements are located by position. Array keys are assumed
+   *       to be "0", "1", ... in order as BSON spec requires.
+   * @param e_path Compiled path to find
+   */
+  element find(const path& e_path) const noexcept;
 
-    /**
-     * @brief Get int32 value
-     * 
-     * @param value Reference to store value
-     */
-    bool get_int32(int32_t& value) const noexcept;
+  /**
+   * @brief Validate whole document structure recursively
+   * 
+   * @note Checks total and element lengths, NUL terminators of names and
+   *       strings, known element types, nesting depth and UTF-8 encoding.
+   * @param max_depth Maximum nesting depth of subdocuments
+   * @param utf8 Check UTF-8 encoding of names and strings
+   * @return Trusted reader (invalid if validation failed)
+   */
+  trusted_reader validate(std::size_t max_depth = 100, bool utf8 = true) const noexcept;
 
-    /**
-     * @brief Get int64 value
-     * 
-     * @param value Reference to store value
-     */
-    bool get_int64(int64_t& value) const noexcept;
+  /**
+   * @brief Find multiple fields in a single pass
+   * 
+   * @note Traversal stops as soon as all names are found.
+   *       For duplicated names in document, the first one is stored.
+   * @param names Array of element names to find
+   * @param count Number of names
+   * @param elements Array to store found elements (invalid element if not found)
+   * @return Number of names found
+   */
+  std::size_t find_many(const key* names, std::size_t count, element* elements) const noexcept;
 
-    /**
-     * @brief Get integer value
-     * 
-     * @param value Reference to store value
-     */
-    bool get_integer(int64_t& value) const noexcept;
+  /**
+   * @brief Find multiple fields in a single pass
+   * 
+   * @param names List of element names to find
+   * @param elements Array to store found elements (at least names.size())
+   * @return Number of names found
+   */
+  std::size_t find_many(std::initializer_list<key> names, element* elements) const noexcept
+  {
+    return find_many(names.begin(), names.size(), elements);
+  }
 
-    /**
-     * @brief Get number value
-     * 
-     * @param value Reference to store value
-     */
-    bool get_number(double& value) const noexcept;
+private:
+  accessor buffer;
+  std::size_t length;
+  friend class element;
+  friend class trusted_reader;
+};
 
+/**
+ * @brief BSON reader for validated documents
+ *
+ * @note Iteration skips all bounds and length checks. Subdocuments obtained
+ *       via trusted_reader::element are trusted too.
+ *       Obtain by reader::validate() or trusted_reader::unchecked().
+ */
+class trusted_reader : public reader {
+public:
+  /**
+   * @brief Element reader class for trusted documents
+   */
+  class element : public reader::element {
+  public:
     /**
-     * @brief Get double as return value
-     * 
-     * @param default_value Default value if the type is not double
+     * @brief Construct a new element (invalid)
      */
-    double as_double(double default_value = std::numeric_limits<double>::quiet_NaN()) const noexcept
-    {
-      (void)get_double(default_value);
-      return default_value;
-    }
+    element() noexcept {}
 
     /**
-     * @brief Get string as return value
-     * 
-     * @param default_value Default string if the type is not string
+     * @brief Get document as trusted reader
      */
-    const char* as_string(const char* default_value = "") const noexcept
+    trusted_reader as_document() const noexcept
     {
-      (void)get_string(default_value);
-      return default_value;
+      return trusted_reader(reader::element::as_document());
     }
 
     /**
-     * @brief Get string as return value
-     * 
-     * @param length Reference to store length
+     * @brief Get array as trusted reader
      */
-    const char* as_string(std::size_t& length) const noexcept
+    trusted_reader as_array() const noexcept
     {
-      const char* result;
-      return get_string(result, length) ? result : (length = 0, "");
+      return trusted_reader(reader::element::as_array());
     }
 
-    /**
-     * @brief Get string as return value
-     * 
-     * @param length Reference to store length
-     * @param default_value Default string if the type is not string
-     * @param default_length Default length if the type is not string
-     */
-    const char* as_string(std::size_t& length, const char* default_value, std::size_t default_length) const noexcept
-    {
-      const char* result;
-      return get_string(result, length) ? result : (length = default_length, default_value);
-    }
+  private:
+    element(const char* e_name, const void* data) noexcept
+    : reader::element(e_name, data) {}
 
-    /**
-     * @brief Get document reader as return value
-     */
-    reader as_document() const noexcept
-    {
-      return as_document(reader(nullptr, 0));
-    }
+    friend class trusted_reader;
+  };
 
+  /**
+   * @brief Iterator class for trusted reader
+   */
+  class const_iterator : public std::iterator<std::forward_iterator_tag, const element> {
+  public:
     /**
-     * @brief Get document reader as return value
-     * 
-     * @param default_value Reader for default value if the type is not document
+     * @brief Construct a new const_iterator (end)
      */
-    reader as_document(const reader& default_value) const noexcept
-    {
-      return as_subdocument(default_value, bson::type::document);
-    }
+    const_iterator() noexcept {}
 
     /**
-     * @brief Get array reader as return value
+     * @brief Access element as reference
      */
-    reader as_array() const noexcept
-    {
-      return as_array(reader(nullptr, 0));
-    }
+    reference operator*() const noexcept { return current; }
 
     /**
-     * @brief Get array reader as return value
-     * 
-     * @param default_value Reader for default value if the type is not array
+     * @brief Access element as pointer
      */
-    reader as_array(const reader& default_value) const noexcept
-    {
-      return as_subdocument(default_value, bson::type::array);
-    }
+    pointer operator->() const noexcept { return &current; }
 
     /**
-     * @brief Get binary as return value
-     * 
-     * @param length Reference to store length
+     * @brief Advance to next element (Pre-increment)
      */
-    const void* as_binary(std::size_t& length) const noexcept
-    {
-      const void* result;
-      return get_binary(result, length) ? result : (length = 0, nullptr);
-    }
+    const_iterator& operator++() noexcept;
 
     /**
-     * @brief Get binary as return value
-     * 
-     * @param length Reference to store length
-     * @param subtype Reference to store subtype
+     * @brief Advance to next element (Post-increment)
      */
-    const void* as_binary(std::size_t& length, subtype& subtype) const noexcept
+    const_iterator operator++(int) noexcept
     {
-      const void* result;
-      return get_binary(result, length, subtype) ? result : (length = 0, nullptr);
+      const_iterator old = *this;
+      this->operator++();
+      return old;
     }
 
     /**
-     * @brief Get binary as return value
+     * @brief Compare (!=) two iterators
      * 
-     * @param length Reference to store length
-     * @param default_value Default pointer if the type is not binary
-     * @param default_length Default length if the type is not binary
+     * @param other Another iterator
      */
-    const void* as_binary(std::size_t& length, const void* default_value, std::size_t default_length) const noexcept
+    bool operator!=(const const_iterator& other) const noexcept
     {
-      const void* result;
-      return get_binary(result, length) ? result : (length = default_length, default_value);
+      return (current.e_name != other.current.e_name);
     }
 
     /**
-     * @brief Get binary as return value
+     * @brief Compare (==) two iterators
      * 
-     * @param length Reference to store length
-     * @param subtype Reference to store subtype
-     * @param default_value Default pointer if the type is not binary
-     * @param default_length Default length if the type is not binary
-     * @param default_subtype Default subtype if the type is not binary
+     * @param other Another iterator
      */
-    const void* as_binary(std::size_t& length, subtype& subtype,
-      const void* default_value, std::size_t default_length, 
-      bson::subtype default_subtype = bson::subtype::generic) const noexcept
+    bool operator==(const const_iterator& other) const noexcept
     {
-      const void* result;
-      return get_binary(result, length, subtype) ? result :
-        (length = default_length, subtype = default_subtype, default_value);
+      return !this->operator!=(other);
     }
 
-    /**
-     * @brief Get boolean as return value
-     * 
-     * @param default_value Default value if the type is not boolean
-     */
-    bool as_boolean(bool default_value = false) const noexcept
+  private:
+    explicit const_iterator(const std::uint8_t* first) noexcept : next_position(first)
     {
-      (void)get_boolean(default_value);
-      return default_value;
+      this->operator++();
     }
 
-    /**
-     * @brief Get int32 as return value
-     * 
-     * @param default_value Default value if the type is not int32
-     */
-    int32_t as_int32(int32_t default_value = 0) const noexcept
-    {
-      (void)get_int32(default_value);
-      return default_value;
-    }
+    friend class trusted_reader;
 
-    /**
-     * @brief Get int64 as return value
-     * 
-     * @param default_value Default value if the type is not int64
-     */
-    int64_t as_int64(int64_t default_value = 0) const noexcept
-    {
-      (void)get_int64(default_value);
-      return default_value;
-    }
+  private:
+    element current;
+    const std::uint8_t* next_position = nullptr;
+  };
 
-    /**
-     * @brief Get integer as return value
-     * 
-     * @param default_value Default value if the type is not int32 nor int64
-     */
-    int64_t as_integer(int64_t default_value = 0) const noexcept
-    {
-      (void)get_integer(default_value);
-      return default_value;
-    }
+  using iterator = const_iterator;
 
-    /**
-     * @brief Get number as return value
-     * 
-     * @param default_value Default value if the type is not double, int32 nor int64
-     */
-    double as_number(double default_value = std::numeric_limits<double>::quiet_NaN()) const noexcept
-    {
-      (void)get_number(default_value);
-      return default_value;
-    }
+public:
+  /**
+   * @brief Construct a new trusted reader (invalid)
+   */
+  trusted_reader() noexcept : reader(nullptr, 0) {}
 
-    /**
-     * @brief Get element name
-     */
-    const char* name() const noexcept
-    {
-      return e_name;
-    }
+  /**
+   * @brief Trust document without validation
+   * 
+   * @note Use only for documents known to be well-formed (e.g. produced by bson::writer).
+   * @param buffer Pointer to buffer
+   * @param length Length of buffer
+   */
+  static trusted_reader unchecked(const void* buffer, std::size_t length) noexcept
+  {
+    return trusted_reader(reader(buffer, length));
+  }
+
+  /**
+   * @brief Return an iterator to the beginning
+   */
+  iterator begin() const noexcept { return cbegin(); }
+
+  /**
+   * @brief Return an iterator to the end
+   */
+  iterator end() const noexcept { return cend(); }
+
+  /**
+   * @brief Return an iterator to the beginning (const)
+   */
+  const_iterator cbegin() const noexcept
+  {
+    return valid() ? const_iterator(buffer.byte + 4) : const_iterator();
+  }
 
-    /**
-     * @brief Get element type
-     */
-    bson::type type() const noexcept
-    {
-      return data ? static_cast<bson::type>(e_name[-1]) : static_cast<bson::type>(0);
-    }
+  /**
+   * @brief Return an iterator to the end (const)
+   */
+  const_iterator cend() const noexcept { return const_iterator(); }
 
-  private:
-    reader as_subdocument(const reader& default_value, bson::type type) const noexcept;
+  using reader::find;
 
-    element(const char* e_name, const void* data)
-    : e_name(e_name), data(data) {}
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name to find
+   */
+  element find(const char* e_name) const noexcept;
 
-    friend class const_iterator;
-    friend class reader;
-    friend std::ostream& operator<<(std::ostream&, const element&);
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name with length
+   */
+  element find(const key& e_name) const noexcept;
 
-  private:
-    const char* e_name = nullptr;
-    accessor data { nullptr };
-  };
+private:
+  explicit trusted_reader(const reader& source) noexcept : reader(source) {}
+
+  friend class reader;
+};
 
+/**
+ * @brief BSON reader for writable buffer with in-place update of values
+ *
+ * @note Only updates which keep the document layout are supported:
+ *       fixed-width values of the same type and strings of the same length.
+ *
+ * @code
+ * bson::mutable_reader r(buffer, length);
+ * r.find("count").set_int64(r.find("count").as_int64() + 1);
+ * @endcode
+ */
+class mutable_reader : public reader {
+public:
   /**
-   * @brief Iterator class for BSON reader
+   * @brief Element class with in-place update
    */
-  class const_iterator : public std::iterator<std::forward_iterator_tag, const element> {
+  class element : public reader::element {
   public:
     /**
-     * @brief Construct a new const_iterator
+     * @brief Construct a new element (invalid)
      */
-    const_iterator() noexcept {}
+    element() noexcept {}
 
     /**
-     * @brief Construct a new const_iterator (copy)
+     * @brief Construct a new element from element of writable document
      * 
-     * @param other Another iterator
+     * @param other Element found in buffer given to mutable_reader
      */
-    const_iterator(const const_iterator& other) noexcept
-    : current(other.current),
-      next_position(other.next_position), end_position(other.end_position) {}
+    explicit element(const reader::element& other) noexcept : reader::element(other) {}
 
     /**
-     * @brief Destroy the const_iterator
+     * @brief Overwrite double value
+     * 
+     * @param value New value
+     * @return false if the element type is not double
      */
-    ~const_iterator() noexcept = default;
+    bool set_double(double value) const noexcept { return store(bson::type::fp64, &value, 8); }
 
     /**
-     * @brief Access element as reference
+     * @brief Overwrite int32 value
+     * 
+     * @param value New value
+     * @return false if the element type is not int32
      */
-    reference operator*() const noexcept
-    {
-      return current;
-    }
+    bool set_int32(std::int32_t value) const noexcept { return store(bson::type::int32, &value, 4); }
 
     /**
-     * @brief Access element as pointer
+     * @brief Overwrite int64 value
+     * 
+     * @param value New value
+     * @return false if the element type is not int64
      */
-    pointer operator->() const noexcept
-    {
-      return &this->operator*();
-    }
+    bool set_int64(std::int64_t value) const noexcept { return store(bson::type::int64, &value, 8); }
 
     /**
-     * @brief Advance to next element (Pre-increment)
+     * @brief Overwrite boolean value
+     * 
+     * @param value New value
+     * @return false if the element type is not boolean
      */
-    const_iterator& operator++() noexcept;
+    bool set_boolean(bool value) const noexcept
+    {
+      const std::uint8_t byte = value ? 1 : 0;
+      return store(bson::type::boolean, &byte, 1);
+    }
 
     /**
-     * @brief Advance to next element (Post-increment)
+     * @brief Overwrite string value of the same length
+     * 
+     * @param string New string
+     * @param length Length of new string
+     * @return false if the element type is not string or the length differs
      */
-    const_iterator operator++(int) noexcept
-    {
-      const_iterator old = *this;
-      this->operator++();
-      return old;
-    }
+    bool set_string(const char* string, std::size_t length) const noexcept;
 
     /**
-     * @brief Compare (!=) two iterators
+     * @brief Overwrite string value of the same length
      * 
-     * @param other Another iterator
+     * @param string New string (NUL terminated)
+     * @return false if the element type is not string or the length differs
      */
-    bool operator!=(const const_iterator& other) const noexcept
+    bool set_string(const char* string) const noexcept
     {
-      if (end_position) {
-        if (other.end_position) {
-          return (current.e_name != other.current.e_name);
-        }
-        return true;
-      }
-      return other.end_position;
+      return set_string(string, std::strlen(string));
     }
 
     /**
-     * @brief Compare (==) two iterators
-     * 
-     * @param other Another iterator
+     * @brief Get document as mutable reader
      */
-    bool operator==(const const_iterator& other) const noexcept
+    mutable_reader as_document() const noexcept
     {
-      return !this->operator!=(other);
+      return mutable_reader(reader::element::as_document());
     }
 
     /**
-     * @brief Check if the iterator is failed state
+     * @brief Get array as mutable reader
      */
-    bool fail() const noexcept
+    mutable_reader as_array() const noexcept
     {
-      return ((!end_position) && (next_position));
+      return mutable_reader(reader::element::as_array());
     }
 
   private:
-    const_iterator(const reader& owner) noexcept;
+    bool store(bson::type type, const void* value, std::size_t size) const noexcept
+    {
+      if (this->type() != type) {
+        return false;
+      }
+      std::memcpy(const_cast<void*>(data.pointer), value, size);
+      return true;
+    }
+  };
 
-    void parse(accessor start) noexcept;
+  /**
+   * @brief Construct a new mutable reader
+   * 
+   * @param buffer Pointer to writable buffer
+   * @param length Length of buffer
+   */
+  mutable_reader(void* buffer, std::size_t length) noexcept : reader(buffer, length) {}
 
-    void set_next(const void* position) noexcept;
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name to find
+   */
+  element find(const char* e_name) const noexcept { return element(reader::find(e_name)); }
 
-    friend class reader;
-    friend std::ostream& operator<<(std::ostream&, const const_iterator&);
+  /**
+   * @brief Find a field
+   * 
+   * @param e_name Element name with length
+   */
+  element find(const key& e_name) const noexcept { return element(reader::find(e_name)); }
 
-  private:
-    element current { nullptr, nullptr };
-    accessor next_position { nullptr };
-    accessor end_position { nullptr };
-  };
+  /**
+   * @brief Find a nested field
+   * 
+   * @param e_path Compiled path to find
+   */
+  element find(const path& e_path) const noexcept { return element(reader::find(e_path)); }
 
-  using iterator = const_iterator;
+private:
+  explicit mutable_reader(const reader& source) noexcept : reader(source) {}
+};
 
+/**
+ * @brief BSON reader with field lookup table
+ *
+ * @note The document is parsed once into an open-addressing hash table
+ *       held in a caller-supplied array of slots. The first occurrence of
+ *       duplicate names is kept (same as reader::find).
+ *       If the table is too small, remaining fields are looked up by linear scan.
+ *
+ * @code
+ * bson::indexed_reader::slot table[64];
+ * bson::indexed_reader index(r, table, 64);
+ * auto field = index.find("name");
+ * @endcode
+ */
+class indexed_reader {
 public:
   /**
-   * @brief Query document length
+   * @brief Entry of lookup table
+   */
+  struct slot {
+    const char* e_name;
+    std::uint32_t hash;
+    std::uint32_t length;
+  };
+
+  /**
+   * @brief Query recommended number of slots
    * 
-   * @param buffer Pointer to buffer
-   * @param length Length of buffer
-   * @return <0 Cannot detect (more data required)
-   * @return >=0 Length of document
+   * @param fields Number of fields in document
+   * @return Power of two with load factor at most 50%
    */
-  static int query_size(const void* buffer, std::size_t length) noexcept;
+  static constexpr std::size_t slots_for(std::size_t fields, std::size_t slots = 2) noexcept
+  {
+    return (slots >= fields * 2) ? slots : slots_for(fields, slots * 2);
+  }
 
   /**
-   * @brief Construct a new BSON reader
+   * @brief Construct a new indexed reader
    * 
-   * @param buffer Pointer to buffer
-   * @param length Length of buffer
+   * @param source Reader of document to index
+   * @param table Array of slots
+   * @param capacity Number of slots (rounded down to power of two)
    */
-  reader(const void* buffer, std::size_t length) noexcept
-  : buffer(static_cast<const std::uint8_t*>(buffer)), length(length) {}
+  indexed_reader(const reader& source, slot* table, std::size_t capacity) noexcept;
 
   /**
-   * @brief Destroy the BSON reader
+   * @brief Check if all fields are indexed
    */
-  ~reader() noexcept = default;
+  bool complete() const noexcept { return !overflow; }
 
   /**
-   * @brief Check if the reader has a valid buffer
+   * @brief Get number of indexed fields
    */
-  bool valid() const noexcept { return (buffer.pointer != nullptr); }
+  std::size_t size() const noexcept { return count; }
 
   /**
-   * @brief Check if the reader has a valid buffer
+   * @brief Get source reader
    */
-  operator bool() const noexcept { return valid(); }
+  const reader& source() const noexcept { return document; }
 
   /**
-   * @brief Return an iterator to the beginning
+   * @brief Find a field
+   * 
+   * @param e_name Element name to find
    */
-  iterator begin() const noexcept { return cbegin(); }
+  reader::element find(const char* e_name) const noexcept;
 
   /**
-   * @brief Return an iterator to the end
+   * @brief Find a field
+   * 
+   * @param e_name Element name to find
    */
-  iterator end() const noexcept { return cend(); }
+  reader::element find(const key& e_name) const noexcept;
+
+private:
+  static std::uint32_t hash(const char* e_name, std::size_t length) noexcept;
+
+  reader::element find(const char* e_name, std::size_t length, std::uint32_t hash) const noexcept;
+
+private:
+  reader document;
+  slot* table;
+  std::size_t mask;
+  std::size_t count = 0;
+  const char* overflow = nullptr;
+};
 
+/**
+ * @brief Immutable document with reference-counted buffer
+ *
+ * @note Copies share the buffer (atomic reference count), so a document can
+ *       be passed to other threads without copying bytes. The buffer is
+ *       deallocated when the last copy is destroyed. Slicing to a plain
+ *       reader does not keep the buffer alive.
+ *
+ * @code
+ * bson::shared_document doc(w);  // takes over the writer's buffer
+ * for (auto& subscriber : subscribers) {
+ *   subscriber.post(doc);
+ * }
+ * @endcode
+ */
+class shared_document : public reader {
+public:
   /**
-   * @brief Return an iterator to the beginning (const)
+   * @brief Construct an empty shared document (invalid)
    */
-  const_iterator cbegin() const noexcept { return const_iterator(*this); }
+  shared_document() noexcept : reader(nullptr, 0) {}
 
   /**
-   * @brief Return an iterator to the end (const)
+   * @brief Construct a new shared document by taking over released buffer
+   *
+   * @note The writer must be a root writer with auto allocation;
+   *       it becomes invalid.
+   * @param source Writer to release buffer from
    */
-  const_iterator cend() const noexcept { return const_iterator(); }
+  explicit shared_document(writer& source) noexcept : shared_document(adopt(source)) {}
+
+  // Buffer of gather writer lacks external payloads (use get_fragments())
+  shared_document(gather_writer&) = delete;
+
+  // Buffer of batch document is owned by the batch
+  shared_document(batch_writer::document&) = delete;
 
   /**
-   * @brief Find a field
+   * @brief Construct a new shared document by copy of bytes
+   *
+   * @param buffer Pointer to document
+   * @param length Length of document in bytes
+   * @param alloc Allocator for the shared buffer (must outlive all copies)
+   */
+  shared_document(const void* buffer, std::size_t length,
+                  allocator& alloc = allocator::get_default()) noexcept
+  : shared_document(copy(buffer, length, alloc)) {}
+
+  /**
+   * @brief Construct a new shared document sharing the buffer of another
+   */
+  shared_document(const shared_document& other) noexcept : reader(other), shared(other.shared)
+  {
+    if (shared) {
+      shared->references.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Construct a new shared document by move (the source becomes invalid)
+   */
+  shared_document(shared_document&& other) noexcept : reader(other), shared(other.shared)
+  {
+    other.reader::operator =(reader(nullptr, 0));
+    other.shared = nullptr;
+  }
+
+  /**
+   * @brief Destroy the shared document (the last copy deallocates the buffer)
+   */
+  ~shared_document() noexcept { unref(); }
+
+  shared_document& operator =(const shared_document& other) noexcept
+  {
+    const auto source = other.shared;
+    if (source) {
+      source->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    const reader view(other);
+    unref();
+    reader::operator =(view);
+    shared = source;
+    return *this;
+  }
+
+  shared_document& operator =(shared_document&& other) noexcept
+  {
+    if (this != &other) {
+      unref();
+      reader::operator =(other);
+      shared = other.shared;
+      other.reader::operator =(reader(nullptr, 0));
+      other.shared = nullptr;
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Get pointer to document bytes
+   */
+  const std::uint8_t* data() const noexcept { return shared ? shared->data : nullptr; }
+
+  /**
+   * @brief Get length of document in bytes
+   */
+  std::size_t size() const noexcept { return shared ? shared->length : 0; }
+
+  /**
+   * @brief Get number of copies sharing the buffer
+   */
+  std::size_t use_count() const noexcept
+  {
+    return shared ? shared->references.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+  struct control {
+    std::atomic<std::size_t> references;
+    allocator* alloc;
+    std::uint8_t* buffer;   ///< Separately allocated buffer (nullptr if placed after control)
+    const std::uint8_t* data;
+    std::size_t length;
+  };
+
+  explicit shared_document(control* shared) noexcept
+  : reader(shared ? shared->data : nullptr, shared ? shared->length : 0), shared(shared) {}
+
+  static control* adopt(writer& source) noexcept;
+
+  static control* copy(const void* buffer, std::size_t length, allocator& alloc) noexcept;
+
+  void unref() noexcept;
+
+private:
+  control* shared = nullptr;
+};
+
+/**
+ * @brief Set of edits applied to a document by splicing byte ranges
+ *
+ * @note Runs of untouched elements are copied by single memcpy and only
+ *       edited fields are encoded; nested length headers are maintained
+ *       by the output writer. Paths and values must outlive the patch.
+ *       When several edits target the same field, the last one wins.
+ *
+ * @code
+ * bson::patch p;
+ * p.set("a.b", changes.find("b"));
+ * p.remove("c");
+ * bson::writer w;
+ * p.apply(source, w);
+ * @endcode
+ */
+class patch {
+public:
+  /**
+   * @brief Maximum number of edits
+   */
+  static constexpr std::size_t max_edits = 16;
+
+  /**
+   * @brief Add or replace a field
    * 
-   * @param e_name Element name to find
+   * @note Missing parent documents are created. A missing array element
+   *       is appended with the next index.
+   * @param e_path Dotted path of field
+   * @param value Element that holds the new value (its name is ignored)
+   * @return false if the path or value is invalid, or edits are full
    */
-  element find(const char* e_name) const noexcept;
+  bool set(const char* e_path, const reader::element& value) noexcept;
+
+  /**
+   * @brief Remove a field
+   * 
+   * @note Remaining elements of an array are renumbered.
+   * @param e_path Dotted path of field
+   * @return false if the path is invalid, or edits are full
+   */
+  bool remove(const char* e_path) noexcept;
+
+  /**
+   * @brief Get number of edits
+   */
+  std::size_t size() const noexcept { return count; }
+
+  /**
+   * @brief Remove all edits
+   */
+  void clear() noexcept { count = 0; }
+
+  /**
+   * @brief Write patched document
+   * 
+   * @note On failure, contents of output are unspecified.
+   * @param source Source document
+   * @param output Writer to append fields of patched document
+   * @return false if source is malformed, a path passes through
+   *         non-document field, or output fails
+   */
+  bool apply(const reader& source, writer& output) const noexcept;
 
 private:
-  accessor buffer;
-  std::size_t length;
-  friend class element;
+  struct edit {
+    path target;
+    reader::element value;  ///< Invalid for removal
+  };
+
+  bool add(const char* e_path, const reader::element& value) noexcept;
+
+  bool merge(const reader& source, writer& output, bool array, std::size_t depth,
+             const edit* const* active, std::size_t n) const noexcept;
+
+  bool write_field(writer& output, const key& e_name, const key& output_name,
+                   const reader::element& original, std::size_t depth,
+                   const edit* const* active, std::size_t n, bool* used,
+                   bool& written) const noexcept;
+
+  static bool copy_element(writer& output, const key& e_name, const reader::element& value) noexcept;
+
+private:
+  edit edits[max_edits];
+  std::size_t count = 0;
 };
 
 } /* namespace bson */
@@ -0,0 +1,1148 @@
+/**
+ * @file bson_json.cpp
+ * @brief Extended JSON serializer for BSON flat reader
+ */
+#include "bson_json.hpp"
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if (__cplusplus >= 201703L) && defined(__has_include)
+# if __has_include(<charconv>)
+#  include <charconv>
+# endif
+#endif
+
+#ifndef BSON_NO_SIMD
+# if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define BSON_SIMD_SSE2 1
+# elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define BSON_SIMD_NEON 1
+# endif
+#endif
+
+namespace bson {
+
+namespace {
+
+/**
+ * @brief Buffered output to json_sink
+ */
+class json_output {
+public:
+  json_output(json_sink sink, void* context) noexcept : sink(sink), context(context) {}
+
+  bool write(const char* data, std::size_t length) noexcept
+  {
+    if (length > sizeof(buffer) - used) {
+      if (!flush()) {
+        return false;
+      }
+      if (length > sizeof(buffer)) {
+        // Pass large chunk through
+        return sink(context, data, length);
+      }
+    }
+    std::memcpy(buffer + used, data, length);
+    used += length;
+    return true;
+  }
+
+  bool put(char c) noexcept
+  {
+    if ((used == sizeof(buffer)) && (!flush())) {
+      return false;
+    }
+    buffer[used++] = c;
+    return true;
+  }
+
+  /**
+   * @brief Reserve space to format short text directly
+   */
+  char* reserve(std::size_t length) noexcept
+  {
+    if ((length > sizeof(buffer) - used) && (!flush())) {
+      return nullptr;
+    }
+    return buffer + used;
+  }
+
+  void commit(std::size_t length) noexcept { used += length; }
+
+  bool flush() noexcept
+  {
+    if (used == 0) {
+      return true;
+    }
+    const auto length = used;
+    used = 0;
+    return sink(context, buffer, length);
+  }
+
+private:
+  json_sink sink;
+  void* context;
+  std::size_t used = 0;
+  char buffer[4096];
+};
+
+const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/**
+ * @brief Format integer (two digits per step)
+ *
+ * @param dest Buffer with at least 20 bytes
+ * @return Length in bytes
+ */
+std::size_t format_integer(char* dest, std::int64_t value) noexcept
+{
+  char digits[20];
+  auto p = digits + sizeof(digits);
+  const bool negative = (value < 0);
+  auto magnitude = negative ? (~static_cast<std::uint64_t>(value) + 1) : static_cast<std::uint64_t>(value);
+  while (magnitude >= 100) {
+    const auto pair = static_cast<unsigned>(magnitude % 100) * 2;
+    magnitude /= 100;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  }
+  if (magnitude >= 10) {
+    const auto pair = static_cast<unsigned>(magnitude) * 2;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  } else {
+    *--p = static_cast<char>('0' + magnitude);
+  }
+  std::size_t length = 0;
+  if (negative) {
+    dest[length++] = '-';
+  }
+  const auto count = static_cast<std::size_t>(digits + sizeof(digits) - p);
+  std::memcpy(dest + length, p, count);
+  return length + count;
+}
+
+/**
+ * @brief Format finite double with the shortest precision that round-trips
+ *
+ * @param dest Buffer with at least 32 bytes
+ * @return Length in bytes
+ */
+std::size_t format_double(char* dest, double value) noexcept
+{
+  // Integral values in int64 range are formatted exactly
+  if ((value == std::floor(value)) && (std::fabs(value) < 9007199254740992.0)) {
+    auto length = format_integer(dest, static_cast<std::int64_t>(value));
+    if ((value == 0) && std::signbit(value)) {
+      dest[0] = '-';
+      dest[1] = '0';
+      length = 2;
+    }
+    dest[length++] = '.';
+    dest[length++] = '0';
+    return length;
+  }
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+  return static_cast<std::size_t>(std::to_chars(dest, dest + 32, value).ptr - dest);
+#else
+  int length = 0;
+  for (int precision = 15; precision <= 17; ++precision) {
+    length = std::snprintf(dest, 32, "%.*g", precision, value);
+    if (std::strtod(dest, nullptr) == value) {
+      break;
+    }
+  }
+  // Keep decimal point independent of locale
+  for (int i = 0; i < length; ++i) {
+    if (dest[i] == ',') {
+      dest[i] = '.';
+    }
+  }
+  return static_cast<std::size_t>(length);
+#endif
+}
+
+/**
+ * @brief Parse JSON number independently of locale
+ *
+ * @note std::strtod() expects the decimal point of LC_NUMERIC, so the copy
+ *       is rewritten to it when std::from_chars() is not available (or the
+ *       value is out of range, to keep std::strtod() results).
+ * @param text NUL-terminated copy of number (modified)
+ * @param length Length of number in bytes
+ */
+double parse_double(char* text, std::size_t length) noexcept
+{
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+  double value;
+  if (std::from_chars(text, text + length, value).ec == std::errc()) {
+    return value;
+  }
+#endif
+  const auto point = std::localeconv()->decimal_point;
+  if ((point[0] != '.') && (point[0] != '\0') && (point[1] == '\0')) {
+    for (std::size_t i = 0; i < length; ++i) {
+      if (text[i] == '.') {
+        text[i] = point[0];
+      }
+    }
+  }
+  return std::strtod(text, nullptr);
+}
+
+const char hex_digits[] = "0123456789abcdef";
+
+inline bool needs_escape(std::uint8_t c) noexcept
+{
+  return (c < 0x20) || (c == '"') || (c == '\\');
+}
+
+const std::uint8_t* skip_plain_scalar(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+  for (; begin < end; ++begin) {
+    if (needs_escape(*begin)) {
+      break;
+    }
+  }
+  return begin;
+}
+
+/**
+ * @brief Skip characters which need no escape (returns first one to escape or end)
+ */
+const std::uint8_t* skip_plain(const std::uint8_t* begin, const std::uint8_t* end) noexcept
+{
+#if defined(BSON_SIMD_SSE2)
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  const auto control = _mm_set1_epi8(0x1f);
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const auto hit = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+      _mm_cmpeq_epi8(_mm_max_epu8(block, control), control)
+    );
+    const auto mask = _mm_movemask_epi8(hit);
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+#elif defined(BSON_SIMD_NEON)
+  const auto quote = vdupq_n_u8('"');
+  const auto backslash = vdupq_n_u8('\\');
+  const auto control = vdupq_n_u8(0x20);
+  for (; end - begin >= 16; begin += 16) {
+    const auto block = vld1q_u8(begin);
+    const auto hit = vorrq_u8(vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash)),
+                              vcltq_u8(block, control));
+    if (vmaxvq_u8(hit)) {
+      return skip_plain_scalar(begin, begin + 16);
+    }
+  }
+#endif
+  return skip_plain_scalar(begin, end);
+}
+
+bool write_string(json_output& out, const char* data, std::size_t length) noexcept
+{
+  auto p = reinterpret_cast<const std::uint8_t*>(data);
+  const auto end = p + length;
+  if (!out.put('"')) {
+    return false;
+  }
+  while (p < end) {
+    const auto plain_end = skip_plain(p, end);
+    if ((plain_end != p) && (!out.write(reinterpret_cast<const char*>(p), plain_end - p))) {
+      return false;
+    }
+    if (plain_end == end) {
+      break;
+    }
+    char escape[6] = { '\\', 0, '0', '0', 0, 0 };
+    std::size_t escape_length = 2;
+    switch (*plain_end) {
+    case '"':  escape[1] = '"'; break;
+    case '\\': escape[1] = '\\'; break;
+    case '\b': escape[1] = 'b'; break;
+    case '\f': escape[1] = 'f'; break;
+    case '\n': escape[1] = 'n'; break;
+    case '\r': escape[1] = 'r'; break;
+    case '\t': escape[1] = 't'; break;
+    default:
+      escape[1] = 'u';
+      escape[4] = hex_digits[*plain_end >> 4];
+      escape[5] = hex_digits[*plain_end & 15];
+      escape_length = 6;
+      break;
+    }
+    if (!out.write(escape, escape_length)) {
+      return false;
+    }
+    p = plain_end + 1;
+  }
+  return out.put('"');
+}
+
+bool write_base64(json_output& out, const std::uint8_t* data, std::size_t length) noexcept
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char quad[4];
+  for (; length >= 3; data += 3, length -= 3) {
+    const std::uint32_t bits = (data[0] << 16) | (data[1] << 8) | data[2];
+    quad[0] = alphabet[bits >> 18];
+    quad[1] = alphabet[(bits >> 12) & 63];
+    quad[2] = alphabet[(bits >> 6) & 63];
+    quad[3] = alphabet[bits & 63];
+    if (!out.write(quad, 4)) {
+      return false;
+    }
+  }
+  if (length > 0) {
+    const std::uint32_t bits = (data[0] << 16) | ((length > 1) ? (data[1] << 8) : 0);
+    quad[0] = alphabet[bits >> 18];
+    quad[1] = alphabet[(bits >> 12) & 63];
+    quad[2] = (length > 1) ? alphabet[(bits >> 6) & 63] : '=';
+    quad[3] = '=';
+    return out.write(quad, 4);
+  }
+  return true;
+}
+
+template <std::size_t N>
+inline bool write_literal(json_output& out, const char (&text)[N]) noexcept
+{
+  return out.write(text, N - 1);
+}
+
+bool write_integer(json_output& out, std::int64_t value) noexcept
+{
+  const auto dest = out.reserve(20);
+  if (!dest) {
+    return false;
+  }
+  out.commit(format_integer(dest, value));
+  return true;
+}
+
+bool write_double(json_output& out, double value, json_mode mode) noexcept
+{
+  if (!std::isfinite(value)) {
+    const char* text = std::isnan(value) ? "NaN" : ((value > 0) ? "Infinity" : "-Infinity");
+    return write_literal(out, "{\"$numberDouble\":\"") &&
+           out.write(text, std::strlen(text)) && write_literal(out, "\"}");
+  }
+  if ((mode == json_mode::canonical) && (!write_literal(out, "{\"$numberDouble\":\""))) {
+    return false;
+  }
+  const auto dest = out.reserve(32);
+  if (!dest) {
+    return false;
+  }
+  out.commit(format_double(dest, value));
+  return (mode != json_mode::canonical) || write_literal(out, "\"}");
+}
+
+bool write_document(json_output& out, const reader& document, bool array,
+                    json_mode mode, std::size_t depth) noexcept;
+
+bool write_value(json_output& out, const reader::element& e, json_mode mode, std::size_t depth) noexcept
+{
+  switch (e.type()) {
+  case bson::type::fp64:
+    return write_double(out, e.as_double(), mode);
+  case bson::type::string: {
+    std::size_t length;
+    const auto string = e.as_string(length);
+    return write_string(out, string, length);
+  }
+  case bson::type::document:
+    return write_document(out, e.as_document(), false, mode, depth + 1);
+  case bson::type::array:
+    return write_document(out, e.as_array(), true, mode, depth + 1);
+  case bson::type::binary: {
+    std::size_t length;
+    bson::subtype subtype;
+    const auto data = static_cast<const std::uint8_t*>(e.as_binary(length, subtype));
+    const auto sub = static_cast<std::uint8_t>(subtype);
+    const char tail[] = { '"', ',', '"', 's', 'u', 'b', 'T', 'y', 'p', 'e', '"', ':', '"',
+                          hex_digits[sub >> 4], hex_digits[sub & 15], '"', '}', '}' };
+    return write_literal(out, "{\"$binary\":{\"base64\":\"") &&
+           write_base64(out, data, length) && out.write(tail, sizeof(tail));
+  }
+  case bson::type::undefined:
+    return write_literal(out, "{\"$undefined\":true}");
+  case bson::type::boolean:
+    return e.as_boolean() ? write_literal(out, "true") : write_literal(out, "false");
+  case bson::type::null:
+    return write_literal(out, "null");
+  case bson::type::int32:
+    if (mode == json_mode::canonical) {
+      return write_literal(out, "{\"$numberInt\":\"") &&
+             write_integer(out, e.as_int32()) && write_literal(out, "\"}");
+    }
+    return write_integer(out, e.as_int32());
+  case bson::type::int64:
+    if (mode == json_mode::canonical) {
+      return write_literal(out, "{\"$numberLong\":\"") &&
+             write_integer(out, e.as_int64()) && write_literal(out, "\"}");
+    }
+    return write_integer(out, e.as_int64());
+  }
+  // Unsupported type
+  return false;
+}
+
+bool write_document(json_output& out, const reader& document, bool array,
+                    json_mode mode, std::size_t depth) noexcept
+{
+  if (depth > json_max_depth) {
+    return false;
+  }
+  if (!out.put(array ? '[' : '{')) {
+    return false;
+  }
+  bool first = true;
+  auto it = document.cbegin();
+  for (; it != document.cend(); ++it) {
+    if ((!first) && (!out.put(','))) {
+      return false;
+    }
+    first = false;
+    if ((!array) &&
+        ((!write_string(out, it->name(), it->name_length())) || (!out.put(':')))) {
+      return false;
+    }
+    if (!write_value(out, *it, mode, depth)) {
+      return false;
+    }
+  }
+  return (!it.fail()) && out.put(array ? ']' : '}');
+}
+
+/**
+ * @brief Growable buffer used as json_sink
+ */
+struct json_buffer {
+  allocator* alloc;
+  char* data;
+  std::size_t length;
+  std::size_t capacity;
+
+  static bool append(void* context, const char* chunk, std::size_t size) noexcept
+  {
+    auto& self = *static_cast<json_buffer*>(context);
+    // Keep one byte for NUL
+    if (self.length + size + 1 > self.capacity) {
+      auto new_capacity = self.capacity ? self.capacity : 256;
+      while (self.length + size + 1 > new_capacity) {
+        new_capacity *= 2;
+      }
+      const auto new_data = static_cast<char*>(
+        self.data ? self.alloc->reallocate(self.data, self.capacity, new_capacity)
+                  : self.alloc->allocate(new_capacity)
+      );
+      if (!new_data) {
+        return false;
+      }
+      self.data = new_data;
+      self.capacity = new_capacity;
+    }
+    std::memcpy(self.data + self.length, chunk, size);
+    self.length += size;
+    return true;
+  }
+};
+
+/**
+ * @brief Growable scratch buffer for decoded strings
+ */
+class scratch_buffer {
+public:
+  explicit scratch_buffer(allocator& alloc) noexcept : alloc(alloc) {}
+
+  ~scratch_buffer() noexcept
+  {
+    if (data != inline_data) {
+      alloc.deallocate(data);
+    }
+  }
+
+  scratch_buffer(const scratch_buffer&) = delete;
+  scratch_buffer& operator =(const scratch_buffer&) = delete;
+
+  /**
+   * @brief Get space for length bytes (contents are kept)
+   */
+  char* reserve(std::size_t length) noexcept
+  {
+    if (length <= capacity) {
+      return data;
+    }
+    auto new_capacity = capacity * 2;
+    while (new_capacity < length) {
+      new_capacity *= 2;
+    }
+    const auto new_data = static_cast<char*>(
+      (data != inline_data) ? alloc.reallocate(data, capacity, new_capacity)
+                            : alloc.allocate(new_capacity)
+    );
+    if (!new_data) {
+      return nullptr;
+    }
+    if (data == inline_data) {
+      std::memcpy(new_data, inline_data, sizeof(inline_data));
+    }
+    data = new_data;
+    capacity = new_capacity;
+    return data;
+  }
+
+private:
+  allocator& alloc;
+  char inline_data[256];
+  char* data = inline_data;
+  std::size_t capacity = sizeof(inline_data);
+};
+
+const double exact_powers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * @brief Map of base64 characters (0xff for invalid)
+ */
+struct base64_table {
+  std::uint8_t values[256];
+
+  base64_table() noexcept
+  {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::memset(values, 0xff, sizeof(values));
+    for (int i = 0; i < 64; ++i) {
+      values[static_cast<std::uint8_t>(alphabet[i])] = static_cast<std::uint8_t>(i);
+    }
+  }
+};
+
+const base64_table base64_values;
+
+/**
+ * @brief Single pass JSON parser emitting into writer
+ */
+class json_parser {
+public:
+  json_parser(const char* text, std::size_t length, allocator& alloc) noexcept
+  : p(text), end(text + length), keys(alloc), values(alloc) {}
+
+  bool parse(writer& w) noexcept
+  {
+    skip_space();
+    if ((p == end) || (*p != '{') || (!parse_object(w, 0))) {
+      return false;
+    }
+    skip_space();
+    return p == end;
+  }
+
+private:
+  void skip_space() noexcept
+  {
+    while ((p < end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t'))) {
+      ++p;
+    }
+  }
+
+  bool consume(char c) noexcept
+  {
+    skip_space();
+    if ((p < end) && (*p == c)) {
+      ++p;
+      return true;
+    }
+    return false;
+  }
+
+  bool consume_literal(const char* literal, std::size_t length) noexcept
+  {
+    if ((static_cast<std::size_t>(end - p) < length) || (std::memcmp(p, literal, length) != 0)) {
+      return false;
+    }
+    p += length;
+    return true;
+  }
+
+  /**
+   * @brief Parse object at '{' into fields of w
+   */
+  bool parse_object(writer& w, std::size_t depth) noexcept
+  {
+    if (depth > json_max_depth) {
+      return false;
+    }
+    ++p;
+    if (consume('}')) {
+      return true;
+    }
+    do {
+      skip_space();
+      const char* name;
+      std::size_t name_length;
+      if ((!parse_string(&keys, name, name_length)) || (!consume(':'))) {
+        return false;
+      }
+      if ((name_length == 0) || (std::memchr(name, '\0', name_length))) {
+        // Not representable as BSON element name
+        return false;
+      }
+      if (!parse_value(w, key(name, name_length), depth)) {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}');
+  }
+
+  /**
+   * @brief Parse array at '[' into fields of w with index keys
+   */
+  bool parse_array(writer& w, std::size_t depth) noexcept
+  {
+    if (depth > json_max_depth) {
+      return false;
+    }
+    ++p;
+    if (consume(']')) {
+      return true;
+    }
+    std::size_t index = 0;
+    do {
+      char name[24];
+      const auto name_length = format_integer(name, static_cast<std::int64_t>(index++));
+      if (!parse_value(w, key(name, name_length), depth)) {
+        return false;
+      }
+    } while (consume(','));
+    return consume(']');
+  }
+
+  bool parse_value(writer& w, const key& name, std::size_t depth) noexcept
+  {
+    skip_space();
+    if (p == end) {
+      return false;
+    }
+    switch (*p) {
+    case '{': {
+      bool handled;
+      if (!parse_wrapper(w, name, handled)) {
+        return false;
+      }
+      if (handled) {
+        return true;
+      }
+      auto subdocument = w.add_document(name);
+      return subdocument.valid() && parse_object(subdocument, depth + 1);
+    }
+    case '[': {
+      auto subarray = w.add_array(name);
+      return subarray.valid() && parse_array(subarray, depth + 1);
+    }
+    case '"': {
+      const char* string;
+      std::size_t length;
+      return parse_string(&values, string, length) && w.add_string(name, string, length);
+    }
+    case 't':
+      return consume_literal("true", 4) && w.add_boolean(name, true);
+    case 'f':
+      return consume_literal("false", 5) && w.add_boolean(name, false);
+    case 'n':
+      return consume_literal("null", 4) && w.add_null(name);
+    default:
+      return parse_number(w, name);
+    }
+  }
+
+  /**
+   * @brief Parse string at '"' (decoded into scratch only if escaped)
+   *
+   * @param scratch Buffer for decoded string (nullptr to reject escapes)
+   */
+  bool parse_string(scratch_buffer* scratch, const char*& string, std::size_t& length) noexcept
+  {
+    if ((p == end) || (*p != '"')) {
+      return false;
+    }
+    const auto begin = reinterpret_cast<const std::uint8_t*>(++p);
+    const auto limit = reinterpret_cast<const std::uint8_t*>(end);
+    auto stop = skip_plain(begin, limit);
+    if ((stop < limit) && (*stop == '"')) {
+      // No escape
+      string = p;
+      length = stop - begin;
+      p = reinterpret_cast<const char*>(stop + 1);
+      return true;
+    }
+
+    if (!scratch) {
+      return false;
+    }
+    std::size_t used = 0;
+    char* dest;
+    auto source = begin;
+    for (;;) {
+      // Decoded escape sequence takes at most 4 bytes
+      dest = scratch->reserve(used + (stop - source) + 4);
+      if (!dest) {
+        return false;
+      }
+      std::memcpy(dest + used, source, stop - source);
+      used += stop - source;
+      if ((stop == limit) || (*stop < 0x20)) {
+        return false;
+      }
+      if (*stop == '"') {
+        break;
+      }
+      // Escape sequence
+      if (limit - stop < 2) {
+        return false;
+      }
+      source = stop + 2;
+      switch (stop[1]) {
+      case '"':  dest[used++] = '"'; break;
+      case '\\': dest[used++] = '\\'; break;
+      case '/':  dest[used++] = '/'; break;
+      case 'b':  dest[used++] = '\b'; break;
+      case 'f':  dest[used++] = '\f'; break;
+      case 'n':  dest[used++] = '\n'; break;
+      case 'r':  dest[used++] = '\r'; break;
+      case 't':  dest[used++] = '\t'; break;
+      case 'u': {
+        std::uint32_t code;
+        if (!parse_hex4(source, limit, code)) {
+          return false;
+        }
+        source += 4;
+        if ((code >= 0xd800) && (code < 0xdc00)) {
+          // Surrogate pair
+          std::uint32_t low;
+          if ((limit - source < 6) || (source[0] != '\\') || (source[1] != 'u') ||
+              (!parse_hex4(source + 2, limit, low)) || (low < 0xdc00) || (low >= 0xe000)) {
+            return false;
+          }
+          source += 6;
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        } else if ((code >= 0xdc00) && (code < 0xe000)) {
+          return false;
+        }
+        used += encode_utf8(dest + used, code);
+        break;
+      }
+      default:
+        return false;
+      }
+      stop = skip_plain(source, limit);
+    }
+    string = dest;
+    length = used;
+    p = reinterpret_cast<const char*>(stop + 1);
+    return true;
+  }
+
+  static bool parse_hex4(const std::uint8_t* source, const std::uint8_t* limit, std::uint32_t& code) noexcept
+  {
+    if (limit - source < 4) {
+      return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; ++i) {
+      const auto c = source[i];
+      std::uint32_t digit;
+      if ((c >= '0') && (c <= '9')) {
+        digit = c - '0';
+      } else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) {
+        digit = (c | 0x20) - 'a' + 10;
+      } else {
+        return false;
+      }
+      code = (code << 4) | digit;
+    }
+    return true;
+  }
+
+  static std::size_t encode_utf8(char* dest, std::uint32_t code) noexcept
+  {
+    if (code < 0x80) {
+      dest[0] = static_cast<char>(code);
+      return 1;
+    }
+    if (code < 0x800) {
+      dest[0] = static_cast<char>(0xc0 | (code >> 6));
+      dest[1] = static_cast<char>(0x80 | (code & 0x3f));
+      return 2;
+    }
+    if (code < 0x10000) {
+      dest[0] = static_cast<char>(0xe0 | (code >> 12));
+      dest[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      dest[2] = static_cast<char>(0x80 | (code & 0x3f));
+      return 3;
+    }
+    dest[0] = static_cast<char>(0xf0 | (code >> 18));
+    dest[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+    dest[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    dest[3] = static_cast<char>(0x80 | (code & 0x3f));
+    return 4;
+  }
+
+  /**
+   * @brief Scan JSON number
+   *
+   * @param integer Set if the number has neither fraction nor exponent
+   * @param mantissa Decimal digits (valid if digits <= 19)
+   * @param digits Number of significant digits
+   * @param exponent Decimal exponent applied to mantissa
+   */
+  bool scan_number(bool& negative, bool& integer, std::uint64_t& mantissa,
+                   int& digits, int& exponent) noexcept
+  {
+    negative = (p < end) && (*p == '-');
+    p += negative;
+    integer = true;
+    mantissa = 0;
+    digits = 0;
+    exponent = 0;
+    if ((p == end) || (*p < '0') || (*p > '9')) {
+      return false;
+    }
+    if (*p == '0') {
+      ++p;
+    } else {
+      for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+        } else {
+          ++exponent;
+        }
+        ++digits;
+      }
+    }
+    if ((p < end) && (*p == '.')) {
+      integer = false;
+      ++p;
+      if ((p == end) || (*p < '0') || (*p > '9')) {
+        return false;
+      }
+      for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+        if ((digits == 0) && (*p == '0')) {
+          // Leading zeros are not significant
+          --exponent;
+          continue;
+        }
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          --exponent;
+        }
+        ++digits;
+      }
+    }
+    if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+      integer = false;
+      ++p;
+      bool negative_exponent = false;
+      if ((p < end) && ((*p == '+') || (*p == '-'))) {
+        negative_exponent = (*p++ == '-');
+      }
+      if ((p == end) || (*p < '0') || (*p > '9')) {
+        return false;
+      }
+      int value = 0;
+      for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p) {
+        if (value < 100000) {
+          value = value * 10 + (*p - '0');
+        }
+      }
+      exponent += negative_exponent ? -value : value;
+    }
+    return true;
+  }
+
+  bool parse_number(writer& w, const key& name) noexcept
+  {
+    const auto begin = p;
+    bool negative, integer;
+    std::uint64_t mantissa;
+    int digits, exponent;
+    if (!scan_number(negative, integer, mantissa, digits, exponent)) {
+      return false;
+    }
+    if (integer && (digits <= 19)) {
+      const auto limit = negative ? (std::uint64_t(1) << 63) : ((std::uint64_t(1) << 63) - 1);
+      if (mantissa <= limit) {
+        const auto value = negative ? static_cast<std::int64_t>(~mantissa + 1)
+                                    : static_cast<std::int64_t>(mantissa);
+        if ((value >= INT32_MIN) && (value <= INT32_MAX)) {
+          return w.add_int32(name, static_cast<std::int32_t>(value));
+        }
+        return w.add_int64(name, value);
+      }
+    }
+    double value;
+    if (!to_double(begin, negative, mantissa, digits, exponent, value)) {
+      return false;
+    }
+    return w.add_double(name, value);
+  }
+
+  bool to_double(const char* begin, bool negative, std::uint64_t mantissa, int digits,
+                 int exponent, double& value) noexcept
+  {
+    if ((digits <= 15) && (exponent >= -22) && (exponent <= 22)) {
+      // Exact: both mantissa and power of ten are representable
+      value = static_cast<double>(mantissa);
+      value = (exponent < 0) ? (value / exact_powers[-exponent]) : (value * exact_powers[exponent]);
+      value = negative ? -value : value;
+      return true;
+    }
+    const auto length = static_cast<std::size_t>(p - begin);
+    const auto copy = values.reserve(length + 1);
+    if (!copy) {
+      return false;
+    }
+    std::memcpy(copy, begin, length);
+    copy[length] = '\0';
+    value = parse_double(copy, length);
+    return true;
+  }
+
+  /**
+   * @brief Parse Extended JSON wrapper object if the object at '{' is one
+   */
+  bool parse_wrapper(writer& w, const key& name, bool& handled) noexcept
+  {
+    handled = false;
+    const auto start = p;
+    ++p;
+    skip_space();
+    if ((end - p < 2) || (p[0] != '"') || (p[1] != '$')) {
+      p = start;
+      return true;
+    }
+    handled = true;
+    if (consume_literal("\"$numberInt\"", 12)) {
+      std::int64_t value;
+      return parse_wrapped_integer(value) && (value >= INT32_MIN) && (value <= INT32_MAX) &&
+             w.add_int32(name, static_cast<std::int32_t>(value));
+    }
+    if (consume_literal("\"$numberLong\"", 13)) {
+      std::int64_t value;
+      return parse_wrapped_integer(value) && w.add_int64(name, value);
+    }
+    if (consume_literal("\"$numberDouble\"", 15)) {
+      double value;
+      return parse_wrapped_double(value) && w.add_double(name, value);
+    }
+    if (consume_literal("\"$undefined\"", 12)) {
+      return consume(':') && (skip_space(), consume_literal("true", 4)) && consume('}') &&
+             w.add_undefined(name);
+    }
+    if (consume_literal("\"$binary\"", 9)) {
+      return parse_binary(w, name);
+    }
+    // Other keys starting with '$' are kept as a document
+    handled = false;
+    p = start;
+    return true;
+  }
+
+  /**
+   * @brief Parse ':"<number>"}' of wrapper
+   */
+  bool parse_wrapped_number(const char*& string, std::size_t& length) noexcept
+  {
+    if (!consume(':')) {
+      return false;
+    }
+    skip_space();
+    return parse_string(&values, string, length) && consume('}') && (length > 0);
+  }
+
+  bool parse_wrapped_integer(std::int64_t& value) noexcept
+  {
+    const char* string;
+    std::size_t length;
+    if (!parse_wrapped_number(string, length)) {
+      return false;
+    }
+    const auto saved_p = p;
+    const auto saved_end = end;
+    p = string;
+    end = string + length;
+    bool negative, integer;
+    std::uint64_t mantissa;
+    int digits, exponent;
+    const bool valid = scan_number(negative, integer, mantissa, digits, exponent) &&
+                       (p == end) && integer && (digits <= 19) &&
+                       (mantissa <= (negative ? (std::uint64_t(1) << 63) : ((std::uint64_t(1) << 63) - 1)));
+    p = saved_p;
+    end = saved_end;
+    if (valid) {
+      value = negative ? static_cast<std::int64_t>(~mantissa + 1) : static_cast<std::int64_t>(mantissa);
+    }
+    return valid;
+  }
+
+  bool parse_wrapped_double(double& value) noexcept
+  {
+    const char* string;
+    std::size_t length;
+    if (!parse_wrapped_number(string, length)) {
+      return false;
+    }
+    if ((length == 3) && (std::memcmp(string, "NaN", 3) == 0)) {
+      value = std::nan("");
+      return true;
+    }
+    if ((length == 8) && (std::memcmp(string, "Infinity", 8) == 0)) {
+      value = HUGE_VAL;
+      return true;
+    }
+    if ((length == 9) && (std::memcmp(string, "-Infinity", 9) == 0)) {
+      value = -HUGE_VAL;
+      return true;
+    }
+    const auto saved_p = p;
+    const auto saved_end = end;
+    p = string;
+    end = string + length;
+    bool negative, integer;
+    std::uint64_t mantissa;
+    int digits, exponent;
+    bool valid = scan_number(negative, integer, mantissa, digits, exponent) && (p == end);
+    if (valid) {
+      valid = to_double(string, negative, mantissa, digits, exponent, value);
+    }
+    p = saved_p;
+    end = saved_end;
+    return valid;
+  }
+
+  /**
+   * @brief Parse ':{"base64":"...","subType":"hh"}}' of $binary wrapper
+   */
+  bool parse_binary(writer& w, const key& name) noexcept
+  {
+    if ((!consume(':')) || (!consume('{'))) {
+      return false;
+    }
+    const char* data = nullptr;
+    std::size_t data_length = 0;
+    int subtype = -1;
+    do {
+      skip_space();
+      if (consume_literal("\"base64\"", 8)) {
+        skip_space();
+        if ((data) || (!consume(':')) || (skip_space(), !parse_string(nullptr, data, data_length))) {
+          return false;
+        }
+      } else if (consume_literal("\"subType\"", 9)) {
+        const char* hex;
+        std::size_t hex_length;
+        if ((subtype >= 0) || (!consume(':')) || (skip_space(), !parse_string(nullptr, hex, hex_length)) ||
+            (hex_length < 1) || (hex_length > 2)) {
+          return false;
+        }
+        std::uint32_t code;
+        const std::uint8_t padded[4] = {
+          '0', '0',
+          static_cast<std::uint8_t>((hex_length == 2) ? hex[0] : '0'),
+          static_cast<std::uint8_t>(hex[hex_length - 1]),
+        };
+        if (!parse_hex4(padded, padded + 4, code)) {
+          return false;
+        }
+        subtype = static_cast<int>(code);
+      } else {
+        return false;
+      }
+    } while (consume(','));
+    if ((!consume('}')) || (!consume('}')) || (!data) || (subtype < 0) || (data_length % 4)) {
+      return false;
+    }
+
+    // Decode base64 into element directly
+    auto padding = 0;
+    while ((padding < 2) && (data_length > 0) && (data[data_length - 1 - padding] == '=')) {
+      ++padding;
+    }
+    const auto length = data_length / 4 * 3 - padding;
+    auto dest = static_cast<std::uint8_t*>(
+      w.add_binary(name, length, static_cast<bson::subtype>(subtype))
+    );
+    if (!dest) {
+      return false;
+    }
+    const auto source = reinterpret_cast<const std::uint8_t*>(data);
+    for (std::size_t i = 0, j = 0; i < data_length; i += 4) {
+      std::uint32_t bits = 0;
+      for (std::size_t k = 0; k < 4; ++k) {
+        const auto c = source[i + k];
+        const auto v = base64_values.values[c];
+        if (v == 0xff) {
+          if ((c != '=') || (i + k < data_length - padding)) {
+            return false;
+          }
+        }
+        bits = (bits << 6) | ((v == 0xff) ? 0 : v);
+      }
+      for (std::size_t k = 0; (k < 3) && (j < length); ++k) {
+        dest[j++] = static_cast<std::uint8_t>(bits >> (16 - k * 8));
+      }
+    }
+    return true;
+  }
+
+private:
+  const char* p;
+  const char* end;
+  scratch_buffer keys;
+  scratch_buffer values;
+};
+
+} /* namespace */
+
+bool to_json(const reader& document, json_sink sink, void* context, json_mode mode) noexcept
+{
+  json_output out(sink, context);
+  return write_document(out, document, false, mode, 0) && out.flush();
+}
+
+char* to_json(const reader& document, std::size_t& length, json_mode mode, allocator& alloc) noexcept
+{
+  json_buffer buffer { &alloc, nullptr, 0, 0 };
+  if ((!to_json(document, &json_buffer::append, &buffer, mode)) ||
+      ((!buffer.data) && (!json_buffer::append(&buffer, "", 0)))) {
+    if (buffer.data) {
+      alloc.deallocate(buffer.data);
+    }
+    return nullptr;
+  }
+  buffer.data[buffer.length] = '\0';
+  length = buffer.length;
+  return buffer.data;
+}
+
+bool from_json(const char* text, std::size_t length, writer& w, allocator& alloc) noexcept
+{
+  json_parser parser(text, length, alloc);
+  return parser.parse(w);
+}
+
+} /* namespace bson */
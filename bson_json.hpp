@@ -0,0 +1,103 @@
+/**
+ * @file bson_json.hpp
+ * @brief Extended JSON serializer for BSON flat reader
+ */
+#ifndef _BSON_CPP11_BSON_JSON_HPP_
+#define _BSON_CPP11_BSON_JSON_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+/**
+ * @brief Output format of Extended JSON (MongoDB Extended JSON v2)
+ */
+enum class json_mode {
+  relaxed,    ///< Numbers as JSON numbers ({"$numberDouble"} only for non-finite values)
+  canonical,  ///< Type-preserving wrappers ({"$numberInt"}, {"$numberLong"}, {"$numberDouble"})
+};
+
+/**
+ * @brief Sink function receiving chunks of JSON text
+ *
+ * @param context Context pointer given to to_json()
+ * @param data Pointer to chunk (not NUL terminated)
+ * @param length Length of chunk in bytes
+ * @return false to abort serialization
+ */
+using json_sink = bool (*)(void* context, const char* data, std::size_t length);
+
+/**
+ * @brief Maximum nesting depth of to_json()
+ */
+constexpr std::size_t json_max_depth = 100;
+
+/**
+ * @brief Serialize document to JSON text in chunks
+ *
+ * @note Text is staged in a small internal buffer and passed to the sink
+ *       whenever it fills up, so no intermediate string of the whole document
+ *       is built. Strings are passed through as UTF-8.
+ * @code
+ * bson::to_json(r, [](void* fd, const char* data, std::size_t length) {
+ *   return write(*static_cast<int*>(fd), data, length) >= 0;
+ * }, &fd);
+ * @endcode
+ * @param document Reader of document
+ * @param sink Sink function
+ * @param context Context pointer for sink
+ * @param mode Output format
+ * @return false if the document is malformed, too deep, or the sink aborted
+ */
+bool to_json(const reader& document, json_sink sink, void* context,
+             json_mode mode = json_mode::relaxed) noexcept;
+
+/**
+ * @brief Serialize document to JSON text in chunks
+ *
+ * @param document Reader of document
+ * @param sink Function object callable as bool(const char* data, std::size_t length)
+ * @param mode Output format
+ */
+template <class Sink>
+bool to_json(const reader& document, Sink& sink, json_mode mode = json_mode::relaxed) noexcept
+{
+  return to_json(document, [](void* context, const char* data, std::size_t length) {
+    return (*static_cast<Sink*>(context))(data, length);
+  }, &sink, mode);
+}
+
+/**
+ * @brief Serialize document to allocated JSON text
+ *
+ * @note The text must be deallocated by alloc (std::free for the default allocator).
+ * @param document Reader of document
+ * @param length Reference to retrieve length in bytes (without NUL)
+ * @param mode Output format
+ * @param alloc Allocator to obtain growable buffer from
+ * @return NUL terminated text (nullptr if failed)
+ */
+char* to_json(const reader& document, std::size_t& length, json_mode mode = json_mode::relaxed,
+              allocator& alloc = allocator::get_default()) noexcept;
+
+/**
+ * @brief Parse JSON object and add its fields to writer
+ *
+ * @note Parsed in a single pass without intermediate tree. Integers are
+ *       stored as int32 or int64 by value range, other numbers as double
+ *       (parsed with '.' whatever the LC_NUMERIC locale). Array elements get keys "0", "1", ... Extended JSON wrappers
+ *       ($numberInt, $numberLong, $numberDouble, $binary, $undefined)
+ *       are converted to their types. On failure, fields added before
+ *       the error remain in the writer.
+ * @param text JSON text (NUL termination not required)
+ * @param length Length of text in bytes
+ * @param w Writer to add fields (root or subdocument)
+ * @param alloc Allocator for scratch buffer of escaped strings
+ * @return false if the text is malformed, not an object, too deep, or writer fails
+ */
+bool from_json(const char* text, std::size_t length, writer& w,
+               allocator& alloc = allocator::get_default()) noexcept;
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_JSON_HPP_ */
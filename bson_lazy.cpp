@@ -0,0 +1,173 @@
+/**
+ * @file bson_lazy.cpp
+ * @brief Lazily indexed document for repeated random access
+ */
+#include "bson_lazy.hpp"
+#include <cstring>
+#include <new>
+
+namespace bson {
+
+namespace {
+
+const std::size_t block_length = 4096;
+
+std::size_t hash_pointer(const void* pointer) noexcept
+{
+  const auto h = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(pointer)) * 0x9e3779b97f4a7c15ull;
+  return static_cast<std::size_t>(h ^ (h >> 32));
+}
+
+} /* namespace */
+
+const reader& lazy_document::view::source() const noexcept
+{
+  return target ? target->document : uncached;
+}
+
+reader::element lazy_document::view::find(const key& e_name) const noexcept
+{
+  if (!target) {
+    return uncached.find(e_name);
+  }
+  const auto index = target->index ? target->index : owner->materialize(*target);
+  if (!index) {
+    // No memory for index
+    return target->document.find(e_name);
+  }
+  return index->find(e_name);
+}
+
+lazy_document::view lazy_document::view::document(const key& e_name) const noexcept
+{
+  const auto e = find(e_name);
+  if ((!e.is_document()) && (!e.is_array())) {
+    return view();
+  }
+  const auto target = owner->get_child(e);
+  if (!target) {
+    // No memory for child: search it without caching
+    return view(owner, e.is_document() ? e.as_document() : e.as_array());
+  }
+  return view(owner, target);
+}
+
+lazy_document::lazy_document(const reader& source, allocator& alloc) noexcept
+: alloc(&alloc), top { source, nullptr }
+{
+}
+
+lazy_document::~lazy_document() noexcept
+{
+  while (blocks) {
+    const auto next = blocks->next;
+    alloc->deallocate(blocks);
+    blocks = next;
+  }
+}
+
+reader::element lazy_document::find(const path& e_path) noexcept
+{
+  if (!e_path.valid()) {
+    return reader::element();
+  }
+  auto current = root();
+  const auto last = e_path.size() - 1;
+  for (std::size_t i = 0; i < last; ++i) {
+    current = current.document(key(e_path[i].data, e_path[i].length));
+  }
+  return current.find(key(e_path[last].data, e_path[last].length));
+}
+
+void* lazy_document::allocate(std::size_t length) noexcept
+{
+  // Keep every allocation aligned for any scalar type
+  const auto align = alignof(std::max_align_t);
+  length = (length + align - 1) / align * align;
+  if ((!blocks) || (blocks->length - blocks->used < length)) {
+    const auto header = (sizeof(block) + align - 1) / align * align;
+    const auto size = (header + length > block_length) ? (header + length) : block_length;
+    const auto new_block = static_cast<block*>(alloc->allocate(size));
+    if (!new_block) {
+      return nullptr;
+    }
+    new_block->next = blocks;
+    new_block->length = size;
+    new_block->used = header;
+    blocks = new_block;
+    allocated += size;
+  }
+  const auto result = reinterpret_cast<std::uint8_t*>(blocks) + blocks->used;
+  blocks->used += length;
+  return result;
+}
+
+const indexed_reader* lazy_document::materialize(node& target) noexcept
+{
+  std::size_t fields = 0;
+  for (auto it = target.document.cbegin(); it != target.document.cend(); ++it) {
+    ++fields;
+  }
+  const auto capacity = indexed_reader::slots_for(fields);
+  const auto storage = allocate(sizeof(indexed_reader));
+  const auto table = static_cast<indexed_reader::slot*>(
+    allocate(sizeof(indexed_reader::slot) * capacity)
+  );
+  if ((!storage) || (!table)) {
+    return nullptr;
+  }
+  target.index = new (storage) indexed_reader(target.document, table, capacity);
+  ++indexed;
+  return target.index;
+}
+
+lazy_document::node* lazy_document::get_child(const reader::element& e) noexcept
+{
+  const auto e_name = e.name();
+  if (children) {
+    for (auto i = hash_pointer(e_name) & child_mask; children[i].e_name; i = (i + 1) & child_mask) {
+      if (children[i].e_name == e_name) {
+        return children[i].target;
+      }
+    }
+  }
+
+  // Grow table to keep load factor at most 50%
+  if ((child_count + 1) * 2 > child_mask + 1) {
+    const auto new_mask = children ? (child_mask << 1) | 1 : 15;
+    const auto new_children = static_cast<child*>(allocate(sizeof(child) * (new_mask + 1)));
+    if (!new_children) {
+      return nullptr;
+    }
+    for (std::size_t i = 0; i <= new_mask; ++i) {
+      new_children[i].e_name = nullptr;
+    }
+    for (std::size_t j = 0; children && (j <= child_mask); ++j) {
+      if (children[j].e_name) {
+        auto i = hash_pointer(children[j].e_name) & new_mask;
+        while (new_children[i].e_name) {
+          i = (i + 1) & new_mask;
+        }
+        new_children[i] = children[j];
+      }
+    }
+    children = new_children;
+    child_mask = new_mask;
+  }
+
+  const auto target = static_cast<node*>(allocate(sizeof(node)));
+  if (!target) {
+    return nullptr;
+  }
+  new (target) node { e.is_document() ? e.as_document() : e.as_array(), nullptr };
+  auto i = hash_pointer(e_name) & child_mask;
+  while (children[i].e_name) {
+    i = (i + 1) & child_mask;
+  }
+  children[i].e_name = e_name;
+  children[i].target = target;
+  ++child_count;
+  return target;
+}
+
+} /* namespace bson */
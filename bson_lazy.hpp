@@ -0,0 +1,186 @@
+/**
+ * @file bson_lazy.hpp
+ * @brief Lazily indexed document for repeated random access
+ */
+#ifndef _BSON_CPP11_BSON_LAZY_HPP_
+#define _BSON_CPP11_BSON_LAZY_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+/**
+ * @brief Document with field indexes materialized on demand
+ *
+ * @note A (sub)document is indexed by indexed_reader the first time a field
+ *       is looked up in it, and the index is kept until the lazy document is
+ *       destroyed. Untouched subdocuments stay as raw bytes. All indexes are
+ *       allocated from blocks owned by the lazy document. If allocation
+ *       fails, lookups fall back to linear search of the bytes. Not thread-safe.
+ *       The source buffer must outlive the lazy document.
+ *
+ * @code
+ * bson::lazy_document doc(r);
+ * auto user = doc.root().document("user");
+ * for (...) {
+ *   user.find("name");   // hashed lookup after the first call
+ * }
+ * @endcode
+ */
+class lazy_document {
+private:
+  struct node;
+
+public:
+  /**
+   * @brief Handle of (sub)document in lazy document
+   */
+  class view {
+  public:
+    /**
+     * @brief Construct an invalid view
+     */
+    view() noexcept {}
+
+    /**
+     * @brief Check if the view is valid
+     */
+    bool valid() const noexcept { return (target != nullptr) || uncached.valid(); }
+
+    /**
+     * @brief Check if the view is valid
+     */
+    operator bool() const noexcept { return valid(); }
+
+    /**
+     * @brief Get reader of (sub)document
+     */
+    const reader& source() const noexcept;
+
+    /**
+     * @brief Find a field
+     * 
+     * @note The first lookup builds the index of this (sub)document.
+     * @param e_name Element name to find
+     */
+    reader::element find(const char* e_name) const noexcept
+    {
+      return find(key(e_name, std::strlen(e_name)));
+    }
+
+    /**
+     * @brief Find a field
+     * 
+     * @param e_name Element name with length
+     */
+    reader::element find(const key& e_name) const noexcept;
+
+    /**
+     * @brief Get view of embedded document or array
+     * 
+     * @param e_name Element name to find
+     * @return Invalid view if not found or not document / array
+     */
+    view document(const char* e_name) const noexcept
+    {
+      return document(key(e_name, std::strlen(e_name)));
+    }
+
+    /**
+     * @brief Get view of embedded document or array
+     * 
+     * @param e_name Element name with length
+     * @return Invalid view if not found or not document / array
+     */
+    view document(const key& e_name) const noexcept;
+
+  private:
+    view(lazy_document* owner, node* target) noexcept : owner(owner), target(target) {}
+
+    view(lazy_document* owner, const reader& document) noexcept : owner(owner), uncached(document) {}
+
+    friend class lazy_document;
+
+  private:
+    lazy_document* owner = nullptr;
+    node* target = nullptr;
+    reader uncached = reader(nullptr, 0);  ///< Document searched linearly (when target is nullptr)
+  };
+
+  /**
+   * @brief Construct a new lazy document
+   * 
+   * @param source Reader of root document
+   * @param alloc Allocator to obtain blocks from (must outlive the lazy document)
+   */
+  explicit lazy_document(const reader& source,
+                         allocator& alloc = allocator::get_default()) noexcept;
+
+  /**
+   * @brief Destroy the lazy document (all indexes are deallocated)
+   */
+  ~lazy_document() noexcept;
+
+  // Prohibit copying and moving
+  lazy_document(const lazy_document&) = delete;
+  lazy_document& operator =(const lazy_document&) = delete;
+
+  /**
+   * @brief Get view of root document
+   */
+  view root() noexcept { return view(this, &top); }
+
+  /**
+   * @brief Find a nested field through cached indexes
+   * 
+   * @param e_path Compiled path to find
+   */
+  reader::element find(const path& e_path) noexcept;
+
+  /**
+   * @brief Get number of indexed (sub)documents
+   */
+  std::size_t materialized() const noexcept { return indexed; }
+
+  /**
+   * @brief Get bytes allocated for indexes
+   */
+  std::size_t footprint() const noexcept { return allocated; }
+
+private:
+  struct node {
+    reader document;
+    const indexed_reader* index;  ///< nullptr until first lookup
+  };
+
+  struct child {
+    const char* e_name;  ///< Element name (identifies the subdocument)
+    node* target;
+  };
+
+  struct block {
+    block* next;
+    std::size_t length;
+    std::size_t used;
+  };
+
+  void* allocate(std::size_t length) noexcept;
+
+  const indexed_reader* materialize(node& target) noexcept;
+
+  node* get_child(const reader::element& e) noexcept;
+
+private:
+  allocator* alloc;
+  node top;
+  block* blocks = nullptr;
+  child* children = nullptr;        ///< Open addressing table of subdocument nodes
+  std::size_t child_mask = 0;
+  std::size_t child_count = 0;
+  std::size_t indexed = 0;
+  std::size_t allocated = 0;
+};
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_LAZY_HPP_ */
@@ -0,0 +1,234 @@
+/**
+ * @file bson_mapped.cpp
+ * @brief Memory-mapped file of concatenated BSON documents
+ */
+#include "bson_mapped.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bson {
+
+namespace {
+
+/**
+ * @brief Header of sidecar index file
+ */
+struct index_header {
+  char magic[8];
+  std::uint64_t file_length;
+  std::uint64_t count;
+};
+
+const char index_magic[8] = { 'B', 'S', 'O', 'N', 'I', 'D', 'X', '1' };
+
+int to_advice(mapped_file::access hint) noexcept
+{
+  switch (hint) {
+  case mapped_file::access::sequential:
+    return MADV_SEQUENTIAL;
+  case mapped_file::access::random:
+    return MADV_RANDOM;
+  default:
+    return MADV_NORMAL;
+  }
+}
+
+} /* namespace */
+
+void mapped_file::const_iterator::check() noexcept
+{
+  if (position >= end_position) {
+    position = end_position;
+    length = 0;
+    return;
+  }
+  const auto total = reader::query_size(position, end_position - position);
+  if ((total < 5) || (static_cast<std::size_t>(total) > static_cast<std::size_t>(end_position - position))) {
+    // Invalid document terminates iteration
+    position = end_position;
+    length = 0;
+    return;
+  }
+  length = total;
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept
+: alloc(other.alloc), base(other.base), length(other.length), opened(other.opened),
+  offsets(other.offsets), index_count(other.index_count), index_capacity(other.index_capacity)
+{
+  other.base = nullptr;
+  other.length = 0;
+  other.opened = false;
+  other.offsets = nullptr;
+  other.index_count = 0;
+  other.index_capacity = 0;
+}
+
+bool mapped_file::open(const char* path, access hint, bool huge_pages) noexcept
+{
+  close();
+  const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if ((::fstat(fd, &st) != 0) || (st.st_size < 0)) {
+    ::close(fd);
+    return false;
+  }
+  length = static_cast<std::size_t>(st.st_size);
+  if (length > 0) {
+    void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      ::close(fd);
+      length = 0;
+      return false;
+    }
+    base = static_cast<const std::uint8_t*>(mapped);
+  }
+  ::close(fd);
+  opened = true;
+  (void)advise(hint);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages && base) {
+    // Best effort (depends on kernel and filesystem support)
+    (void)::madvise(const_cast<std::uint8_t*>(base), length, MADV_HUGEPAGE);
+  }
+#else
+  (void)huge_pages;
+#endif
+  return true;
+}
+
+void mapped_file::close() noexcept
+{
+  if (base) {
+    ::munmap(const_cast<std::uint8_t*>(base), length);
+    base = nullptr;
+  }
+  length = 0;
+  opened = false;
+  if (offsets) {
+    alloc->deallocate(offsets);
+    offsets = nullptr;
+  }
+  index_count = 0;
+  index_capacity = 0;
+}
+
+bool mapped_file::advise(access hint) noexcept
+{
+  if (!base) {
+    return opened;
+  }
+  return (::madvise(const_cast<std::uint8_t*>(base), length, to_advice(hint)) == 0);
+}
+
+bool mapped_file::build_index() noexcept
+{
+  index_count = 0;
+  if (!opened) {
+    return false;
+  }
+  std::size_t offset = 0;
+  for (auto it = cbegin(); it != cend(); ++it) {
+    if ((index_count == index_capacity) &&
+        (!reserve_index(index_capacity ? (index_capacity * 2) : 1024))) {
+      return false;
+    }
+    offset = it.position - base;
+    offsets[index_count++] = offset;
+    offset += it.length;
+  }
+  // Iteration stops early at invalid document
+  return (offset == length);
+}
+
+bool mapped_file::save_index(const char* path) const noexcept
+{
+  if (!opened) {
+    return false;
+  }
+  std::FILE* file = std::fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  index_header header;
+  std::memcpy(header.magic, index_magic, sizeof(header.magic));
+  header.file_length = length;
+  header.count = index_count;
+  bool result = (std::fwrite(&header, sizeof(header), 1, file) == 1) &&
+                (std::fwrite(offsets, sizeof(*offsets), index_count, file) == index_count);
+  if (std::fclose(file) != 0) {
+    result = false;
+  }
+  return result;
+}
+
+bool mapped_file::load_index(const char* path) noexcept
+{
+  index_count = 0;
+  if (!opened) {
+    return false;
+  }
+  std::FILE* file = std::fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  index_header header;
+  bool result = (std::fread(&header, sizeof(header), 1, file) == 1) &&
+                (std::memcmp(header.magic, index_magic, sizeof(header.magic)) == 0) &&
+                (header.file_length == length) &&
+                (header.count <= length / 5) &&
+                reserve_index(header.count) &&
+                (std::fread(offsets, sizeof(*offsets), header.count, file) == header.count);
+  std::fclose(file);
+  if (!result) {
+    return false;
+  }
+
+  // Offsets must be increasing and leave room for the smallest document
+  for (std::size_t i = 0; i < header.count; ++i) {
+    if ((offsets[i] + 5 > length) || ((i > 0) && (offsets[i] < offsets[i - 1] + 5))) {
+      return false;
+    }
+  }
+  index_count = header.count;
+  return true;
+}
+
+reader mapped_file::doc(std::size_t position) const noexcept
+{
+  if (position >= index_count) {
+    return reader(nullptr, 0);
+  }
+  const auto offset = offsets[position];
+  const auto total = reader::query_size(base + offset, length - offset);
+  if ((total < 5) || (static_cast<std::size_t>(total) > length - offset)) {
+    return reader(nullptr, 0);
+  }
+  return reader(base + offset, total);
+}
+
+bool mapped_file::reserve_index(std::size_t capacity) noexcept
+{
+  if (index_capacity >= capacity) {
+    return true;
+  }
+  const auto bytes = capacity * sizeof(*offsets);
+  auto new_offsets = static_cast<std::uint64_t*>(
+    offsets ? alloc->reallocate(offsets, index_capacity * sizeof(*offsets), bytes) : alloc->allocate(bytes)
+  );
+  if (!new_offsets) {
+    return false;
+  }
+  offsets = new_offsets;
+  index_capacity = capacity;
+  return true;
+}
+
+} /* namespace bson */
@@ -0,0 +1,245 @@
+/**
+ * @file bson_mapped.hpp
+ * @brief Memory-mapped file of concatenated BSON documents
+ */
+#ifndef _BSON_CPP11_BSON_MAPPED_HPP_
+#define _BSON_CPP11_BSON_MAPPED_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+/**
+ * @brief Read-only memory-mapped file of concatenated BSON documents
+ *        (e.g. mongodump output)
+ *
+ * @note Documents are returned as reader views into the mapping (no copy).
+ *       Sequential scans use the iterator; random access requires
+ *       build_index() or load_index() first.
+ *
+ * @code
+ * bson::mapped_file f;
+ * if (f.open("dump.bson", bson::mapped_file::access::sequential)) {
+ *   for (auto doc : f) {
+ *     // use doc
+ *   }
+ * }
+ * @endcode
+ */
+class mapped_file {
+public:
+  /**
+   * @brief Access pattern hint (passed to madvise)
+   */
+  enum class access {
+    normal,
+    sequential,
+    random,
+  };
+
+  /**
+   * @brief Iterator of documents
+   */
+  class const_iterator : public std::iterator<std::forward_iterator_tag, reader, std::ptrdiff_t, const reader*, reader> {
+  public:
+    /**
+     * @brief Construct a new const_iterator (end)
+     */
+    const_iterator() noexcept {}
+
+    /**
+     * @brief Get current document
+     */
+    reader operator*() const noexcept
+    {
+      return reader(position, length);
+    }
+
+    /**
+     * @brief Advance to next document (Pre-increment)
+     */
+    const_iterator& operator++() noexcept
+    {
+      position += length;
+      check();
+      return *this;
+    }
+
+    /**
+     * @brief Advance to next document (Post-increment)
+     */
+    const_iterator operator++(int) noexcept
+    {
+      const_iterator old = *this;
+      this->operator++();
+      return old;
+    }
+
+    /**
+     * @brief Compare (!=) two iterators
+     * 
+     * @param other Another iterator
+     */
+    bool operator!=(const const_iterator& other) const noexcept
+    {
+      return (position != other.position);
+    }
+
+    /**
+     * @brief Compare (==) two iterators
+     * 
+     * @param other Another iterator
+     */
+    bool operator==(const const_iterator& other) const noexcept
+    {
+      return !this->operator!=(other);
+    }
+
+  private:
+    const_iterator(const std::uint8_t* position, const std::uint8_t* end) noexcept
+    : position(position), end_position(end)
+    {
+      check();
+    }
+
+    void check() noexcept;
+
+    friend class mapped_file;
+
+  private:
+    const std::uint8_t* position = nullptr;
+    const std::uint8_t* end_position = nullptr;
+    std::size_t length = 0;
+  };
+
+  using iterator = const_iterator;
+
+public:
+  /**
+   * @brief Construct a new mapped file (closed)
+   * 
+   * @param alloc Allocator for offset index
+   */
+  explicit mapped_file(allocator& alloc = allocator::get_default()) noexcept : alloc(&alloc) {}
+
+  /**
+   * @brief Construct a new mapped file (move)
+   * 
+   * @param other Another mapped file
+   */
+  mapped_file(mapped_file&& other) noexcept;
+
+  /**
+   * @brief Destroy the mapped file
+   */
+  ~mapped_file() noexcept { close(); }
+
+  /**
+   * @brief Open and map file
+   * 
+   * @param path Path of file
+   * @param hint Access pattern hint
+   * @param huge_pages Request transparent huge pages for the mapping
+   */
+  bool open(const char* path, access hint = access::normal, bool huge_pages = false) noexcept;
+
+  /**
+   * @brief Unmap file and discard index
+   */
+  void close() noexcept;
+
+  /**
+   * @brief Check if the file is open
+   */
+  bool is_open() const noexcept { return opened; }
+
+  /**
+   * @brief Change access pattern hint
+   * 
+   * @param hint Access pattern hint
+   */
+  bool advise(access hint) noexcept;
+
+  /**
+   * @brief Get pointer to mapped data
+   */
+  const void* data() const noexcept { return base; }
+
+  /**
+   * @brief Get length of file in bytes
+   */
+  std::size_t size() const noexcept { return length; }
+
+  /**
+   * @brief Build offset index by walking length prefixes
+   * 
+   * @return false if allocation failed or the file has an invalid document
+   *         (documents before it are indexed)
+   */
+  bool build_index() noexcept;
+
+  /**
+   * @brief Save offset index to sidecar file
+   * 
+   * @param path Path of sidecar file
+   */
+  bool save_index(const char* path) const noexcept;
+
+  /**
+   * @brief Load offset index from sidecar file
+   * 
+   * @note The index is rejected if it was built for a file of different length
+   *       or has out-of-range offsets.
+   * @param path Path of sidecar file
+   */
+  bool load_index(const char* path) noexcept;
+
+  /**
+   * @brief Get number of indexed documents
+   */
+  std::size_t count() const noexcept { return index_count; }
+
+  /**
+   * @brief Get indexed document
+   * 
+   * @param position Index of document
+   * @return Invalid reader if out of range
+   */
+  reader doc(std::size_t position) const noexcept;
+
+  /**
+   * @brief Return an iterator to the beginning
+   */
+  iterator begin() const noexcept { return cbegin(); }
+
+  /**
+   * @brief Return an iterator to the end
+   */
+  iterator end() const noexcept { return cend(); }
+
+  /**
+   * @brief Return an iterator to the beginning (const)
+   */
+  const_iterator cbegin() const noexcept { return const_iterator(base, base + length); }
+
+  /**
+   * @brief Return an iterator to the end (const)
+   */
+  const_iterator cend() const noexcept { return const_iterator(base + length, base + length); }
+
+private:
+  bool reserve_index(std::size_t capacity) noexcept;
+
+private:
+  allocator* alloc;
+  const std::uint8_t* base = nullptr;
+  std::size_t length = 0;
+  bool opened = false;
+  std::uint64_t* offsets = nullptr;
+  std::size_t index_count = 0;
+  std::size_t index_capacity = 0;
+};
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_MAPPED_HPP_ */
@@ -0,0 +1,143 @@
+/**
+ * @file bson_parallel.cpp
+ * @brief Parallel scan over collections of BSON documents
+ */
+#include "bson_parallel.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace bson {
+
+namespace {
+
+const std::size_t max_batch = 0xffffffffu;
+
+inline std::uint64_t pack(std::uint64_t lo, std::uint64_t hi) noexcept
+{
+  return (hi << 32) | lo;
+}
+
+inline std::size_t low(std::uint64_t bounds) noexcept
+{
+  return static_cast<std::size_t>(bounds & 0xffffffffu);
+}
+
+inline std::size_t high(std::uint64_t bounds) noexcept
+{
+  return static_cast<std::size_t>(bounds >> 32);
+}
+
+} /* namespace */
+
+constexpr unsigned parallel_scheduler::max_workers;
+
+unsigned parallel_scheduler::default_workers() noexcept
+{
+  const auto concurrency = std::thread::hardware_concurrency();
+  return std::min(std::max(concurrency, 1u), max_workers);
+}
+
+parallel_scheduler::parallel_scheduler(std::size_t count, unsigned workers, std::size_t grain) noexcept
+: count(count), grain(std::max<std::size_t>(grain, 1)),
+  worker_count(workers ? std::min(workers, max_workers) : default_workers())
+{
+  assign(0);
+}
+
+bool parallel_scheduler::next(unsigned worker, std::size_t& begin, std::size_t& end) noexcept
+{
+  auto& own = ranges[worker].bounds;
+  for (;;) {
+    auto bounds = own.load();
+    const auto lo = low(bounds);
+    const auto hi = high(bounds);
+    if (lo < hi) {
+      const auto taken = std::min(grain, hi - lo);
+      if (own.compare_exchange_weak(bounds, pack(lo + taken, hi))) {
+        begin = batch_begin + lo;
+        end = begin + taken;
+        return true;
+      }
+      continue;
+    }
+    if (!steal(worker)) {
+      return false;
+    }
+  }
+}
+
+bool parallel_scheduler::steal(unsigned worker) noexcept
+{
+  for (unsigned i = 1; i < worker_count; ++i) {
+    auto& victim = ranges[(worker + i) % worker_count].bounds;
+    auto bounds = victim.load();
+    for (;;) {
+      const auto lo = low(bounds);
+      const auto hi = high(bounds);
+      if (hi - lo < 2) {
+        // Remaining item (if any) is left to the owner
+        break;
+      }
+      const auto middle = lo + (hi - lo) / 2;
+      if (victim.compare_exchange_weak(bounds, pack(lo, middle))) {
+        // Own range is empty here, so no other thief can be modifying it
+        ranges[worker].bounds.store(pack(middle, hi));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void parallel_scheduler::assign(std::size_t batch_begin) noexcept
+{
+  this->batch_begin = batch_begin;
+  const auto batch = std::min(count - batch_begin, max_batch);
+  for (unsigned i = 0; i < max_workers; ++i) {
+    if (i < worker_count) {
+      const auto lo = static_cast<std::uint64_t>(batch) * i / worker_count;
+      const auto hi = static_cast<std::uint64_t>(batch) * (i + 1) / worker_count;
+      ranges[i].bounds.store(pack(lo, hi));
+    } else {
+      ranges[i].bounds.store(0);
+    }
+  }
+}
+
+void parallel_scheduler::run(void (*task)(void* context, unsigned worker), void* context) noexcept
+{
+  while (batch_begin < count) {
+    std::thread threads[max_workers - 1];
+    unsigned started = 1;
+    while ((started < worker_count) && start(threads[started - 1], task, context, started)) {
+      ++started;
+    }
+
+    // Workers whose threads were not started run on the calling thread
+    for (unsigned i = started; i < worker_count; ++i) {
+      task(context, i);
+    }
+    task(context, 0);
+    for (unsigned i = 1; i < started; ++i) {
+      threads[i - 1].join();
+    }
+    const auto next_begin = batch_begin + std::min(count - batch_begin, max_batch);
+    if (next_begin >= count) {
+      break;
+    }
+    assign(next_begin);
+  }
+}
+
+bool parallel_scheduler::start(std::thread& thread, void (*task)(void* context, unsigned worker),
+                               void* context, unsigned worker) noexcept
+{
+  try {
+    thread = std::thread(task, context, worker);
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+
+} /* namespace bson */
@@ -0,0 +1,236 @@
+/**
+ * @file bson_parallel.hpp
+ * @brief Parallel scan over collections of BSON documents
+ */
+#ifndef _BSON_CPP11_BSON_PARALLEL_HPP_
+#define _BSON_CPP11_BSON_PARALLEL_HPP_
+
+#include "bson_flat.hpp"
+#include <mutex>
+#include <thread>
+
+namespace bson {
+
+/**
+ * @brief Work-stealing scheduler over index range [0, count)
+ *
+ * @note Each worker owns a contiguous range and takes chunks of `grain` items
+ *       from its front. An idle worker steals the back half of another
+ *       worker's range, so uneven document sizes do not leave workers idle.
+ *       Ranges are packed into one 64-bit atomic per worker, so batches are
+ *       limited to 2^32-1 items; larger counts are processed in batches.
+ */
+class parallel_scheduler {
+public:
+  /**
+   * @brief Maximum number of workers
+   */
+  static constexpr unsigned max_workers = 64;
+
+  /**
+   * @brief Get default number of workers (hardware concurrency)
+   */
+  static unsigned default_workers() noexcept;
+
+  /**
+   * @brief Construct a new scheduler
+   * 
+   * @param count Number of items
+   * @param workers Number of workers (0 for default_workers())
+   * @param grain Number of items taken at once
+   */
+  parallel_scheduler(std::size_t count, unsigned workers = 0, std::size_t grain = 16) noexcept;
+
+  /**
+   * @brief Destroy the scheduler
+   */
+  virtual ~parallel_scheduler() noexcept = default;
+
+  /**
+   * @brief Get number of workers
+   */
+  unsigned workers() const noexcept { return worker_count; }
+
+  /**
+   * @brief Get next range for worker
+   * 
+   * @param worker Worker index
+   * @param begin Reference to store first index
+   * @param end Reference to store last index (exclusive)
+   * @return false if no work left
+   */
+  bool next(unsigned worker, std::size_t& begin, std::size_t& end) noexcept;
+
+  /**
+   * @brief Run task on all workers and wait for completion
+   * 
+   * @note The calling thread runs worker 0. If a thread cannot be created,
+   *       the calling thread also runs that worker and the following ones
+   *       (before worker 0), so every item is processed. The task is called
+   *       once per worker for each batch of 2^32-1 items.
+   * @param task Function called with (context, worker index)
+   * @param context Context passed to task
+   */
+  void run(void (*task)(void* context, unsigned worker), void* context) noexcept;
+
+  /**
+   * @brief Run callable on all workers and wait for completion
+   * 
+   * @param task Callable with (unsigned worker)
+   */
+  template <class Task>
+  void run(Task& task) noexcept
+  {
+    run(&invoke<Task>, &task);
+  }
+
+protected:
+  /**
+   * @brief Start thread running task for worker
+   *
+   * @note Override to simulate thread creation failure.
+   * @param thread Reference to store started thread
+   * @param task Function called with (context, worker index)
+   * @param context Context passed to task
+   * @param worker Worker index
+   * @return false if the thread could not be created
+   */
+  virtual bool start(std::thread& thread, void (*task)(void* context, unsigned worker),
+                     void* context, unsigned worker) noexcept;
+
+private:
+  template <class Task>
+  static void invoke(void* context, unsigned worker)
+  {
+    (*static_cast<Task*>(context))(worker);
+  }
+
+  bool steal(unsigned worker) noexcept;
+
+  void assign(std::size_t batch_begin) noexcept;
+
+private:
+  struct alignas(64) range {
+    std::atomic<std::uint64_t> bounds;
+  };
+
+  range ranges[max_workers];
+  std::size_t count;
+  std::size_t grain;
+  std::size_t batch_begin = 0;
+  unsigned worker_count;
+};
+
+/**
+ * @brief Reduce documents in parallel
+ *
+ * @note Each worker accumulates into its own copy of identity, and the
+ *       per-worker results are merged by combine at the end (in unspecified
+ *       order, so combine must be associative and commutative).
+ * @tparam Collection Type with count() and doc(std::size_t) returning reader
+ *         (e.g. bson::mapped_file after build_index())
+ * @param collection Collection of documents (shared read-only)
+ * @param identity Initial value of each worker
+ * @param accumulate Function (T& local, const reader& doc, std::size_t index)
+ * @param combine Function (T& total, const T& local)
+ * @param workers Number of workers (0 for default)
+ * @param grain Number of documents taken at once
+ */
+template <class Collection, class T, class Accumulate, class Combine>
+T parallel_reduce(const Collection& collection, const T& identity, Accumulate accumulate,
+                  Combine combine, unsigned workers = 0, std::size_t grain = 16)
+{
+  parallel_scheduler scheduler(collection.count(), workers, grain);
+  T total(identity);
+  std::mutex lock;
+  auto task = [&](unsigned worker) {
+    T local(identity);
+    std::size_t begin, end;
+    while (scheduler.next(worker, begin, end)) {
+      for (auto i = begin; i < end; ++i) {
+        accumulate(local, collection.doc(i), i);
+      }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    combine(total, local);
+  };
+  scheduler.run(task);
+  return total;
+}
+
+/**
+ * @brief Call function for each document in parallel
+ * 
+ * @param collection Collection of documents (shared read-only)
+ * @param function Function (const reader& doc, std::size_t index) called concurrently
+ * @param workers Number of workers (0 for default)
+ * @param grain Number of documents taken at once
+ */
+template <class Collection, class Function>
+void parallel_for_each(const Collection& collection, Function function,
+                       unsigned workers = 0, std::size_t grain = 16)
+{
+  parallel_scheduler scheduler(collection.count(), workers, grain);
+  auto task = [&](unsigned worker) {
+    std::size_t begin, end;
+    while (scheduler.next(worker, begin, end)) {
+      for (auto i = begin; i < end; ++i) {
+        function(collection.doc(i), i);
+      }
+    }
+  };
+  scheduler.run(task);
+}
+
+/**
+ * @brief Count documents matching predicate in parallel
+ * 
+ * @param collection Collection of documents (shared read-only)
+ * @param predicate Function (const reader& doc) returning bool
+ * @param workers Number of workers (0 for default)
+ * @param grain Number of documents taken at once
+ */
+template <class Collection, class Predicate>
+std::size_t parallel_count(const Collection& collection, Predicate predicate,
+                           unsigned workers = 0, std::size_t grain = 16)
+{
+  return parallel_reduce(
+    collection, std::size_t(0),
+    [&](std::size_t& local, const reader& doc, std::size_t) { local += predicate(doc) ? 1 : 0; },
+    [](std::size_t& total, std::size_t local) { total += local; },
+    workers, grain
+  );
+}
+
+/**
+ * @brief Select documents matching predicate in parallel
+ * 
+ * @param collection Collection of documents (shared read-only)
+ * @param predicate Function (const reader& doc) returning bool
+ * @param indexes Array to store matched indexes in ascending order
+ *        (at least collection.count() elements, used as scratch)
+ * @param workers Number of workers (0 for default)
+ * @param grain Number of documents taken at once
+ * @return Number of matched documents
+ */
+template <class Collection, class Predicate>
+std::size_t parallel_filter(const Collection& collection, Predicate predicate, std::size_t* indexes,
+                            unsigned workers = 0, std::size_t grain = 16)
+{
+  const auto none = static_cast<std::size_t>(-1);
+  parallel_for_each(collection, [&](const reader& doc, std::size_t i) {
+    indexes[i] = predicate(doc) ? i : none;
+  }, workers, grain);
+  std::size_t matched = 0;
+  const auto count = collection.count();
+  for (std::size_t i = 0; i < count; ++i) {
+    if (indexes[i] != none) {
+      indexes[matched++] = indexes[i];
+    }
+  }
+  return matched;
+}
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_PARALLEL_HPP_ */
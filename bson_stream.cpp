@@ -0,0 +1,147 @@
+/**
+ * @file bson_stream.cpp
+ * @brief Streaming document framer for BSON flat reader
+ */
+#include "bson_stream.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace bson {
+
+constexpr std::size_t stream_reader::default_max_document_size;
+
+stream_reader::stream_reader(std::size_t max_document_size, allocator& alloc) noexcept
+: alloc(&alloc),
+  max_document_size(std::min<std::size_t>(std::max<std::size_t>(max_document_size, 5), INT32_MAX))
+{
+}
+
+stream_reader::stream_reader(stream_reader&& other) noexcept
+: alloc(other.alloc), max_document_size(other.max_document_size),
+  chunk(other.chunk), chunk_length(other.chunk_length), chunk_offset(other.chunk_offset),
+  carry(other.carry), carry_capacity(other.carry_capacity), carry_length(other.carry_length),
+  failed(other.failed)
+{
+  other.chunk = nullptr;
+  other.chunk_length = 0;
+  other.chunk_offset = 0;
+  other.carry = nullptr;
+  other.carry_capacity = 0;
+  other.carry_length = 0;
+}
+
+stream_reader::~stream_reader() noexcept
+{
+  if (carry) {
+    alloc->deallocate(carry);
+  }
+}
+
+bool stream_reader::feed(const void* chunk, std::size_t length) noexcept
+{
+  if (failed || (chunk_offset < chunk_length)) {
+    return false;
+  }
+  this->chunk = static_cast<const std::uint8_t*>(chunk);
+  chunk_length = length;
+  chunk_offset = 0;
+  return true;
+}
+
+reader stream_reader::next() noexcept
+{
+  if (failed) {
+    return reader(nullptr, 0);
+  }
+  auto available = chunk_length - chunk_offset;
+  int total;
+  if (carry_length > 0) {
+    // Complete the document straddling chunk boundary
+    if (carry_length < 4) {
+      const auto part = std::min<std::size_t>(4 - carry_length, available);
+      std::memcpy(carry + carry_length, chunk + chunk_offset, part);
+      carry_length += part;
+      chunk_offset += part;
+      available -= part;
+      if (carry_length < 4) {
+        return reader(nullptr, 0);
+      }
+    }
+    total = reader::query_size(carry, carry_length);
+    if ((total < 5) || (static_cast<std::size_t>(total) > max_document_size) || (!reserve(total))) {
+      failed = true;
+      return reader(nullptr, 0);
+    }
+    const auto part = std::min<std::size_t>(total - carry_length, available);
+    std::memcpy(carry + carry_length, chunk + chunk_offset, part);
+    carry_length += part;
+    chunk_offset += part;
+    if (carry_length < static_cast<std::size_t>(total)) {
+      return reader(nullptr, 0);
+    }
+    carry_length = 0;
+    return reader(carry, total);
+  }
+
+  if (available == 0) {
+    return reader(nullptr, 0);
+  }
+  total = reader::query_size(chunk + chunk_offset, available);
+  if (total < 0) {
+    // Length field straddles chunk boundary
+    stash(4);
+    return reader(nullptr, 0);
+  }
+  if ((total < 5) || (static_cast<std::size_t>(total) > max_document_size)) {
+    failed = true;
+    return reader(nullptr, 0);
+  }
+  if (available < static_cast<std::size_t>(total)) {
+    stash(total);
+    return reader(nullptr, 0);
+  }
+  const auto document = chunk + chunk_offset;
+  chunk_offset += total;
+  return reader(document, total);
+}
+
+void stream_reader::reset() noexcept
+{
+  chunk = nullptr;
+  chunk_length = 0;
+  chunk_offset = 0;
+  carry_length = 0;
+  failed = false;
+}
+
+bool stream_reader::stash(std::size_t required) noexcept
+{
+  if (!reserve(required)) {
+    failed = true;
+    return false;
+  }
+  carry_length = chunk_length - chunk_offset;
+  std::memcpy(carry, chunk + chunk_offset, carry_length);
+  chunk_offset = chunk_length;
+  return true;
+}
+
+bool stream_reader::reserve(std::size_t required) noexcept
+{
+  if (carry_capacity >= required) {
+    return true;
+  }
+  auto new_capacity = std::max<std::size_t>(std::max<std::size_t>(carry_capacity * 2, 64), required);
+  new_capacity = std::min(new_capacity, max_document_size);
+  auto new_carry = static_cast<std::uint8_t*>(
+    carry ? alloc->reallocate(carry, carry_capacity, new_capacity) : alloc->allocate(new_capacity)
+  );
+  if (!new_carry) {
+    return false;
+  }
+  carry = new_carry;
+  carry_capacity = new_capacity;
+  return true;
+}
+
+} /* namespace bson */
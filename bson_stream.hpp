@@ -0,0 +1,113 @@
+/**
+ * @file bson_stream.hpp
+ * @brief Streaming document framer for BSON flat reader
+ */
+#ifndef _BSON_CPP11_BSON_STREAM_HPP_
+#define _BSON_CPP11_BSON_STREAM_HPP_
+
+#include "bson_flat.hpp"
+
+namespace bson {
+
+/**
+ * @brief Framer of BSON documents in byte stream
+ *
+ * @note Chunks are not copied. Documents entirely inside a chunk are
+ *       returned as views into the chunk. Only a document straddling chunk
+ *       boundaries is assembled in the internal carry buffer.
+ *
+ * @code
+ * bson::stream_reader s;
+ * while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+ *   s.feed(chunk, n);
+ *   while (auto doc = s.next()) {
+ *     // use doc
+ *   }
+ *   if (s.fail()) {
+ *     // invalid or too large document
+ *   }
+ * }
+ * @endcode
+ */
+class stream_reader {
+public:
+  /**
+   * @brief Default maximum document length (16 MiB, same as MongoDB)
+   */
+  static constexpr std::size_t default_max_document_size = 16 * 1024 * 1024;
+
+  /**
+   * @brief Construct a new stream reader
+   * 
+   * @param max_document_size Maximum document length in bytes
+   * @param alloc Allocator for carry buffer
+   */
+  explicit stream_reader(std::size_t max_document_size = default_max_document_size,
+                         allocator& alloc = allocator::get_default()) noexcept;
+
+  /**
+   * @brief Construct a new stream reader (move)
+   * 
+   * @param other Another stream reader
+   */
+  stream_reader(stream_reader&& other) noexcept;
+
+  /**
+   * @brief Destroy the stream reader
+   */
+  ~stream_reader() noexcept;
+
+  /**
+   * @brief Feed a chunk of stream
+   * 
+   * @note The chunk must be kept until next() returns an invalid reader.
+   * @param chunk Pointer to chunk
+   * @param length Length of chunk
+   * @return false if the previous chunk is not consumed yet or the stream failed
+   */
+  bool feed(const void* chunk, std::size_t length) noexcept;
+
+  /**
+   * @brief Get next complete document
+   * 
+   * @note The returned reader refers to the chunk or the carry buffer and
+   *       is valid until the next call of next() or feed().
+   * @return Invalid reader if more data is required or the stream failed
+   */
+  reader next() noexcept;
+
+  /**
+   * @brief Check if the stream failed (invalid or too large document)
+   */
+  bool fail() const noexcept { return failed; }
+
+  /**
+   * @brief Get length of incomplete document held in carry buffer
+   */
+  std::size_t buffered() const noexcept { return carry_length; }
+
+  /**
+   * @brief Discard all buffered data and clear failure
+   */
+  void reset() noexcept;
+
+private:
+  bool stash(std::size_t required) noexcept;
+
+  bool reserve(std::size_t required) noexcept;
+
+private:
+  allocator* alloc;
+  std::size_t max_document_size;
+  const std::uint8_t* chunk = nullptr;
+  std::size_t chunk_length = 0;
+  std::size_t chunk_offset = 0;
+  std::uint8_t* carry = nullptr;
+  std::size_t carry_capacity = 0;
+  std::size_t carry_length = 0;
+  bool failed = false;
+};
+
+} /* namespace bson */
+
+#endif  /* _BSON_CPP11_BSON_STREAM_HPP_ */
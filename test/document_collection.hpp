@@ -0,0 +1,47 @@
+/**
+ * @file document_collection.hpp
+ * @brief Collection of documents in one buffer (shared by tests and benchmarks)
+ */
+#ifndef _BSON_CPP11_TEST_DOCUMENT_COLLECTION_HPP_
+#define _BSON_CPP11_TEST_DOCUMENT_COLLECTION_HPP_
+
+#include <cstdint>
+#include <vector>
+#include "../bson_flat.hpp"
+
+/**
+ * @brief Collection of documents in one buffer
+ *
+ * @note Provides count() and doc(std::size_t) like bson::mapped_file, so it
+ *       can be passed to the parallel helpers and bson::project().
+ */
+class document_collection {
+public:
+  /**
+   * @brief Append copy of document
+   *
+   * @param w Writer holding document
+   */
+  void add(const bson::writer& w)
+  {
+    const std::uint8_t* bytes;
+    std::size_t length;
+    if (w.get_bytes(bytes, length)) {
+      offsets.push_back(buffer.size());
+      buffer.insert(buffer.end(), bytes, bytes + length);
+    }
+  }
+
+  std::size_t count() const noexcept { return offsets.size(); }
+
+  bson::reader doc(std::size_t i) const noexcept
+  {
+    return bson::reader(buffer.data() + offsets[i], buffer.size() - offsets[i]);
+  }
+
+private:
+  std::vector<std::uint8_t> buffer;
+  std::vector<std::size_t> offsets;
+};
+
+#endif  /* _BSON_CPP11_TEST_DOCUMENT_COLLECTION_HPP_ */
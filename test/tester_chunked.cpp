@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../bson_chunked.hpp"
+
+namespace {
+
+template <class Document>
+void write_sample(Document& w, const std::vector<std::uint8_t>& blob)
+{
+  w.add_int32("a", 1);
+  w.add_string("s", "string straddling chunk boundaries");
+  {
+    auto d = w.add_document("d");
+    d.add_double("f", 0.5);
+    {
+      auto e = d.add_array("e");
+      e.add_int64("0", -1);
+      e.add_null("1");
+    }
+    d.add_binary("b", blob.data(), blob.size(), bson::subtype::user_defined);
+  }
+  w.add_true("t");
+  w.add_int64("i", 1234567890123);
+}
+
+std::string flatten(bson::chunked_writer& w)
+{
+  std::size_t length;
+  const auto bytes = w.flatten(length);
+  if (!bytes) {
+    return "(failed)";
+  }
+  std::string result(reinterpret_cast<const char*>(bytes), length);
+  std::free(bytes);
+  return result;
+}
+
+std::string bytes_of(const bson::writer& w)
+{
+  const std::uint8_t* bytes;
+  std::size_t length;
+  if (!w.get_bytes(bytes, length)) {
+    return "(invalid)";
+  }
+  return std::string(reinterpret_cast<const char*>(bytes), length);
+}
+
+} /* namespace */
+
+TEST(chunked_writer, same_bytes_as_writer)
+{
+  const std::vector<std::uint8_t> blob(40, 0x5a);
+  bson::writer expected;
+  write_sample(expected, blob);
+  const auto reference = bytes_of(expected);
+
+  // Every chunk length moves headers to other positions across boundaries
+  for (std::size_t chunk_length = 16; chunk_length <= 48; ++chunk_length) {
+    bson::chunked_writer w(chunk_length);
+    write_sample(w, blob);
+    ASSERT_EQ(reference.size(), w.size()) << chunk_length;
+    ASSERT_LT(1u, w.chunks()) << chunk_length;
+
+    const bson::chunked_writer::fragment* fragments;
+    std::size_t count;
+    ASSERT_TRUE(w.get_fragments(fragments, count)) << chunk_length;
+    std::string joined;
+    for (std::size_t i = 0; i < count; ++i) {
+      // Binary element "b" (3 + 4 + 1 + 40) with terminators of d and root
+      ASSERT_LE(fragments[i].length, std::max<std::size_t>(chunk_length, blob.size() + 10));
+      joined.append(static_cast<const char*>(fragments[i].data), fragments[i].length);
+    }
+    ASSERT_EQ(reference, joined) << chunk_length;
+    ASSERT_EQ(reference, flatten(w)) << chunk_length;
+  }
+}
+
+TEST(chunked_writer, append_after_output)
+{
+  bson::chunked_writer w(16);
+  bson::writer expected;
+  ASSERT_TRUE(w.add_int32("a", 1));
+  ASSERT_TRUE(expected.add_int32("a", 1));
+  const auto first = flatten(w);
+  ASSERT_EQ(bytes_of(expected), first);
+
+  // Terminator written for output is overwritten by the next element
+  ASSERT_TRUE(w.add_string("b", "more text"));
+  ASSERT_TRUE(expected.add_string("b", "more text"));
+  const auto second = flatten(w);
+  ASSERT_EQ(bytes_of(expected), second);
+  ASSERT_TRUE(bson::reader(second.data(), second.size()).validate().valid());
+  ASSERT_EQ(std::string("more text"), bson::reader(second.data(), second.size()).find("b").as_string());
+}
+
+TEST(chunked_writer, large_value)
+{
+  const std::vector<std::uint8_t> blob(100000, 0x33);
+  bson::chunked_writer w(64);
+  ASSERT_TRUE(w.add_int32("a", 1));
+  ASSERT_TRUE(w.add_binary("b", blob.data(), blob.size()));
+  ASSERT_TRUE(w.add_int32("c", 2));
+
+  // The value gets a chunk of its own size instead of many small chunks
+  ASSERT_GE(3u, w.chunks());
+  const auto bytes = flatten(w);
+  const bson::reader r(bytes.data(), bytes.size());
+  ASSERT_TRUE(r.validate().valid());
+  const void* data;
+  std::size_t length;
+  ASSERT_TRUE(r.find("b").get_binary(data, length));
+  ASSERT_EQ(blob.size(), length);
+  ASSERT_EQ(0, std::memcmp(blob.data(), data, length));
+  ASSERT_EQ(2, r.find("c").as_int32());
+}
+
+TEST(chunked_writer, open_subdocument)
+{
+  bson::chunked_writer w(16);
+  const bson::chunked_writer::fragment* fragments;
+  std::size_t count;
+  std::size_t length;
+  {
+    auto d = w.add_document("d");
+    ASSERT_TRUE(d.valid());
+    ASSERT_FALSE(w.valid());
+    ASSERT_FALSE(w.add_int32("a", 1));
+    ASSERT_FALSE(w.get_fragments(fragments, count));
+    ASSERT_EQ(nullptr, w.flatten(length));
+    {
+      auto e = d.add_document("e");
+      ASSERT_FALSE(d.add_int32("x", 1));
+      ASSERT_TRUE(e.add_int32("y", 2));
+    }
+    ASSERT_TRUE(d.add_int32("x", 1));
+  }
+  ASSERT_TRUE(w.valid());
+  const auto bytes = flatten(w);
+  ASSERT_EQ(2, bson::reader(bytes.data(), bytes.size()).find(bson::path("d.e.y")).as_int32());
+
+  // Parent closed before its subdocument: the document cannot be completed
+  {
+    auto d = w.add_document("f");
+    auto e = d.add_document("g");
+    bson::chunked_document moved(std::move(d));
+    ASSERT_TRUE(e.valid());
+  }
+  ASSERT_FALSE(w.valid());
+  ASSERT_FALSE(w.get_fragments(fragments, count));
+}
+
+TEST(chunked_writer, no_memory)
+{
+  // Room for the first chunk only
+  std::uint8_t region[256];
+  bson::arena_allocator arena(region, sizeof(region));
+  bson::chunked_writer w(128, arena);
+  ASSERT_TRUE(w.valid());
+  ASSERT_TRUE(w.add_int32("a", 1));
+  const std::string text(200, 'x');
+  ASSERT_FALSE(w.add_string("s", text.c_str()));
+
+  // Failed element leaves the document intact
+  ASSERT_TRUE(w.valid());
+  const bson::chunked_writer::fragment* fragments;
+  std::size_t count;
+  ASSERT_TRUE(w.get_fragments(fragments, count));
+  ASSERT_EQ(1u, count);
+  bson::writer expected;
+  ASSERT_TRUE(expected.add_int32("a", 1));
+  ASSERT_EQ(bytes_of(expected), std::string(static_cast<const char*>(fragments[0].data), fragments[0].length));
+
+  bson::arena_allocator empty(region, 0);
+  bson::chunked_writer failed(128, empty);
+  ASSERT_FALSE(failed.valid());
+  ASSERT_FALSE(failed.add_int32("a", 1));
+  ASSERT_FALSE(failed.get_fragments(fragments, count));
+}
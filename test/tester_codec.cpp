@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../bson_codec.hpp"
+
+namespace app {
+
+struct point {
+  std::int32_t x = 0;
+  std::int32_t y = 0;
+};
+BSON_FIELDS(point, x, y)
+
+struct shape {
+  std::string name;
+  bool closed = false;
+  double scale = 1.0;
+  std::int64_t id = 0;
+  point origin;
+  std::vector<point> vertices;
+  std::vector<std::int32_t> tags;
+  std::vector<std::vector<std::string>> labels;
+};
+BSON_FIELDS(shape, name, closed, scale, id, origin, vertices, tags, labels)
+
+} /* namespace app */
+
+TEST(codec, round_trip)
+{
+  app::shape s;
+  s.name = "triangle";
+  s.closed = true;
+  s.scale = 2.5;
+  s.id = 1LL << 40;
+  s.origin.x = -1;
+  s.origin.y = 2;
+  s.vertices.resize(3);
+  for (int i = 0; i < 3; ++i) {
+    s.vertices[i].x = i;
+    s.vertices[i].y = i * 10;
+  }
+  s.tags = { 7, 8, 9 };
+  s.labels = { { "a", "b" }, {}, { "c" } };
+
+  bson::writer w;
+  ASSERT_TRUE(bson::encode(w, s));
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  bson::reader r(bytes, length);
+  ASSERT_STREQ("triangle", r.find("name").as_string());
+  ASSERT_EQ(2, r.find(bson::path("origin.y")).as_int32());
+  ASSERT_EQ(20, r.find(bson::path("vertices.2.y")).as_int32());
+  ASSERT_EQ(9, r.find(bson::path("tags.2")).as_int32());
+  ASSERT_STREQ("c", r.find(bson::path("labels.2.0")).as_string());
+
+  app::shape d;
+  ASSERT_TRUE(bson::decode(r, d));
+  ASSERT_EQ(s.name, d.name);
+  ASSERT_EQ(s.closed, d.closed);
+  ASSERT_EQ(s.scale, d.scale);
+  ASSERT_EQ(s.id, d.id);
+  ASSERT_EQ(-1, d.origin.x);
+  ASSERT_EQ(2, d.origin.y);
+  ASSERT_EQ(3u, d.vertices.size());
+  ASSERT_EQ(20, d.vertices[2].y);
+  ASSERT_EQ(s.tags, d.tags);
+  ASSERT_EQ(s.labels, d.labels);
+}
+
+TEST(codec, decode_order)
+{
+  // Reordered, unknown and missing fields; int32 widened to int64 / double
+  bson::writer w;
+  w.add_int32("id", 5);
+  w.add_string("unknown", "ignored");
+  w.add_int32("scale", 3);
+  w.add_string("name", "n");
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  app::shape d;
+  d.tags = { 1 };
+  ASSERT_TRUE(bson::decode(bson::reader(bytes, length), d));
+  ASSERT_EQ(5, d.id);
+  ASSERT_EQ(3.0, d.scale);
+  ASSERT_EQ("n", d.name);
+  ASSERT_EQ(std::vector<std::int32_t>{ 1 }, d.tags);
+
+  // Incompatible type
+  bson::writer v;
+  v.add_string("x", "1");
+  ASSERT_TRUE(v.get_bytes(bytes, length));
+  app::point p;
+  ASSERT_FALSE(bson::decode(bson::reader(bytes, length), p));
+
+  // Malformed document
+  const std::uint8_t broken[] = { 0x0c, 0x00, 0x00, 0x00, 0x10, 0x78, 0x00, 0x01, 0x00 };
+  ASSERT_FALSE(bson::decode(bson::reader(broken, sizeof(broken)), p));
+}
+
+TEST(codec, fixed_buffer_full)
+{
+  app::shape s;
+  s.name = std::string(64, 'x');
+  std::uint8_t buffer[32];
+  bson::writer w(buffer, sizeof(buffer));
+  ASSERT_FALSE(bson::encode(w, s));
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+#include "../bson_columnar.hpp"
+#include "document_collection.hpp"
+
+TEST(projection, project)
+{
+  document_collection docs;
+  for (std::int32_t i = 0; i < 1000; ++i) {
+    bson::writer w;
+    w.add_string("name", "item");
+    if (i % 10 == 3) {
+      // Different field order
+      w.add_int64("qty", i);
+      w.add_double("price", i * 0.5);
+    } else {
+      if (i % 7 != 0) {
+        w.add_double("price", i * 0.5);
+      }
+      if (i % 5 == 0) {
+        w.add_string("qty", "none");
+      } else {
+        w.add_int32("qty", i);
+      }
+    }
+    docs.add(w);
+  }
+
+  for (unsigned workers : { 1u, 3u }) {
+    bson::projection columns({ { "price" }, { "qty", bson::type::int64 }, { "ts" } });
+    ASSERT_TRUE(columns.valid());
+    ASSERT_TRUE(bson::project(docs, columns, workers, 1));
+    ASSERT_EQ(1000u, columns.rows());
+    ASSERT_EQ(3u, columns.columns());
+    ASSERT_EQ(nullptr, columns[0].int64());
+    ASSERT_EQ(nullptr, columns[1].fp64());
+
+    const auto price = columns[0].fp64();
+    const auto qty = columns[1].int64();
+    std::size_t price_nulls = 0;
+    std::size_t qty_nulls = 0;
+    for (std::int32_t i = 0; i < 1000; ++i) {
+      const bool has_price = (i % 10 == 3) || (i % 7 != 0);
+      const bool has_qty = (i % 10 == 3) || (i % 5 != 0);
+      ASSERT_EQ(!has_price, columns[0].is_null(i)) << i;
+      ASSERT_EQ(has_price ? i * 0.5 : 0, price[i]) << i;
+      ASSERT_EQ(!has_qty, columns[1].is_null(i)) << i;
+      ASSERT_EQ(has_qty ? i : 0, qty[i]) << i;
+      ASSERT_TRUE(columns[2].is_null(i));
+      price_nulls += has_price ? 0 : 1;
+      qty_nulls += has_qty ? 0 : 1;
+    }
+    ASSERT_EQ(price_nulls, columns[0].null_count(1000));
+    ASSERT_EQ(qty_nulls, columns[1].null_count(1000));
+    ASSERT_EQ(1000u, columns[2].null_count(1000));
+  }
+
+  // Invalid columns
+  ASSERT_FALSE(bson::projection({ { "name", bson::type::string } }).valid());
+  ASSERT_FALSE(bson::projection(nullptr, 0).valid());
+  bson::projection invalid(nullptr, 0);
+  ASSERT_FALSE(bson::project(docs, invalid));
+}
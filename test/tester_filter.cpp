@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <clocale>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../bson_filter.hpp"
+
+namespace {
+
+bson::reader make_reader(bson::writer& w)
+{
+  const std::uint8_t* bytes;
+  std::size_t length;
+  return w.get_bytes(bytes, length) ? bson::reader(bytes, length) : bson::reader(nullptr, 0);
+}
+
+} /* namespace */
+
+TEST(filter, match)
+{
+  bson::writer w;
+  w.add_string("status", "ok");
+  w.add_int32("latency", 150);
+  w.add_double("ratio", 0.25);
+  w.add_int64("big", INT64_MAX);
+  w.add_boolean("cached", false);
+  w.add_null("owner");
+  {
+    auto user = w.add_document("user");
+    user.add_string("name", "alice");
+    {
+      auto tags = user.add_array("tags");
+      tags.push_string("a");
+      tags.push_string("b");
+    }
+  }
+  const auto doc = make_reader(w);
+  ASSERT_TRUE(doc.valid());
+
+  const struct {
+    const char* expression;
+    bool expected;
+  } cases[] = {
+    { "status == \"ok\" && latency > 100", true },
+    { "status == \"ok\" && latency > 200", false },
+    { "status != \"ok\" || latency >= 150", true },
+    { "latency == 150.0 && latency < 150.5 && latency <= 150", true },
+    { "ratio > 0 && ratio < 1 && ratio == 0.25", true },
+    { "big == 9223372036854775807 && big > 9223372036854775806", true },
+    { "big < -9223372036854775808", false },
+    { "cached == false && !(cached == true) && owner == null", true },
+    { "status < \"okay\" && status > \"o\" && status >= \"ok\"", true },
+    { "user.name == \"alice\" && user.tags.1 == \"b\"", true },
+    { "exists(user.tags.0) && !exists(user.tags.2) && !exists(missing)", true },
+    { "missing == 1", false },
+    { "missing != 1", true },
+    { "status > 1 || latency == \"150\"", false },
+    { "!(status == \"ok\" && (latency < 100 || ratio > 0.5))", true },
+    { "latency>100&&status==\"ok\"", true },
+  };
+  for (const auto& c : cases) {
+    bson::filter f(c.expression);
+    ASSERT_TRUE(f.valid()) << c.expression << " at " << f.error_position();
+    ASSERT_EQ(c.expected, f.match(doc)) << c.expression;
+    ASSERT_EQ(c.expected, f(doc)) << c.expression;
+  }
+
+  // Invalid document never matches
+  const bson::reader invalid(nullptr, 0);
+  ASSERT_FALSE(bson::filter("missing != 1").match(invalid));
+  ASSERT_FALSE(bson::filter("!(status == \"ok\")").match(invalid));
+  ASSERT_FALSE(bson::filter("status == \"ok\"").match(invalid));
+
+  // Malformed element stops traversal: later fields are not missing
+  const std::uint8_t truncated[] = { 0x09, 0x00, 0x00, 0x00, 0x10, 0x78, 0x00, 0x01, 0x00 };
+  const bson::reader short_doc(truncated, sizeof(truncated));
+  ASSERT_FALSE(bson::filter("x != 1").match(short_doc));
+  ASSERT_FALSE(bson::filter("!(x == 1)").match(short_doc));
+  ASSERT_FALSE(bson::filter("!exists(x)").match(short_doc));
+  {
+    bson::writer w;
+    ASSERT_TRUE(w.add_int32("x", 1));
+    ASSERT_TRUE(w.add_int32("y", 2));
+    {
+      auto d = w.add_document("d");
+      ASSERT_TRUE(d.add_int32("v", 3));
+    }
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_TRUE(w.get_bytes(bytes, length));
+    std::vector<std::uint8_t> corrupted(bytes, bytes + length);
+    ASSERT_TRUE(bson::filter("x == 1 && y != 3 && d.v == 3").match(bson::reader(corrupted.data(), length)));
+    corrupted[4 + 7] = 0x42;  // Type of y
+    ASSERT_FALSE(bson::filter("x == 1 && y != 2").match(bson::reader(corrupted.data(), length)));
+    ASSERT_FALSE(bson::filter("x == 1 && !exists(d)").match(bson::reader(corrupted.data(), length)));
+    ASSERT_TRUE(bson::filter("x == 1").match(bson::reader(corrupted.data(), length)));
+    corrupted.assign(bytes, bytes + length);
+    corrupted[4 + 7 + 7 + 7] = 0x42;  // Type of d.v
+    ASSERT_FALSE(bson::filter("d.w != 1").match(bson::reader(corrupted.data(), length)));
+  }
+}
+
+TEST(filter, locale)
+{
+  const char* selected = nullptr;
+  for (auto name : { "de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8", "de_DE", "fr_FR" }) {
+    if (std::setlocale(LC_NUMERIC, name)) {
+      selected = name;
+      break;
+    }
+  }
+  if (!selected) {
+    GTEST_SKIP() << "no locale with comma decimal point";
+  }
+  const bson::filter f("x > 1.25 && x < +1.75");
+  std::setlocale(LC_NUMERIC, "C");
+  ASSERT_TRUE(f.valid()) << selected;
+  bson::writer inside, below;
+  ASSERT_TRUE(inside.add_double("x", 1.5));
+  ASSERT_TRUE(below.add_double("x", 1.2));
+  ASSERT_TRUE(f.match(make_reader(inside))) << selected;
+  ASSERT_FALSE(f.match(make_reader(below))) << selected;
+}
+
+TEST(filter, compile_errors)
+{
+  const struct {
+    const char* expression;
+    std::size_t position;
+  } cases[] = {
+    { "", 0 },
+    { "status", 6 },
+    { "status ==", 9 },
+    { "status == \"ok", 13 },
+    { "status == ok", 10 },
+    { "a == 1 &&", 9 },
+    { "(a == 1", 7 },
+    { "a == 1)", 6 },
+    { "a..b == 1", 2 },
+    { "a < true", 8 },
+    { "a >= null", 9 },
+    { "a == 1x", 6 },
+    { "exists(a", 8 },
+  };
+  for (const auto& c : cases) {
+    bson::filter f;
+    ASSERT_FALSE(f.compile(c.expression)) << c.expression;
+    ASSERT_FALSE(f.valid()) << c.expression;
+    ASSERT_EQ(c.position, f.error_position()) << c.expression;
+    ASSERT_FALSE(f.match(bson::reader(nullptr, 0)));
+  }
+
+  // Limits
+  std::string deep(bson::filter::max_depth, '(');
+  deep += "a == 1";
+  deep += std::string(bson::filter::max_depth, ')');
+  ASSERT_FALSE(bson::filter(deep.c_str()).valid());
+  std::string many = "a == 1";
+  for (std::size_t i = 0; i < bson::filter::max_literals; ++i) {
+    many += " || a == 1";
+  }
+  ASSERT_FALSE(bson::filter(many.c_str()).valid());
+
+  // Recompile after failure
+  bson::filter f;
+  ASSERT_FALSE(f.compile("a =="));
+  ASSERT_TRUE(f.compile("a == 1 && b == 2"));
+  ASSERT_EQ(3u, f.size());
+}
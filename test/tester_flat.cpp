@@ -2,6 +2,13 @@
 #include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <sys/uio.h>
 #include "../bson_flat.hpp"
 
 static bool compare_binary(const std::string& expected, const void *actual, std::string& message)
@@ -232,6 +239,42 @@ TEST(writer, add_document)
   );
 }
 
+TEST(writer, add_document_nested)
+{
+  std::uint8_t buffer[48];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  bson::writer w(buffer, 0x2b);
+  {
+    auto s1 = w.add_document("a");
+    {
+      auto s2 = s1.add_array("b");
+      {
+        auto s3 = s2.add_document("0");
+        ASSERT_TRUE(s3.add_int32("c", 1));
+      }
+      ASSERT_TRUE(s2.add_null("1"));
+    }
+    ASSERT_TRUE(s1.add_true("e"));
+  }
+  ASSERT_BINEQ(
+    "2b 00 00 00 "
+    "03 61 00 "
+      "23 00 00 00 "
+      "04 62 00 "
+        "17 00 00 00 "
+        "03 30 00 "
+          "0c 00 00 00 "
+          "10 63 00 01 00 00 00 "
+          "00 "
+        "0a 31 00 "
+        "00 "
+      "08 65 00 01 "
+      "00 "
+    "00 aa",
+    buffer
+  );
+}
+
 TEST(writer, add_document_with_writer)
 {
   std::uint8_t buffer[32];
@@ -313,6 +356,99 @@ TEST(writer, add_array_with_writer)
   );
 }
 
+TEST(writer, array_writer_push)
+{
+  std::uint8_t buffer[64];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  bson::writer w(buffer, 0x3b);
+  {
+    auto a = w.add_array("a");
+    ASSERT_TRUE(a.push_int32(0x12345678));
+    ASSERT_TRUE(a.push_string("x"));
+    ASSERT_TRUE(a.push_true());
+    ASSERT_TRUE(a.push_null());
+    {
+      auto d = a.push_document();
+      ASSERT_TRUE(d.add_false("b"));
+    }
+    {
+      auto s = a.push_array();
+      ASSERT_TRUE(s.push_undefined());
+    }
+    ASSERT_EQ(6, a.size());
+  }
+  ASSERT_BINEQ(
+    "3b 00 00 00 "
+    "04 61 00 "
+      "33 00 00 00 "
+      "10 30 00 78 56 34 12 "
+      "02 31 00 02 00 00 00 78 00 "
+      "08 32 00 01 "
+      "0a 33 00 "
+      "03 34 00 "
+        "09 00 00 00 "
+        "08 62 00 00 "
+        "00 "
+      "04 35 00 "
+        "08 00 00 00 "
+        "06 30 00 "
+        "00 "
+      "00 "
+    "00 aa",
+    buffer
+  );
+}
+
+TEST(writer, array_writer_push_range)
+{
+  std::int32_t values[12];
+  for (int i = 0; i < 12; ++i) {
+    values[i] = i * 3;
+  }
+  bson::writer w;
+  {
+    auto a = w.add_array("a");
+    ASSERT_TRUE(a.push_double(0.5));
+    ASSERT_TRUE(a.push_range(values, 12));
+    ASSERT_TRUE(a.push_range(values, 0));
+    const std::int64_t big[] = { -1, 1ll << 40 };
+    ASSERT_TRUE(a.push_range(big, 2));
+    ASSERT_EQ(15, a.size());
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  ASSERT_EQ(4 + 3 + 4 + (3 + 8) + 9 * (3 + 4) + 3 * (4 + 4) + 2 * (4 + 8) + 1 + 1, length);
+
+  bson::reader r(bytes, length);
+  auto array = r.find("a").as_array();
+  int index = 0;
+  for (const auto& e : array) {
+    ASSERT_EQ(std::to_string(index), e.name());
+    if (index == 0) {
+      ASSERT_DOUBLE_EQ(0.5, e.as_double());
+    } else if (index <= 12) {
+      ASSERT_EQ((index - 1) * 3, e.as_int32(-1));
+    } else {
+      ASSERT_TRUE(e.is_int64());
+    }
+    ++index;
+  }
+  ASSERT_EQ(15, index);
+  ASSERT_EQ(1ll << 40, array.find("14").as_int64());
+}
+
+TEST(writer, array_writer_fixed_buffer_full)
+{
+  const double values[] = { 1.0, 2.0 };
+  std::uint8_t buffer[0x1d];
+  bson::writer w(buffer, sizeof(buffer));
+  auto a = w.add_array("a");
+  ASSERT_FALSE(a.push_range(values, 2));
+  ASSERT_TRUE(a.push_range(values, 1));
+  ASSERT_EQ(1, a.size());
+}
+
 TEST(writer, add_binary)
 {
   std::uint8_t buffer[40];
@@ -331,6 +467,169 @@ TEST(writer, add_binary)
   );
 }
 
+TEST(writer, deferred)
+{
+  const std::uint8_t* bytes;
+  std::size_t length;
+  std::uint8_t buffer[32];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  bson::writer w(buffer, 0x1b);
+  ASSERT_TRUE(w.set_deferred());
+  ASSERT_TRUE(w.add_true("a"));
+  ASSERT_BINEQ(
+    "05 00 00 00 "
+    "08 61 00 01 "
+    "aa",
+    buffer
+  );
+  {
+    auto s = w.add_document("b");
+    ASSERT_FALSE(s.set_deferred(false));
+    ASSERT_TRUE(s.add_int32("c", 2));
+    ASSERT_TRUE(s.get_bytes(bytes, length));
+    ASSERT_EQ(buffer + 11, bytes);
+    ASSERT_EQ(12, length);
+    ASSERT_TRUE(s.add_null("d"));
+  }
+  ASSERT_BINEQ(
+    "05 00 00 00 "
+    "08 61 00 01 "
+    "03 62 00 "
+      "0f 00 00 00 "
+      "10 63 00 02 00 00 00 "
+      "0a 64 00 "
+      "00 "
+    "aa",
+    buffer
+  );
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  ASSERT_EQ(0x1b, length);
+  ASSERT_BINEQ(
+    "1b 00 00 00 "
+    "08 61 00 01 "
+    "03 62 00 "
+      "0f 00 00 00 "
+      "10 63 00 02 00 00 00 "
+      "0a 64 00 "
+      "00 "
+    "00 aa",
+    buffer
+  );
+}
+
+TEST(writer, deferred_release)
+{
+  std::size_t length;
+  bson::writer w;
+  ASSERT_TRUE(w.set_deferred());
+  ASSERT_TRUE(w.add_false("a"));
+  {
+    auto s = w.add_array("b");
+    ASSERT_TRUE(s.add_true("0"));
+  }
+  std::uint8_t* bytes = w.release(length);
+  ASSERT_EQ(0x15, length);
+  ASSERT_BINEQ(
+    "15 00 00 00 "
+    "08 61 00 00 "
+    "04 62 00 "
+      "09 00 00 00 "
+      "08 30 00 01 "
+      "00 "
+    "00",
+    bytes
+  );
+  std::free(bytes);
+
+  bson::writer w2;
+  ASSERT_TRUE(w2.set_deferred());
+  ASSERT_TRUE(w2.add_null("a"));
+  ASSERT_TRUE(w2.set_deferred(false));
+  auto buffer = *reinterpret_cast<const std::uint8_t**>(&w2);
+  ASSERT_BINEQ("08 00 00 00 0a 61 00 00", buffer);
+}
+
+TEST(writer, key)
+{
+  using namespace bson::literals;
+  static_assert(bson::key("abc").length == 3, "length of literal");
+  static_assert("de"_key.length == 2, "length of user-defined literal");
+  const char names[] = "ghi";
+  std::uint8_t buffer[64];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  bson::writer w(buffer, 0x33);
+  ASSERT_TRUE(w.add_int32(bson::key("abc"), 1));
+  ASSERT_TRUE(w.add_double("de"_key, 1.5));
+  ASSERT_TRUE(w.add_string({names, 1}, "x"));
+  ASSERT_TRUE(w.add_null({names + 1, 2}));
+  ASSERT_FALSE(w.add_true({names, 0}));
+  {
+    auto s = w.add_document(bson::key("s"));
+    ASSERT_TRUE(s.add_true("t"_key));
+  }
+  ASSERT_BINEQ(
+    "33 00 00 00 "
+    "10 61 62 63 00 01 00 00 00 "
+    "01 64 65 00 00 00 00 00 00 00 f8 3f "
+    "02 67 00 02 00 00 00 78 00 "
+    "0a 68 69 00 "
+    "03 73 00 "
+      "09 00 00 00 "
+      "08 74 00 01 "
+      "00 "
+    "00 aa",
+    buffer
+  );
+}
+
+namespace {
+constexpr char schema_ts[] = "ts";
+constexpr char schema_v[] = "v";
+constexpr char schema_ok[] = "ok";
+using sample_schema = bson::schema<
+  bson::field<schema_ts, std::int64_t>,
+  bson::field<schema_v, double>,
+  bson::field<schema_ok, bool>
+>;
+} /* namespace */
+
+TEST(writer, schema)
+{
+  static_assert(sample_schema::size == 28, "size of fields");
+  static_assert(sample_schema::document_size == 33, "size of document");
+  std::uint8_t buffer[64];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  {
+    bson::writer w(buffer, 0x28);
+    ASSERT_TRUE(sample_schema::encode(w, 0x1234, 1.5, true));
+    ASSERT_TRUE(w.add_int32("n", 7));
+    ASSERT_FALSE(sample_schema::encode(w, 0, 0.0, false));
+  }
+  ASSERT_BINEQ(
+    "28 00 00 00 "
+    "12 74 73 00 34 12 00 00 00 00 00 00 "
+    "01 76 00 00 00 00 00 00 00 f8 3f "
+    "08 6f 6b 00 01 "
+    "10 6e 00 07 00 00 00 "
+    "00 aa",
+    buffer
+  );
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  ASSERT_EQ(0u, sample_schema::encode_document(buffer, 32, 1, 2.0, false));
+  ASSERT_EQ(33u, sample_schema::encode_document(buffer, sizeof(buffer), 1, 2.0, false));
+  ASSERT_BINEQ(
+    "21 00 00 00 "
+    "12 74 73 00 01 00 00 00 00 00 00 00 "
+    "01 76 00 00 00 00 00 00 00 00 40 "
+    "08 6f 6b 00 00 "
+    "00 aa",
+    buffer
+  );
+  bson::reader r(buffer, 33);
+  ASSERT_EQ(1, r.find("ts").as_int64());
+  ASSERT_EQ(2.0, r.find("v").as_double());
+}
+
 TEST(writer, release)
 {
   std::size_t length = 0xdeadbeef;
@@ -358,6 +657,420 @@ TEST(writer, release)
   ASSERT_FALSE(w.valid());
 }
 
+namespace {
+
+class counting_allocator : public bson::allocator {
+public:
+  void* allocate(std::size_t length) noexcept override
+  {
+    ++allocations;
+    return std::malloc(length);
+  }
+
+  void* reallocate(void* buffer, std::size_t, std::size_t new_length) noexcept override
+  {
+    ++reallocations;
+    return std::realloc(buffer, new_length);
+  }
+
+  void deallocate(void* buffer) noexcept override
+  {
+    ++deallocations;
+    std::free(buffer);
+  }
+
+  int allocations = 0;
+  int reallocations = 0;
+  int deallocations = 0;
+};
+
+} /* namespace */
+
+TEST(writer, custom_allocator)
+{
+  counting_allocator a;
+  {
+    bson::writer w(a);
+    ASSERT_TRUE(w);
+    ASSERT_EQ(1, a.allocations);
+    char name[] = "a";
+    for (int i = 0; i < 16; ++i) {
+      name[0] = 'a' + i;
+      ASSERT_TRUE(w.add_int64(name, i));
+    }
+    ASSERT_EQ(1, a.reallocations);
+  }
+  ASSERT_EQ(1, a.deallocations);
+}
+
+TEST(writer, batch)
+{
+  counting_allocator a;
+  {
+    bson::batch_writer batch(16, a);
+    ASSERT_EQ(1, a.allocations);
+    {
+      auto w = batch.add_document(5);
+      ASSERT_TRUE(w.add_int32("a", 1));
+      auto other = batch.add_document();
+      ASSERT_FALSE(other.add_int32("b", 2));
+      const std::uint8_t* bytes;
+      std::size_t length;
+      ASSERT_FALSE(batch.get_bytes(bytes, length));
+    }
+    {
+      auto w = batch.add_document(5);
+      w.set_deferred();
+      auto s = w.add_document("s");
+      ASSERT_TRUE(s.add_true("t"));
+    }
+    ASSERT_LE(1, a.reallocations);
+    {
+      auto w = batch.add_document();
+    }
+    ASSERT_EQ(3u, batch.count());
+    ASSERT_EQ(0x0c + 0x11 + 0x05u, batch.size());
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_TRUE(batch.get_bytes(bytes, length));
+    ASSERT_EQ(batch.size(), length);
+    ASSERT_BINEQ(
+      "0c 00 00 00 10 61 00 01 00 00 00 00 "
+      "11 00 00 00 03 73 00 09 00 00 00 08 74 00 01 00 00 "
+      "05 00 00 00 00",
+      bytes
+    );
+    {
+      // Destroyed while subdocument is open (storage kept for the subdocument)
+      alignas(bson::batch_writer::document) unsigned char storage[sizeof(bson::batch_writer::document)];
+      auto w = ::new (storage) bson::batch_writer::document(batch.add_document());
+      ASSERT_TRUE(w->valid());
+      auto s = w->add_document("s");
+      w->~document();
+    }
+    ASSERT_EQ(3u, batch.count());
+    ASSERT_EQ(0x0c + 0x11 + 0x05u, batch.size());
+    ASSERT_TRUE(batch.get_bytes(bytes, length));
+    ASSERT_TRUE(batch.add_document().valid());
+    {
+      // Buffer owned by batch cannot be released through base class
+      auto w = batch.add_document();
+      ASSERT_TRUE(w.add_int32("r", 1));
+      bson::writer& base = w;
+      ASSERT_EQ(nullptr, base.release(length));
+      ASSERT_TRUE(w.add_int32("s", 2));
+    }
+    ASSERT_EQ(5u, batch.count());
+    ASSERT_TRUE(batch.get_bytes(bytes, length));
+    batch.clear();
+    ASSERT_EQ(0u, batch.count());
+    {
+      auto w = batch.add_document();
+      ASSERT_TRUE(w.add_null("n"));
+    }
+    std::size_t released_length;
+    auto released = batch.release(released_length);
+    ASSERT_NE(nullptr, released);
+    ASSERT_EQ(8u, released_length);
+    ASSERT_BINEQ("08 00 00 00 0a 6e 00 00", released);
+    a.deallocate(released);
+  }
+  ASSERT_EQ(1, a.deallocations);
+}
+
+TEST(writer, batch_fixed_buffer)
+{
+  std::uint8_t buffer[32];
+  std::memset(buffer, 0xaa, sizeof(buffer));
+  bson::batch_writer batch(buffer, 0x1d);
+  for (int i = 0; i < 2; ++i) {
+    auto w = batch.add_document();
+    ASSERT_TRUE(w.add_int32("i", i));
+  }
+  {
+    // Rest of buffer only fits an empty document
+    auto w = batch.add_document();
+    ASSERT_TRUE(w.valid());
+    ASSERT_FALSE(w.add_int32("i", 2));
+  }
+  {
+    auto w = batch.add_document();
+    ASSERT_FALSE(w.valid());
+  }
+  ASSERT_EQ(3u, batch.count());
+  ASSERT_EQ(0x1du, batch.size());
+  std::size_t length;
+  ASSERT_EQ(nullptr, batch.release(length));
+  ASSERT_BINEQ(
+    "0c 00 00 00 10 69 00 00 00 00 00 00 "
+    "0c 00 00 00 10 69 00 01 00 00 00 00 "
+    "05 00 00 00 00 aa",
+    buffer
+  );
+
+  // Growth is limited to the rest of buffer
+  std::uint8_t large[1000];
+  bson::batch_writer fixed(large, sizeof(large));
+  {
+    auto w = fixed.add_document(16);
+    ASSERT_TRUE(w.add_string("s", std::string(600, 'x').c_str()));
+    ASSERT_FALSE(w.add_string("t", std::string(400, 'y').c_str()));
+  }
+  ASSERT_EQ(1u, fixed.count());
+  ASSERT_EQ(4 + 1 + 2 + 4 + 601 + 1u, fixed.size());
+}
+
+namespace {
+
+template <class Writer>
+void write_gather_sample(Writer& w, const std::uint8_t* blob, const char* text)
+{
+  w.add_int32("a", 1);
+  w.add_string("s", "short");
+  w.add_binary("b", blob, 16, bson::subtype::user_defined);
+  {
+    auto d = w.add_document("d");
+    d.add_string("t", text);
+    {
+      auto e = d.add_array("e");
+      e.push_binary(blob, 8);
+      e.push_null();
+    }
+    d.add_binary("z", blob, 0);
+  }
+  w.add_true("x");
+}
+
+} /* namespace */
+
+TEST(writer, gather)
+{
+  static_assert(sizeof(bson::gather_writer::fragment) == sizeof(iovec), "iovec compatible");
+  static_assert(offsetof(bson::gather_writer::fragment, data) == offsetof(iovec, iov_base), "iovec compatible");
+  static_assert(offsetof(bson::gather_writer::fragment, length) == offsetof(iovec, iov_len), "iovec compatible");
+  std::uint8_t blob[16];
+  for (int i = 0; i < 16; ++i) {
+    blob[i] = static_cast<std::uint8_t>(0xb0 + i);
+  }
+  const char* text = "long string";
+
+  bson::writer expected_writer;
+  write_gather_sample(expected_writer, blob, text);
+  const std::uint8_t* expected;
+  std::size_t expected_length;
+  ASSERT_TRUE(expected_writer.get_bytes(expected, expected_length));
+
+  for (bool deferred : { false, true }) {
+    bson::gather_writer w(8);
+    w.set_deferred(deferred);
+    write_gather_sample(w, blob, text);
+    ASSERT_EQ(3u, w.external_count());
+    ASSERT_EQ(expected_length, w.size());
+    const bson::gather_writer::fragment* fragments;
+    std::size_t count;
+    ASSERT_TRUE(w.get_fragments(fragments, count));
+    ASSERT_EQ(7u, count);
+    ASSERT_EQ(blob, fragments[1].data);
+    ASSERT_EQ(text, fragments[3].data);
+    std::vector<std::uint8_t> joined;
+    for (std::size_t i = 0; i < count; ++i) {
+      auto bytes = static_cast<const std::uint8_t*>(fragments[i].data);
+      joined.insert(joined.end(), bytes, bytes + fragments[i].length);
+    }
+    ASSERT_EQ(expected_length, joined.size());
+    ASSERT_EQ(0, std::memcmp(expected, joined.data(), expected_length)) << "deferred " << deferred;
+  }
+
+  bson::gather_writer w(8);
+  {
+    auto d = w.add_document("d");
+    const bson::gather_writer::fragment* fragments;
+    std::size_t count;
+    ASSERT_FALSE(w.get_fragments(fragments, count));
+  }
+
+  // Buffer without external payloads is not reachable via writer
+  {
+    bson::gather_writer g(8);
+    write_gather_sample(g, blob, text);
+    bson::writer& base = g;
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_FALSE(base.get_bytes(bytes, length));
+    ASSERT_EQ(nullptr, base.release(length));
+    bson::writer copy;
+    ASSERT_FALSE(copy.add_document("g", base));
+    ASSERT_TRUE(copy.get_bytes(bytes, length));
+    ASSERT_EQ(5u, length);
+    const bson::gather_writer::fragment* fragments;
+    std::size_t count;
+    ASSERT_TRUE(g.get_fragments(fragments, count));
+  }
+}
+
+TEST(writer, move)
+{
+  counting_allocator a;
+  {
+    bson::writer w1(a);
+    ASSERT_TRUE(w1.add_true("a"));
+    bson::writer w2(std::move(w1));
+    ASSERT_FALSE(w1);
+    ASSERT_TRUE(w2);
+    ASSERT_TRUE(w2.add_false("b"));
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_TRUE(w2.get_bytes(bytes, length));
+    ASSERT_EQ(13, length);
+  }
+  ASSERT_EQ(1, a.deallocations);
+}
+
+TEST(writer, size_hint)
+{
+  counting_allocator a;
+  {
+    bson::writer w(0x1000, a);
+    ASSERT_TRUE(w);
+    ASSERT_NE(nullptr, w.add_binary("a", 0x1000 - 13));
+    ASSERT_EQ(0, a.reallocations);
+    ASSERT_NE(nullptr, w.add_binary("b", 1));
+    ASSERT_EQ(1, a.reallocations);
+  }
+  {
+    bson::writer w(1, a);
+    ASSERT_TRUE(w);
+    ASSERT_TRUE(w.add_null("c"));
+  }
+}
+
+TEST(writer, reserve)
+{
+  counting_allocator a;
+  bson::writer w(a);
+  ASSERT_TRUE(w.reserve(0x1000));
+  ASSERT_EQ(1, a.reallocations);
+  {
+    auto s = w.add_document("s");
+    ASSERT_TRUE(s.reserve(0x1000 - 16));
+    ASSERT_FALSE(w.reserve(1));
+    ASSERT_NE(nullptr, s.add_binary("a", 0x1000 - 32));
+  }
+  ASSERT_EQ(1, a.reallocations);
+
+  std::uint8_t buffer[16];
+  bson::writer f(buffer, sizeof(buffer));
+  ASSERT_TRUE(f.reserve(11));
+  ASSERT_FALSE(f.reserve(12));
+}
+
+TEST(writer, size_history)
+{
+  counting_allocator a;
+  bson::size_history history;
+  ASSERT_EQ(128, history.get());
+  for (int i = 0; i < 2; ++i) {
+    bson::writer w(history, a);
+    ASSERT_NE(nullptr, w.add_binary("a", 1000));
+  }
+  ASSERT_EQ(1, a.reallocations);
+  ASSERT_EQ(1013, history.get());
+  std::size_t length;
+  {
+    bson::writer w(history, a);
+    ASSERT_TRUE(w.add_null("a"));
+    std::free(w.release(length));
+  }
+  ASSERT_EQ(887, history.get());
+}
+
+TEST(allocator, arena)
+{
+  alignas(16) std::uint8_t region[512];
+  bson::arena_allocator a(region, sizeof(region));
+  std::size_t length;
+  {
+    bson::writer w(a);
+    ASSERT_TRUE(w.add_int32("A", 0x12345678));
+    std::uint8_t* bytes = w.release(length);
+    ASSERT_EQ(region, bytes);
+    ASSERT_EQ(0x0c, length);
+    ASSERT_BINEQ(
+      "0c 00 00 00 "
+      "10 41 00 78 56 34 12 "
+      "00 ",
+      bytes
+    );
+  }
+  ASSERT_EQ(128, a.used());
+  {
+    // The last allocation grows in place
+    bson::writer w(a);
+    ASSERT_TRUE(w.add_binary("b", 200));
+    ASSERT_EQ(region + 128, w.release(length));
+    ASSERT_EQ(0xd5, length);
+  }
+  ASSERT_EQ(384, a.used());
+  {
+    // Region exhausted without upstream
+    bson::writer w(a);
+    ASSERT_TRUE(w);
+    ASSERT_EQ(nullptr, w.add_binary("c", 200));
+  }
+  ASSERT_EQ(384, a.used());
+  a.reset();
+  ASSERT_EQ(0, a.used());
+  {
+    bson::writer w(a);
+    ASSERT_EQ(region, w.release(length));
+  }
+}
+
+TEST(allocator, arena_upstream)
+{
+  alignas(16) std::uint8_t region[64];
+  counting_allocator upstream;
+  bson::arena_allocator a(region, sizeof(region), &upstream);
+  {
+    bson::writer w(a);
+    ASSERT_TRUE(w);
+    ASSERT_EQ(1, upstream.allocations);
+  }
+  ASSERT_EQ(1, upstream.deallocations);
+}
+
+TEST(allocator, pool)
+{
+  counting_allocator upstream;
+  bson::pool_allocator a(upstream);
+  std::size_t length;
+  std::uint8_t* first;
+  {
+    bson::writer w(a);
+    ASSERT_TRUE(w.add_true("a"));
+    first = w.release(length);
+    ASSERT_NE(nullptr, first);
+  }
+  a.deallocate(first);
+  {
+    // Recycled buffer
+    bson::writer w(a);
+    ASSERT_TRUE(w.add_true("a"));
+    ASSERT_EQ(first, w.release(length));
+    ASSERT_EQ(1, upstream.allocations);
+    a.deallocate(first);
+  }
+  {
+    // Grow to the next size class
+    bson::writer w(a);
+    ASSERT_NE(nullptr, w.add_binary("b", 200));
+    ASSERT_EQ(2, upstream.allocations);
+  }
+  ASSERT_EQ(0, upstream.deallocations);
+  a.trim();
+  ASSERT_EQ(2, upstream.deallocations);
+}
+
 namespace bson {
 
 std::ostream& operator<<(std::ostream& ostream, const reader::element& element)
@@ -1024,3 +1737,627 @@ TEST(reader, find)
   auto ab = r.find("AB");
   ASSERT_FALSE(ab.valid());
 }
+
+TEST(reader, indexed)
+{
+  static_assert(bson::indexed_reader::slots_for(3) == 8, "slots for 3 fields");
+  static_assert(bson::indexed_reader::slots_for(4) == 8, "slots for 4 fields");
+  std::uint8_t buffer[] = {
+    0x1a,0x00,0x00,0x00,
+      0x06,0x41,0x00,
+      0x08,0x42,0x00,0x01,
+      0x10,0x43,0x44,0x00,0x05,0x00,0x00,0x00,
+      0x08,0x41,0x00,0x00,
+      0x0a,0x45,0x00,
+    0x00,
+  };
+  bson::reader r(buffer, sizeof(buffer));
+  bson::indexed_reader::slot table[8];
+  bson::indexed_reader index(r, table, 8);
+  ASSERT_TRUE(index.complete());
+  ASSERT_EQ(4u, index.size());
+  ASSERT_TRUE(index.find("A").is_undefined());
+  ASSERT_TRUE(index.find("B").is_boolean());
+  ASSERT_EQ(5, index.find(bson::key("CD")).as_int32());
+  ASSERT_TRUE(index.find("E").is_null());
+  ASSERT_FALSE(index.find("C").valid());
+  ASSERT_FALSE(index.find("AB").valid());
+  ASSERT_FALSE(index.find("").valid());
+
+  // Table too small: fields after the limit are found by linear scan
+  bson::indexed_reader small(r, table, 5);
+  ASSERT_FALSE(small.complete());
+  ASSERT_EQ(2u, small.size());
+  ASSERT_TRUE(small.find("A").is_undefined());
+  ASSERT_EQ(5, small.find("CD").as_int32());
+  ASSERT_TRUE(small.find("E").is_null());
+  ASSERT_FALSE(small.find("F").valid());
+
+  bson::indexed_reader none(r, nullptr, 0);
+  ASSERT_FALSE(none.complete());
+  ASSERT_TRUE(none.find("B").is_boolean());
+}
+
+TEST(reader, find_many)
+{
+  std::uint8_t buffer[] = {
+    0x1a,0x00,0x00,0x00,
+      0x06,0x41,0x00,
+      0x08,0x42,0x00,0x01,
+      0x10,0x43,0x44,0x00,0x05,0x00,0x00,0x00,
+      0x08,0x41,0x00,0x00,
+      0x0a,0x45,0x00,
+    0x00,
+  };
+  bson::reader r(buffer, sizeof(buffer));
+  bson::reader::element e[4];
+  ASSERT_EQ(3u, r.find_many({"CD", "A", "Z", "B"}, e));
+  ASSERT_EQ(5, e[0].as_int32());
+  ASSERT_TRUE(e[1].is_undefined());
+  ASSERT_FALSE(e[2].valid());
+  ASSERT_TRUE(e[3].is_boolean());
+
+  // Duplicated names in request are all filled
+  const bson::key names[] = { "E", "C", "E" };
+  ASSERT_EQ(2u, r.find_many(names, 3, e));
+  ASSERT_TRUE(e[0].is_null());
+  ASSERT_FALSE(e[1].valid());
+  ASSERT_TRUE(e[2].is_null());
+
+  ASSERT_EQ(0u, r.find_many(names, 0, e));
+  bson::reader broken(buffer, 4);
+  ASSERT_EQ(0u, broken.find_many({"A"}, e));
+  ASSERT_FALSE(e[0].valid());
+}
+
+TEST(reader, find_path)
+{
+  bson::path p("a.b.2.c");
+  ASSERT_TRUE(p.valid());
+  ASSERT_EQ(4u, p.size());
+  ASSERT_EQ(1u, p[0].length);
+  ASSERT_EQ(bson::path::no_index, p[1].index);
+  ASSERT_EQ(2u, p[2].index);
+  ASSERT_EQ(bson::path::no_index, bson::path("01")[0].index);
+  ASSERT_EQ(bson::path::no_index, bson::path("4294967296")[0].index);
+  ASSERT_EQ(10u, bson::path("a.10")[1].index);
+  ASSERT_FALSE(bson::path("").valid());
+  ASSERT_FALSE(bson::path("a..b").valid());
+  ASSERT_FALSE(bson::path("a.").valid());
+  ASSERT_FALSE(bson::path("a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q").valid());
+
+  bson::writer w;
+  {
+    auto a = w.add_document("a");
+    {
+      auto b = a.add_array("b");
+      {
+        auto d = b.push_document();
+        d.add_int32("c", 1);
+      }
+      b.push_int32(2);
+      {
+        auto d = b.push_document();
+        d.add_int32("c", 3);
+      }
+    }
+    a.add_int32("10", 4);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  bson::reader r(bytes, length);
+  ASSERT_EQ(3, r.find(p).as_int32());
+  ASSERT_EQ(1, r.find(bson::path("a.b.0.c")).as_int32());
+  ASSERT_EQ(2, r.find(bson::path("a.b.1")).as_int32());
+  ASSERT_TRUE(r.find(bson::path("a.b")).is_array());
+  ASSERT_EQ(4, r.find(bson::path("a.10")).as_int32());
+  ASSERT_FALSE(r.find(bson::path("a.b.3")).valid());
+  ASSERT_FALSE(r.find(bson::path("a.b.1.c")).valid());
+  ASSERT_FALSE(r.find(bson::path("a.x")).valid());
+  ASSERT_FALSE(r.find(bson::path("")).valid());
+}
+
+TEST(reader, validate)
+{
+  std::uint8_t buffer[] = {
+    0x2d,0x00,0x00,0x00,
+      0x02,0x41,0x00,0x02,0x00,0x00,0x00,0x78,0x00,
+      0x03,0x42,0x00,
+        0x0c,0x00,0x00,0x00,
+          0x10,0x43,0x00,0x07,0x00,0x00,0x00,
+        0x00,
+      0x05,0x44,0x00,0x01,0x00,0x00,0x00,0x80,0xff,
+      0x0a,0x45,0x00,
+      0x08,0x46,0x00,0x01,
+    0x00,
+  };
+  bson::reader r(buffer, sizeof(buffer));
+  auto t = r.validate();
+  ASSERT_TRUE(t.valid());
+  const char* names = "ABDEF";
+  for (const auto& field : t) {
+    ASSERT_EQ(*names++, field.name()[0]);
+  }
+  ASSERT_EQ('\0', *names);
+  ASSERT_STREQ("x", t.find("A").as_string());
+  ASSERT_EQ(7, t.find("B").as_document().find("C").as_int32());
+  ASSERT_TRUE(t.find("E").is_null());
+  ASSERT_TRUE(t.find("F").as_boolean());
+  ASSERT_FALSE(t.find("G").valid());
+  ASSERT_EQ(7, t.find(bson::path("B.C")).as_int32());
+  ASSERT_FALSE(r.validate(0).valid());
+  ASSERT_FALSE(bson::reader(buffer, sizeof(buffer) - 1).validate().valid());
+  ASSERT_FALSE(bson::reader(nullptr, 0).validate().valid());
+  ASSERT_FALSE(bson::trusted_reader().begin() != bson::trusted_reader().end());
+
+  // Unterminated string
+  buffer[12] = 0x79;
+  ASSERT_FALSE(r.validate().valid());
+  buffer[12] = 0x00;
+
+  // Subdocument length exceeds parent
+  buffer[16] = 0x20;
+  ASSERT_FALSE(r.validate().valid());
+  buffer[16] = 0x0c;
+
+  // Unknown type
+  buffer[40] = 0x7f;
+  ASSERT_FALSE(r.validate().valid());
+  buffer[40] = 0x08;
+
+  // Early terminator
+  buffer[37] = 0x00;
+  ASSERT_FALSE(r.validate().valid());
+  buffer[37] = 0x0a;
+  ASSERT_TRUE(r.validate().valid());
+
+  auto u = bson::trusted_reader::unchecked(buffer, sizeof(buffer));
+  const void* binary;
+  std::size_t length;
+  ASSERT_TRUE(u.find("D").get_binary(binary, length));
+  ASSERT_EQ(1u, length);
+  ASSERT_EQ(0xff, *static_cast<const std::uint8_t*>(binary));
+}
+
+TEST(reader, long_names)
+{
+  const std::string long_name(70, 'n');
+  bson::writer w;
+  ASSERT_TRUE(w.add_int32((long_name + "a").c_str(), 1));
+  ASSERT_TRUE(w.add_int32((long_name + "b").c_str(), 2));
+  ASSERT_TRUE(w.add_int32("c", 3));
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  bson::reader r(bytes, length);
+  ASSERT_EQ(2, r.find((long_name + "b").c_str()).as_int32());
+  ASSERT_EQ(3, r.find("c").as_int32());
+  ASSERT_FALSE(r.find(long_name.c_str()).valid());
+  ASSERT_EQ(2, r.validate().find((long_name + "b").c_str()).as_int32());
+
+  // Name truncated by total length
+  std::uint8_t buffer[256];
+  ASSERT_GE(sizeof(buffer), length);
+  std::memcpy(buffer, bytes, length);
+  const std::int32_t truncated = 40;
+  std::memcpy(buffer, &truncated, 4);
+  bson::reader t(buffer, sizeof(buffer));
+  ASSERT_TRUE(t.begin().fail());
+  ASSERT_FALSE(t.validate().valid());
+}
+
+// Validated while initializing statics, before main()
+static bool validate_in_static_initializer()
+{
+  const std::string long_name(40, 'n');
+  bson::writer w;
+  if (!w.add_string(long_name.c_str(), "\xc3\xa9t\xc3\xa9 ........................................")) {
+    return false;
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  return w.get_bytes(bytes, length) && bson::reader(bytes, length).validate().valid();
+}
+
+static const bool validated_in_static_initializer = validate_in_static_initializer();
+
+TEST(reader, validate_static_initialization)
+{
+  ASSERT_TRUE(validated_in_static_initializer);
+}
+
+TEST(reader, validate_utf8)
+{
+  const std::string ascii(40, 'x');
+  const char* const valid[] = {
+    "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xef\xbf\xbf",
+    "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf",
+  };
+  const char* const invalid[] = {
+    "\x80", "\xc0\x80", "\xc1\xbf", "\xe0\x9f\xbf", "\xed\xa0\x80",
+    "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xff",
+    "\xe3\x81", "\xe3\x41\x81",
+  };
+  for (const auto& prefix : { std::string(), ascii }) {
+    for (auto s : valid) {
+      bson::writer w;
+      ASSERT_TRUE(w.add_string("s", (prefix + s + "y").c_str()));
+      ASSERT_TRUE(w.add_string("t", (prefix + s).c_str()));
+      const std::uint8_t* bytes;
+      std::size_t length;
+      ASSERT_TRUE(w.get_bytes(bytes, length));
+      ASSERT_TRUE(bson::reader(bytes, length).validate().valid()) << prefix << s;
+    }
+    for (auto s : invalid) {
+      bson::writer w;
+      ASSERT_TRUE(w.add_string("s", (prefix + s).c_str()));
+      const std::uint8_t* bytes;
+      std::size_t length;
+      ASSERT_TRUE(w.get_bytes(bytes, length));
+      ASSERT_FALSE(bson::reader(bytes, length).validate().valid()) << prefix << s;
+      ASSERT_TRUE(bson::reader(bytes, length).validate(100, false).valid()) << prefix << s;
+    }
+  }
+  bson::writer w;
+  ASSERT_TRUE(w.add_null((ascii + "\xc0\x80").c_str()));
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  ASSERT_FALSE(bson::reader(bytes, length).validate().valid());
+}
+
+TEST(reader, mutable_update)
+{
+  bson::writer w;
+  w.add_double("d", 1.5);
+  w.add_int32("i", 1);
+  w.add_string("s", "abc");
+  {
+    auto a = w.add_array("a");
+    a.push_int64(2);
+    a.push_boolean(false);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  std::vector<std::uint8_t> buffer(bytes, bytes + length);
+
+  bson::mutable_reader r(buffer.data(), buffer.size());
+  ASSERT_TRUE(r.find("d").set_double(-2.0));
+  ASSERT_TRUE(r.find("i").set_int32(0x12345678));
+  ASSERT_FALSE(r.find("i").set_int64(3));
+  ASSERT_FALSE(r.find("d").set_int32(3));
+  ASSERT_FALSE(r.find("x").set_int32(3));
+  ASSERT_TRUE(r.find("s").set_string("xyz"));
+  ASSERT_FALSE(r.find("s").set_string("wxyz"));
+  ASSERT_FALSE(r.find("s").set_string("xy"));
+  ASSERT_TRUE(r.find(bson::path("a.0")).set_int64(-1));
+  auto a = r.find("a").as_array();
+  ASSERT_TRUE(a.valid());
+  auto it = a.begin();
+  ++it;
+  ASSERT_TRUE(bson::mutable_reader::element(*it).set_boolean(true));
+
+  bson::reader c(buffer.data(), buffer.size());
+  ASSERT_EQ(length, buffer.size());
+  ASSERT_EQ(-2.0, c.find("d").as_double());
+  ASSERT_EQ(0x12345678, c.find("i").as_int32());
+  ASSERT_STREQ("xyz", c.find("s").as_string());
+  ASSERT_EQ(-1, c.find(bson::path("a.0")).as_int64());
+  ASSERT_TRUE(c.find(bson::path("a.1")).as_boolean());
+  ASSERT_TRUE(c.validate().valid());
+}
+
+TEST(patch, apply)
+{
+  bson::writer src;
+  src.add_int32("a", 1);
+  {
+    auto b = src.add_document("b");
+    b.add_string("c", "x");
+    b.add_int32("d", 2);
+  }
+  {
+    auto e = src.add_array("e");
+    e.push_int32(1);
+    e.push_int32(2);
+  }
+  src.add_true("f");
+  src.add_null("h");
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(src.get_bytes(bytes, length));
+  bson::reader source(bytes, length);
+
+  bson::writer values;
+  values.add_int64("a", 10);
+  values.add_string("d", "long string");
+  values.add_int32("y", 3);
+  values.add_double("g", 0.5);
+  values.add_int32("n", 9);
+  const std::uint8_t* value_bytes;
+  std::size_t value_length;
+  ASSERT_TRUE(values.get_bytes(value_bytes, value_length));
+  bson::reader changes(value_bytes, value_length);
+
+  bson::patch p;
+  ASSERT_TRUE(p.set("a", changes.find("a")));
+  ASSERT_TRUE(p.remove("f"));
+  ASSERT_TRUE(p.set("b.d", changes.find("d")));
+  ASSERT_TRUE(p.set("b.z.y", changes.find("y")));
+  ASSERT_TRUE(p.set("e.1", changes.find("n")));
+  ASSERT_TRUE(p.set("g", changes.find("g")));
+  ASSERT_TRUE(p.remove("missing.field"));
+  ASSERT_FALSE(p.set("x", changes.find("missing")));
+  ASSERT_FALSE(p.remove("a..b"));
+  ASSERT_EQ(7u, p.size());
+
+  bson::writer out;
+  ASSERT_TRUE(p.apply(source, out));
+
+  bson::writer expected;
+  expected.add_int64("a", 10);
+  {
+    auto b = expected.add_document("b");
+    b.add_string("c", "x");
+    b.add_string("d", "long string");
+    auto z = b.add_document("z");
+    z.add_int32("y", 3);
+  }
+  {
+    auto e = expected.add_array("e");
+    e.push_int32(1);
+    e.push_int32(9);
+  }
+  expected.add_null("h");
+  expected.add_double("g", 0.5);
+  const std::uint8_t* expected_bytes;
+  std::size_t expected_length;
+  ASSERT_TRUE(expected.get_bytes(expected_bytes, expected_length));
+  ASSERT_TRUE(out.get_bytes(bytes, length));
+  ASSERT_EQ(expected_length, length);
+  ASSERT_EQ(0, std::memcmp(expected_bytes, bytes, length));
+
+  // Path through non-document field
+  bson::patch q;
+  ASSERT_TRUE(q.set("a.b", changes.find("y")));
+  bson::writer fail;
+  ASSERT_FALSE(q.apply(source, fail));
+}
+
+TEST(patch, array)
+{
+  bson::writer src;
+  {
+    auto a = src.add_array("a");
+    for (std::int32_t i = 0; i < 12; ++i) {
+      a.push_int32(i);
+    }
+  }
+  src.add_true("t");
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(src.get_bytes(bytes, length));
+  bson::reader source(bytes, length);
+
+  bson::writer values;
+  values.add_string("s", "x");
+  values.add_int64("n", 7);
+  const std::uint8_t* value_bytes;
+  std::size_t value_length;
+  ASSERT_TRUE(values.get_bytes(value_bytes, value_length));
+  bson::reader changes(value_bytes, value_length);
+
+  // Remove middle elements, replace one and append beyond the end
+  bson::patch p;
+  ASSERT_TRUE(p.remove("a.2"));
+  ASSERT_TRUE(p.set("a.5", changes.find("s")));
+  ASSERT_TRUE(p.remove("a.9"));
+  ASSERT_TRUE(p.set("a.20", changes.find("n")));
+  ASSERT_TRUE(p.remove("a.30"));
+
+  bson::writer out;
+  ASSERT_TRUE(p.apply(source, out));
+
+  bson::writer expected;
+  {
+    auto a = expected.add_array("a");
+    for (std::int32_t i = 0; i < 12; ++i) {
+      if ((i == 2) || (i == 9)) {
+        continue;
+      }
+      if (i == 5) {
+        a.push_string("x");
+      } else {
+        a.push_int32(i);
+      }
+    }
+    a.push_int64(7);
+  }
+  expected.add_true("t");
+  const std::uint8_t* expected_bytes;
+  std::size_t expected_length;
+  ASSERT_TRUE(expected.get_bytes(expected_bytes, expected_length));
+  ASSERT_TRUE(out.get_bytes(bytes, length));
+  ASSERT_EQ(expected_length, length);
+  ASSERT_EQ(0, std::memcmp(expected_bytes, bytes, length));
+
+  // Keys stay contiguous
+  const auto array = bson::reader(bytes, length).find("a").as_array();
+  std::size_t index = 0;
+  for (const auto& e : array) {
+    ASSERT_EQ(std::to_string(index++), e.name());
+  }
+  ASSERT_EQ(11u, index);
+}
+
+TEST(stats, counters)
+{
+  bson::stats::reset();
+  {
+    bson::writer w(16);
+    ASSERT_TRUE(w.add_int32("a", 1));
+    {
+      auto d = w.add_document("d");
+      auto e = d.add_document("e");
+      ASSERT_TRUE(e.add_string("s", "long enough to grow the buffer"));
+    }
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_TRUE(w.get_bytes(bytes, length));
+    bson::reader r(bytes, length);
+    ASSERT_FALSE(r.find("x").valid());
+    ASSERT_TRUE(r.validate().valid());
+  }
+  {
+    std::uint8_t buffer[8];
+    bson::writer w(buffer, sizeof(buffer));
+    ASSERT_FALSE(w.add_int32("a", 1));
+  }
+  const auto s = bson::stats::snapshot();
+  auto total = s;
+  total += s;
+  if (!bson::stats::enabled) {
+    ASSERT_EQ(0u, s.allocations);
+    ASSERT_EQ(0u, s.elements_scanned);
+    return;
+  }
+  ASSERT_EQ(1u, s.allocations);
+  ASSERT_LE(1u, s.reallocations);
+  ASSERT_LT(0u, s.bytes_copied);
+  ASSERT_EQ(7u + 8 + 8 + 38, s.bytes_written);
+  ASSERT_EQ(1u, s.failed_appends);
+  ASSERT_EQ(1u, s.subdocuments[0]);
+  ASSERT_EQ(1u, s.subdocuments[1]);
+  ASSERT_EQ(2u, s.elements_scanned);
+  ASSERT_EQ(4u, s.elements_validated);
+  ASSERT_EQ(2 * s.bytes_written, total.bytes_written);
+  bson::stats::reset();
+  ASSERT_EQ(0u, bson::stats::snapshot().bytes_written);
+}
+
+#ifdef BSON_HAS_STRING_VIEW
+TEST(reader, string_view)
+{
+  const std::string name("name");
+  const std::string value("value\0with nul", 15);
+  bson::writer w;
+  ASSERT_TRUE(w.add_string(std::string_view(name), std::string_view(value)));
+  ASSERT_TRUE(w.add_string("s", std::string_view("abc")));
+  ASSERT_TRUE(w.add_int32(std::string_view("i"), 1));
+  const std::uint8_t blob[] = { 1, 2, 3 };
+  ASSERT_TRUE(w.add_binary("b", blob, sizeof(blob)));
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  bson::reader r(bytes, length);
+  ASSERT_EQ(std::string_view(value), r.find(std::string_view(name)).as_string_view());
+  ASSERT_EQ("abc", r.find("s").as_string_view());
+  ASSERT_EQ("none", r.find("i").as_string_view("none"));
+  ASSERT_EQ(1, r.validate().find(std::string_view("i")).as_int32());
+  ASSERT_EQ(r.find("s").as_string(), r.find("s").as_string_view().data());
+#ifdef BSON_HAS_SPAN
+  const auto span = r.find("b").as_binary_span();
+  ASSERT_EQ(3u, span.size());
+  ASSERT_EQ(3, span[2]);
+  ASSERT_TRUE(r.find("s").as_binary_span().empty());
+#endif
+}
+#endif
+
+TEST(reader, shared_document)
+{
+  struct counting_allocator : public bson::allocator {
+    void* allocate(std::size_t length) noexcept override
+    {
+      ++live;
+      return std::malloc(length);
+    }
+    void* reallocate(void* buffer, std::size_t, std::size_t new_length) noexcept override
+    {
+      return std::realloc(buffer, new_length);
+    }
+    void deallocate(void* buffer) noexcept override
+    {
+      --live;
+      std::free(buffer);
+    }
+    int live = 0;
+  } alloc;
+
+  {
+    bson::writer w(alloc);
+    w.set_deferred();
+    w.add_int32("a", 1);
+    bson::shared_document doc(w);
+    ASSERT_FALSE(w.valid());
+    ASSERT_TRUE(doc.valid());
+    ASSERT_EQ(1u, doc.use_count());
+    ASSERT_EQ(12u, doc.size());
+    ASSERT_EQ(1, doc.find("a").as_int32());
+
+    // Fan out to threads
+    std::vector<std::thread> threads;
+    std::vector<int> results(4);
+    for (int i = 0; i < 4; ++i) {
+      bson::shared_document copy(doc);
+      threads.emplace_back([copy, i, &results]() {
+        bson::shared_document local(copy);
+        results[i] = local.find("a").as_int32();
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    threads.clear();
+    ASSERT_EQ(std::vector<int>(4, 1), results);
+    ASSERT_EQ(1u, doc.use_count());
+
+    bson::shared_document moved(std::move(doc));
+    ASSERT_FALSE(doc.valid());
+    ASSERT_EQ(0u, doc.use_count());
+    doc = moved;
+    ASSERT_EQ(2u, moved.use_count());
+    doc = doc;
+    ASSERT_EQ(2u, moved.use_count());
+    moved = bson::shared_document();
+    ASSERT_EQ(1u, doc.use_count());
+    ASSERT_EQ(2, alloc.live);
+  }
+  ASSERT_EQ(0, alloc.live);
+
+  // Copy of bytes and invalid sources
+  {
+    const std::uint8_t bytes[] = { 0x05, 0x00, 0x00, 0x00, 0x00 };
+    bson::shared_document doc(bytes, sizeof(bytes), alloc);
+    ASSERT_NE(bytes, doc.data());
+    ASSERT_EQ(0, std::memcmp(bytes, doc.data(), sizeof(bytes)));
+    ASSERT_EQ(1, alloc.live);
+    ASSERT_TRUE(doc.validate().valid());
+
+    std::uint8_t buffer[16];
+    bson::writer fixed(buffer, sizeof(buffer));
+    ASSERT_FALSE(bson::shared_document(fixed).valid());
+  }
+  ASSERT_EQ(0, alloc.live);
+
+  // Gather writer (payload is outside of buffer)
+  {
+    static_assert(!std::is_constructible<bson::shared_document, bson::gather_writer&>::value,
+                  "gather writer must not be adopted");
+    static_assert(!std::is_constructible<bson::shared_document, bson::batch_writer::document&>::value,
+                  "batch document must not be adopted");
+    std::vector<std::uint8_t> blob(10000, 0xab);
+    bson::gather_writer g(16, alloc);
+    ASSERT_TRUE(g.add_binary("b", blob.data(), blob.size()));
+    bson::writer& base = g;
+    bson::shared_document doc(base);
+    ASSERT_FALSE(doc.valid());
+    ASSERT_TRUE(g.valid());
+    const bson::gather_writer::fragment* fragments;
+    std::size_t count;
+    ASSERT_TRUE(g.get_fragments(fragments, count));
+  }
+  ASSERT_EQ(0, alloc.live);
+}
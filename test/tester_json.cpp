@@ -0,0 +1,273 @@
+#include <gtest/gtest.h>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "../bson_json.hpp"
+
+namespace {
+
+std::string json(const bson::writer& w, bson::json_mode mode = bson::json_mode::relaxed)
+{
+  const std::uint8_t* bytes;
+  std::size_t length;
+  if (!w.get_bytes(bytes, length)) {
+    return "(invalid)";
+  }
+  std::size_t text_length;
+  const auto text = bson::to_json(bson::reader(bytes, length), text_length, mode);
+  if (!text) {
+    return "(failed)";
+  }
+  std::string result(text, text_length);
+  std::free(text);
+  return result;
+}
+
+} /* namespace */
+
+TEST(json, types)
+{
+  bson::writer w;
+  w.add_double("d", 1.5);
+  w.add_string("s", "a\"b\\c\n\x01/");
+  {
+    auto d = w.add_document("o");
+    d.add_int32("i", -42);
+  }
+  {
+    auto a = w.add_array("a");
+    a.push_int64(INT64_MIN);
+    a.push_true();
+    a.push_null();
+  }
+  const std::uint8_t blob[] = { 0x00, 0xff, 0x10, 0x20 };
+  w.add_binary("b", blob, sizeof(blob), bson::subtype::uuid);
+  w.add_undefined("u");
+  w.add_false("f");
+  w.add_int64("l", 1234567890123LL);
+  ASSERT_EQ("{\"d\":1.5,\"s\":\"a\\\"b\\\\c\\n\\u0001/\",\"o\":{\"i\":-42},"
+            "\"a\":[-9223372036854775808,true,null],"
+            "\"b\":{\"$binary\":{\"base64\":\"AP8QIA==\",\"subType\":\"04\"}},"
+            "\"u\":{\"$undefined\":true},\"f\":false,\"l\":1234567890123}", json(w));
+  ASSERT_EQ("{\"d\":{\"$numberDouble\":\"1.5\"},\"s\":\"a\\\"b\\\\c\\n\\u0001/\","
+            "\"o\":{\"i\":{\"$numberInt\":\"-42\"}},"
+            "\"a\":[{\"$numberLong\":\"-9223372036854775808\"},true,null],"
+            "\"b\":{\"$binary\":{\"base64\":\"AP8QIA==\",\"subType\":\"04\"}},"
+            "\"u\":{\"$undefined\":true},\"f\":false,\"l\":{\"$numberLong\":\"1234567890123\"}}",
+            json(w, bson::json_mode::canonical));
+  ASSERT_EQ("{}", json(bson::writer()));
+}
+
+TEST(json, doubles)
+{
+  const double values[] = { 0.1, 1.0 / 3, 5e-324, 1.7976931348623157e308, 123456789.125, 1e21 };
+  for (auto value : values) {
+    bson::writer w;
+    w.add_double("d", value);
+    const auto text = json(w);
+    ASSERT_EQ(value, std::strtod(text.c_str() + 5, nullptr)) << text;
+  }
+  bson::writer w;
+  w.add_double("a", 0.1);
+  w.add_double("b", 2.0);
+  w.add_double("c", -0.0);
+  w.add_double("d", std::numeric_limits<double>::infinity());
+  w.add_double("e", std::nan(""));
+  ASSERT_EQ("{\"a\":0.1,\"b\":2.0,\"c\":-0.0,\"d\":{\"$numberDouble\":\"Infinity\"},"
+            "\"e\":{\"$numberDouble\":\"NaN\"}}", json(w));
+}
+
+TEST(json, streaming)
+{
+  // Long string with escapes crossing 16-byte blocks and the internal buffer
+  std::string value(10000, 'x');
+  for (std::size_t i = 0; i < value.size(); i += 37) {
+    value[i] = '"';
+  }
+  bson::writer w;
+  w.add_string("s", value.c_str());
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+
+  std::string output;
+  int chunks = 0;
+  auto sink = [&](const char* data, std::size_t size) {
+    output.append(data, size);
+    ++chunks;
+    return true;
+  };
+  ASSERT_TRUE(bson::to_json(bson::reader(bytes, length), sink));
+  ASSERT_LT(1, chunks);
+  std::string expected = "{\"s\":\"";
+  for (auto c : value) {
+    if (c == '"') {
+      expected += '\\';
+    }
+    expected += c;
+  }
+  expected += "\"}";
+  ASSERT_EQ(expected, output);
+
+  // Sink abort
+  auto abort = [](const char*, std::size_t) { return false; };
+  ASSERT_FALSE(bson::to_json(bson::reader(bytes, length), abort));
+
+  // Malformed document
+  const std::uint8_t broken[] = { 0x0c, 0x00, 0x00, 0x00, 0x10, 0x78, 0x00, 0x01, 0x00 };
+  std::size_t text_length;
+  ASSERT_EQ(nullptr, bson::to_json(bson::reader(broken, sizeof(broken)), text_length));
+}
+
+namespace {
+
+std::string reparse(const std::string& text, bson::json_mode mode = bson::json_mode::relaxed)
+{
+  bson::writer w;
+  if (!bson::from_json(text.data(), text.size(), w)) {
+    return "(failed)";
+  }
+  return json(w, mode);
+}
+
+} /* namespace */
+
+TEST(json, parse)
+{
+  const std::string text =
+    " { \"i\" : 1, \"n\":-2147483648, \"l\":2147483648, \"m\":-9223372036854775808,"
+    " \"big\":9223372036854775808, \"d\":0.25, \"e\":-1.5e-3, \"z\":0,"
+    " \"s\":\"a\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\ud83d\\ude00\", \"t\":true, \"f\":false, \"x\":null,"
+    " \"a\":[1,[2,{}],[]], \"o\":{\"p\":{\"q\":\"r\"}}, \"\\u0041\":\"k\" }\n";
+  bson::writer w;
+  ASSERT_TRUE(bson::from_json(text.data(), text.size(), w));
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  bson::reader r(bytes, length);
+  ASSERT_TRUE(r.validate().valid());
+  ASSERT_EQ(bson::type::int32, r.find("i").type());
+  ASSERT_EQ(INT32_MIN, r.find("n").as_int32());
+  ASSERT_EQ(bson::type::int64, r.find("l").type());
+  ASSERT_EQ(INT64_MIN, r.find("m").as_int64());
+  ASSERT_EQ(bson::type::fp64, r.find("big").type());
+  ASSERT_EQ(9223372036854775808.0, r.find("big").as_double());
+  ASSERT_EQ(0.25, r.find("d").as_double());
+  ASSERT_EQ(-1.5e-3, r.find("e").as_double());
+  ASSERT_EQ(bson::type::int32, r.find("z").type());
+  ASSERT_STREQ("a\"\\/\b\f\n\r\t\xc3\xa9\xf0\x9f\x98\x80", r.find("s").as_string());
+  ASSERT_TRUE(r.find("t").as_boolean());
+  ASSERT_EQ(bson::type::boolean, r.find("f").type());
+  ASSERT_EQ(bson::type::null, r.find("x").type());
+  ASSERT_EQ(2, r.find(bson::path("a.1.0")).as_int32());
+  ASSERT_TRUE(r.find(bson::path("a.1.1")).is_document());
+  ASSERT_TRUE(r.find(bson::path("a.2")).is_array());
+  ASSERT_STREQ("r", r.find(bson::path("o.p.q")).as_string());
+  ASSERT_STREQ("k", r.find("A").as_string());
+}
+
+TEST(json, parse_doubles)
+{
+  const char* const numbers[] = {
+    "0.1", "1e22", "1e23", "123456789012345678", "1.7976931348623157e308", "5e-324",
+    "0.000001234", "3.141592653589793238", "-0.0", "1e400",
+  };
+  for (auto number : numbers) {
+    const std::string text = std::string("{\"d\":") + number + "}";
+    bson::writer w;
+    ASSERT_TRUE(bson::from_json(text.data(), text.size(), w)) << number;
+    const std::uint8_t* bytes;
+    std::size_t length;
+    ASSERT_TRUE(w.get_bytes(bytes, length));
+    const auto e = bson::reader(bytes, length).find("d");
+    if (e.type() == bson::type::fp64) {
+      ASSERT_EQ(std::strtod(number, nullptr), e.as_double()) << number;
+    } else {
+      ASSERT_EQ(std::strtoll(number, nullptr, 10), e.as_int64()) << number;
+    }
+  }
+}
+
+TEST(json, parse_locale)
+{
+  const char* selected = nullptr;
+  for (auto name : { "de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8", "de_DE", "fr_FR" }) {
+    if (std::setlocale(LC_NUMERIC, name)) {
+      selected = name;
+      break;
+    }
+  }
+  if (!selected) {
+    GTEST_SKIP() << "no locale with comma decimal point";
+  }
+  const char text[] = "{\"d\":3.141592653589793238,\"e\":-1.5e-300}";
+  bson::writer w;
+  const auto parsed = bson::from_json(text, sizeof(text) - 1, w);
+  std::setlocale(LC_NUMERIC, "C");
+  ASSERT_TRUE(parsed) << selected;
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+  ASSERT_EQ(3.141592653589793238, bson::reader(bytes, length).find("d").as_double()) << selected;
+  ASSERT_EQ(-1.5e-300, bson::reader(bytes, length).find("e").as_double()) << selected;
+}
+
+TEST(json, parse_extended)
+{
+  bson::writer w;
+  w.add_int32("i", 7);
+  w.add_int64("l", 7);
+  w.add_double("d", 7.0);
+  w.add_double("inf", -std::numeric_limits<double>::infinity());
+  const std::uint8_t blob[] = { 0x00, 0xff, 0x10, 0x20, 0x30 };
+  w.add_binary("b", blob, sizeof(blob), bson::subtype::user_defined);
+  w.add_binary("e", blob, 0);
+  w.add_undefined("u");
+  {
+    auto d = w.add_document("o");
+    d.add_string("$other", "kept");
+  }
+  for (auto mode : { bson::json_mode::relaxed, bson::json_mode::canonical }) {
+    const auto text = json(w, mode);
+    ASSERT_EQ(text, reparse(text, mode));
+  }
+  ASSERT_EQ(json(w, bson::json_mode::canonical), reparse(json(w, bson::json_mode::canonical),
+                                                         bson::json_mode::canonical));
+  ASSERT_EQ("{\"x\":{\"$numberLong\":\"12\"}}",
+            reparse("{\"x\":{ \"$numberLong\" : \"12\" }}", bson::json_mode::canonical));
+}
+
+TEST(json, parse_errors)
+{
+  const char* const invalid[] = {
+    "", "[]", "1", "{", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "{\"a\":1} x", "{a:1}",
+    "{\"a\":01}", "{\"a\":1.}", "{\"a\":-}", "{\"a\":tru}", "{\"a\":\"x}", "{\"a\":\"\\x\"}",
+    "{\"a\":\"\\ud800\"}", "{\"a\":\"\\udc00\"}", "{\"a\":\"\x01\"}", "{\"\":1}", "{\"\\u0000\":1}",
+    "{\"a\":[1 2]}", "{\"a\":{\"$numberInt\":\"2147483648\"}}", "{\"a\":{\"$numberInt\":1}}",
+    "{\"a\":{\"$binary\":{\"base64\":\"AP8\",\"subType\":\"00\"}}}",
+    "{\"a\":{\"$binary\":{\"base64\":\"A*==\",\"subType\":\"00\"}}}",
+  };
+  for (auto text : invalid) {
+    bson::writer w;
+    ASSERT_FALSE(bson::from_json(text, std::strlen(text), w)) << text;
+  }
+
+  // Nesting depth
+  std::string deep = "{\"a\":";
+  for (int i = 0; i < 200; ++i) {
+    deep += "[";
+  }
+  bson::writer w;
+  ASSERT_FALSE(bson::from_json(deep.data(), deep.size(), w));
+
+  // Escaped string longer than the inline scratch buffer
+  std::string value(1000, 'y');
+  value[500] = '"';
+  bson::writer v;
+  v.add_string("s", value.c_str());
+  ASSERT_EQ(json(v), reparse(json(v)));
+}
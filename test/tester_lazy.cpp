@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "../bson_lazy.hpp"
+
+namespace {
+
+class counting_allocator : public bson::allocator {
+public:
+  void* allocate(std::size_t length) noexcept override
+  {
+    ++allocations;
+    return bson::allocator::get_default().allocate(length);
+  }
+
+  void* reallocate(void* buffer, std::size_t length, std::size_t new_length) noexcept override
+  {
+    return bson::allocator::get_default().reallocate(buffer, length, new_length);
+  }
+
+  void deallocate(void* buffer) noexcept override
+  {
+    ++deallocations;
+    bson::allocator::get_default().deallocate(buffer);
+  }
+
+  int allocations = 0;
+  int deallocations = 0;
+};
+
+} /* namespace */
+
+TEST(lazy_document, find)
+{
+  bson::writer w;
+  w.add_int32("a", 1);
+  {
+    auto u = w.add_document("user");
+    u.add_string("name", "alice");
+    auto t = u.add_array("tags");
+    t.push_string("x");
+    t.push_string("y");
+  }
+  for (int i = 0; i < 40; ++i) {
+    auto d = w.add_document(("d" + std::to_string(i)).c_str());
+    d.add_int32("v", i);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+
+  counting_allocator alloc;
+  {
+    bson::lazy_document doc(bson::reader(bytes, length), alloc);
+    ASSERT_EQ(0u, doc.materialized());
+    auto root = doc.root();
+    ASSERT_EQ(1, root.find("a").as_int32());
+    ASSERT_EQ(1u, doc.materialized());
+    ASSERT_FALSE(root.find("missing").valid());
+    ASSERT_FALSE(root.document("a").valid());
+    auto user = root.document("user");
+    ASSERT_TRUE(user.valid());
+    ASSERT_EQ(1u, doc.materialized());
+    ASSERT_STREQ("alice", user.find("name").as_string());
+    ASSERT_EQ(2u, doc.materialized());
+    ASSERT_STREQ("y", doc.find(bson::path("user.tags.1")).as_string());
+    ASSERT_EQ(3u, doc.materialized());
+
+    // Subdocument views are cached
+    ASSERT_EQ(&user.source(), &root.document("user").source());
+    ASSERT_STREQ("alice", doc.find(bson::path("user.name")).as_string());
+    ASSERT_EQ(3u, doc.materialized());
+
+    for (int i = 0; i < 40; ++i) {
+      ASSERT_EQ(i, root.document(("d" + std::to_string(i)).c_str()).find("v").as_int32());
+    }
+    for (int i = 0; i < 40; ++i) {
+      ASSERT_EQ(i, doc.find(bson::path(("d" + std::to_string(i) + ".v").c_str())).as_int32());
+    }
+    ASSERT_EQ(43u, doc.materialized());
+    ASSERT_FALSE(doc.find(bson::path("a.b")).valid());
+    ASSERT_FALSE(doc.find(bson::path("")).valid());
+    ASSERT_LT(0u, doc.footprint());
+  }
+  ASSERT_LT(0, alloc.allocations);
+  ASSERT_EQ(alloc.allocations, alloc.deallocations);
+}
+
+TEST(lazy_document, no_memory)
+{
+  bson::writer w;
+  {
+    auto d = w.add_document("d");
+    d.add_int32("v", 7);
+  }
+  {
+    auto a = w.add_array("a");
+    a.push_int32(8);
+  }
+  const std::uint8_t* bytes;
+  std::size_t length;
+  ASSERT_TRUE(w.get_bytes(bytes, length));
+
+  // Falls back to linear lookup while children cannot be cached
+  std::uint8_t region[1];
+  bson::arena_allocator arena(region, 0);
+  bson::lazy_document doc(bson::reader(bytes, length), arena);
+  ASSERT_TRUE(doc.root().find("d").is_document());
+  const auto d = doc.root().document("d");
+  ASSERT_TRUE(d.valid());
+  ASSERT_EQ(7, d.find("v").as_int32());
+  ASSERT_FALSE(d.document("v").valid());
+  ASSERT_EQ(7, doc.find(bson::path("d.v")).as_int32());
+  ASSERT_FALSE(doc.find(bson::path("d.w")).valid());
+  ASSERT_EQ(8, doc.find(bson::path("a.0")).as_int32());
+  ASSERT_EQ(0u, doc.materialized());
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../bson_mapped.hpp"
+
+namespace {
+
+class temporary_file {
+public:
+  temporary_file(const std::vector<std::uint8_t>& content)
+  {
+    char name[] = "/tmp/tester_mapped_XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd >= 0) {
+      if (!content.empty()) {
+        (void)!write(fd, content.data(), content.size());
+      }
+      ::close(fd);
+      path = name;
+    }
+  }
+
+  ~temporary_file()
+  {
+    std::remove(path.c_str());
+    std::remove(index_path().c_str());
+  }
+
+  std::string index_path() const { return path + ".idx"; }
+
+  std::string path;
+};
+
+std::vector<std::uint8_t> make_documents(int count)
+{
+  std::vector<std::uint8_t> content;
+  for (int i = 0; i < count; ++i) {
+    bson::writer w;
+    w.add_int32("i", i);
+    for (int j = 0; j < i % 3; ++j) {
+      w.add_string("s", "padding");
+    }
+    const std::uint8_t* bytes;
+    std::size_t length;
+    w.get_bytes(bytes, length);
+    content.insert(content.end(), bytes, bytes + length);
+  }
+  return content;
+}
+
+} /* namespace */
+
+TEST(mapped_file, iterate)
+{
+  const auto content = make_documents(100);
+  temporary_file file(content);
+  bson::mapped_file f;
+  ASSERT_FALSE(f.is_open());
+  ASSERT_TRUE(f.open(file.path.c_str(), bson::mapped_file::access::sequential, true));
+  ASSERT_TRUE(f.is_open());
+  ASSERT_EQ(content.size(), f.size());
+  ASSERT_EQ(0, std::memcmp(content.data(), f.data(), content.size()));
+  int count = 0;
+  for (auto doc : f) {
+    ASSERT_EQ(count++, doc.find("i").as_int32());
+  }
+  ASSERT_EQ(100, count);
+  ASSERT_TRUE(f.advise(bson::mapped_file::access::random));
+  f.close();
+  ASSERT_FALSE(f.is_open());
+  ASSERT_FALSE(f.begin() != f.end());
+}
+
+TEST(mapped_file, index)
+{
+  const auto content = make_documents(100);
+  temporary_file file(content);
+  bson::mapped_file f;
+  ASSERT_FALSE(f.build_index());
+  ASSERT_TRUE(f.open(file.path.c_str()));
+  ASSERT_EQ(0u, f.count());
+  ASSERT_FALSE(f.doc(0).valid());
+  ASSERT_TRUE(f.build_index());
+  ASSERT_EQ(100u, f.count());
+  ASSERT_EQ(57, f.doc(57).find("i").as_int32());
+  ASSERT_EQ(99, f.doc(99).find("i").as_int32());
+  ASSERT_FALSE(f.doc(100).valid());
+  ASSERT_TRUE(f.save_index(file.index_path().c_str()));
+
+  bson::mapped_file g;
+  ASSERT_TRUE(g.open(file.path.c_str(), bson::mapped_file::access::random));
+  ASSERT_TRUE(g.load_index(file.index_path().c_str()));
+  ASSERT_EQ(100u, g.count());
+  ASSERT_EQ(42, g.doc(42).find("i").as_int32());
+
+  // Index built for another file
+  const auto other_content = make_documents(10);
+  temporary_file other(other_content);
+  bson::mapped_file h(std::move(g));
+  ASSERT_FALSE(g.is_open());
+  ASSERT_EQ(42, h.doc(42).find("i").as_int32());
+  ASSERT_TRUE(h.open(other.path.c_str()));
+  ASSERT_FALSE(h.load_index(file.index_path().c_str()));
+  ASSERT_EQ(0u, h.count());
+  ASSERT_FALSE(h.load_index("/nonexistent/index"));
+}
+
+TEST(mapped_file, invalid_document)
+{
+  auto content = make_documents(5);
+  content.push_back(0x03);
+  content.push_back(0x00);
+  temporary_file file(content);
+  bson::mapped_file f;
+  ASSERT_TRUE(f.open(file.path.c_str()));
+  ASSERT_FALSE(f.build_index());
+  ASSERT_EQ(5u, f.count());
+  int count = 0;
+  for (auto doc : f) {
+    ASSERT_TRUE(doc.valid());
+    ++count;
+  }
+  ASSERT_EQ(5, count);
+}
+
+TEST(mapped_file, empty)
+{
+  temporary_file file({});
+  bson::mapped_file f;
+  ASSERT_TRUE(f.open(file.path.c_str()));
+  ASSERT_EQ(0u, f.size());
+  ASSERT_FALSE(f.begin() != f.end());
+  ASSERT_TRUE(f.build_index());
+  ASSERT_EQ(0u, f.count());
+  ASSERT_FALSE(f.open("/nonexistent/file"));
+  ASSERT_FALSE(f.is_open());
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "../bson_parallel.hpp"
+#include "document_collection.hpp"
+
+namespace {
+
+// Documents of uneven sizes with index in field "i"
+document_collection make_collection(std::size_t count)
+{
+  document_collection collection;
+  for (std::size_t i = 0; i < count; ++i) {
+    bson::writer w;
+    w.add_int64("i", static_cast<std::int64_t>(i));
+    for (std::size_t j = 0; j < i % 7; ++j) {
+      w.add_string("s", "padding");
+    }
+    collection.add(w);
+  }
+  return collection;
+}
+
+} /* namespace */
+
+TEST(parallel, scheduler)
+{
+  for (unsigned workers : { 1u, 2u, 3u, 8u }) {
+    for (std::size_t grain : { 1u, 5u, 64u }) {
+      const std::size_t count = 1000;
+      std::vector<std::atomic<int>> visited(count);
+      for (auto& v : visited) {
+        v = 0;
+      }
+      bson::parallel_scheduler scheduler(count, workers, grain);
+      ASSERT_EQ(workers, scheduler.workers());
+      auto task = [&](unsigned worker) {
+        std::size_t begin, end;
+        while (scheduler.next(worker, begin, end)) {
+          EXPECT_LE(end - begin, grain);
+          for (auto i = begin; i < end; ++i) {
+            ++visited[i];
+          }
+        }
+      };
+      scheduler.run(task);
+      for (std::size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(1, visited[i]) << "index " << i << " workers " << workers << " grain " << grain;
+      }
+    }
+  }
+  ASSERT_LE(1u, bson::parallel_scheduler::default_workers());
+  ASSERT_EQ(bson::parallel_scheduler::max_workers, bson::parallel_scheduler(1, 1000).workers());
+}
+
+TEST(parallel, scheduler_steal)
+{
+  // Worker 1 stalls; its range must be completed by worker 0
+  bson::parallel_scheduler scheduler(100, 2, 1);
+  std::atomic<int> processed(0);
+  std::atomic<bool> done(false);
+  auto task = [&](unsigned worker) {
+    std::size_t begin, end;
+    if (worker == 1) {
+      while (!done) {
+        std::this_thread::yield();
+      }
+    }
+    while (scheduler.next(worker, begin, end)) {
+      processed += static_cast<int>(end - begin);
+    }
+    if (worker == 0) {
+      done = true;
+    }
+  };
+  scheduler.run(task);
+  ASSERT_EQ(100, processed);
+}
+
+namespace {
+
+// Scheduler whose threads fail to start from a given worker index
+class failing_scheduler : public bson::parallel_scheduler {
+public:
+  failing_scheduler(std::size_t count, unsigned workers, unsigned first_failure) noexcept
+  : parallel_scheduler(count, workers, 1), first_failure(first_failure) {}
+
+protected:
+  bool start(std::thread& thread, void (*task)(void* context, unsigned worker),
+             void* context, unsigned worker) noexcept override
+  {
+    return (worker < first_failure) && parallel_scheduler::start(thread, task, context, worker);
+  }
+
+private:
+  unsigned first_failure;
+};
+
+} /* namespace */
+
+TEST(parallel, scheduler_start_failure)
+{
+  for (unsigned first_failure : { 1u, 2u, 3u }) {
+    const std::size_t count = 1000;
+    std::vector<std::atomic<int>> visited(count);
+    for (auto& v : visited) {
+      v = 0;
+    }
+    std::atomic<int> calls[4];
+    for (auto& c : calls) {
+      c = 0;
+    }
+    failing_scheduler scheduler(count, 4, first_failure);
+    auto task = [&](unsigned worker) {
+      ++calls[worker];
+      std::size_t begin, end;
+      while (scheduler.next(worker, begin, end)) {
+        for (auto i = begin; i < end; ++i) {
+          ++visited[i];
+        }
+      }
+    };
+    scheduler.run(task);
+    for (auto& c : calls) {
+      ASSERT_EQ(1, c) << "first failure " << first_failure;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      ASSERT_EQ(1, visited[i]) << "index " << i << " first failure " << first_failure;
+    }
+  }
+}
+
+TEST(parallel, for_each)
+{
+  const auto collection = make_collection(500);
+  std::vector<std::atomic<int>> visited(collection.count());
+  for (auto& v : visited) {
+    v = 0;
+  }
+  bson::parallel_for_each(collection, [&](const bson::reader& doc, std::size_t index) {
+    if (doc.find("i").as_int64() == static_cast<std::int64_t>(index)) {
+      ++visited[index];
+    }
+  }, 4, 3);
+  for (const auto& v : visited) {
+    ASSERT_EQ(1, v);
+  }
+}
+
+TEST(parallel, count_filter_reduce)
+{
+  const auto collection = make_collection(1000);
+  auto predicate = [](const bson::reader& doc) {
+    return (doc.find("i").as_int64() % 3) == 0;
+  };
+  ASSERT_EQ(334u, bson::parallel_count(collection, predicate, 4));
+  ASSERT_EQ(334u, bson::parallel_count(collection, predicate, 1));
+
+  std::vector<std::size_t> indexes(collection.count());
+  ASSERT_EQ(334u, bson::parallel_filter(collection, predicate, indexes.data(), 4, 7));
+  for (std::size_t i = 0; i < 334; ++i) {
+    ASSERT_EQ(i * 3, indexes[i]);
+  }
+
+  const auto sum = bson::parallel_reduce(
+    collection, std::int64_t(0),
+    [](std::int64_t& local, const bson::reader& doc, std::size_t) { local += doc.find("i").as_int64(); },
+    [](std::int64_t& total, std::int64_t local) { total += local; },
+    8
+  );
+  ASSERT_EQ(999 * 1000 / 2, sum);
+
+  const document_collection empty;
+  ASSERT_EQ(0u, bson::parallel_count(empty, predicate));
+}
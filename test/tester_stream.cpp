@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "../bson_stream.hpp"
+
+namespace {
+
+std::vector<std::uint8_t> make_stream()
+{
+  std::vector<std::uint8_t> stream;
+  for (int i = 0; i < 3; ++i) {
+    bson::writer w;
+    w.add_int32("i", i);
+    for (int j = 0; j < i; ++j) {
+      w.add_string("s", "padding");
+    }
+    const std::uint8_t* bytes;
+    std::size_t length;
+    w.get_bytes(bytes, length);
+    stream.insert(stream.end(), bytes, bytes + length);
+  }
+  return stream;
+}
+
+} /* namespace */
+
+TEST(stream_reader, whole_chunk)
+{
+  const auto stream = make_stream();
+  bson::stream_reader s;
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_TRUE(s.feed(stream.data(), stream.size()));
+  std::size_t offset = 0;
+  for (int i = 0; i < 3; ++i) {
+    auto doc = s.next();
+    ASSERT_TRUE(doc.valid());
+    ASSERT_EQ(i, doc.find("i").as_int32());
+
+    // Zero-copy view into the chunk
+    ASSERT_EQ(reinterpret_cast<const char*>(stream.data() + offset + 5), doc.begin()->name());
+    offset += bson::reader::query_size(stream.data() + offset, stream.size() - offset);
+  }
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_FALSE(s.fail());
+  ASSERT_EQ(0u, s.buffered());
+}
+
+TEST(stream_reader, split_chunks)
+{
+  const auto stream = make_stream();
+  for (std::size_t split = 0; split <= stream.size(); ++split) {
+    bson::stream_reader s;
+    int count = 0;
+    ASSERT_TRUE(s.feed(stream.data(), split));
+    while (auto doc = s.next()) {
+      ASSERT_EQ(count++, doc.find("i").as_int32());
+    }
+    ASSERT_TRUE(s.feed(stream.data() + split, stream.size() - split));
+    while (auto doc = s.next()) {
+      ASSERT_EQ(count, doc.find("i").as_int32()) << "split at " << split;
+      ASSERT_EQ(count + 1, std::distance(doc.begin(), doc.end()));
+      ++count;
+    }
+    ASSERT_EQ(3, count) << "split at " << split;
+    ASSERT_FALSE(s.fail());
+    ASSERT_EQ(0u, s.buffered());
+  }
+}
+
+TEST(stream_reader, byte_by_byte)
+{
+  const auto stream = make_stream();
+  bson::stream_reader s;
+  int count = 0;
+  for (std::size_t i = 0; i < stream.size(); ++i) {
+    ASSERT_TRUE(s.feed(&stream[i], 1));
+    while (auto doc = s.next()) {
+      ASSERT_EQ(count++, doc.find("i").as_int32());
+    }
+  }
+  ASSERT_EQ(3, count);
+}
+
+TEST(stream_reader, undrained_chunk)
+{
+  const auto stream = make_stream();
+  bson::stream_reader s;
+  ASSERT_TRUE(s.feed(stream.data(), stream.size()));
+  ASSERT_TRUE(s.next().valid());
+  ASSERT_FALSE(s.feed(stream.data(), stream.size()));
+  ASSERT_EQ(1, s.next().find("i").as_int32());
+}
+
+TEST(stream_reader, too_large)
+{
+  const auto stream = make_stream();
+  bson::stream_reader s(16);
+  ASSERT_TRUE(s.feed(stream.data(), stream.size()));
+  ASSERT_TRUE(s.next().valid());
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_TRUE(s.fail());
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_FALSE(s.feed(stream.data(), stream.size()));
+  s.reset();
+  ASSERT_FALSE(s.fail());
+  ASSERT_TRUE(s.feed(stream.data(), 12));
+  ASSERT_TRUE(s.next().valid());
+}
+
+TEST(stream_reader, too_small)
+{
+  const std::uint8_t stream[] = { 0x04,0x00,0x00,0x00, 0x00 };
+  bson::stream_reader s;
+  ASSERT_TRUE(s.feed(stream, 2));
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_FALSE(s.fail());
+  ASSERT_EQ(2u, s.buffered());
+  ASSERT_TRUE(s.feed(stream + 2, 3));
+  ASSERT_FALSE(s.next().valid());
+  ASSERT_TRUE(s.fail());
+}